@@ -3,8 +3,28 @@
 
 #include <stdint.h>
 
+#define RING_MAX_CLASSES        4
+#define RING_CLASS_PORTS        4
+
+#define RING_DSCP_CLASS(map, dscp) (((map)[(dscp) >> 4] >> (((dscp) & 15) * 2)) & 3)
+
+/* Ring pair of a traffic class other than 0; fields as in device_meta_t */
 #if defined(__NFP_LANG_MICROC)
 #include <nfp.h>
+__packed struct ring_pair_t
+#else
+struct __attribute__((packed)) ring_pair_t
+#endif
+{
+    uint64_t rx_buffer_iova;
+    uint64_t tx_buffer_iova;
+    uint32_t rx_head;
+    uint32_t rx_tail;
+    uint32_t tx_head;
+    uint32_t tx_tail;
+};
+
+#if defined(__NFP_LANG_MICROC)
 __packed struct device_meta_t
 #else
 struct __attribute__((packed)) device_meta_t
@@ -22,6 +42,84 @@ struct __attribute__((packed)) device_meta_t
     uint32_t rx_tail;
     uint32_t tx_head;
     uint32_t tx_tail;
+
+    /*
+     * Header/payload split, off while payload_size is 0. Each ring slot
+     * then has a payload slot of payload_size bytes at the same index:
+     * the first packet_size bytes of a frame go in the ring slot, the
+     * next payload_size bytes in the payload slot.
+     */
+    uint64_t rx_payload_iova;
+    uint64_t tx_payload_iova;
+    uint32_t payload_size;
+
+    uint32_t ring_flags;            /* RING_F_* */
+
+    /*
+     * Traffic classes, 0 the most urgent. Class 0 uses the rings above,
+     * class c > 0 class_rings[c - 1]. A frame goes to icmp_class if it
+     * is ICMP, else to port_class[i] if its UDP destination port is
+     * class_port[i] (0 for unused), else to the class of its DSCP, 2
+     * bits each in dscp_class (RING_DSCP_CLASS()). All 32-bit words,
+     * so that host and NFP agree on them.
+     */
+    uint32_t num_classes;           /* 0 or 1: one ring pair */
+    uint32_t class_port[RING_CLASS_PORTS];
+    uint32_t port_class[RING_CLASS_PORTS];
+    uint32_t icmp_class;
+    uint32_t dscp_class[64 / 16];
+    struct ring_pair_t class_rings[RING_MAX_CLASSES - 1];
+
+    /*
+     * Overload: a frame that finds its RX ring full for longer than
+     * rx_full_budget_us is dropped and counted (RX_DROP_RING_FULL)
+     * instead of holding its context. 0 waits for space indefinitely.
+     */
+    uint32_t rx_full_budget_us;
+
+    /*
+     * Restart without reloading the firmware. start_signal is a
+     * generation: the firmware loads the configuration when it first
+     * sees a new nonzero value. The host drops it to 0 to pause RX, with
+     * TX still served; frames arriving then are dropped
+     * (RX_DROP_PAUSED). rx_busy counts RX contexts holding a frame for a
+     * ring; each counts itself in before it reads start_signal, so once
+     * the host reads 0 here after the pause, no more frames reach the
+     * rings. With the rings drained the host writes RING_RESTARTING,
+     * which holds TX too, rewrites the configuration and rings, then
+     * writes the next generation.
+     */
+    uint32_t rx_busy;
+};
+
+#define RING_RESTARTING         0xffffffffffffffffull
+
+/* Reasons the RX firmware drops a frame, indexing its rx_drops counters */
+#define RX_DROP_FILTER          0   /* Not a frame for the host */
+#define RX_DROP_RING_FULL       1   /* Ring full past rx_full_budget_us */
+#define RX_DROP_PAUSED          2   /* Arrived while paused for a restart */
+#define RX_DROP_REASONS         4
+
+/*
+ * Variable-length slots (RING_F_VARLEN): packet_size is then the
+ * largest slot, and each slot starts with a ring_slot_hdr followed by
+ * the frame. Frames of any length up to packet_size - RING_SLOT_HDR_LEN
+ * are accepted, and only len bytes are meaningful. Fields are in network
+ * byte order, as the NFP writes them.
+ */
+#define RING_F_VARLEN           (1 << 0)
+
+#define RING_SLOT_HDR_LEN       8
+
+#if defined(__NFP_LANG_MICROC)
+__packed struct ring_slot_hdr
+#else
+struct __attribute__((packed)) ring_slot_hdr
+#endif
+{
+    uint16_t len;                   /* Frame bytes after the header */
+    uint16_t flags;                 /* 0; reserved for multi-slot frames */
+    uint32_t reserved;
 };
 
 #endif /* UDP_ECHO_CFG_H */
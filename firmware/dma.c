@@ -1,8 +1,10 @@
 #include <nfp.h>
 #include <nfp/pcie.h>
+#include <nfp/mem_bulk.h>
 
 #include "dma.h"
 #include "config.h"
+#include "devcfg.h"
 
 #define MIN(A, B) ((A) < (B) ? (A) : (B))
 
@@ -154,4 +156,159 @@ void dma_packet_recv(struct pkt_t* pkt, uint32_t len, uint64_t pcie_addr)
     }
 
     wait_for_all(&ctm_cmpl_sig.even, &ctm_cmpl_sig.odd);
-}
\ No newline at end of file
+}
+
+/*
+ * Header/payload split. The first hdr_len bytes of the frame go to (or
+ * come from) hdr_addr and the next payload_len bytes payload_addr. The
+ * header must sit in the CTM part of the packet; the payload takes the
+ * rest of the CTM part, then the MU part.
+ *
+ * user/lib/nic_emu.c models these transfers for the emulated NIC; keep
+ * the two in step.
+ */
+void dma_packet_send_split(struct pkt_t* pkt,
+                uint64_t hdr_addr, uint32_t hdr_len,
+                uint64_t payload_addr, uint32_t payload_len)
+{
+    unsigned int len = pkt->nbi_meta.pkt_info.len - 2 * MAC_PREPEND_BYTES;
+    unsigned int offset = PKT_NBI_OFFSET + 2 * MAC_PREPEND_BYTES;
+    unsigned int ctm_len, ctm_payload_len, buf_transfer_len;
+    int island, pnum;
+    __mem40 void* pkt_mu_buffer;
+    SIGNAL_PAIR hdr_cmpl_sig, ctm_cmpl_sig, buf_cmpl_sig;
+
+    ctm_len = MIN(256 - PKT_NBI_OFFSET - 2 * MAC_PREPEND_BYTES, len);
+    hdr_len = MIN(hdr_len, ctm_len);
+    payload_len = MIN(payload_len, len - hdr_len);
+    ctm_payload_len = MIN(ctm_len - hdr_len, payload_len);
+    buf_transfer_len = payload_len - ctm_payload_len;
+
+    island = pkt->nbi_meta.pkt_info.isl;
+    pnum = pkt->nbi_meta.pkt_info.pnum;
+    dma_op(pkt_ctm_ptr40(island, pnum, offset), hdr_len, hdr_addr,
+        NFP_PCIE_DMA_TOPCI_HI, &hdr_cmpl_sig);
+
+    if (ctm_payload_len > 0)
+        dma_op(pkt_ctm_ptr40(island, pnum, offset + hdr_len), ctm_payload_len,
+            payload_addr, NFP_PCIE_DMA_TOPCI_HI, &ctm_cmpl_sig);
+
+    if (buf_transfer_len > 0)
+    {
+        pkt_mu_buffer = (__mem40 void*) ((pkt->nbi_meta.pkt_info.muptr << 11) + 256);
+        dma_op(pkt_mu_buffer, buf_transfer_len, payload_addr + ctm_payload_len,
+            NFP_PCIE_DMA_TOPCI_HI, &buf_cmpl_sig);
+    }
+
+    wait_for_all(&hdr_cmpl_sig.even, &hdr_cmpl_sig.odd);
+    if (ctm_payload_len > 0)
+        wait_for_all(&ctm_cmpl_sig.even, &ctm_cmpl_sig.odd);
+    if (buf_transfer_len > 0)
+        wait_for_all(&buf_cmpl_sig.even, &buf_cmpl_sig.odd);
+}
+
+void dma_packet_recv_split(struct pkt_t* pkt,
+                uint64_t hdr_addr, uint32_t hdr_len,
+                uint64_t payload_addr, uint32_t payload_len)
+{
+    unsigned int len = hdr_len + payload_len;
+    unsigned int offset = PKT_NBI_OFFSET + MAC_PREPEND_BYTES;
+    unsigned int ctm_len, ctm_payload_len, buf_transfer_len;
+    int island, pnum;
+    __mem40 void* pkt_mu_buffer;
+    SIGNAL_PAIR hdr_cmpl_sig, ctm_cmpl_sig, buf_cmpl_sig;
+
+    ctm_len = MIN(256 - PKT_NBI_OFFSET - MAC_PREPEND_BYTES, len);
+    hdr_len = MIN(hdr_len, ctm_len);
+    ctm_payload_len = MIN(ctm_len - hdr_len, payload_len);
+    buf_transfer_len = payload_len - ctm_payload_len;
+
+    island = pkt->nbi_meta.pkt_info.isl;
+    pnum = pkt->nbi_meta.pkt_info.pnum;
+    dma_op(pkt_ctm_ptr40(island, pnum, offset), hdr_len, hdr_addr,
+        NFP_PCIE_DMA_FROMPCI_HI, &hdr_cmpl_sig);
+
+    if (ctm_payload_len > 0)
+        dma_op(pkt_ctm_ptr40(island, pnum, offset + hdr_len), ctm_payload_len,
+            payload_addr, NFP_PCIE_DMA_FROMPCI_HI, &ctm_cmpl_sig);
+
+    if (buf_transfer_len > 0)
+    {
+        pkt_mu_buffer = (__mem40 void*) ((pkt->nbi_meta.pkt_info.muptr << 11) + 256);
+        dma_op(pkt_mu_buffer, buf_transfer_len, payload_addr + ctm_payload_len,
+            NFP_PCIE_DMA_FROMPCI_HI, &buf_cmpl_sig);
+    }
+
+    wait_for_all(&hdr_cmpl_sig.even, &hdr_cmpl_sig.odd);
+    if (ctm_payload_len > 0)
+        wait_for_all(&ctm_cmpl_sig.even, &ctm_cmpl_sig.odd);
+    if (buf_transfer_len > 0)
+        wait_for_all(&buf_cmpl_sig.even, &buf_cmpl_sig.odd);
+}
+
+/*
+ * len bytes between the packet buffer at offset and the host: the CTM
+ * part, then the MU part right after it.
+ */
+static void dma_packet_xfer(struct pkt_t* pkt, unsigned int offset,
+                uint32_t len, uint64_t pcie_addr, int queue)
+{
+    unsigned int ctm_transfer_len, buf_transfer_len;
+    __mem40 void* pkt_mu_buffer;
+    SIGNAL_PAIR ctm_cmpl_sig, buf_cmpl_sig;
+
+    ctm_transfer_len = MIN(256 - offset, len);
+    buf_transfer_len = len - ctm_transfer_len;
+
+    dma_op(pkt_ctm_ptr40(pkt->nbi_meta.pkt_info.isl, pkt->nbi_meta.pkt_info.pnum, offset),
+        ctm_transfer_len, pcie_addr, queue, &ctm_cmpl_sig);
+
+    if (buf_transfer_len > 0)
+    {
+        pkt_mu_buffer = (__mem40 void*) ((pkt->nbi_meta.pkt_info.muptr << 11) + 256);
+        dma_op(pkt_mu_buffer, buf_transfer_len, pcie_addr + ctm_transfer_len, queue, &buf_cmpl_sig);
+
+        wait_for_all(&ctm_cmpl_sig.even, &ctm_cmpl_sig.odd, &buf_cmpl_sig.even, &buf_cmpl_sig.odd);
+        return;
+    }
+
+    wait_for_all(&ctm_cmpl_sig.even, &ctm_cmpl_sig.odd);
+}
+
+/*
+ * Variable-length slots. The slot header is put in the packet buffer
+ * right in front of the frame, over the MAC prepend on RX, so that
+ * header and frame go in one transfer.
+ *
+ * The frame length is not known before the slot is read, so TX reads
+ * the whole slot and takes the length from the header.
+ */
+void dma_packet_send_varlen(struct pkt_t* pkt, uint64_t pcie_addr)
+{
+    unsigned int len = pkt->nbi_meta.pkt_info.len - 2 * MAC_PREPEND_BYTES;
+    unsigned int offset = PKT_NBI_OFFSET + 2 * MAC_PREPEND_BYTES - RING_SLOT_HDR_LEN;
+    __xwrite uint32_t slot_hdr[RING_SLOT_HDR_LEN / 4];
+
+    slot_hdr[0] = len << 16;    /* len, flags 0 */
+    slot_hdr[1] = 0;
+    mem_write32(slot_hdr, pkt_ctm_ptr40(pkt->nbi_meta.pkt_info.isl,
+        pkt->nbi_meta.pkt_info.pnum, offset), sizeof(slot_hdr));
+
+    dma_packet_xfer(pkt, offset, RING_SLOT_HDR_LEN + len, pcie_addr,
+        NFP_PCIE_DMA_TOPCI_HI);
+}
+
+uint32_t dma_packet_recv_varlen(struct pkt_t* pkt, uint32_t slot_len, uint64_t pcie_addr)
+{
+    unsigned int offset = PKT_NBI_OFFSET + MAC_PREPEND_BYTES - RING_SLOT_HDR_LEN;
+    __xread uint32_t slot_hdr[RING_SLOT_HDR_LEN / 4];
+    uint32_t len;
+
+    dma_packet_xfer(pkt, offset, slot_len, pcie_addr, NFP_PCIE_DMA_FROMPCI_HI);
+
+    mem_read32(slot_hdr, pkt_ctm_ptr40(pkt->nbi_meta.pkt_info.isl,
+        pkt->nbi_meta.pkt_info.pnum, offset), sizeof(slot_hdr));
+    len = slot_hdr[0] >> 16;
+
+    return MIN(len, slot_len - RING_SLOT_HDR_LEN);
+}
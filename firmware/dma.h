@@ -14,4 +14,14 @@ void dma_recv(__mem40 void* addr,
 void dma_packet_send(struct pkt_t* pkt, uint64_t pcie_addr);
 void dma_packet_recv(struct pkt_t* pkt, uint32_t len, uint64_t pcie_addr);
 
+void dma_packet_send_split(struct pkt_t* pkt,
+                uint64_t hdr_addr, uint32_t hdr_len,
+                uint64_t payload_addr, uint32_t payload_len);
+void dma_packet_recv_split(struct pkt_t* pkt,
+                uint64_t hdr_addr, uint32_t hdr_len,
+                uint64_t payload_addr, uint32_t payload_len);
+
+void dma_packet_send_varlen(struct pkt_t* pkt, uint64_t pcie_addr);
+uint32_t dma_packet_recv_varlen(struct pkt_t* pkt, uint32_t slot_len, uint64_t pcie_addr);
+
 #endif /* ME_DMA_H */
@@ -9,25 +9,147 @@
 #include "dma.h"
 
 __declspec(export cls) volatile struct device_meta_t cfg = { 0 };
-__shared __lmem uint32_t buffer_capacity, packet_size;
+__shared __lmem uint32_t buffer_capacity, packet_size, payload_size;
+__shared __lmem uint32_t ring_flags, frame_min, frame_max;
+
+/* Ring-full budget in timestamp ticks, 0 to wait for space indefinitely */
+#define TIMESTAMP_TICKS_PER_US  50      /* 800 MHz ME clock, 16 cycles a tick */
+__shared __lmem uint64_t full_budget;
+
+/* Classification, copied from cfg at start so it costs no CLS reads */
+__shared __lmem uint32_t num_classes;
+__shared __lmem uint32_t class_port[RING_CLASS_PORTS];
+__shared __lmem uint32_t port_class[RING_CLASS_PORTS];
+__shared __lmem uint32_t icmp_class;
+__shared __lmem uint32_t dscp_class[64 / 16];
 
 #ifdef PKT_STATS
 __declspec(export imem) uint64_t rx_counters[8];
 #endif
 
+/* Drops per reason (RX_DROP_*); only touched on the drop path */
+__declspec(export imem) uint64_t rx_drops[RX_DROP_REASONS];
+
 __volatile __shared __emem uint32_t debug[4096 * 64];
 __volatile __shared __emem uint32_t debug_idx;
 
-__volatile __shared __lmem uint32_t shadow_tail = 0;
+__volatile __shared __lmem uint32_t shadow_tail[RING_MAX_CLASSES] = { 0 };
+__volatile __shared __lmem uint32_t shadow_payload = 0;
 __volatile __shared __lmem uint8_t init = 0;
 
+/* Restart (see device_meta_t): generation loaded, contexts holding a frame */
+__volatile __shared __lmem uint64_t loaded_gen = 0;
+__volatile __shared __lmem uint32_t busy = 0;
+__volatile __shared __lmem uint8_t reloading = 0;
+
+/* Copy the configuration into local memory, rings empty */
+static void load_config(void)
+{
+    uint32_t i;
+
+    buffer_capacity = cfg.buffer_size;
+    packet_size = cfg.packet_size;
+    payload_size = cfg.payload_size;
+    ring_flags = cfg.ring_flags;
+    full_budget = (uint64_t) cfg.rx_full_budget_us * TIMESTAMP_TICKS_PER_US;
+
+    num_classes = cfg.num_classes;
+    for (i = 0; i < RING_CLASS_PORTS; i++)
+    {
+        class_port[i] = cfg.class_port[i];
+        port_class[i] = cfg.port_class[i];
+    }
+    icmp_class = cfg.icmp_class;
+    for (i = 0; i < 64 / 16; i++)
+        dscp_class[i] = cfg.dscp_class[i];
+
+    /* Frames that fit the slot, or exactly fill it */
+    frame_min = frame_max = packet_size + payload_size;
+    if (ring_flags & RING_F_VARLEN)
+    {
+        frame_min = 0;
+        frame_max = packet_size - RING_SLOT_HDR_LEN;
+    }
+
+    for (i = 0; i < RING_MAX_CLASSES; i++)
+        shadow_tail[i] = 0;
+    shadow_payload = 0;
+}
+
+/*
+ * With a frame in hand: count this context busy and return 1 if it may
+ * go to a ring, else 0 while paused. Contexts are not preempted, so the
+ * local counters need no atomics, and CLS is accessed in order, so the
+ * host either sees this context busy or it sees the pause.
+ */
+static int rx_admit(void)
+{
+    volatile uint64_t start;
+
+    while (1)
+    {
+        busy++;
+        cfg.rx_busy = busy;
+        start = cfg.start_signal;
+        if (start == loaded_gen)
+            return 1;
+
+        busy--;
+        cfg.rx_busy = busy;
+        if (start == 0 || start == RING_RESTARTING)
+            return 0;
+
+        /* Next generation: nobody is busy, the first context in reloads */
+        if (reloading)
+        {
+            ctx_swap();
+            continue;
+        }
+        reloading = 1;
+        load_config();
+        loaded_gen = start;
+        reloading = 0;
+    }
+}
+
+/* Done with an admitted frame */
+__intrinsic static void rx_release(void)
+{
+    busy--;
+    cfg.rx_busy = busy;
+}
+
+/* Traffic class of a frame; see device_meta_t */
+__intrinsic static uint32_t classify_packet(struct pkt_t* pkt)
+{
+    uint32_t i;
+
+    if (num_classes <= 1)
+        return 0;
+
+    if (pkt->hdr.ip.proto == NET_IP_PROTO_ICMP)
+        return icmp_class;
+
+    for (i = 0; i < RING_CLASS_PORTS; i++)
+    {
+        if (class_port[i] != 0 && class_port[i] == pkt->hdr.udp.dport)
+            return port_class[i];
+    }
+
+    return RING_DSCP_CLASS(dscp_class, pkt->hdr.ip.tos >> 2);
+}
+
+#define RX_HEAD(c)  ((c) == 0 ? cfg.rx_head : cfg.class_rings[(c) - 1].rx_head)
+#define RX_TAIL(c)  ((c) == 0 ? cfg.rx_tail : cfg.class_rings[(c) - 1].rx_tail)
+#define RX_IOVA(c)  ((c) == 0 ? cfg.rx_buffer_iova : cfg.class_rings[(c) - 1].rx_buffer_iova)
+
 void rx_process(void)
 {
     struct pkt_t pkt;
     __mem40 void* pkt_data;
     volatile uint32_t head;
-    uint32_t tail, updated_tail;
-    uint64_t pcie_addr;
+    uint32_t tail, updated_tail, payload_off, c;
+    uint64_t pcie_addr, full_since = 0, now;
 
 /*
 
@@ -43,12 +165,13 @@ void rx_process(void)
     pkt_data = receive_packet_with_hdrs(&pkt);
 
     // 3. Filter packets based on header
-    switch (filter_packets(&pkt))
+    switch (filter_packets(&pkt, frame_min, frame_max))
     {
         case ALLOW:
             break;
 
         case DROP:
+            mem_incr64(&rx_drops[RX_DROP_FILTER]);
             drop_packet(&pkt);
             return;
 
@@ -57,47 +180,86 @@ void rx_process(void)
             return;
     }
 
-    // 4. Modify header fields locally
+    // 4. Pick the ring, then modify header fields locally
+    c = classify_packet(&pkt);
     modify_packet_header(&pkt);
 
+    // Not while the host restarts the rings
+    if (!rx_admit())
+    {
+        mem_incr64(&rx_drops[RX_DROP_PAUSED]);
+        drop_packet(&pkt);
+        return;
+    }
+
     // 5. Copy modified header to CTM
     write_packet_header(&pkt);
 
-    // 6. Wait until RX ring is empty
+    // 6. Wait for space in the RX ring, at most full_budget
     while (1)
     {
         // Access from CLS. Thread will be swapped out!
-        head = cfg.rx_head;
+        head = RX_HEAD(c);
 
         // Access from local memory. No swapping
-        tail = shadow_tail;
+        tail = shadow_tail[c];
         updated_tail = tail + packet_size;
         if (updated_tail >= buffer_capacity)
             updated_tail = 0;
 
         /* Buffer full */
         if (updated_tail == head)
+        {
+            if (full_budget == 0)
+                continue;
+
+            now = me_time64();
+            if (full_since == 0)
+                full_since = now;
+            else if (now - full_since > full_budget)
+            {
+                mem_incr64(&rx_drops[RX_DROP_RING_FULL]);
+                drop_packet(&pkt);
+                rx_release();
+                return;
+            }
             continue;
+        }
 
         break;
     }
-    shadow_tail = updated_tail;
+    shadow_tail[c] = updated_tail;
+
+    // Payload slot at the same index, kept alongside to avoid a divide
+    payload_off = shadow_payload;
+    shadow_payload = updated_tail == 0 ? 0 : payload_off + payload_size;
 
     // 7. DMA the packet to host memory
-    pcie_addr = cfg.rx_buffer_iova + tail;
-    dma_packet_send(&pkt, pcie_addr);
+    pcie_addr = RX_IOVA(c) + tail;
+    if (payload_size != 0)
+        dma_packet_send_split(&pkt, pcie_addr, packet_size,
+            cfg.rx_payload_iova + payload_off, payload_size);
+    else if (ring_flags & RING_F_VARLEN)
+        dma_packet_send_varlen(&pkt, pcie_addr);
+    else
+        dma_packet_send(&pkt, pcie_addr);
 
     // 8. Update RingBuffer
     while (1)
     {
         // Access from CLS. Thread will be swapped out!
-        if (cfg.rx_tail != tail)
+        if (RX_TAIL(c) != tail)
             continue;
 
         break;
     }
     // Access to CLS is in-order. No need for atomic update
-    cfg.rx_tail = updated_tail;
+    if (c == 0)
+        cfg.rx_tail = updated_tail;
+    else
+        cfg.class_rings[c - 1].rx_tail = updated_tail;
+
+    rx_release();
 
     // 9. Free packet
     drop_packet(&pkt);
@@ -115,12 +277,12 @@ int main(void)
         {
             start = cfg.start_signal;
 
-            if (start)
+            if (start != 0 && start != RING_RESTARTING)
                 break;
         }
 
-        buffer_capacity = cfg.buffer_size;
-        packet_size = cfg.packet_size;
+        load_config();
+        loaded_gen = start;
         init = 1;
     }
     else
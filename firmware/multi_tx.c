@@ -9,68 +9,160 @@
 #include "dma.h"
 
 __declspec(export cls) volatile struct device_meta_t cfg = { 0 };
-__shared __lmem uint32_t buffer_capacity, packet_size;
+__shared __lmem uint32_t buffer_capacity, packet_size, payload_size, ring_flags;
+__shared __lmem uint32_t num_classes;
 
 #ifdef PKT_STATS
 __declspec(export imem) uint64_t tx_counters[8];
 #endif
 
-__volatile __shared __lmem uint32_t shadow_head = 0;
+__volatile __shared __lmem uint32_t shadow_head[RING_MAX_CLASSES] = { 0 };
+__volatile __shared __lmem uint32_t shadow_payload = 0;
 __volatile __shared __lmem uint8_t init = 0;
 
+/* Restart (see device_meta_t): generation loaded */
+__volatile __shared __lmem uint64_t loaded_gen = 0;
+__volatile __shared __lmem uint8_t reloading = 0;
+
+/* Copy the configuration into local memory, rings empty */
+static void load_config(void)
+{
+    uint32_t i;
+
+    buffer_capacity = cfg.buffer_size;
+    packet_size = cfg.packet_size;
+    payload_size = cfg.payload_size;
+    ring_flags = cfg.ring_flags;
+    num_classes = cfg.num_classes;
+    if (num_classes == 0)
+        num_classes = 1;
+
+    for (i = 0; i < RING_MAX_CLASSES; i++)
+        shadow_head[i] = 0;
+    shadow_payload = 0;
+}
+
+/* Load generation start, once for all contexts */
+static void tx_reload(uint64_t start)
+{
+    if (start == 0 || start == RING_RESTARTING || reloading)
+        return;
+
+    reloading = 1;
+    load_config();
+    loaded_gen = start;
+    reloading = 0;
+}
+
 /* CTM credit defines */
 #define MAX_ME_CTM_PKT_CREDITS  256
 #define MAX_ME_CTM_BUF_CREDITS  32
 
 __export __shared __cls struct ctm_pkt_credits ctm_credits;
 
+#define TX_HEAD(c)  ((c) == 0 ? cfg.tx_head : cfg.class_rings[(c) - 1].tx_head)
+#define TX_TAIL(c)  ((c) == 0 ? cfg.tx_tail : cfg.class_rings[(c) - 1].tx_tail)
+#define TX_IOVA(c)  ((c) == 0 ? cfg.tx_buffer_iova : cfg.class_rings[(c) - 1].tx_buffer_iova)
+
 void tx_process(void)
 {
     struct pkt_t pkt;
     __mem40 void* pkt_data;
     volatile uint32_t tail;
-    uint32_t head, updated_head;
-    uint64_t pcie_addr;
+    uint32_t head, updated_head, payload_off, c;
+    volatile uint64_t start;
+    uint64_t pcie_addr, gen;
 
     // 1. Allocate packet
     pkt_data = allocate_packet(&pkt);
 
-    // 2. Wait until TX ring is non-empty
+    // 2. Wait until a TX ring is non-empty, most urgent class first
+    c = 0;
     while (1)
     {
+        gen = loaded_gen;
+
         // Access from CLS. Thread will be swapped out!
-        tail = cfg.tx_tail;
+        tail = TX_TAIL(c);
 
         // Access from local memory. No swapping
-        head = shadow_head;
+        head = shadow_head[c];
         updated_head = head + packet_size;
         if (updated_head >= buffer_capacity)
             updated_head = 0;
 
         /* Buffer empty */
         if (head == tail)
+        {
+            if (++c < num_classes)
+                continue;
+            c = 0;
+
+            /*
+             * After each round too: the new generation may have posted
+             * as many frames as the old one left off at, so that its
+             * tail matches the stale shadow_head.
+             */
+            start = cfg.start_signal;
+            if (start != gen)
+                tx_reload(start);
             continue;
+        }
 
-        break;
+        /*
+         * Read after the tail: a tail rewritten for a restart is only
+         * visible once start_signal is RING_RESTARTING. The host drains
+         * TX first, so nothing is claimed across a reload. The read
+         * swaps, so the slot must still be unclaimed after it.
+         */
+        start = cfg.start_signal;
+        if ((start == gen || start == 0) && loaded_gen == gen && shadow_head[c] == head)
+            break;
+        if (start == gen || start == 0)
+            continue;
+
+        tx_reload(start);
+        c = 0;
     }
-    shadow_head = updated_head;
+    shadow_head[c] = updated_head;
+
+    // Payload slot at the same index, kept alongside to avoid a divide
+    payload_off = shadow_payload;
+    shadow_payload = updated_head == 0 ? 0 : payload_off + payload_size;
 
     // 3. DMA packet data to CTM buffer
-    pcie_addr = cfg.tx_buffer_iova + head;
-    dma_packet_recv(&pkt, packet_size, pcie_addr);
-    pkt.nbi_meta.pkt_info.len = packet_size + MAC_PREPEND_BYTES;
+    pcie_addr = TX_IOVA(c) + head;
+    if (payload_size != 0)
+    {
+        dma_packet_recv_split(&pkt, pcie_addr, packet_size,
+            cfg.tx_payload_iova + payload_off, payload_size);
+        pkt.nbi_meta.pkt_info.len = packet_size + payload_size + MAC_PREPEND_BYTES;
+    }
+    else if (ring_flags & RING_F_VARLEN)
+    {
+        pkt.nbi_meta.pkt_info.len =
+            dma_packet_recv_varlen(&pkt, packet_size, pcie_addr) + MAC_PREPEND_BYTES;
+    }
+    else
+    {
+        dma_packet_recv(&pkt, packet_size, pcie_addr);
+        pkt.nbi_meta.pkt_info.len = packet_size + MAC_PREPEND_BYTES;
+    }
 
     // 4. Update RingBuffer
     while (1)
     {
         // Access from CLS. Thread will be swapped out!
-        if (cfg.tx_head != head)
+        if (TX_HEAD(c) != head)
             continue;
 
         break;
     }
     // Access to CLS is in-order. No need for atomic update
-    cfg.tx_head = updated_head;
+    if (c == 0)
+        cfg.tx_head = updated_head;
+    else
+        cfg.class_rings[c - 1].tx_head = updated_head;
 
     // 5. Send packet over NBI
     send_packet(&pkt);
@@ -90,12 +182,12 @@ int main(void)
         {
             start = cfg.start_signal;
 
-            if (start)
+            if (start != 0 && start != RING_RESTARTING)
                 break;
         }
 
-        buffer_capacity = cfg.buffer_size;
-        packet_size = cfg.packet_size;
+        load_config();
+        loaded_gen = start;
         init = 1;
     }
     else
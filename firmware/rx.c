@@ -34,7 +34,7 @@ void rx_process(void)
     pkt_data = receive_packet_with_hdrs(&pkt);
 
     // 3. Filter packets based on header
-    switch (filter_packets(&pkt))
+    switch (filter_packets(&pkt, packet_size, packet_size))
     {
         case ALLOW:
             break;
@@ -99,8 +99,14 @@ void write_packet_header(struct pkt_t* pkt)
     mem_write32(&hdr, pkt_ctm_buffer, sizeof(hdr));
 }
 
-int filter_packets(struct pkt_t* pkt)
+/*
+ * Allow UDP/ICMP frames of min_len to max_len bytes, MAC prepend
+ * excluded. Fixed-size slots pass the slot size as both.
+ */
+int filter_packets(struct pkt_t* pkt, uint32_t min_len, uint32_t max_len)
 {
+    uint32_t len;
+
     /* Drop non-IP packets */
     if (pkt->hdr.eth.type != NET_ETH_TYPE_IPV4)
         return DROP;
@@ -117,7 +123,8 @@ int filter_packets(struct pkt_t* pkt)
     }
 
     /* Drop packets with illegal pkt length */
-    if ((pkt->nbi_meta.pkt_info.len - 2 * MAC_PREPEND_BYTES) != packet_size)
+    len = pkt->nbi_meta.pkt_info.len - 2 * MAC_PREPEND_BYTES;
+    if (len < min_len || len > max_len)
         return DROP;
 
     return ALLOW;
@@ -16,7 +16,7 @@ extern __mem40 void* receive_packet_with_hdrs(struct pkt_t* pkt);
 extern __mem40 void* receive_packet(struct pkt_t* pkt);
 extern void read_packet_header(struct pkt_t* pkt);
 extern void write_packet_header(struct pkt_t* pkt);
-extern int filter_packets(struct pkt_t* pkt);
+extern int filter_packets(struct pkt_t* pkt, uint32_t min_len, uint32_t max_len);
 extern void modify_packet_header(struct pkt_t* pkt);
 extern void free_packet(struct pkt_t* pkt);
 extern void drop_packet(struct pkt_t* pkt);
@@ -1,12 +1,15 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 
-#define __USE_GNU
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <asm-generic/ioctl.h>
 #include <unistd.h>
 #include <dlfcn.h>
@@ -14,12 +17,20 @@
 
 #include "nfp_ioctl.h"
 
-#define MEM_BARRIER() __asm__ volatile("" ::: "memory")
+#define likely(x)       __builtin_expect(!!(x), 1)
+#define unlikely(x)     __builtin_expect(!!(x), 0)
 
-static int (*libc_open)(const char* pathname, int flags) = NULL;
-static int (*libc_open64)(const char* pathname, int flags) = NULL;
+/*
+ * /dev/nfp-cpp-<n> is served on NFP_CPP_SOCKET_PATH for n = 0 and on
+ * NFP_CPP_SOCKET_PATH<n> otherwise (see nfp_cpp_dev.h).
+ */
+#define NFP_CPP_DEV_PREFIX      "/dev/nfp-cpp-"
+#define NFP_CPP_SOCKET_PATH     "/tmp/nfp_cpp"
+
+static int (*libc_open)(const char* pathname, int flags, ...) = NULL;
+static int (*libc_open64)(const char* pathname, int flags, ...) = NULL;
 static int (*libc_openat)(int dirfd, const char* pathname,
-    int flags) = NULL;
+    int flags, ...) = NULL;
 static int (*libc_close)(int fd) = NULL;
 static ssize_t (*libc_pread)(int fd, void* buf, size_t count,
             off_t offset) = NULL;
@@ -29,16 +40,20 @@ static ssize_t (*libc_pwrite)(int fd, const void* buf,
         size_t count, off_t offset) = NULL;
 static ssize_t (*libc_pwrite64)(int fd, const void* buf,
         size_t count, off_t offset) = NULL;
+static ssize_t (*libc_preadv)(int fd, const struct iovec* iov,
+        int iovcnt, off_t offset) = NULL;
+static ssize_t (*libc_pwritev)(int fd, const struct iovec* iov,
+        int iovcnt, off_t offset) = NULL;
+static ssize_t (*libc_preadv64)(int fd, const struct iovec* iov,
+        int iovcnt, off_t offset) = NULL;
+static ssize_t (*libc_pwritev64)(int fd, const struct iovec* iov,
+        int iovcnt, off_t offset) = NULL;
+static ssize_t (*libc_readv)(int fd, const struct iovec* iov,
+        int iovcnt) = NULL;
 static int (*libc_ioctl)(int fd, unsigned long request, char* argp);
 
 #define MAX_FD  1024 * 1024
 
-enum fd_type {
-    FD_UNUSED,
-    FD_CPP,
-    FD_LIBC
-};
-
 enum op_type {
     OP_UNUSED,
     OP_PREAD,
@@ -46,382 +61,453 @@ enum op_type {
     OP_IOCTL
 };
 
-static int fd_status[MAX_FD];
-static inline void ensure_init(void);
+/**
+ * Log levels, selected through the NFP_SHIM_LOG environment variable.
+ * Only errors are reported by default; per-call tracing is opt-in so
+ * that ordinary file I/O of the interposed tool is not slowed down.
+ */
+enum log_level {
+    LOG_NONE,
+    LOG_ERROR,
+    LOG_INFO,
+    LOG_TRACE
+};
+
+static int log_level = LOG_ERROR;
 
-int open(const char* pathname, int flags)
+#define SHIM_LOG(_lvl, ...)                 \
+do {                                        \
+    if (unlikely(log_level >= (_lvl)))      \
+        fprintf(stderr, __VA_ARGS__);       \
+} while (0)
+
+/**
+ * One bit per descriptor: set if the descriptor is a CPP socket.
+ * 128 KB instead of a 4 MB status array, and the common (non-CPP)
+ * case touches a single word.
+ */
+#define FD_BITS         (8 * sizeof(uint64_t))
+static uint64_t fd_cpp_map[MAX_FD / FD_BITS];
+
+static inline int fd_is_cpp(int fd)
 {
-    int fd;
-    int temp;
-    struct sockaddr address;
+    if (unlikely(fd < 0 || fd >= MAX_FD))
+        return 0;
 
-    fprintf(stderr, "SHIM: %s\n", __func__);
+    return (fd_cpp_map[fd / FD_BITS] >> (fd % FD_BITS)) & 1;
+}
 
-    ensure_init();
+static inline void fd_set_cpp(int fd)
+{
+    __atomic_fetch_or(&fd_cpp_map[fd / FD_BITS],
+        (uint64_t) 1 << (fd % FD_BITS), __ATOMIC_RELAXED);
+}
 
-    if (strcmp(pathname, "/dev/nfp-cpp-0") == 0)
-    {
-        fd = socket(AF_UNIX, SOCK_STREAM, 0);
-        if (fd < 0)
-            return -1;
+static inline void fd_clear_cpp(int fd)
+{
+    __atomic_fetch_and(&fd_cpp_map[fd / FD_BITS],
+        ~((uint64_t) 1 << (fd % FD_BITS)), __ATOMIC_RELAXED);
+}
 
-        if (fd >= MAX_FD)
-        {
-            errno = EMFILE;
-            return -1;
-        }
+static void init(void);
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
 
-        memset(&address, 0, sizeof(struct sockaddr));
-        address.sa_family = AF_UNIX;
-        strcpy(address.sa_data, "/tmp/nfp_cpp");
-        if (connect(fd, &address, sizeof(struct sockaddr)) < 0)
-        {
-            temp = errno;
-            libc_close(fd);
-            errno = temp;
+/**
+ * Symbols are bound by the constructor below. Another library's
+ * constructor may still call into us first, so keep a cold fallback.
+ */
+static inline void ensure_init(void)
+{
+    if (unlikely(libc_ioctl == NULL))
+        pthread_once(&init_once, init);
+}
 
-            return -1;
-        }
+/**
+ * @return
+ *   NIC index if pathname is a CPP device node, -1 otherwise.
+ */
+static inline int cpp_dev_index(const char* pathname)
+{
+    if (likely(strncmp(pathname, NFP_CPP_DEV_PREFIX,
+                    sizeof(NFP_CPP_DEV_PREFIX) - 1) != 0))
+        return -1;
 
-        fd_status[fd] = FD_CPP;
-        return 0;
-    }
-    else
-    {
-        return libc_open(pathname, flags);
-    }
+    pathname += sizeof(NFP_CPP_DEV_PREFIX) - 1;
+    if (pathname[0] < '0' || pathname[0] > '9' || pathname[1] != '\0')
+        return -1;
+
+    return pathname[0] - '0';
 }
 
-int open64(const char* pathname, int flags)
+static int cpp_open(int index)
 {
     int fd;
     int temp;
     struct sockaddr address;
+    char path[sizeof(address.sa_data)];
 
-    fprintf(stderr, "SHIM: %s\n", __func__);
-
-    ensure_init();
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
 
-    if (strcmp(pathname, "/dev/nfp-cpp-0") == 0)
+    if (fd >= MAX_FD)
     {
-        fd = socket(AF_UNIX, SOCK_STREAM, 0);
-        if (fd < 0)
-            return -1;
-
-        if (fd >= MAX_FD)
-        {
-            errno = EMFILE;
-            return -1;
-        }
-
-        memset(&address, 0, sizeof(struct sockaddr));
-        address.sa_family = AF_UNIX;
-        strcpy(address.sa_data, "/tmp/nfp_cpp");
-        if (connect(fd, &address, sizeof(struct sockaddr)) < 0)
-        {
-            temp = errno;
-            libc_close(fd);
-            errno = temp;
-
-            return -1;
-        }
-
-        fd_status[fd] = FD_CPP;
-        return fd;
+        libc_close(fd);
+        errno = EMFILE;
+        return -1;
     }
+
+    memset(&address, 0, sizeof(struct sockaddr));
+    address.sa_family = AF_UNIX;
+    if (index == 0)
+        snprintf(path, sizeof(path), "%s", NFP_CPP_SOCKET_PATH);
     else
+        snprintf(path, sizeof(path), "%s%d", NFP_CPP_SOCKET_PATH, index);
+    memcpy(address.sa_data, path, sizeof(path));
+    if (connect(fd, &address, sizeof(struct sockaddr)) < 0)
     {
-        return libc_open64(pathname, flags);
+        temp = errno;
+        libc_close(fd);
+        errno = temp;
+
+        return -1;
     }
+
+    fd_set_cpp(fd);
+    return fd;
 }
 
-int openat(int dirfd, const char* pathname, int flags)
+static int cpp_send_header(int fd, uint64_t op, uint64_t count,
+        uint64_t offset)
 {
-    fprintf(stderr, "SHIM: %s\n", __func__);
-
-    ensure_init();
+    uint64_t hdr[3] = { op, count, offset };
 
-    if (pathname[0] == '/')
-    {
-        return open(pathname, flags);
-    }
-    else
-    {
-        fprintf(stderr, "Relative addressing not supported!\n");
+    /* One syscall for the whole request header */
+    return write(fd, hdr, sizeof(hdr)) == sizeof(hdr) ? 0 : -1;
+}
 
-        errno = ENOTDIR;
-        return -1;
-    }
+static ssize_t cpp_io_error(int fd)
+{
+    SHIM_LOG(LOG_ERROR, "SHIM: error on CPP socket: %s\n",
+        strerror(errno));
+    close(fd);
+    errno = EIO;
+    return -1;
 }
 
-/* TODO: add error checking */
-int close(int fd)
+/**
+ * Read a CPP range into an iovec. The device server sees a single
+ * request regardless of how many segments the caller passed.
+ */
+static ssize_t cpp_preadv(int fd, const struct iovec* iov, int iovcnt,
+        off_t offset)
 {
-    fprintf(stderr, "SHIM: %s\n", __func__);
+    uint64_t temp;
+    size_t count = 0;
+    ssize_t ret, len;
+    int i;
 
-    ensure_init();
+    for (i = 0; i < iovcnt; i++)
+        count += iov[i].iov_len;
+
+    if (cpp_send_header(fd, OP_PREAD, count, offset) < 0)
+        return cpp_io_error(fd);
 
-    int ret = libc_close(fd);
+    ret = read(fd, &temp, sizeof(temp));
+    if (ret < (ssize_t) sizeof(temp))
+        return cpp_io_error(fd);
 
-    if (ret == 0)
+    ret = (int) temp;
+    if (ret < 0)
     {
-        fd_status[fd] = FD_UNUSED;
+        errno = -ret;
+        return -1;
+    }
+
+    len = 0;
+    for (i = 0; i < iovcnt && len < (ssize_t) temp; i++)
+    {
+        size_t seg = iov[i].iov_len;
+        size_t done = 0;
+
+        if (seg > temp - len)
+            seg = temp - len;
+
+        while (done < seg)
+        {
+            ret = read(fd, (char*) iov[i].iov_base + done, seg - done);
+            if (ret <= 0)
+                return cpp_io_error(fd);
+            done += ret;
+        }
+        len += seg;
     }
 
-    return ret;
+    return temp;
 }
 
-ssize_t pread(int fd, void* buf, size_t count, off_t offset)
+static ssize_t cpp_pwritev(int fd, const struct iovec* iov, int iovcnt,
+        off_t offset)
 {
+    uint64_t temp;
+    size_t count = 0;
     ssize_t ret;
+    int i;
 
-    fprintf(stderr, "SHIM: %s\n", __func__);
+    for (i = 0; i < iovcnt; i++)
+        count += iov[i].iov_len;
 
-    ensure_init();
+    if (cpp_send_header(fd, OP_PWRITE, count, offset) < 0)
+        return cpp_io_error(fd);
 
-    if (fd_status[fd] == FD_CPP)
+    i = 0;
+    while (i < iovcnt)
     {
-        uint64_t temp;
-        ssize_t len;
-
-        temp = (uint64_t) OP_PREAD;
-        ret = write(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pread_error;
-
-        temp = (uint64_t) count;
-        ret = write(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pread_error;
-
-        temp = (uint64_t) offset;
-        ret = write(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pread_error;
+        ret = writev(fd, &iov[i], iovcnt - i);
+        if (ret < 0)
+            return cpp_io_error(fd);
 
-        ret = read(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pread_error;
+        /* Skip over fully written segments, finish a partial one */
+        while (i < iovcnt && (size_t) ret >= iov[i].iov_len)
+            ret -= iov[i++].iov_len;
 
-        ret = (int) temp;
-        if (ret < 0)
+        if (i < iovcnt && ret > 0)
         {
-            errno = -ret;
-            return -1;
-        }
+            struct iovec rest = {
+                .iov_base = (char*) iov[i].iov_base + ret,
+                .iov_len = iov[i].iov_len - ret
+            };
 
-        len = 0;
-        while (len < temp)
-        {
-            ret = read(fd, ((char*) buf) + len, temp - len);
-            if (ret < 0)
-                goto handle_pread_error;
-            len += ret;
+            while (rest.iov_len > 0)
+            {
+                ret = writev(fd, &rest, 1);
+                if (ret < 0)
+                    return cpp_io_error(fd);
+                rest.iov_base = (char*) rest.iov_base + ret;
+                rest.iov_len -= ret;
+            }
+            i++;
         }
+    }
 
-        return temp;
+    ret = read(fd, &temp, sizeof(temp));
+    if (ret < (ssize_t) sizeof(temp))
+        return cpp_io_error(fd);
 
-handle_pread_error:
-        fprintf(stderr, "Error when writing to socket: %s",
-            strerror(errno));
-        close(fd);
-        errno = EIO;
+    ret = (int) temp;
+    if (ret < 0)
+    {
+        errno = -ret;
         return -1;
     }
-    else
-        return libc_pread(fd, buf, count, offset);
+
+    return temp;
 }
 
-ssize_t pread64(int fd, void* buf, size_t count, off_t offset)
+static inline mode_t open_mode(int flags, va_list ap)
 {
-    ssize_t ret;
+    if ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE)
+        return va_arg(ap, mode_t);
+    return 0;
+}
 
-    fprintf(stderr, "SHIM: %s\n", __func__);
+int open(const char* pathname, int flags, ...)
+{
+    va_list ap;
+    mode_t mode;
+    int index;
 
     ensure_init();
+    SHIM_LOG(LOG_TRACE, "SHIM: %s %s\n", __func__, pathname);
 
-    if (fd_status[fd] == FD_CPP)
-    {
-        uint64_t temp;
-        ssize_t len;
+    if (unlikely((index = cpp_dev_index(pathname)) >= 0))
+        return cpp_open(index);
 
-        temp = (uint64_t) OP_PREAD;
-        ret = write(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pread_error;
+    va_start(ap, flags);
+    mode = open_mode(flags, ap);
+    va_end(ap);
 
-        temp = (uint64_t) count;
-        ret = write(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pread_error;
+    return libc_open(pathname, flags, mode);
+}
 
-        temp = (uint64_t) offset;
-        ret = write(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pread_error;
+int open64(const char* pathname, int flags, ...)
+{
+    va_list ap;
+    mode_t mode;
+    int index;
 
-        ret = read(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pread_error;
+    ensure_init();
+    SHIM_LOG(LOG_TRACE, "SHIM: %s %s\n", __func__, pathname);
 
-        ret = (int) temp;
-        if (ret < 0)
-        {
-            errno = -ret;
-            return -1;
-        }
+    if (unlikely((index = cpp_dev_index(pathname)) >= 0))
+        return cpp_open(index);
 
-        len = 0;
-        while (len < temp)
-        {
-            ret = read(fd, ((char*) buf) + len, temp - len);
-            if (ret < 0)
-                goto handle_pread_error;
-            len += ret;
-        }
+    va_start(ap, flags);
+    mode = open_mode(flags, ap);
+    va_end(ap);
+
+    return libc_open64(pathname, flags, mode);
+}
 
-        return temp;
+int openat(int dirfd, const char* pathname, int flags, ...)
+{
+    va_list ap;
+    mode_t mode;
+    int index;
 
-handle_pread_error:
-        fprintf(stderr, "Error when writing to socket: %s",
-            strerror(errno));
-        close(fd);
-        errno = EIO;
-        return -1;
-    }
-    else
-        return libc_pread64(fd, buf, count, offset);
+    ensure_init();
+    SHIM_LOG(LOG_TRACE, "SHIM: %s %s\n", __func__, pathname);
+
+    if (unlikely((index = cpp_dev_index(pathname)) >= 0))
+        return cpp_open(index);
+
+    va_start(ap, flags);
+    mode = open_mode(flags, ap);
+    va_end(ap);
+
+    return libc_openat(dirfd, pathname, flags, mode);
 }
 
-ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset)
+int close(int fd)
 {
-    ssize_t ret;
+    ensure_init();
+    SHIM_LOG(LOG_TRACE, "SHIM: %s %d\n", __func__, fd);
+
+    /*
+     * Before the descriptor can be handed out again, e.g. to cpp_open()
+     * on another thread. Linux releases it even if close() fails with
+     * EINTR or EIO, so the bit goes whatever libc_close() returns.
+     */
+    if (fd >= 0 && fd < MAX_FD)
+        fd_clear_cpp(fd);
 
-    fprintf(stderr, "SHIM: %s\n", __func__);
+    return libc_close(fd);
+}
 
+ssize_t pread(int fd, void* buf, size_t count, off_t offset)
+{
     ensure_init();
+    SHIM_LOG(LOG_TRACE, "SHIM: %s %d\n", __func__, fd);
 
-    if (fd_status[fd] == FD_CPP)
+    if (unlikely(fd_is_cpp(fd)))
     {
-        uint64_t temp;
-        ssize_t len;
+        struct iovec iov = { .iov_base = buf, .iov_len = count };
+        return cpp_preadv(fd, &iov, 1, offset);
+    }
 
-        temp = (uint64_t) OP_PWRITE;
-        ret = write(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pwrite_error;
+    return libc_pread(fd, buf, count, offset);
+}
 
-        temp = (uint64_t) count;
-        ret = write(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pwrite_error;
+ssize_t pread64(int fd, void* buf, size_t count, off_t offset)
+{
+    ensure_init();
+    SHIM_LOG(LOG_TRACE, "SHIM: %s %d\n", __func__, fd);
 
-        temp = (uint64_t) offset;
-        ret = write(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pwrite_error;
+    if (unlikely(fd_is_cpp(fd)))
+    {
+        struct iovec iov = { .iov_base = buf, .iov_len = count };
+        return cpp_preadv(fd, &iov, 1, offset);
+    }
 
-        len = 0;
-        while (len < count)
-        {
-            ret = write(fd, ((char*) buf) + len, count - len);
-            if (ret < 0)
-                goto handle_pwrite_error;
-            len += ret;
-        }
+    return libc_pread64(fd, buf, count, offset);
+}
 
-        ret = read(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pwrite_error;
+ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset)
+{
+    ensure_init();
+    SHIM_LOG(LOG_TRACE, "SHIM: %s %d\n", __func__, fd);
 
-        ret = (int) temp;
-        if (ret < 0)
-        {
-            errno = -ret;
-            return -1;
-        }
+    if (unlikely(fd_is_cpp(fd)))
+    {
+        struct iovec iov = { .iov_base = (void*) buf, .iov_len = count };
+        return cpp_pwritev(fd, &iov, 1, offset);
+    }
 
-        return temp;
+    return libc_pwrite(fd, buf, count, offset);
+}
 
-handle_pwrite_error:
-        fprintf(stderr, "Error when writing to socket: %s",
-            strerror(errno));
-        close(fd);
-        errno = EIO;
-        return -1;
+ssize_t pwrite64(int fd, const void* buf, size_t count, off_t offset)
+{
+    ensure_init();
+    SHIM_LOG(LOG_TRACE, "SHIM: %s %d\n", __func__, fd);
+
+    if (unlikely(fd_is_cpp(fd)))
+    {
+        struct iovec iov = { .iov_base = (void*) buf, .iov_len = count };
+        return cpp_pwritev(fd, &iov, 1, offset);
     }
-    else
-        return libc_pwrite(fd, buf, count, offset);
+
+    return libc_pwrite64(fd, buf, count, offset);
 }
 
-ssize_t pwrite64(int fd, const void* buf, size_t count, off_t offset)
+ssize_t preadv(int fd, const struct iovec* iov, int iovcnt, off_t offset)
 {
-    ssize_t ret;
+    ensure_init();
+    SHIM_LOG(LOG_TRACE, "SHIM: %s %d\n", __func__, fd);
+
+    if (unlikely(fd_is_cpp(fd)))
+        return cpp_preadv(fd, iov, iovcnt, offset);
 
-    fprintf(stderr, "SHIM: %s\n", __func__);
+    return libc_preadv(fd, iov, iovcnt, offset);
+}
 
+ssize_t pwritev(int fd, const struct iovec* iov, int iovcnt, off_t offset)
+{
     ensure_init();
+    SHIM_LOG(LOG_TRACE, "SHIM: %s %d\n", __func__, fd);
 
-    if (fd_status[fd] == FD_CPP)
-    {
-        uint64_t temp;
-        ssize_t len;
+    if (unlikely(fd_is_cpp(fd)))
+        return cpp_pwritev(fd, iov, iovcnt, offset);
 
-        temp = (uint64_t) OP_PWRITE;
-        ret = write(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pwrite_error;
+    return libc_pwritev(fd, iov, iovcnt, offset);
+}
 
-        temp = (uint64_t) count;
-        ret = write(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pwrite_error;
+ssize_t preadv64(int fd, const struct iovec* iov, int iovcnt, off_t offset)
+{
+    ensure_init();
+    SHIM_LOG(LOG_TRACE, "SHIM: %s %d\n", __func__, fd);
 
-        temp = (uint64_t) offset;
-        ret = write(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pwrite_error;
+    if (unlikely(fd_is_cpp(fd)))
+        return cpp_preadv(fd, iov, iovcnt, offset);
 
-        len = 0;
-        while (len < count)
-        {
-            ret = write(fd, ((char*) buf) + len, count - len);
-            if (ret < 0)
-                goto handle_pwrite_error;
-            len += ret;
-        }
+    return libc_preadv64(fd, iov, iovcnt, offset);
+}
 
-        ret = read(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_pwrite_error;
+ssize_t pwritev64(int fd, const struct iovec* iov, int iovcnt, off_t offset)
+{
+    ensure_init();
+    SHIM_LOG(LOG_TRACE, "SHIM: %s %d\n", __func__, fd);
 
-        ret = (int) temp;
-        if (ret < 0)
-        {
-            errno = -ret;
-            return -1;
-        }
+    if (unlikely(fd_is_cpp(fd)))
+        return cpp_pwritev(fd, iov, iovcnt, offset);
+
+    return libc_pwritev64(fd, iov, iovcnt, offset);
+}
 
-        return temp;
+/**
+ * The CPP device has no file position. Reading the raw socket would
+ * desynchronise the request stream, so refuse instead.
+ */
+ssize_t readv(int fd, const struct iovec* iov, int iovcnt)
+{
+    ensure_init();
+    SHIM_LOG(LOG_TRACE, "SHIM: %s %d\n", __func__, fd);
 
-handle_pwrite_error:
-        fprintf(stderr, "Error when writing to socket: %s",
-            strerror(errno));
-        close(fd);
-        errno = EIO;
+    if (unlikely(fd_is_cpp(fd)))
+    {
+        errno = ESPIPE;
         return -1;
     }
-    else
-        return libc_pwrite64(fd, buf, count, offset);
+
+    return libc_readv(fd, iov, iovcnt);
 }
 
 int ioctl(int fd, unsigned long request, char* argp)
 {
-    fprintf(stderr, "SHIM: %s\n", __func__);
-
     ensure_init();
+    SHIM_LOG(LOG_TRACE, "SHIM: %s %d\n", __func__, fd);
 
-    if (fd_status[fd] == FD_CPP)
+    if (fd_is_cpp(fd))
     {
         struct nfp_cpp_area_request area_req;
         struct nfp_cpp_event_request event_req;
@@ -430,15 +516,10 @@ int ioctl(int fd, unsigned long request, char* argp)
         uint64_t arg_size, temp;
         int ret;
 
-        temp = (uint64_t) OP_IOCTL;
-        ret = write(fd, &temp, sizeof(temp));
-        if (ret < sizeof(temp))
-            goto handle_ioctl_error;
-
         switch (request)
         {
         case NFP_IOCTL_CPP_IDENTIFICATION:
-            fprintf(stderr, "IOCTL: NFP_IOCTL_CPP_IDENTIFICATION\n");
+            SHIM_LOG(LOG_INFO, "IOCTL: NFP_IOCTL_CPP_IDENTIFICATION\n");
             if (!argp)
                 return sizeof(ident);
 
@@ -446,51 +527,56 @@ int ioctl(int fd, unsigned long request, char* argp)
             break;
 
         case NFP_IOCTL_FIRMWARE_LOAD:
-            fprintf(stderr, "IOCTL: NFP_IOCTL_FIRMWARE_LOAD\n");
+            SHIM_LOG(LOG_INFO, "IOCTL: NFP_IOCTL_FIRMWARE_LOAD\n");
             arg_size = NFP_FIRMWARE_MAX;
             break;
 
         case NFP_IOCTL_FIRMWARE_LAST:
-            fprintf(stderr, "IOCTL: NFP_IOCTL_FIRMWARE_LAST\n");
+            SHIM_LOG(LOG_INFO, "IOCTL: NFP_IOCTL_FIRMWARE_LAST\n");
             arg_size = 0;
             break;
 
         case NFP_IOCTL_CPP_AREA_REQUEST:
-            fprintf(stderr, "IOCTL: NFP_IOCTL_CPP_AREA_REQUEST\n");
+            SHIM_LOG(LOG_INFO, "IOCTL: NFP_IOCTL_CPP_AREA_REQUEST\n");
             arg_size = sizeof(area_req);
             break;
 
         case NFP_IOCTL_CPP_AREA_RELEASE:
-            fprintf(stderr, "IOCTL: NFP_IOCTL_CPP_AREA_RELEASE\n");
+            SHIM_LOG(LOG_INFO, "IOCTL: NFP_IOCTL_CPP_AREA_RELEASE\n");
             arg_size = sizeof(area_req);
             break;
 
         case NFP_IOCTL_CPP_AREA_RELEASE_OBSOLETE:
-            fprintf(stderr, "IOCTL: NFP_IOCTL_CPP_AREA_REQUEST_OBSOLETE\n");
+            SHIM_LOG(LOG_INFO, "IOCTL: NFP_IOCTL_CPP_AREA_REQUEST_OBSOLETE\n");
             arg_size = sizeof(area_req.offset);
             break;
 
         case NFP_IOCTL_CPP_EXPL_REQUEST:
-            fprintf(stderr, "IOCTL: NFP_IOCTL_CPP_EXPL_REQUEST\n");
+            SHIM_LOG(LOG_INFO, "IOCTL: NFP_IOCTL_CPP_EXPL_REQUEST\n");
             arg_size = sizeof(explicit_req);
             break;
 
         case NFP_IOCTL_CPP_EVENT_ACQUIRE:
-            fprintf(stderr, "IOCTL: NFP_IOCTL_CPP_EVENT_ACQUIRE\n");
+            SHIM_LOG(LOG_INFO, "IOCTL: NFP_IOCTL_CPP_EVENT_ACQUIRE\n");
             arg_size = sizeof(event_req);
             break;
 
         case NFP_IOCTL_CPP_EVENT_RELEASE:
-            fprintf(stderr, "IOCTL: NFP_IOCTL_CPP_EVENT_RELEASE\n");
+            SHIM_LOG(LOG_INFO, "IOCTL: NFP_IOCTL_CPP_EVENT_RELEASE\n");
             arg_size = sizeof(event_req);
             break;
 
         default:
-            fprintf(stderr, "IOCTL: %lu\n", request);
+            SHIM_LOG(LOG_ERROR, "IOCTL: unsupported request %lu\n", request);
             errno = EINVAL;
             return -1;
         }
 
+        temp = (uint64_t) OP_IOCTL;
+        ret = write(fd, &temp, sizeof(temp));
+        if (ret < sizeof(temp))
+            goto handle_ioctl_error;
+
         temp = request;
         ret = write(fd, &temp, sizeof(temp));
         if (ret < sizeof(temp))
@@ -528,13 +614,13 @@ int ioctl(int fd, unsigned long request, char* argp)
             break;
         case NFP_IOCTL_CPP_AREA_REQUEST:
             ret = read(fd, (void*) &area_req, sizeof(area_req));
-            if (ret < sizeof(ident))
+            if (ret < sizeof(area_req))
                 goto handle_ioctl_error;
             memcpy(argp, (void*) &area_req, sizeof(area_req));
             break;
         case NFP_IOCTL_CPP_EXPL_REQUEST:
             ret = read(fd, (void*) &explicit_req, sizeof(explicit_req));
-            if (ret < sizeof(ident))
+            if (ret < sizeof(explicit_req))
                 goto handle_ioctl_error;
             memcpy(argp, (void*) &explicit_req, sizeof(explicit_req));
             break;
@@ -543,11 +629,7 @@ int ioctl(int fd, unsigned long request, char* argp)
         return (int)temp;
 
 handle_ioctl_error:
-        fprintf(stderr, "Error when writing to socket: %s",
-            strerror(errno));
-        close(fd);
-        errno = EIO;
-        return -1;
+        return cpp_io_error(fd);
     }
     else
         return libc_ioctl(fd, request, argp);
@@ -557,7 +639,7 @@ static void *bind_symbol(const char *sym)
 {
   void *ptr;
   if ((ptr = dlsym(RTLD_NEXT, sym)) == NULL) {
-    fprintf(stderr, "flextcp socket interpose: dlsym failed (%s)\n", sym);
+    fprintf(stderr, "nfp interpose: dlsym failed (%s)\n", sym);
     abort();
   }
   return ptr;
@@ -565,6 +647,12 @@ static void *bind_symbol(const char *sym)
 
 static void init(void)
 {
+    const char* level;
+
+    level = getenv("NFP_SHIM_LOG");
+    if (level != NULL)
+        log_level = atoi(level);
+
     libc_open = bind_symbol("open");
     libc_open64 = bind_symbol("open64");
     libc_openat = bind_symbol("openat");
@@ -573,33 +661,18 @@ static void init(void)
     libc_pwrite = bind_symbol("pwrite");
     libc_pread64 = bind_symbol("pread64");
     libc_pwrite64 = bind_symbol("pwrite64");
-    libc_ioctl = bind_symbol("ioctl");
+    libc_preadv = bind_symbol("preadv");
+    libc_pwritev = bind_symbol("pwritev");
+    libc_preadv64 = bind_symbol("preadv64");
+    libc_pwritev64 = bind_symbol("pwritev64");
+    libc_readv = bind_symbol("readv");
+
+    /* Published last: ensure_init() keys off this pointer */
+    __atomic_store_n(&libc_ioctl, bind_symbol("ioctl"), __ATOMIC_RELEASE);
 }
 
-/**
- * TODO: Handle multi-threaded cases
- */
-static inline void ensure_init(void)
+__attribute__((constructor))
+static void shim_ctor(void)
 {
-    static volatile uint32_t init_cnt = 0;
-    static volatile uint8_t init_done = 0;
-
-    if (init_done == 0)
-    {
-
-        if (__sync_fetch_and_add(&init_cnt, 1) == 0)
-        {
-            init();
-            MEM_BARRIER();
-            init_done = 1;
-        }
-        else
-        {
-            while (init_done == 0)
-            {
-                pthread_yield();
-            }
-            MEM_BARRIER();
-        }
-    }
+    pthread_once(&init_once, init);
 }
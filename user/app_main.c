@@ -1,11 +1,14 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <getopt.h>
+#include <limits.h>
 
 #include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <unistd.h>
 
 #include "devcfg.h"
@@ -13,56 +16,277 @@
 #include "memzone.h"
 #include "driver.h"
 #include "ring_buffer.h"
+#include "datapath.h"
+#include "traffic_class.h"
+#include "pkt_handler.h"
+#include "latency.h"
+#include "stats_shm.h"
+#include "control.h"
+#include "warm_restart.h"
+#include "watchdog.h"
 #include "io.h"
 #include "nfp_cpp.h"
 #include "nfp_rtsym.h"
+#include "nfp_cpp_emu.h"
+#include "nic_emu.h"
 
-extern int nfp_cpp_dev_main(struct rte_pci_device* dev, struct nfp_cpp* cpp);
+extern int nfp_cpp_dev_main(struct rte_pci_device* dev, struct nfp_cpp* cpp,
+        int index);
 
-static const struct memzone  *buffer_rx, *buffer_tx;
-static struct ringbuffer_t ring_rx, ring_tx;
+/* The handler a NIC runs, published as one pointer for other threads */
+struct nic_handler
+{
+    const struct pkt_handler* handler;
+    void* ctx;
+    char spec[CONTROL_MAX_LINE];                /*> "name[:args]"; args point here */
+};
+
+/**
+ * A change the control thread hands to a NIC's poller, which makes it
+ * between two polls and clears nic_ctx.request when done.
+ */
+struct nic_request
+{
+    enum
+    {
+        NIC_REQ_HANDLER,                        /*> Swap in handler, get the old one back */
+        NIC_REQ_RESIZE,                         /*> datapath_restart() to capacity */
+        NIC_REQ_HANDOVER,                       /*> Save handler state, stay off the rings */
+    } op;
+    struct nic_handler* handler;
+    uint32_t capacity;
+    int result;
+};
+
+/**
+ * One independent datapath per NIC. Its threads are pinned to the CPUs
+ * local to the NIC and its memzones are reserved from there, so they
+ * are placed on the NIC's NUMA node.
+ */
+struct nic_ctx
+{
+    int index;                                  /*> NIC index, by PCI address */
+    struct rte_pci_device* dev;
+    struct nfp_cpp* cpp;
+    const struct memzone *buffer_rx, *buffer_tx;
+    const struct memzone *payload_rx, *payload_tx;  /*> NULL unless split */
+    const struct memzone* class_rx[RING_MAX_CLASSES - 1];   /*> Classes 1.. */
+    const struct memzone* class_tx[RING_MAX_CLASSES - 1];
+    struct datapath dp;
+    struct pkt_gen* gen;                        /*> NULL unless generating */
+    struct timespec start;                      /*> Process start */
+    pthread_t thread;
+    struct nic_handler* active;                 /*> What dp runs, for the stats thread */
+    struct nic_request* request;                /*> Pending, from the control thread */
+    uint64_t stats_rounds;                      /*> Stats intervals completed */
+    int running;                                /*> Polling; takes requests */
+    const struct warm_nic* warm;                /*> Taken over from, NULL if cold */
+    int parked;                                 /*> Handed over: not polling */
+    struct watchdog watchdog;                   /*> Checked by the stats thread */
+};
+
+static struct nic_ctx nics[PCI_MAX_NICS];
+static int nic_count;
+
+/* Selected with -H name[:args] */
+static const struct pkt_handler* handler;
+static const char* handler_args;
+
+/* Capture with -w FILE; NIC n > 0 writes FILE.n */
+static struct capture_config capture_cfg;
+
+/* Per-source policing with -P RATE[,BURST]; each NIC polices on its own */
+#define POLICE_SOURCES          (1u << 20)
+#define POLICE_DEFAULT_BURST    32
+
+static uint32_t police_rate;
+static uint32_t police_burst = POLICE_DEFAULT_BURST;
+
+/*
+ * Variable-length slots with -V SLOT: frames of any length up to
+ * SLOT - RING_SLOT_HDR_LEN. The rings keep their number of slots.
+ */
+static uint32_t slot_size = UDP_PACKET_SIZE;
+static int varlen;
+
+#define RING_SLOTS              (RING_BUFFER_SIZE / UDP_PACKET_SIZE)
+#define RING_BYTES              (RING_SLOTS * slot_size)
+
+/* Header/payload split with -X BYTES: payload slot size, 0 for off */
+static uint32_t split_payload;
+
+#define SPLIT_PAYLOAD_BYTES     (RING_SLOTS * split_payload)
+
+/*
+ * Overload with -B US (firmware: drop a frame held that long for a full
+ * RX ring) and -O tail|oldest:US (host: drop by queueing time)
+ */
+static uint32_t rx_full_budget_us;
+static enum datapath_overload overload = DATAPATH_OVERLOAD_WAIT;
+static uint32_t overload_age_us;
+
+/* Traffic classes with -Q SPEC (see traffic_class.h); classes 0 for one */
+static struct tc_config tc_cfg;
+
+/* Generator mode with -G SPEC: TX only, no handler (see pkt_gen.h) */
+static const char* gen_spec;
+
+/* Handler on -W N worker threads per NIC, 0 for the polling thread */
+static unsigned int workers;
+
+/* Control socket with -C PATH (see control_cmds) */
+static const char* control_path;
+
+/*
+ * Warm restart with -R PATH: a manifest there (warm_restart.h) is taken
+ * over at startup, and "handover" writes one. The handler state of NIC
+ * n goes in PATH.n, the emulated NIC's in PATH.emu.
+ */
+static const char* warm_path;
+static struct warm_nic warm_nics[PCI_MAX_NICS];
+static const struct memzone* warm_zones[PCI_MAX_NICS][WARM_MAX_ZONES];
+static int warm_count;
+
+/*
+ * Watchdog with -T MS[,N]: sample every MS, rounded up to whole stats
+ * intervals, report after N samples; 0 off
+ */
+static uint32_t watchdog_ms = WATCHDOG_DEFAULT_PERIOD_MS;
+static uint32_t watchdog_periods = WATCHDOG_DEFAULT_PERIODS;
+
+/* 0 quiet, 1 the per-second counters of PKT_STATS builds; set by "log" */
+static int log_level = 1;
 
 #define SYMBOL_DEVICE_META  "i32._cfg"
 #define SYMBOL_RX_STATS     "_rx_counters"
 #define SYMBOL_TX_STATS     "_tx_counters"
+#define SYMBOL_RX_DROPS     "_rx_drops"
+
+/* Published for viewers such as nfp-top.out; NULL if unavailable */
+static struct stats_shm* stats_shm;
 
-void* log_main(void* _ptr)
+static uint32_t ring_used(const struct ringbuffer_t* rb)
 {
-    (void) _ptr;
-    int fd;
+    if (rb->entry_size == 0)
+        return 0;
+    return ((rb->tail + rb->capacity - rb->head) % rb->capacity) / rb->entry_size;
+}
+
+/**
+ * Copy one interval's worth of counters into the shared segment. Only
+ * reads what the worker already keeps; never waits for it.
+ */
+static void stats_publish(struct nic_ctx* nic, struct stats_nic* slot,
+        const uint64_t* fw_rx, const uint64_t* fw_tx, const uint64_t* fw_drops,
+        const struct lat_hist* latency, const struct lat_hist* class_lat,
+        double tsc_per_ns)
+{
+    const struct datapath* dp = &nic->dp;
+    struct timespec now;
+    unsigned int c;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    if ((fd = open("buffer_log_rx", O_CREAT | O_RDWR, 0666)) < 0)
+    stats_shm_write_begin(slot);
+
+    snprintf(slot->name, sizeof(slot->name), "%s", nic->dev->name);
+    slot->timestamp_ns = now.tv_sec * 1000000000ull + now.tv_nsec;
+    memcpy(slot->fw_rx, fw_rx, sizeof(slot->fw_rx));
+    memcpy(slot->fw_tx, fw_tx, sizeof(slot->fw_tx));
+    memcpy(slot->fw_drops, fw_drops, sizeof(slot->fw_drops));
+
+    slot->rx_packets = dp->stats.rx_packets;
+    slot->tx_packets = dp->stats.tx_packets;
+    slot->dropped = dp->stats.dropped;
+    slot->policed = dp->stats.policed;
+    slot->overload = dp->stats.overload;
+    slot->batches = dp->stats.batches;
+    slot->mmio_reads = dp->stats.mmio_reads;
+    slot->mmio_writes = dp->stats.mmio_writes;
+    slot->rx_ring_used = ring_used(&dp->cls[0].rx);
+    slot->tx_ring_used = ring_used(&dp->cls[0].tx);
+    slot->ring_slots = dp->cls[0].rx.entry_size ?
+        dp->cls[0].rx.capacity / dp->cls[0].rx.entry_size : 0;
+
+    if (dp->capture != NULL)
     {
-        perror("open failed");
-        return NULL;
+        struct capture_stats cs;
+
+        capture_get_stats(dp->capture, &cs);
+        slot->cap_written = cs.written;
+        slot->cap_dropped = cs.dropped;
     }
 
-    if ((ftruncate(fd, RING_BUFFER_SIZE)) < 0)
+    if (nic->gen != NULL)
     {
-        perror("trunate failed");
-        return NULL;
+        slot->gen_packets = nic->gen->stats.packets;
+        slot->gen_full_ns = nic->gen->stats.full_tsc / tsc_per_ns;
     }
 
-    while (1)
+    if (latency != NULL)
     {
-        if (pwrite(fd, (void*) buffer_rx->addr, RING_BUFFER_SIZE, 0) < 0)
-        {
-            perror("write failed");
-            return NULL;
-        }
+        slot->lat_count = latency->count;
+        slot->lat_p50 = lat_hist_percentile(latency, 50) / tsc_per_ns;
+        slot->lat_p99 = lat_hist_percentile(latency, 99) / tsc_per_ns;
+        slot->lat_p999 = lat_hist_percentile(latency, 99.9) / tsc_per_ns;
+        slot->lat_max = latency->max / tsc_per_ns;
+    }
 
-        sleep(1);
+    slot->classes = dp->num_classes;
+    for (c = 0; c < dp->num_classes && c < STATS_MAX_CLASSES; c++)
+    {
+        slot->class_rx[c] = dp->cls[c].rx_packets;
+        if (latency == NULL)
+            continue;
+        slot->class_lat_count[c] = class_lat[c].count;
+        slot->class_lat_p50[c] = lat_hist_percentile(&class_lat[c], 50) / tsc_per_ns;
+        slot->class_lat_p99[c] = lat_hist_percentile(&class_lat[c], 99) / tsc_per_ns;
     }
 
-    return NULL;
+    stats_shm_write_end(slot);
+}
+
+/**
+ * Watchdog of one NIC (watchdog.h), on the stats thread's read of the
+ * device: sample has meta and the firmware counters of this interval,
+ * the rest are counters the poller and workers keep anyway. Stalls go
+ * to stderr with a snapshot.
+ */
+static void stats_watchdog(struct nic_ctx* nic, struct watchdog_sample* sample,
+        struct debug_ring* trace)
+{
+    struct watchdog_event events[WATCHDOG_MAX_EVENTS];
+    const struct dispatch* d;
+    char prefix[32];
+    unsigned int n, w;
+
+    /* Every poll reads a doorbell, even with nothing to do */
+    sample->polling = !__atomic_load_n(&nic->parked, __ATOMIC_ACQUIRE);
+    sample->polls = __atomic_load_n(&nic->dp.stats.mmio_reads, __ATOMIC_RELAXED);
+
+    d = nic->dp.dispatch;
+    sample->workers = d != NULL ? d->workers : 0;
+    for (w = 0; w < sample->workers; w++)
+    {
+        sample->worker_queued[w] = __atomic_load_n(&d->worker[w].head, __ATOMIC_ACQUIRE);
+        sample->worker_done[w] = __atomic_load_n(&d->worker[w].tail, __ATOMIC_ACQUIRE);
+    }
+
+    n = watchdog_check(&nic->watchdog, sample, events, WATCHDOG_MAX_EVENTS);
+    if (n > 0)
+    {
+        snprintf(prefix, sizeof(prefix), "[%d WATCHDOG]", nic->index);
+        watchdog_report(stderr, prefix, events, n, sample, trace);
+    }
 }
 
 void* stats_main(void* arg)
 {
-    struct nfp_cpp* cpp = (struct nfp_cpp*) arg;
-    struct nfp_rtsym_table* symbol_table = nfp_rtsym_table_read(cpp);
+    struct nic_ctx* nic = (struct nic_ctx*) arg;
+    struct nfp_rtsym_table* symbol_table = nfp_rtsym_table_read(nic->cpp);
     struct nfp_cpp_area* rx_counters_area = (struct nfp_cpp_area*) malloc(sizeof(struct nfp_cpp_area));
     struct nfp_cpp_area* tx_counters_area = (struct nfp_cpp_area*) malloc(sizeof(struct nfp_cpp_area));
+    struct nfp_cpp_area* rx_drops_area = (struct nfp_cpp_area*) malloc(sizeof(struct nfp_cpp_area));
 
     uint64_t* rx_counters = (uint64_t*) nfp_rtsym_map(
                                             symbol_table,
@@ -74,54 +298,308 @@ void* stats_main(void* arg)
                                             SYMBOL_TX_STATS,
                                             8 * sizeof(uint64_t),
                                             &tx_counters_area);
+    uint64_t* rx_drops = (uint64_t*) nfp_rtsym_map(
+                                            symbol_table,
+                                            SYMBOL_RX_DROPS,
+                                            RX_DROP_REASONS * sizeof(uint64_t),
+                                            &rx_drops_area);
+    struct lat_hist* latency = (struct lat_hist*) calloc(1, sizeof(struct lat_hist));
+    struct lat_hist* class_lat = (struct lat_hist*) calloc(RING_MAX_CLASSES, sizeof(struct lat_hist));
+    double tsc_per_ns = lat_tsc_per_ns();
+    uint64_t fw_rx[STATS_FW_CONTEXTS] = { 0 }, fw_tx[STATS_FW_CONTEXTS] = { 0 };
+    uint64_t fw_drops[RX_DROP_REASONS] = { 0 };
+    const struct device_meta_t* meta = NULL;
+    struct nfp_cpp_area* meta_area;
+    struct watchdog_sample* sample = NULL;
+    struct debug_ring ring, *trace = NULL;
+    uint32_t watchdog_every = (watchdog_ms + 999) / 1000, watchdog_rounds = 0;
+    unsigned int c;
+    int have_latency, watchdog_due, running;
+#ifdef PKT_STATS
+    uint64_t gen_packets = 0, gen_full = 0, gen_tsc = lat_tsc();
+#endif
+
+    /* The watchdog samples on this thread's read of the device */
+    if (watchdog_ms != 0)
+    {
+        meta = (const struct device_meta_t*) nfp_rtsym_map(
+                                            symbol_table,
+                                            SYMBOL_DEVICE_META,
+                                            sizeof(struct device_meta_t),
+                                            &meta_area);
+        sample = (struct watchdog_sample*) calloc(1, sizeof(struct watchdog_sample));
+        watchdog_init(&nic->watchdog, watchdog_periods);
+
+        /* Only firmware that logs with debug.h has a trace ring */
+        if (nfp_rtsym_lookup(symbol_table, DEBUG_RING_SYMBOL) != NULL &&
+            debug_ring_open(&ring, symbol_table, NULL, NULL) == 0)
+            trace = &ring;
+    }
 
     while (1)
     {
         sleep(1);
 
-        fprintf(stderr, "[RX] %lu %lu %lu %lu %lu %lu %lu %lu\n",
-                    rx_counters[0],
-                    rx_counters[1],
-                    rx_counters[2],
-                    rx_counters[3],
-                    rx_counters[4],
-                    rx_counters[5],
-                    rx_counters[6],
-                    rx_counters[7]);
-
-        fprintf(stderr, "[TX] %lu %lu %lu %lu %lu %lu %lu %lu\n",
-            tx_counters[0],
-            tx_counters[1],
-            tx_counters[2],
-            tx_counters[3],
-            tx_counters[4],
-            tx_counters[5],
-            tx_counters[6],
-            tx_counters[7]);
+        /* The datapath is only set up once the NIC is running */
+        running = __atomic_load_n(&nic->running, __ATOMIC_ACQUIRE);
+
+        watchdog_due = meta != NULL && sample != NULL && running &&
+            ++watchdog_rounds >= watchdog_every;
+
+        /*
+         * The only bus access per interval, shared with the watchdog;
+         * counters exist with PKT_STATS firmware
+         */
+        if (watchdog_due)
+            memcpy(&sample->meta, (const void*) meta, sizeof(sample->meta));
+        if (rx_counters != NULL)
+            memcpy(fw_rx, rx_counters, sizeof(fw_rx));
+        if (tx_counters != NULL)
+            memcpy(fw_tx, tx_counters, sizeof(fw_tx));
+        if (rx_drops != NULL)
+            memcpy(fw_drops, rx_drops, sizeof(fw_drops));
+
+        if (watchdog_due)
+        {
+            watchdog_rounds = 0;
+            sample->have_counters = rx_counters != NULL && tx_counters != NULL;
+            memcpy(sample->fw_rx, fw_rx, sizeof(sample->fw_rx));
+            memcpy(sample->fw_tx, fw_tx, sizeof(sample->fw_tx));
+            stats_watchdog(nic, sample, trace);
+        }
+
+        /* Host latency over the last interval, RX visible to TX published */
+        have_latency = 0;
+        for (c = 0; running && c < nic->dp.num_classes; c++)
+        {
+            if (nic->dp.cls[c].latency != NULL &&
+                lat_recorder_collect(nic->dp.cls[c].latency, &class_lat[c], 100) == 0)
+            {
+                lat_hist_merge(latency, &class_lat[c]);
+                have_latency = 1;
+            }
+        }
+
+        if (stats_shm != NULL && running)
+            stats_publish(nic, &stats_shm->nics[nic->index], fw_rx, fw_tx, fw_drops,
+                have_latency ? latency : NULL, class_lat, tsc_per_ns);
+
+#ifdef PKT_STATS
+        if (__atomic_load_n(&log_level, __ATOMIC_RELAXED) > 0)
+        {
+            struct nic_handler* active;
+
+            fprintf(stderr, "[%d RX] %lu %lu %lu %lu %lu %lu %lu %lu\n",
+                        nic->index,
+                        fw_rx[0],
+                        fw_rx[1],
+                        fw_rx[2],
+                        fw_rx[3],
+                        fw_rx[4],
+                        fw_rx[5],
+                        fw_rx[6],
+                        fw_rx[7]);
+
+            fprintf(stderr, "[%d TX] %lu %lu %lu %lu %lu %lu %lu %lu\n",
+                nic->index,
+                fw_tx[0],
+                fw_tx[1],
+                fw_tx[2],
+                fw_tx[3],
+                fw_tx[4],
+                fw_tx[5],
+                fw_tx[6],
+                fw_tx[7]);
+
+            fprintf(stderr, "[%d HOST] rx %lu tx %lu drop %lu policed %lu batches %lu\n",
+                nic->index,
+                nic->dp.stats.rx_packets,
+                nic->dp.stats.tx_packets,
+                nic->dp.stats.dropped,
+                nic->dp.stats.policed,
+                nic->dp.stats.batches);
+
+            fprintf(stderr, "[%d DROP] nic filter %lu ring_full %lu paused %lu "
+                            "host overload %lu policed %lu handler %lu\n",
+                nic->index,
+                fw_drops[RX_DROP_FILTER],
+                fw_drops[RX_DROP_RING_FULL],
+                fw_drops[RX_DROP_PAUSED],
+                nic->dp.stats.overload,
+                nic->dp.stats.policed,
+                nic->dp.stats.dropped);
+
+            if (nic->dp.policer != NULL)
+            {
+                const struct policer_stats* ps = policer_stats(nic->dp.policer);
+                uint32_t rate, burst;
+
+                policer_get_limit(nic->dp.policer, &rate, &burst);
+                fprintf(stderr, "[%d POLICE] rate %u burst %u passed %lu dropped %lu evictions %lu\n",
+                    nic->index, rate, burst, ps->passed, ps->dropped, ps->evictions);
+            }
+
+            if (nic->gen != NULL)
+            {
+                const struct pkt_gen_stats* gs = &nic->gen->stats;
+                uint64_t now = lat_tsc();
+                double secs = (now - gen_tsc) / tsc_per_ns / 1e9;
+
+                fprintf(stderr, "[%d GEN] size %u flows %u target %lu pps achieved %.0f pps "
+                                "ring full %.1f ms behind %lu\n",
+                    nic->index, nic->gen->size, nic->gen->flows, nic->gen->rate,
+                    (gs->packets - gen_packets) / secs,
+                    (gs->full_tsc - gen_full) / tsc_per_ns / 1e6, gs->behind);
+
+                gen_packets = gs->packets;
+                gen_full = gs->full_tsc;
+                gen_tsc = now;
+            }
+
+            if (have_latency)
+                fprintf(stderr, "[%d LAT] n %lu p50 %.2f p99 %.2f p99.9 %.2f max %.2f us\n",
+                    nic->index,
+                    latency->count,
+                    lat_hist_percentile(latency, 50) / tsc_per_ns / 1e3,
+                    lat_hist_percentile(latency, 99) / tsc_per_ns / 1e3,
+                    lat_hist_percentile(latency, 99.9) / tsc_per_ns / 1e3,
+                    latency->max / tsc_per_ns / 1e3);
+
+            for (c = 0; have_latency && nic->dp.num_classes > 1 && c < nic->dp.num_classes; c++)
+                fprintf(stderr, "[%d LAT] class %u rx %lu n %lu p50 %.2f p99 %.2f max %.2f us\n",
+                    nic->index, c,
+                    nic->dp.cls[c].rx_packets,
+                    class_lat[c].count,
+                    lat_hist_percentile(&class_lat[c], 50) / tsc_per_ns / 1e3,
+                    lat_hist_percentile(&class_lat[c], 99) / tsc_per_ns / 1e3,
+                    class_lat[c].max / tsc_per_ns / 1e3);
+
+            /* Once, as the control thread may swap it (see ctl_handler()) */
+            active = __atomic_load_n(&nic->active, __ATOMIC_ACQUIRE);
+            if (active != NULL && active->handler->report != NULL)
+                active->handler->report(active->ctx, stderr);
+        }
+#endif
+
+        if (have_latency)
+        {
+            lat_hist_reset(latency);
+            for (c = 0; c < nic->dp.num_classes; c++)
+                lat_hist_reset(&class_lat[c]);
+        }
+
+        /* Past the handler: a grace period for ctl_handler() */
+        __atomic_add_fetch(&nic->stats_rounds, 1, __ATOMIC_RELEASE);
     }
 
     return NULL;
 }
 
-void configure_device(struct device_meta_t* meta)
+/* PATH.n, or PATH.emu for index -1 */
+static void warm_file(char* buf, size_t size, int index)
+{
+    if (index < 0)
+        snprintf(buf, size, "%s.emu", warm_path);
+    else
+        snprintf(buf, size, "%s.%d", warm_path, index);
+}
+
+/**
+ * Save the handler's state for the next process; poller only.
+ *
+ * @return
+ *   1 if saved, 0 if there is nothing to save, -1 on failure.
+ */
+static int nic_save_handler(struct nic_ctx* nic)
+{
+    const struct pkt_handler* h = nic->dp.handler;
+    char path[PATH_MAX];
+    FILE* f;
+    int ret;
+
+    /* With workers, the state is spread over their contexts */
+    if (h->save == NULL || workers > 0)
+        return 0;
+
+    warm_file(path, sizeof(path), nic->index);
+    f = fopen(path, "w");
+    if (f == NULL)
+        return -1;
+    ret = h->save(nic->dp.handler_ctx, f);
+    ret |= fclose(f);
+
+    return ret ? -1 : 1;
+}
+
+/* Load what nic_save_handler() left for the handler now set up */
+static void nic_restore_handler(struct nic_ctx* nic)
 {
-    meta->packet_size = UDP_PACKET_SIZE;
-    meta->buffer_size = RING_BUFFER_SIZE;
-    meta->rx_buffer_iova = buffer_rx->iova;
-    meta->tx_buffer_iova = buffer_tx->iova;
-    meta->rx_head = meta->rx_tail = 0;
-    meta->tx_head = meta->tx_tail = 0;
+    const struct pkt_handler* h = nic->dp.handler;
+    char path[PATH_MAX];
+    FILE* f;
+
+    if (nic->warm->handler[0] == '\0')
+        return;
+
+    warm_file(path, sizeof(path), nic->index);
+    if (strcmp(nic->warm->handler, nic->active->spec) != 0 || h->restore == NULL ||
+        workers > 0)
+    {
+        fprintf(stderr, "NIC %d: State of %s left out\n", nic->index, nic->warm->handler);
+    }
+    else if ((f = fopen(path, "r")) == NULL || h->restore(nic->dp.handler_ctx, f))
+    {
+        fprintf(stderr, "NIC %d: Cannot restore %s state from %s\n",
+            nic->index, h->name, path);
+        if (f != NULL)
+            fclose(f);
+    }
+    else
+    {
+        fclose(f);
+    }
+
+    remove(path);
+}
+
+/* Make the change the control thread asked for; poller only */
+static void nic_serve(struct nic_ctx* nic)
+{
+    struct nic_request* req = nic->request;
+    struct nic_handler* old;
+
+    switch (req->op)
+    {
+        case NIC_REQ_HANDLER:
+            old = nic->active;
+            nic->dp.handler = req->handler->handler;
+            nic->dp.handler_ctx = req->handler->ctx;
+            __atomic_store_n(&nic->active, req->handler, __ATOMIC_RELEASE);
+            req->handler = old;
+            req->result = 0;
+            break;
+        case NIC_REQ_RESIZE:
+            req->result = datapath_restart(&nic->dp, req->capacity);
+            break;
+        case NIC_REQ_HANDOVER:
+            req->result = nic_save_handler(nic);
+            break;
+    }
 
-    rte_io_wmb();   /* Flush preceding writes! */
+    /* From here on the poller holds nothing the request replaced */
+    __atomic_store_n(&nic->request, NULL, __ATOMIC_RELEASE);
 
-    nn_writeq(1, &meta->start_signal);
+    /* Handed over: off the rings until the process exits or it is called off */
+    while (__atomic_load_n(&nic->parked, __ATOMIC_ACQUIRE))
+        usleep(100);
 }
 
 void* udp_worker(void* arg)
 {
-    struct nfp_cpp* cpp = (struct nfp_cpp*) arg;
-    struct nfp_rtsym_table* symbol_table = nfp_rtsym_table_read(cpp);
+    struct nic_ctx* nic = (struct nic_ctx*) arg;
+    struct nfp_rtsym_table* symbol_table = nfp_rtsym_table_read(nic->cpp);
     struct nfp_cpp_area* device_meta_area = (struct nfp_cpp_area*) malloc(sizeof(struct nfp_cpp_area));
+    struct timespec now;
     struct device_meta_t* meta = (struct device_meta_t*)
                                         nfp_rtsym_map(
                                             symbol_table,
@@ -132,92 +610,1089 @@ void* udp_worker(void* arg)
     if (meta == NULL)
         return NULL;
 
-    ring_rx.base_addr = (void*) buffer_rx->addr;
-    ring_rx.capacity = RING_BUFFER_SIZE;
-    ring_rx.entry_size = UDP_PACKET_SIZE;
-    ring_tx.base_addr = (void*) buffer_tx->addr;
-    ring_tx.capacity = RING_BUFFER_SIZE;
-    ring_tx.entry_size = UDP_PACKET_SIZE;
+    /* Taken over, the rings keep the size they were resized to */
+    if (datapath_init(&nic->dp, meta,
+            (void*) nic->buffer_rx->addr, (void*) nic->buffer_tx->addr,
+            nic->warm != NULL ? nic->warm->capacity : RING_BYTES, slot_size,
+            handler, handler_args))
+        return NULL;
 
-    configure_device(meta);
+    nic->active = calloc(1, sizeof(*nic->active));
+    if (nic->active == NULL)
+        return NULL;
+    nic->active->handler = handler;
+    nic->active->ctx = nic->dp.handler_ctx;
+    snprintf(nic->active->spec, sizeof(nic->active->spec), "%s%s%s", handler->name,
+        handler_args != NULL ? ":" : "", handler_args != NULL ? handler_args : "");
 
-    while (1)
+    if (varlen && datapath_set_varlen(&nic->dp))
+        return NULL;
+
+    if (tc_cfg.classes > 1)
+    {
+        void* rx_bases[RING_MAX_CLASSES - 1];
+        void* tx_bases[RING_MAX_CLASSES - 1];
+        uint64_t rx_iovas[RING_MAX_CLASSES - 1], tx_iovas[RING_MAX_CLASSES - 1];
+        unsigned int c;
+
+        for (c = 0; c + 1 < tc_cfg.classes; c++)
+        {
+            rx_bases[c] = (void*) nic->class_rx[c]->addr;
+            tx_bases[c] = (void*) nic->class_tx[c]->addr;
+            rx_iovas[c] = nic->class_rx[c]->iova;
+            tx_iovas[c] = nic->class_tx[c]->iova;
+        }
+
+        if (datapath_set_classes(&nic->dp, &tc_cfg, rx_bases, tx_bases,
+                rx_iovas, tx_iovas))
+            return NULL;
+    }
+
+    if (workers > 0 && datapath_set_workers(&nic->dp, workers, handler_args))
+        return NULL;
+
+    if (nic->payload_rx != NULL)
+        datapath_set_split(&nic->dp,
+            (void*) nic->payload_rx->addr, (void*) nic->payload_tx->addr,
+            nic->payload_rx->iova, nic->payload_tx->iova, split_payload);
+
+    if (datapath_set_overload(&nic->dp, rx_full_budget_us, overload,
+            overload_age_us * lat_tsc_per_ns() * 1000))
+        return NULL;
+
+#ifdef PKT_STATS
+    if (datapath_enable_latency(&nic->dp))
+        fprintf(stderr, "NIC %d: Latency recording disabled\n", nic->index);
+#endif
+
+    if (capture_cfg.path != NULL)
     {
-        ring_rx.tail = nn_readl(&meta->rx_tail);
-        ring_tx.head = nn_readl(&meta->tx_head);
+        struct capture_config cfg = capture_cfg;
+        char path[256];
+
+        if (nic->index > 0)
+        {
+            snprintf(path, sizeof(path), "%s.%d", capture_cfg.path, nic->index);
+            cfg.path = path;
+        }
+
+        nic->dp.capture = capture_open(&cfg);
+        if (nic->dp.capture == NULL)
+            return NULL;
+    }
+
+    if (police_rate != 0)
+    {
+        nic->dp.policer = policer_create(POLICE_SOURCES, police_rate, police_burst);
+        if (nic->dp.policer == NULL)
+            return NULL;
+    }
 
-        fprintf(stderr, "RING RX [%u ~ %u]\n", ring_rx.head, ring_rx.tail);
-        fprintf(stderr, "RING TX [%u ~ %u]\n", ring_tx.head, ring_tx.tail);
+    if (gen_spec != NULL)
+    {
+        nic->gen = pkt_gen_create(gen_spec, slot_size - nic->dp.cls[0].tx.hdr_size,
+                        &nic->dp.copy);
+        if (nic->gen == NULL)
+            return NULL;
+    }
 
-        if (!ringbuffer_empty(&ring_rx) && !ringbuffer_full(&ring_tx))
+    if (nic->warm != NULL)
+    {
+        nic_restore_handler(nic);
+        if (datapath_attach(&nic->dp, nic->buffer_rx->iova, nic->buffer_tx->iova,
+                nic->warm->rx_head, nic->warm->tx_tail))
         {
-            void* readptr = ringbuffer_front(&ring_rx);
-            void* writeptr = ringbuffer_back(&ring_tx);
+            fprintf(stderr, "NIC %d: Cannot take over the rings, starting them over\n",
+                nic->index);
+            nic->warm = NULL;
+        }
+    }
+    if (nic->warm == NULL)
+        datapath_start(&nic->dp, nic->buffer_rx->iova, nic->buffer_tx->iova);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(stderr, "NIC %d (%s): %s datapath %s after %.1f ms\n",
+            nic->index, nic->dev->name,
+            nic->gen != NULL ? "generator" : handler->name,
+            nic->warm != NULL ? "taken over" : "up",
+            (now.tv_sec - nic->start.tv_sec) * 1e3 +
+            (now.tv_nsec - nic->start.tv_nsec) / 1e6);
+
+    __atomic_store_n(&nic->running, 1, __ATOMIC_RELEASE);
+
+    if (nic->gen != NULL)
+    {
+        while (1)
+            datapath_generate(&nic->dp, nic->gen);
+    }
+
+    while (1)
+    {
+        datapath_poll(&nic->dp);
+        if (__atomic_load_n(&nic->request, __ATOMIC_ACQUIRE) != NULL)
+            nic_serve(nic);
+    }
+
+    if (nic->dp.capture != NULL)
+        capture_close(nic->dp.capture);
+    policer_destroy(nic->dp.policer);
+    pkt_gen_destroy(nic->gen);
+    datapath_fini(&nic->dp);
+    free(nic->active);
+
+    return NULL;
+}
+
+void* cpp_server_main(void* arg)
+{
+    struct nic_ctx* nic = (struct nic_ctx*) arg;
+
+    nfp_cpp_dev_main(nic->dev, nic->cpp, nic->index);
+
+    return NULL;
+}
+
+/**
+ * Bring up the datapath of one NIC. Runs pinned to the NIC's local
+ * CPUs; threads created here inherit the affinity.
+ */
+void* nic_main(void* arg)
+{
+    struct nic_ctx* nic = (struct nic_ctx*) arg;
+    pthread_t stats_thread, cpp_thread;
+    unsigned int c;
+
+    /* Taken over: the memzones are mapped already, and hold the rings */
+    if (nic->warm != NULL)
+        goto reserved;
+
+    nic->buffer_rx = memzone_reserve(RING_BYTES);
+    nic->buffer_tx = memzone_reserve(RING_BYTES);
+    if (nic->buffer_rx == NULL || nic->buffer_tx == NULL)
+    {
+        fprintf(stderr, "NIC %d: Cannot reserve ring buffers\n", nic->index);
+        return NULL;
+    }
 
-            memcpy(writeptr, readptr, UDP_PACKET_SIZE);
+    memset((void*) nic->buffer_rx->addr, 0, RING_BYTES);
+    memset((void*) nic->buffer_tx->addr, 0, RING_BYTES);
 
-            ringbuffer_pop(&ring_rx);
-            ringbuffer_push(&ring_tx);
+    if (split_payload != 0)
+    {
+        nic->payload_rx = memzone_reserve(SPLIT_PAYLOAD_BYTES);
+        nic->payload_tx = memzone_reserve(SPLIT_PAYLOAD_BYTES);
+        if (nic->payload_rx == NULL || nic->payload_tx == NULL)
+        {
+            fprintf(stderr, "NIC %d: Cannot reserve payload rings\n", nic->index);
+            return NULL;
+        }
 
-            rte_io_wmb();
+        memset((void*) nic->payload_rx->addr, 0, SPLIT_PAYLOAD_BYTES);
+        memset((void*) nic->payload_tx->addr, 0, SPLIT_PAYLOAD_BYTES);
+    }
 
-            nn_writel(ring_tx.tail, &meta->tx_tail);
-            nn_writel(ring_rx.head, &meta->rx_head);
+    for (c = 0; c + 1 < tc_cfg.classes; c++)
+    {
+        nic->class_rx[c] = memzone_reserve(RING_BYTES);
+        nic->class_tx[c] = memzone_reserve(RING_BYTES);
+        if (nic->class_rx[c] == NULL || nic->class_tx[c] == NULL)
+        {
+            fprintf(stderr, "NIC %d: Cannot reserve class %u rings\n", nic->index, c + 1);
+            return NULL;
         }
+
+        memset((void*) nic->class_rx[c]->addr, 0, RING_BYTES);
+        memset((void*) nic->class_tx[c]->addr, 0, RING_BYTES);
     }
 
+reserved:
+    fprintf(stderr, "NIC %d BUFFER RX %u Physical: [0x%p ~ 0x%p]\n",
+            nic->index, RING_BYTES, (char*) nic->buffer_rx->iova,
+            (char*) nic->buffer_rx->iova + RING_BYTES);
+    fprintf(stderr, "NIC %d BUFFER TX %u Physical: [0x%p ~ 0x%p]\n",
+            nic->index, RING_BYTES, (char*) nic->buffer_tx->iova,
+            (char*) nic->buffer_tx->iova + RING_BYTES);
+
+    pthread_create(&stats_thread, NULL, stats_main, (void*) nic);
+
+    /* The CPP device server needs the PCIe BARs */
+    if (!nfp_cpp_emu_enabled())
+        pthread_create(&cpp_thread, NULL, cpp_server_main, (void*) nic);
+
+    udp_worker(nic);
+
+    if (!nfp_cpp_emu_enabled())
+        pthread_join(cpp_thread, NULL);
+    pthread_join(stats_thread, NULL);
+
     return NULL;
 }
 
+static void nic_start(struct nic_ctx* nic)
+{
+    int cpus[CPU_SETSIZE];
+    pthread_attr_t attr;
+    cpu_set_t set;
+    int count, i;
+
+    pthread_attr_init(&attr);
+
+    count = pci_device_cpus(nic->dev, cpus, CPU_SETSIZE);
+    if (count > 0)
+    {
+        CPU_ZERO(&set);
+        for (i = 0; i < count; i++)
+            CPU_SET(cpus[i], &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+
+    if (pthread_create(&nic->thread, &attr, nic_main, (void*) nic))
+    {
+        /* Affinity may be refused (e.g. cpuset); run unpinned */
+        pthread_attr_destroy(&attr);
+        pthread_create(&nic->thread, NULL, nic_main, (void*) nic);
+        return;
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+/*
+ * Control socket commands (-C PATH). Each applies to every NIC whose
+ * datapath is up, in turn. Limits and sampling are single words the
+ * datapath reads once per burst, so they are written from here; handler
+ * swaps and ring resizes go to the NIC's poller (nic_request).
+ */
+
+/* Hand req to the NIC's poller and wait until it has been made */
+static int nic_post(struct nic_ctx* nic, struct nic_request* req)
+{
+    __atomic_store_n(&nic->request, req, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&nic->request, __ATOMIC_ACQUIRE) != NULL)
+        usleep(100);
+    return req->result;
+}
+
+static int nic_up(struct nic_ctx* nic)
+{
+    return __atomic_load_n(&nic->running, __ATOMIC_ACQUIRE);
+}
+
+static int ctl_status(void* ctx, int argc, char** argv, FILE* out)
+{
+    struct capture_stats cs;
+    uint32_t rate, burst;
+    struct nic_ctx* nic;
+    int i;
+
+    for (i = 0; i < nic_count; i++)
+    {
+        nic = &nics[i];
+        if (!nic_up(nic))
+        {
+            fprintf(out, "NIC %d: down\n", i);
+            continue;
+        }
+
+        fprintf(out, "NIC %d (%s): %s, %u workers, rings of %u %u byte slots, "
+                     "generation %lu\n",
+            i, nic->dev->name,
+            nic->gen != NULL ? "generator" : __atomic_load_n(&nic->active, __ATOMIC_ACQUIRE)->spec,
+            workers, nic->dp.cls[0].rx.capacity / nic->dp.cls[0].rx.entry_size,
+            nic->dp.cls[0].rx.entry_size, nic->dp.generation);
+
+        if (nic->dp.policer != NULL)
+        {
+            policer_get_limit(nic->dp.policer, &rate, &burst);
+            fprintf(out, "  police rate %u burst %u\n", rate, burst);
+        }
+        if (nic->dp.capture != NULL)
+        {
+            capture_get_stats(nic->dp.capture, &cs);
+            fprintf(out, "  capture sample %u written %lu dropped %lu\n",
+                __atomic_load_n(&nic->dp.capture->sample, __ATOMIC_RELAXED),
+                cs.written, cs.dropped);
+        }
+        if (watchdog_ms != 0)
+            fprintf(out, "  watchdog every %u s, events %lu, stalled now %u\n",
+                (watchdog_ms + 999) / 1000, __atomic_load_n(&nic->watchdog.raised, __ATOMIC_RELAXED),
+                __atomic_load_n(&nic->watchdog.active, __ATOMIC_RELAXED));
+    }
+
+    fprintf(out, "log %d\n", __atomic_load_n(&log_level, __ATOMIC_RELAXED));
+    return 0;
+}
+
+static int ctl_handler(void* ctx, int argc, char** argv, FILE* out)
+{
+    struct nic_handler* nh[PCI_MAX_NICS] = { NULL };
+    struct nic_request req[PCI_MAX_NICS];
+    uint64_t rounds[PCI_MAX_NICS];
+    const struct pkt_handler* h;
+    int i, ret = 0;
+
+    if (argc != 2)
+    {
+        fprintf(out, "Usage: handler NAME[:ARGS]\n");
+        return -1;
+    }
+
+    h = pkt_handler_find(argv[1]);
+    if (h == NULL)
+    {
+        fprintf(out, "Unknown handler: %s\n", argv[1]);
+        return -1;
+    }
+
+    if (workers > 0 || gen_spec != NULL)
+    {
+        fprintf(out, "Handlers cannot be swapped with -W or -G\n");
+        return -1;
+    }
+
+    if (split_payload != 0 && h->whole_frame)
+    {
+        fprintf(out, "Handler %s needs whole frames, not -X\n", h->name);
+        return -1;
+    }
+
+    /* Set up off the datapath, for every NIC before any swaps */
+    for (i = 0; i < nic_count && ret == 0; i++)
+    {
+        if (!nic_up(&nics[i]))
+            continue;
+
+        nh[i] = calloc(1, sizeof(*nh[i]));
+        if (nh[i] == NULL)
+        {
+            ret = -1;
+            break;
+        }
+        nh[i]->handler = h;
+        snprintf(nh[i]->spec, sizeof(nh[i]->spec), "%s", argv[1]);
+        if (h->init != NULL && h->init(&nh[i]->ctx, pkt_handler_args(nh[i]->spec)))
+        {
+            fprintf(out, "NIC %d: %s failed to initialise\n", i, h->name);
+            free(nh[i]);
+            nh[i] = NULL;
+            ret = -1;
+        }
+    }
+
+    if (ret)
+    {
+        for (i = 0; i < nic_count; i++)
+        {
+            if (nh[i] != NULL && h->fini != NULL)
+                h->fini(nh[i]->ctx);
+            free(nh[i]);
+        }
+        return -1;
+    }
+
+    for (i = 0; i < nic_count; i++)
+    {
+        if (nh[i] == NULL)
+            continue;
+
+        req[i].op = NIC_REQ_HANDLER;
+        req[i].handler = nh[i];
+        nic_post(&nics[i], &req[i]);
+        rounds[i] = __atomic_load_n(&nics[i].stats_rounds, __ATOMIC_ACQUIRE);
+        fprintf(out, "NIC %d: %s\n", i, nh[i]->spec);
+    }
+
+    /*
+     * Grace period: the poller is done with the old handler once it has
+     * answered, the stats thread once it has started a new interval and
+     * finished it.
+     */
+    for (i = 0; i < nic_count; i++)
+    {
+        if (nh[i] == NULL)
+            continue;
+
+        while (__atomic_load_n(&nics[i].stats_rounds, __ATOMIC_ACQUIRE) < rounds[i] + 2)
+            usleep(10000);
+
+        if (req[i].handler->handler->fini != NULL)
+            req[i].handler->handler->fini(req[i].handler->ctx);
+        free(req[i].handler);
+    }
+
+    return 0;
+}
+
+static int ctl_police(void* ctx, int argc, char** argv, FILE* out)
+{
+    uint32_t rate, burst, cur_rate, cur_burst;
+    char* end;
+    int i, bad;
+
+    if (argc != 2)
+    {
+        fprintf(out, "Usage: police RATE[,BURST]\n");
+        return -1;
+    }
+
+    /* No BURST keeps the current one */
+    rate = strtoul(argv[1], &end, 0);
+    burst = 0;
+    bad = end == argv[1];
+    if (*end == ',')
+    {
+        burst = strtoul(end + 1, &end, 0);
+        bad |= burst == 0;
+    }
+    if (bad || *end != '\0')
+    {
+        fprintf(out, "Bad limit: %s\n", argv[1]);
+        return -1;
+    }
+
+    for (i = 0; i < nic_count; i++)
+    {
+        if (!nic_up(&nics[i]))
+            continue;
+        if (nics[i].dp.policer == NULL)
+        {
+            fprintf(out, "NIC %d: Not policing; start with -P\n", i);
+            return -1;
+        }
+
+        policer_get_limit(nics[i].dp.policer, &cur_rate, &cur_burst);
+        policer_set_limit(nics[i].dp.policer, rate, burst != 0 ? burst : cur_burst);
+        fprintf(out, "NIC %d: rate %u burst %u\n", i, rate, burst != 0 ? burst : cur_burst);
+    }
+
+    return 0;
+}
+
+static int ctl_sample(void* ctx, int argc, char** argv, FILE* out)
+{
+    uint32_t sample;
+    char* end;
+    int i;
+
+    if (argc != 2)
+    {
+        fprintf(out, "Usage: sample N\n");
+        return -1;
+    }
+
+    sample = strtoul(argv[1], &end, 0);
+    if (*end != '\0')
+    {
+        fprintf(out, "Bad sample: %s\n", argv[1]);
+        return -1;
+    }
+
+    for (i = 0; i < nic_count; i++)
+    {
+        if (!nic_up(&nics[i]))
+            continue;
+        if (nics[i].dp.capture == NULL)
+        {
+            fprintf(out, "NIC %d: Not capturing; start with -w\n", i);
+            return -1;
+        }
+
+        capture_set_sample(nics[i].dp.capture, sample);
+    }
+
+    return 0;
+}
+
+static int ctl_log(void* ctx, int argc, char** argv, FILE* out)
+{
+    if (argc != 2 || (strcmp(argv[1], "0") != 0 && strcmp(argv[1], "1") != 0))
+    {
+        fprintf(out, "Usage: log 0|1\n");
+        return -1;
+    }
+
+    __atomic_store_n(&log_level, atoi(argv[1]), __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Each ring of the NIC, and payload ring, has room for slots slots */
+static int nic_rings_fit(const struct nic_ctx* nic, uint32_t slots)
+{
+    size_t bytes = (size_t) slots * slot_size;
+    unsigned int c;
+
+    if (nic->buffer_rx->len < bytes || nic->buffer_tx->len < bytes)
+        return 0;
+    for (c = 0; c + 1 < tc_cfg.classes; c++)
+    {
+        if (nic->class_rx[c]->len < bytes || nic->class_tx[c]->len < bytes)
+            return 0;
+    }
+    if (nic->payload_rx != NULL &&
+        (nic->payload_rx->len < (size_t) slots * split_payload ||
+         nic->payload_tx->len < (size_t) slots * split_payload))
+        return 0;
+
+    return 1;
+}
+
+static int ctl_resize(void* ctx, int argc, char** argv, FILE* out)
+{
+    uint32_t capacity[PCI_MAX_NICS];
+    int resized[PCI_MAX_NICS];
+    struct nic_request req;
+    uint32_t slots;
+    char* end;
+    int i;
+
+    if (argc != 2)
+    {
+        fprintf(out, "Usage: resize SLOTS\n");
+        return -1;
+    }
+
+    slots = strtoul(argv[1], &end, 0);
+    if (*end != '\0' || slots < 2)
+    {
+        fprintf(out, "Bad number of slots: %s\n", argv[1]);
+        return -1;
+    }
+
+    if (gen_spec != NULL)
+    {
+        fprintf(out, "Rings cannot be resized with -G\n");
+        return -1;
+    }
+
+    /* Every NIC or none: check them all before resizing any */
+    for (i = 0; i < nic_count; i++)
+    {
+        if (nic_up(&nics[i]) && !nic_rings_fit(&nics[i], slots))
+        {
+            fprintf(out, "NIC %d: %u slots do not fit the ring buffers\n", i, slots);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < nic_count; i++)
+    {
+        resized[i] = 0;
+        if (!nic_up(&nics[i]))
+            continue;
+
+        capacity[i] = nics[i].dp.cls[0].rx.capacity;
+        req.op = NIC_REQ_RESIZE;
+        req.capacity = slots * slot_size;
+        if (nic_post(&nics[i], &req))
+        {
+            fprintf(out, "NIC %d: Restart failed\n", i);
+            break;
+        }
+        resized[i] = 1;
+    }
+
+    if (i == nic_count)
+    {
+        for (i = 0; i < nic_count; i++)
+        {
+            if (resized[i])
+                fprintf(out, "NIC %d: rings of %u slots, generation %lu\n",
+                    i, slots, nics[i].dp.generation);
+        }
+        return 0;
+    }
+
+    /* A failed restart leaves its rings as they were; put the others back */
+    while (i-- > 0)
+    {
+        if (!resized[i])
+            continue;
+
+        req.op = NIC_REQ_RESIZE;
+        req.capacity = capacity[i];
+        if (nic_post(&nics[i], &req))
+            fprintf(out, "NIC %d: Cannot go back to %u slots\n", i, capacity[i] / slot_size);
+        else
+            fprintf(out, "NIC %d: back to %u slots\n", i, capacity[i] / slot_size);
+    }
+
+    return -1;
+}
+
+/* Memzones of a warm restart entry, in warm_nic.zones order */
+static void warm_record_zone(struct warm_zone* z, const struct memzone* mz)
+{
+    if (mz == NULL)
+        return;
+    z->handle = mz->handle;
+    z->len = mz->len;
+    z->iova = mz->iova;
+}
+
+/* What the next process needs to take over the NIC's rings */
+static void nic_warm_record(const struct nic_ctx* nic, struct warm_nic* w, int saved)
+{
+    const struct datapath* dp = &nic->dp;
+    unsigned int c;
+
+    memset(w, 0, sizeof(*w));
+    snprintf(w->name, sizeof(w->name), "%s", nic->dev->name);
+    w->capacity = dp->cls[0].rx.capacity;
+    w->slot_size = dp->cls[0].rx.entry_size;
+    w->payload_size = dp->payload_size;
+    w->ring_flags = dp->cls[0].rx.hdr_size != 0 ? RING_F_VARLEN : 0;
+    w->classes = dp->num_classes;
+    w->generation = dp->generation;
+
+    warm_record_zone(&w->zones[WARM_ZONE_RX], nic->buffer_rx);
+    warm_record_zone(&w->zones[WARM_ZONE_TX], nic->buffer_tx);
+    warm_record_zone(&w->zones[WARM_ZONE_PAYLOAD_RX], nic->payload_rx);
+    warm_record_zone(&w->zones[WARM_ZONE_PAYLOAD_TX], nic->payload_tx);
+    for (c = 1; c < dp->num_classes; c++)
+    {
+        warm_record_zone(&w->zones[WARM_ZONE_CLASS_RX(c)], nic->class_rx[c - 1]);
+        warm_record_zone(&w->zones[WARM_ZONE_CLASS_TX(c)], nic->class_tx[c - 1]);
+    }
+
+    for (c = 0; c < dp->num_classes; c++)
+    {
+        w->rx_head[c] = dp->cls[c].rx.head;
+        w->tx_tail[c] = dp->cls[c].tx.tail;
+    }
+
+    if (saved > 0)
+        snprintf(w->handler, sizeof(w->handler), "%s", nic->active->spec);
+}
+
+/* Handover called off: the pollers carry on, and nothing is left for -R */
+static void warm_call_off(void)
+{
+    char path[PATH_MAX];
+    int i;
+
+    remove(warm_path);
+    for (i = 0; i < nic_count; i++)
+    {
+        warm_file(path, sizeof(path), i);
+        remove(path);
+        __atomic_store_n(&nics[i].parked, 0, __ATOMIC_RELEASE);
+    }
+}
+
+static int ctl_handover(void* ctx, int argc, char** argv, FILE* out)
+{
+    struct warm_nic state[PCI_MAX_NICS];
+    struct nic_request req;
+    char path[PATH_MAX];
+    struct capture* cap;
+    struct nic_ctx* nic;
+    uint64_t rounds;
+    int i, n = 0, saved;
+
+    if (warm_path == NULL || gen_spec != NULL)
+    {
+        fprintf(out, "Handing over needs -R, and not -G\n");
+        return -1;
+    }
+
+    /* Each poller stops between two polls, with its handler's state saved */
+    for (i = 0; i < nic_count; i++)
+    {
+        nic = &nics[i];
+        if (!nic_up(nic))
+            continue;
+
+        __atomic_store_n(&nic->parked, 1, __ATOMIC_RELEASE);
+        req.op = NIC_REQ_HANDOVER;
+        saved = nic_post(nic, &req);
+        if (saved < 0)
+            fprintf(out, "NIC %d: Handler state not saved\n", i);
+        nic_warm_record(nic, &state[n++], saved);
+    }
+
+    if (warm_save(warm_path, state, n))
+    {
+        warm_call_off();
+        fprintf(out, "Cannot write %s, carrying on\n", warm_path);
+        return -1;
+    }
+
+    /* The emulated firmware goes down with the process: take it along */
+    warm_file(path, sizeof(path), -1);
+    if (nfp_cpp_emu_enabled() && nic_emu_suspend(path))
+    {
+        warm_call_off();
+        fprintf(out, "Cannot save the emulated NIC, carrying on\n");
+        return -1;
+    }
+
+    /* Flush captures, once the stats thread is past them */
+    for (i = 0; i < nic_count; i++)
+    {
+        cap = nics[i].dp.capture;
+        if (!nic_up(&nics[i]) || cap == NULL)
+            continue;
+        __atomic_store_n(&nics[i].dp.capture, NULL, __ATOMIC_RELEASE);
+        rounds = __atomic_load_n(&nics[i].stats_rounds, __ATOMIC_ACQUIRE);
+        while (__atomic_load_n(&nics[i].stats_rounds, __ATOMIC_ACQUIRE) < rounds + 2)
+            usleep(10000);
+        capture_close(cap);
+    }
+
+    for (i = 0; i < n; i++)
+        fprintf(out, "NIC %s: generation %lu, handed over to %s\n",
+            state[i].name, state[i].generation, warm_path);
+
+    return CONTROL_EXIT;
+}
+
+static const struct control_cmd control_cmds[] = {
+    { "status", "Handler, rings, limits and sampling of each NIC", ctl_status },
+    { "handler", "NAME[:ARGS]  Swap the handler, without -W or -G", ctl_handler },
+    { "police", "RATE[,BURST]  Per-source limit, with -P", ctl_police },
+    { "sample", "N  Capture 1 in N frames, with -w", ctl_sample },
+    { "log", "0|1  Per-second counters off or on (PKT_STATS builds)", ctl_log },
+    { "resize", "SLOTS  Drain and restart the rings with SLOTS slots each", ctl_resize },
+    { "handover", "Save state for nfp-user.out -R and exit, rings left running", ctl_handover },
+    { NULL, NULL, NULL },
+};
+
+/* Manifest entry i describes rings laid out as the options ask */
+static int warm_usable(const struct warm_nic* w)
+{
+    uint32_t classes = tc_cfg.classes > 1 ? tc_cfg.classes : 1;
+
+    return w->slot_size == slot_size && w->payload_size == split_payload &&
+        w->ring_flags == (varlen ? RING_F_VARLEN : 0) && w->classes == classes &&
+        w->capacity % slot_size == 0 && w->capacity >= 2 * slot_size;
+}
+
+/**
+ * Map the memzones of manifest entry i, before anything else is
+ * reserved; on failure none stay mapped.
+ */
+static int warm_attach(int i)
+{
+    const struct warm_nic* w = &warm_nics[i];
+    const struct warm_zone* zone;
+    uint64_t bytes;
+    int z, used;
+
+    if (!warm_usable(w))
+    {
+        fprintf(stderr, "%s: Rings were laid out for other options\n", w->name);
+        return -1;
+    }
+
+    for (z = 0; z < WARM_MAX_ZONES; z++)
+    {
+        zone = &w->zones[z];
+        if (z == WARM_ZONE_PAYLOAD_RX || z == WARM_ZONE_PAYLOAD_TX)
+        {
+            used = w->payload_size != 0;
+            bytes = (uint64_t) w->capacity / w->slot_size * w->payload_size;
+        }
+        else
+        {
+            used = z <= WARM_ZONE_TX || (unsigned int) (z - WARM_ZONE_CLASS_RX(1)) / 2 + 1 < w->classes;
+            bytes = w->capacity;
+        }
+        if (!used)
+            continue;
+
+        if (zone->len < bytes ||
+            (warm_zones[i][z] = memzone_attach(zone->handle, zone->len, zone->iova)) == NULL)
+        {
+            fprintf(stderr, "%s: Cannot map the rings again\n", w->name);
+            while (--z >= 0)
+            {
+                memzone_free(warm_zones[i][z]);
+                warm_zones[i][z] = NULL;
+            }
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Take over the NIC's rings if the manifest has them mapped */
+static void nic_take_over(struct nic_ctx* nic)
+{
+    unsigned int c;
+    int i;
+
+    for (i = 0; i < warm_count; i++)
+    {
+        if (warm_zones[i][WARM_ZONE_RX] != NULL && strcmp(warm_nics[i].name, nic->dev->name) == 0)
+            break;
+    }
+    if (i == warm_count)
+        return;
+
+    nic->warm = &warm_nics[i];
+    nic->buffer_rx = warm_zones[i][WARM_ZONE_RX];
+    nic->buffer_tx = warm_zones[i][WARM_ZONE_TX];
+    nic->payload_rx = warm_zones[i][WARM_ZONE_PAYLOAD_RX];
+    nic->payload_tx = warm_zones[i][WARM_ZONE_PAYLOAD_TX];
+    for (c = 1; c < warm_nics[i].classes; c++)
+    {
+        nic->class_rx[c - 1] = warm_zones[i][WARM_ZONE_CLASS_RX(c)];
+        nic->class_tx[c - 1] = warm_zones[i][WARM_ZONE_CLASS_TX(c)];
+    }
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-H HANDLER[:ARGS]] [-w FILE [-s SNAPLEN] [-S N] [-f FILTER]]\n"
+                    "          [-P RATE[,BURST]] [-G SPEC] [-X BYTES | -V SLOT] [-Q SPEC]\n"
+                    "          [-B US] [-O tail|oldest:US] [-W N] [-C PATH] [-R PATH]\n"
+                    "          [-T MS[,N]]\n"
+                    "  -w FILE    Capture received frames to a pcap file\n"
+                    "  -s SNAPLEN Bytes kept per frame (default and max %d)\n"
+                    "  -S N       Capture 1 in N frames\n"
+                    "  -f FILTER  e.g. \"udp and dst port 53 and src host 10.0.0.1\"\n"
+                    "  -P RATE    Drop IPv4 packets over RATE pps per source address,\n"
+                    "             allowing bursts of BURST (default %d)\n"
+                    "  -G SPEC    Generate UDP packets instead of handling RX, e.g.\n"
+                    "             size=64,rate=1000000,flows=256,dst_step=1\n"
+                    "  -X BYTES   Split frames: the first %d bytes in the ring, the\n"
+                    "             next BYTES in a separate payload ring\n"
+                    "  -V SLOT    Variable-length frames in SLOT byte slots (a\n"
+                    "             multiple of %d), each with a %d byte length header\n"
+                    "  -Q SPEC    Traffic classes with their own rings, e.g.\n"
+                    "             classes=2,icmp=0,dscp=46:0,sched=strict,guard=64\n"
+                    "  -B US      NIC drops a frame after US for a full RX ring\n"
+                    "             (default: waits for space)\n"
+                    "  -O POLICY  Host drops packets queued over US: tail drops\n"
+                    "             arrivals, oldest the packets that waited\n"
+                    "  -W N       Run the handler on N worker threads (max %d);\n"
+                    "             not for handlers that keep state, e.g. kv, flow\n"
+                    "  -C PATH    Control socket for nfp-ctl.out, e.g. %s\n"
+                    "  -R PATH    Warm restart: take over the rings from the manifest at\n"
+                    "             PATH if there is one; \"handover\" writes it\n"
+                    "  -T MS[,N]  Watchdog: check the rings and threads every MS, in\n"
+                    "             whole seconds, and report what made no progress N\n"
+                    "             times running\n"
+                    "             (default %d,%d; 0 for off)\n"
+                    "Handlers (default %s):\n",
+                    prog, CAPTURE_MAX_SNAPLEN, POLICE_DEFAULT_BURST, UDP_PACKET_SIZE,
+                    CACHE_LINE_SIZE, RING_SLOT_HDR_LEN, DISPATCH_MAX_WORKERS,
+                    CONTROL_DEFAULT_PATH, WATCHDOG_DEFAULT_PERIOD_MS,
+                    WATCHDOG_DEFAULT_PERIODS, PKT_HANDLER_DEFAULT);
+    pkt_handler_list(stderr);
+}
+
 int main(int argc, char* argv[])
 {
-    struct rte_pci_device* dev;
-    int ret;
+    struct rte_pci_device* devs[PCI_MAX_NICS];
+    struct nfp_cpp* cpps[PCI_MAX_NICS];
+    struct timespec start;
+    const char* handler_spec = PKT_HANDLER_DEFAULT;
+    char emu_state[PATH_MAX];
+    char* end;
+    int count, i, opt, attached = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while ((opt = getopt(argc, argv, "H:w:s:S:f:P:G:X:V:Q:B:O:W:C:R:T:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'H':
+                handler_spec = optarg;
+                break;
+            case 'w':
+                capture_cfg.path = optarg;
+                break;
+            case 's':
+                capture_cfg.snaplen = strtoul(optarg, NULL, 0);
+                break;
+            case 'S':
+                capture_cfg.sample = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                capture_cfg.filter = optarg;
+                break;
+            case 'P':
+                police_rate = strtoul(optarg, &end, 0);
+                if (*end == ',')
+                    police_burst = strtoul(end + 1, NULL, 0);
+                break;
+            case 'G':
+                gen_spec = optarg;
+                break;
+            case 'X':
+                split_payload = strtoul(optarg, NULL, 0);
+                break;
+            case 'V':
+                slot_size = strtoul(optarg, NULL, 0);
+                varlen = 1;
+                break;
+            case 'B':
+                rx_full_budget_us = strtoul(optarg, NULL, 0);
+                break;
+            case 'O':
+                if (strncmp(optarg, "tail:", 5) == 0)
+                    overload = DATAPATH_OVERLOAD_TAIL;
+                else if (strncmp(optarg, "oldest:", 7) == 0)
+                    overload = DATAPATH_OVERLOAD_OLDEST;
+                else
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                overload_age_us = strtoul(strchr(optarg, ':') + 1, NULL, 0);
+                break;
+            case 'W':
+                workers = strtoul(optarg, NULL, 0);
+                break;
+            case 'C':
+                control_path = optarg;
+                break;
+            case 'R':
+                warm_path = optarg;
+                break;
+            case 'T':
+                watchdog_ms = strtoul(optarg, &end, 0);
+                if (*end == ',')
+                    watchdog_periods = strtoul(end + 1, NULL, 0);
+                break;
+            case 'Q':
+                if (tc_config_parse(&tc_cfg, optarg))
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (varlen && (slot_size == 0 || slot_size % CACHE_LINE_SIZE != 0 ||
+                   split_payload != 0))
+    {
+        fprintf(stderr, "-V needs a multiple of %d and no -X\n", CACHE_LINE_SIZE);
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (tc_cfg.classes > 1 && (split_payload != 0 || gen_spec != NULL))
+    {
+        fprintf(stderr, "-Q does not go with -X or -G\n");
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (workers > DISPATCH_MAX_WORKERS ||
+        (workers > 0 && (tc_cfg.classes > 1 || gen_spec != NULL)))
+    {
+        fprintf(stderr, "-W takes up to %d and does not go with -Q or -G\n",
+            DISPATCH_MAX_WORKERS);
+        usage(argv[0]);
+        return 1;
+    }
 
-    memzone_init();
+    handler = pkt_handler_find(handler_spec);
+    if (handler == NULL)
+    {
+        fprintf(stderr, "Unknown handler: %s\n", handler_spec);
+        usage(argv[0]);
+        return 1;
+    }
+    handler_args = pkt_handler_args(handler_spec);
+
+    /* Each worker has its own context: state would split between them */
+    if (workers > 0 && handler->stateful)
+    {
+        fprintf(stderr, "-W does not go with handler %s, which keeps state\n",
+            handler->name);
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (split_payload != 0 && handler->whole_frame)
+    {
+        fprintf(stderr, "-X does not go with handler %s, which needs whole frames\n",
+            handler->name);
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* A manifest is used once; the rings it names are mapped first */
+    if (warm_path != NULL)
+    {
+        warm_count = warm_load(warm_path, warm_nics, PCI_MAX_NICS);
+        if (warm_count < 0)
+            warm_count = 0;
+        remove(warm_path);
+    }
+
+    /* Emulated, taking over needs rings another process can map */
+    if (nfp_cpp_emu_enabled() && warm_path != NULL)
+        memzone_init_iova_va_shared();
+    else if (nfp_cpp_emu_enabled())
+        memzone_init_iova_va();
+    else
+        memzone_init();
+
+    for (i = 0; i < warm_count; i++)
+        attached += warm_attach(i) == 0;
+
+    if (nfp_cpp_emu_enabled())
+    {
+        /* Emulated device: DMA straight to our VA, firmware on a thread */
+        if (warm_path != NULL)
+        {
+            warm_file(emu_state, sizeof(emu_state), -1);
+            if (attached > 0 && attached == warm_count)
+                nic_emu_set_resume(emu_state);
+            else
+                remove(emu_state);
+        }
+        if (nic_emu_init())
+            return 0;
+    }
 
-    dev = pci_scan();
-    if (!dev)
+    count = pci_scan_all(devs, PCI_MAX_NICS);
+    if (count == 0)
     {
         fprintf(stderr, "Cannot find Netronome NIC\n");
         return 0;
     }
 
-    struct nfp_cpp* cpp;
-    ret = pci_probe(dev, &cpp);
-    if (ret)
+    if (pci_probe_all(devs, cpps, count) == 0)
     {
         fprintf(stderr, "Probe unsuccessful\n");
         return 0;
     }
 
-    buffer_rx = memzone_reserve(RING_BUFFER_SIZE);
-    buffer_tx = memzone_reserve(RING_BUFFER_SIZE);
-
-    memset((void*) buffer_rx->addr, 0, RING_BUFFER_SIZE);
-    memset((void*) buffer_tx->addr, 0, RING_BUFFER_SIZE);
+    stats_shm = stats_shm_create(count);
 
-    fprintf(stderr, "BUFFER RX %u Physical: [0x%p ~ 0x%p]\n",
-            RING_BUFFER_SIZE, (char*) buffer_rx->iova, (char*) buffer_rx->iova + RING_BUFFER_SIZE);
-    fprintf(stderr, "BUFFER TX %u Physical: [0x%p ~ 0x%p]\n",
-            RING_BUFFER_SIZE, (char*) buffer_rx->iova, (char*) buffer_rx->iova + RING_BUFFER_SIZE);
+    nic_count = count;
+    if (control_path != NULL && control_start(control_path, control_cmds, NULL) == NULL)
+        return 1;
 
-    pthread_t log_thread, worker_thread;
-    pthread_create(&log_thread, NULL, log_main, NULL);
-    pthread_create(&worker_thread, NULL, udp_worker, (void*) cpp);
+    for (i = 0; i < count; i++)
+    {
+        if (cpps[i] == NULL)
+            continue;
 
-#ifdef PKT_STATS
-    pthread_t stats_thread;
-    pthread_create(&stats_thread, NULL, stats_main, (void*) cpp);
-#endif
+        nics[i].index = i;
+        nics[i].dev = devs[i];
+        nics[i].cpp = cpps[i];
+        nics[i].start = start;
+        nic_take_over(&nics[i]);
+        nic_start(&nics[i]);
+    }
 
-    nfp_cpp_dev_main(dev, cpp);
-    
-    pthread_join(worker_thread, NULL);
-    pthread_join(log_thread, NULL);
-#ifdef PKT_STATS
-    pthread_join(stats_thread, NULL);
-#endif
+    for (i = 0; i < count; i++)
+    {
+        if (cpps[i] != NULL)
+            pthread_join(nics[i].thread, NULL);
+    }
 
     return 0;
 }
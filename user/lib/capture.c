@@ -0,0 +1,409 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "capture.h"
+#include "latency.h"
+
+#define CAPTURE_BLOCK           4096
+#define CAPTURE_BUFFER_SIZE     (1 << 20)
+#define CAPTURE_FLUSH_NS        1000000000ull
+
+#define PCAP_MAGIC_NS           0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET  1
+
+#define ETH_HLEN                14
+#define ETH_TYPE_IPV4           0x0800
+
+struct pcap_file_hdr
+{
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_rec_hdr
+{
+    uint32_t ts_sec;
+    uint32_t ts_nsec;
+    uint32_t caplen;
+    uint32_t len;
+};
+
+struct capture_writer
+{
+    pthread_t thread;
+    volatile int stop;
+    int fd;
+    uint8_t* buf;                   /*> Block-aligned for O_DIRECT */
+    uint32_t used;                  /*> Bytes in buf */
+    uint64_t file_off;              /*> File offset of buf, block-aligned */
+
+    /* TSC to CLOCK_REALTIME */
+    uint64_t base_tsc;
+    uint64_t base_ns;
+    double tsc_per_ns;
+};
+
+static int parse_ip(const char* s, uint32_t* ip)
+{
+    struct in_addr addr;
+
+    if (inet_pton(AF_INET, s, &addr) != 1)
+        return -1;
+    *ip = addr.s_addr;
+    return 0;
+}
+
+static int parse_filter(const char* expr, struct capture_filter* f)
+{
+    char* copy = strdup(expr);
+    char *tok, *save = NULL;
+    int dir = 0;        /* 0 any, 1 src, 2 dst */
+    int ret = 0;
+    uint32_t ip;
+    uint16_t port;
+
+    memset(f, 0, sizeof(*f));
+
+    for (tok = strtok_r(copy, " ", &save); tok != NULL && ret == 0;
+         tok = strtok_r(NULL, " ", &save))
+    {
+        if (strcmp(tok, "and") == 0)
+            continue;
+        else if (strcmp(tok, "udp") == 0)
+            f->proto = IPPROTO_UDP;
+        else if (strcmp(tok, "tcp") == 0)
+            f->proto = IPPROTO_TCP;
+        else if (strcmp(tok, "icmp") == 0)
+            f->proto = IPPROTO_ICMP;
+        else if (strcmp(tok, "proto") == 0)
+        {
+            tok = strtok_r(NULL, " ", &save);
+            if (tok == NULL)
+                ret = -1;
+            else
+                f->proto = strtoul(tok, NULL, 0);
+        }
+        else if (strcmp(tok, "src") == 0)
+        {
+            dir = 1;
+            continue;
+        }
+        else if (strcmp(tok, "dst") == 0)
+        {
+            dir = 2;
+            continue;
+        }
+        else if (strcmp(tok, "host") == 0)
+        {
+            tok = strtok_r(NULL, " ", &save);
+            if (tok == NULL || parse_ip(tok, &ip))
+                ret = -1;
+            else if (dir == 1)
+                f->src_ip = ip;
+            else if (dir == 2)
+                f->dst_ip = ip;
+            else
+                f->any_ip = ip;
+        }
+        else if (strcmp(tok, "port") == 0)
+        {
+            tok = strtok_r(NULL, " ", &save);
+            if (tok == NULL)
+            {
+                ret = -1;
+                break;
+            }
+            port = strtoul(tok, NULL, 0);
+            if (dir == 1)
+                f->src_port = port;
+            else if (dir == 2)
+                f->dst_port = port;
+            else
+                f->any_port = port;
+            f->has_ports = 1;
+        }
+        else
+        {
+            fprintf(stderr, "%s(): Unknown filter term: %s\n", __func__, tok);
+            ret = -1;
+        }
+
+        dir = 0;
+    }
+
+    free(copy);
+    return ret;
+}
+
+int capture_match(const struct capture_filter* f, const uint8_t* frame,
+        uint32_t len)
+{
+    uint32_t ihl, src_ip, dst_ip;
+    uint16_t src_port, dst_port;
+    uint8_t proto;
+
+    if (len < ETH_HLEN + 20 ||
+        ((frame[12] << 8) | frame[13]) != ETH_TYPE_IPV4)
+        return 0;
+
+    ihl = (frame[ETH_HLEN] & 0xf) * 4;
+    proto = frame[ETH_HLEN + 9];
+    memcpy(&src_ip, frame + ETH_HLEN + 12, 4);
+    memcpy(&dst_ip, frame + ETH_HLEN + 16, 4);
+
+    if (f->proto && proto != f->proto)
+        return 0;
+    if (f->src_ip && src_ip != f->src_ip)
+        return 0;
+    if (f->dst_ip && dst_ip != f->dst_ip)
+        return 0;
+    if (f->any_ip && src_ip != f->any_ip && dst_ip != f->any_ip)
+        return 0;
+
+    if (!f->has_ports)
+        return 1;
+
+    /* Port terms only match UDP and TCP */
+    if ((proto != IPPROTO_UDP && proto != IPPROTO_TCP) ||
+        len < ETH_HLEN + ihl + 4)
+        return 0;
+
+    src_port = (frame[ETH_HLEN + ihl] << 8) | frame[ETH_HLEN + ihl + 1];
+    dst_port = (frame[ETH_HLEN + ihl + 2] << 8) | frame[ETH_HLEN + ihl + 3];
+
+    if (f->src_port && src_port != f->src_port)
+        return 0;
+    if (f->dst_port && dst_port != f->dst_port)
+        return 0;
+    if (f->any_port && src_port != f->any_port && dst_port != f->any_port)
+        return 0;
+
+    return 1;
+}
+
+/**
+ * Write the block-aligned part of the buffer, or with partial set all
+ * of it: the last block is padded, then the file truncated back.
+ */
+static int capture_flush(struct capture* cap, struct capture_writer* w,
+        int partial)
+{
+    uint32_t len, keep;
+
+    if (partial)
+        len = (w->used + CAPTURE_BLOCK - 1) & ~(CAPTURE_BLOCK - 1);
+    else
+        len = w->used & ~(CAPTURE_BLOCK - 1);
+
+    if (len == 0)
+        return 0;
+
+    if (len > w->used)
+        memset(w->buf + w->used, 0, len - w->used);
+
+    if (pwrite(w->fd, w->buf, len, w->file_off) != len)
+    {
+        perror("capture write failed");
+        return -1;
+    }
+
+    if (partial)
+    {
+        /* Keep the partial block; it is rewritten by the next flush */
+        if (ftruncate(w->fd, w->file_off + w->used) < 0)
+            return -1;
+        keep = w->used & (CAPTURE_BLOCK - 1);
+        len = w->used - keep;
+    }
+    else
+    {
+        keep = w->used - len;
+    }
+
+    if (len > 0)
+    {
+        memmove(w->buf, w->buf + len, keep);
+        w->file_off += len;
+        w->used = keep;
+    }
+
+    __atomic_store_n(&cap->bytes, w->file_off + w->used, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void capture_append(struct capture* cap, struct capture_writer* w,
+        const struct capture_entry* e)
+{
+    struct pcap_rec_hdr rec;
+    uint64_t ns;
+
+    if (w->used + sizeof(rec) + e->caplen > CAPTURE_BUFFER_SIZE)
+        capture_flush(cap, w, 0);
+
+    ns = w->base_ns + (uint64_t) ((int64_t) (e->tsc - w->base_tsc) / w->tsc_per_ns);
+    rec.ts_sec = ns / 1000000000ull;
+    rec.ts_nsec = ns % 1000000000ull;
+    rec.caplen = e->caplen;
+    rec.len = e->len;
+
+    memcpy(w->buf + w->used, &rec, sizeof(rec));
+    memcpy(w->buf + w->used + sizeof(rec), e->data, e->caplen);
+    w->used += sizeof(rec) + e->caplen;
+
+    __atomic_store_n(&cap->written, cap->written + 1, __ATOMIC_RELAXED);
+}
+
+static void* capture_main(void* arg)
+{
+    struct capture* cap = arg;
+    struct capture_writer* w = cap->thread;
+    struct timespec now;
+    uint64_t last_flush = 0, now_ns;
+    uint32_t head, tail;
+
+    while (1)
+    {
+        head = __atomic_load_n(&cap->head, __ATOMIC_ACQUIRE);
+        tail = cap->tail;
+
+        for (; tail != head; tail++)
+            capture_append(cap, w, &cap->queue[tail & (CAPTURE_QUEUE_SIZE - 1)]);
+        __atomic_store_n(&cap->tail, tail, __ATOMIC_RELEASE);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        now_ns = now.tv_sec * 1000000000ull + now.tv_nsec;
+        if (now_ns - last_flush >= CAPTURE_FLUSH_NS || w->stop)
+        {
+            capture_flush(cap, w, 1);
+            last_flush = now_ns;
+        }
+
+        if (w->stop && cap->tail == __atomic_load_n(&cap->head, __ATOMIC_ACQUIRE))
+            break;
+
+        if (tail == head)
+            usleep(1000);
+    }
+
+    return NULL;
+}
+
+struct capture* capture_open(const struct capture_config* cfg)
+{
+    struct capture* cap;
+    struct capture_writer* w;
+    struct pcap_file_hdr hdr;
+    struct timespec real;
+
+    cap = calloc(1, sizeof(*cap));
+    w = calloc(1, sizeof(*w));
+    if (cap == NULL || w == NULL)
+        goto err;
+    cap->thread = w;
+    w->fd = -1;
+
+    cap->snaplen = cfg->snaplen;
+    if (cap->snaplen == 0 || cap->snaplen > CAPTURE_MAX_SNAPLEN)
+        cap->snaplen = CAPTURE_MAX_SNAPLEN;
+    cap->sample = cfg->sample;
+    cap->sample_left = cfg->sample;
+
+    if (cfg->filter != NULL)
+    {
+        if (parse_filter(cfg->filter, &cap->filter))
+        {
+            fprintf(stderr, "%s(): Bad filter: %s\n", __func__, cfg->filter);
+            goto err;
+        }
+        cap->has_filter = 1;
+    }
+
+    cap->queue = calloc(CAPTURE_QUEUE_SIZE, sizeof(struct capture_entry));
+    if (cap->queue == NULL ||
+        posix_memalign((void**) &w->buf, CAPTURE_BLOCK, CAPTURE_BUFFER_SIZE))
+        goto err;
+
+    /* O_DIRECT where the filesystem allows it (not e.g. tmpfs) */
+    w->fd = open(cfg->path, O_CREAT | O_TRUNC | O_WRONLY | O_DIRECT, 0644);
+    if (w->fd < 0)
+        w->fd = open(cfg->path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (w->fd < 0)
+    {
+        fprintf(stderr, "%s(): Cannot create %s\n", __func__, cfg->path);
+        goto err;
+    }
+
+    hdr.magic = PCAP_MAGIC_NS;
+    hdr.version_major = 2;
+    hdr.version_minor = 4;
+    hdr.thiszone = 0;
+    hdr.sigfigs = 0;
+    hdr.snaplen = cap->snaplen;
+    hdr.linktype = PCAP_LINKTYPE_ETHERNET;
+    memcpy(w->buf, &hdr, sizeof(hdr));
+    w->used = sizeof(hdr);
+
+    w->tsc_per_ns = lat_tsc_per_ns();
+    clock_gettime(CLOCK_REALTIME, &real);
+    w->base_tsc = lat_tsc();
+    w->base_ns = real.tv_sec * 1000000000ull + real.tv_nsec;
+
+    if (pthread_create(&w->thread, NULL, capture_main, cap))
+        goto err;
+
+    return cap;
+
+err:
+    if (w != NULL)
+    {
+        if (w->fd >= 0)
+            close(w->fd);
+        free(w->buf);
+        free(w);
+    }
+    if (cap != NULL)
+        free(cap->queue);
+    free(cap);
+    return NULL;
+}
+
+void capture_close(struct capture* cap)
+{
+    struct capture_writer* w = cap->thread;
+
+    w->stop = 1;
+    pthread_join(w->thread, NULL);
+
+    close(w->fd);
+    free(w->buf);
+    free(w);
+    free(cap->queue);
+    free(cap);
+}
+
+void capture_get_stats(const struct capture* cap, struct capture_stats* st)
+{
+    st->seen = cap->seen;
+    st->filtered = cap->filtered;
+    st->queued = cap->queued;
+    st->dropped = cap->dropped;
+    st->written = __atomic_load_n(&cap->written, __ATOMIC_RELAXED);
+    st->bytes = __atomic_load_n(&cap->bytes, __ATOMIC_RELAXED);
+}
+
+void capture_set_sample(struct capture* cap, uint32_t sample)
+{
+    __atomic_store_n(&cap->sample, sample, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,154 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @file
+ * Packet capture tap for the datapath.
+ *
+ * The worker calls capture_tap() for each received frame. Sampling and
+ * the filter are applied right there, and accepted frames (up to the
+ * snap length) go into a single-producer/single-consumer queue. A
+ * capture thread drains the queue into a nanosecond pcap file. If the
+ * queue is full the frame is counted as dropped; the worker never
+ * waits.
+ *
+ * The file is written in aligned blocks, with O_DIRECT when the
+ * filesystem supports it. Once a second the partial last block is
+ * written too and the file truncated to its real length, so the file
+ * is a valid pcap between flushes.
+ *
+ * Filters are a conjunction of terms separated by "and":
+ *   udp | tcp | icmp | proto N
+ *   [src|dst] host A.B.C.D
+ *   [src|dst] port N
+ */
+
+#define CAPTURE_QUEUE_SIZE      4096        /* Entries, power of two */
+#define CAPTURE_MAX_SNAPLEN     256
+
+struct capture_config
+{
+    const char* path;
+    uint32_t snaplen;                       /*> Bytes kept per frame, 0 for all */
+    uint32_t sample;                        /*> Keep 1 in N frames, 0 or 1 for all */
+    const char* filter;                     /*> NULL to keep everything */
+};
+
+struct capture_filter
+{
+    uint8_t proto;                          /*> IP protocol, 0 for any */
+    uint8_t has_ports;                      /*> Port terms present */
+    uint32_t src_ip, dst_ip, any_ip;        /*> Network order, 0 for any */
+    uint16_t src_port, dst_port, any_port;  /*> Host order, 0 for any */
+};
+
+struct capture_entry
+{
+    uint64_t tsc;
+    uint32_t len;                           /*> Original length */
+    uint32_t caplen;                        /*> Bytes in data */
+    uint8_t data[CAPTURE_MAX_SNAPLEN];
+};
+
+struct capture_stats
+{
+    uint64_t seen;                          /*> Frames offered to the tap */
+    uint64_t filtered;                      /*> Skipped by sampling or filter */
+    uint64_t queued;
+    uint64_t dropped;                       /*> Queue full */
+    uint64_t written;                       /*> Records in the file */
+    uint64_t bytes;                         /*> File size */
+};
+
+struct capture
+{
+    /* Worker side */
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t sample_left;
+    uint32_t snaplen;
+    uint32_t sample;                        /*> Any thread may change it */
+    int has_filter;
+    struct capture_filter filter;
+    uint64_t seen, filtered, queued, dropped;
+
+    /* Capture thread side */
+    uint32_t tail __attribute__((aligned(64)));
+    uint64_t written, bytes;
+
+    struct capture_entry* queue;
+    void* thread;                           /*> Writer state, capture.c */
+};
+
+/**
+ * Open the file and start the capture thread.
+ *
+ * @return
+ *   NULL if the filter does not parse or the file cannot be created.
+ */
+struct capture* capture_open(const struct capture_config* cfg);
+
+/**
+ * Stop the thread, write out what was queued and close the file.
+ */
+void capture_close(struct capture* cap);
+
+void capture_get_stats(const struct capture* cap, struct capture_stats* st);
+
+/* Keep 1 in sample frames from now on, 0 or 1 for all; from any thread */
+void capture_set_sample(struct capture* cap, uint32_t sample);
+
+/**
+ * @return
+ *   1 if the frame passes the filter.
+ */
+int capture_match(const struct capture_filter* f, const uint8_t* frame,
+        uint32_t len);
+
+/**
+ * Offer a frame to the tap. Worker side; never blocks.
+ */
+static inline void capture_tap(struct capture* cap, const void* frame,
+        uint32_t len, uint64_t tsc)
+{
+    struct capture_entry* e;
+    uint32_t tail, sample = __atomic_load_n(&cap->sample, __ATOMIC_RELAXED);
+
+    cap->seen++;
+
+    if (sample > 1)
+    {
+        if (--cap->sample_left != 0 && cap->sample_left <= sample)
+        {
+            cap->filtered++;
+            return;
+        }
+        cap->sample_left = sample;
+    }
+
+    if (cap->has_filter && !capture_match(&cap->filter, frame, len))
+    {
+        cap->filtered++;
+        return;
+    }
+
+    tail = __atomic_load_n(&cap->tail, __ATOMIC_ACQUIRE);
+    if (cap->head - tail == CAPTURE_QUEUE_SIZE)
+    {
+        cap->dropped++;
+        return;
+    }
+
+    e = &cap->queue[cap->head & (CAPTURE_QUEUE_SIZE - 1)];
+    e->tsc = tsc;
+    e->len = len;
+    e->caplen = len < cap->snaplen ? len : cap->snaplen;
+    memcpy(e->data, frame, e->caplen);
+
+    __atomic_store_n(&cap->head, cap->head + 1, __ATOMIC_RELEASE);
+    cap->queued++;
+}
+
+#endif /* _CAPTURE_H_ */
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "control.h"
+
+struct control
+{
+    const struct control_cmd* cmds;
+    void* ctx;
+    char path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+    int fd;                                 /*> Listening socket */
+    volatile int client;                    /*> Socket being served, or -1 */
+    volatile int stop;
+    pthread_t thread;
+};
+
+static void control_help(const struct control* ctl, FILE* out)
+{
+    const struct control_cmd* cmd;
+
+    for (cmd = ctl->cmds; cmd->name != NULL; cmd++)
+        fprintf(out, "%-10s %s\n", cmd->name, cmd->help);
+    fprintf(out, "%-10s %s\n", "help", "This list");
+}
+
+/* Run one line; an empty one does nothing and gets no reply */
+static void control_line(struct control* ctl, char* line, FILE* out)
+{
+    const struct control_cmd* cmd;
+    char* argv[CONTROL_MAX_ARGS];
+    char* save;
+    int argc = 0, ret = -1;
+
+    for (argv[argc] = strtok_r(line, " \t\r\n", &save);
+         argv[argc] != NULL && argc < CONTROL_MAX_ARGS - 1;
+         argv[++argc] = strtok_r(NULL, " \t\r\n", &save))
+        ;
+    if (argc == 0)
+        return;
+
+    if (strcmp(argv[0], "help") == 0)
+    {
+        control_help(ctl, out);
+        ret = 0;
+    }
+    else
+    {
+        for (cmd = ctl->cmds; cmd->name != NULL; cmd++)
+        {
+            if (strcmp(cmd->name, argv[0]) == 0)
+                break;
+        }
+
+        if (cmd->name == NULL)
+            fprintf(out, "Unknown command: %s\n", argv[0]);
+        else if (argv[argc] != NULL)
+            fprintf(out, "Too many arguments\n");
+        else
+            ret = cmd->run(ctl->ctx, argc, argv, out);
+    }
+
+    fprintf(out, ret >= 0 ? "ok\n" : "error\n");
+    fflush(out);
+
+    if (ret == CONTROL_EXIT)
+        exit(0);
+}
+
+static void control_serve(struct control* ctl, int fd)
+{
+    char line[CONTROL_MAX_LINE];
+    FILE *in, *out;
+    int fd_out;
+
+    fd_out = dup(fd);
+    in = fdopen(fd, "r");
+    out = fd_out >= 0 ? fdopen(fd_out, "w") : NULL;
+    if (in == NULL || out == NULL)
+    {
+        if (in != NULL)
+            fclose(in);
+        else
+            close(fd);
+        if (out != NULL)
+            fclose(out);
+        else if (fd_out >= 0)
+            close(fd_out);
+        return;
+    }
+
+    while (!ctl->stop && fgets(line, sizeof(line), in) != NULL)
+        control_line(ctl, line, out);
+
+    fclose(out);
+    fclose(in);
+}
+
+static void* control_main(void* arg)
+{
+    struct control* ctl = arg;
+    int fd;
+
+    while (!ctl->stop)
+    {
+        fd = accept(ctl->fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+
+        ctl->client = fd;
+        control_serve(ctl, fd);
+        ctl->client = -1;
+    }
+
+    return NULL;
+}
+
+struct control* control_start(const char* path, const struct control_cmd* cmds,
+        void* ctx)
+{
+    struct sockaddr_un addr;
+    struct control* ctl;
+    struct stat st;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "%s(): Socket path too long: %s\n", __func__, path);
+        return NULL;
+    }
+
+    ctl = calloc(1, sizeof(*ctl));
+    if (ctl == NULL)
+        return NULL;
+    ctl->cmds = cmds;
+    ctl->ctx = ctx;
+    ctl->client = -1;
+    snprintf(ctl->path, sizeof(ctl->path), "%s", path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    ctl->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ctl->fd < 0)
+        goto err;
+
+    /* A socket left by an earlier run; anything else is not ours to remove */
+    if (lstat(path, &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode))
+        {
+            fprintf(stderr, "%s(): %s exists and is not a socket\n", __func__, path);
+            goto err;
+        }
+        unlink(path);
+    }
+
+    if (bind(ctl->fd, (struct sockaddr*) &addr, sizeof(addr)))
+    {
+        fprintf(stderr, "%s(): Cannot bind %s: %s\n", __func__, path, strerror(errno));
+        goto err;
+    }
+
+    /* Owner only, before anyone can connect: commands reconfigure the NICs */
+    if (chmod(path, 0600) || listen(ctl->fd, 1))
+    {
+        fprintf(stderr, "%s(): Cannot listen on %s: %s\n", __func__, path,
+            strerror(errno));
+        unlink(path);
+        goto err;
+    }
+
+    if (pthread_create(&ctl->thread, NULL, control_main, ctl))
+        goto err;
+
+    return ctl;
+
+err:
+    if (ctl->fd >= 0)
+        close(ctl->fd);
+    free(ctl);
+    return NULL;
+}
+
+void control_stop(struct control* ctl)
+{
+    int client;
+
+    if (ctl == NULL)
+        return;
+
+    ctl->stop = 1;
+    shutdown(ctl->fd, SHUT_RDWR);
+    client = ctl->client;
+    if (client >= 0)
+        shutdown(client, SHUT_RDWR);
+    pthread_join(ctl->thread, NULL);
+
+    close(ctl->fd);
+    unlink(ctl->path);
+    free(ctl);
+}
@@ -0,0 +1,63 @@
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+#include <stdio.h>
+
+/**
+ * @file
+ * Control socket: a UNIX stream socket that takes one command per line,
+ * so that a running datapath can be inspected and changed without a
+ * restart (nfp-ctl.out is a client; the commands are the
+ * application's).
+ *
+ * A line is a command name and its arguments, separated by blanks, at
+ * most CONTROL_MAX_ARGS - 1 words in all. The reply is whatever the
+ * command writes, followed by a line "ok", or "error" if it failed.
+ * "help" lists the commands. Clients are served one at a time, on the
+ * control thread: commands run there, never on a datapath thread, and
+ * must hand over anything the datapath has to apply itself.
+ */
+
+#define CONTROL_MAX_ARGS        8
+#define CONTROL_MAX_LINE        256
+#define CONTROL_DEFAULT_PATH    "/tmp/nfp-ctl.sock"
+
+/* run() result: success, and the process exits once the reply is out */
+#define CONTROL_EXIT            1
+
+struct control_cmd
+{
+    const char* name;
+    const char* help;                       /*> Arguments and effect, one line */
+
+    /**
+     * @param argv
+     *   The command name, then its arguments.
+     * @param out
+     *   Reply, or the reason for failing.
+     * @return
+     *   0 on success, -1 on failure, CONTROL_EXIT to end the process.
+     */
+    int (*run)(void* ctx, int argc, char** argv, FILE* out);
+};
+
+struct control;
+
+/**
+ * Listen on path, replacing any stale socket there, and start the
+ * control thread.
+ *
+ * @param cmds
+ *   Commands, ending with one whose name is NULL; kept by reference.
+ * @param ctx
+ *   Passed to every command.
+ * @return
+ *   The server, or NULL on failure.
+ */
+struct control* control_start(const char* path, const struct control_cmd* cmds,
+        void* ctx);
+
+/* Stop the thread, dropping any client, and remove the socket */
+void control_stop(struct control* ctl);
+
+#endif /* _CONTROL_H_ */
@@ -0,0 +1,1074 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "io.h"
+#include "datapath.h"
+
+#define ETH_TYPE_OFFSET     12
+#define IPV4_SRC_OFFSET     26
+
+static void datapath_class_init(struct datapath_class* q, void* rx_base,
+        void* tx_base, uint32_t capacity, uint32_t entry_size)
+{
+    q->rx.base_addr = rx_base;
+    q->rx.capacity = capacity;
+    q->rx.entry_size = entry_size;
+    q->tx.base_addr = tx_base;
+    q->tx.capacity = capacity;
+    q->tx.entry_size = entry_size;
+    q->weight = 1;
+}
+
+int datapath_init(struct datapath* dp, volatile struct device_meta_t* meta,
+        void* rx_base, void* tx_base, uint32_t capacity, uint32_t entry_size,
+        const struct pkt_handler* handler, const char* handler_args)
+{
+    memset(dp, 0, sizeof(*dp));
+
+    dp->meta = meta;
+    dp->num_classes = 1;
+    datapath_class_init(&dp->cls[0], rx_base, tx_base, capacity, entry_size);
+    dp->cls[0].rx_head_db = &meta->rx_head;
+    dp->cls[0].rx_tail_db = &meta->rx_tail;
+    dp->cls[0].tx_head_db = &meta->tx_head;
+    dp->cls[0].tx_tail_db = &meta->tx_tail;
+    dp->handler = handler;
+    dp->batch = DATAPATH_MAX_BATCH;
+    dp->views = dp->view_buf;
+    dp->actions = dp->action_buf;
+    pkt_copy_select(&dp->copy, entry_size);
+
+    if (handler->init != NULL && handler->init(&dp->handler_ctx, handler_args))
+    {
+        fprintf(stderr, "%s(): Handler %s failed to initialise\n",
+            __func__, handler->name);
+        return -1;
+    }
+
+    return 0;
+}
+
+void datapath_set_split(struct datapath* dp, void* rx_payload, void* tx_payload,
+        uint64_t rx_payload_iova, uint64_t tx_payload_iova, uint32_t payload_size)
+{
+    dp->rx_payload = rx_payload;
+    dp->tx_payload = tx_payload;
+    dp->rx_payload_iova = rx_payload_iova;
+    dp->tx_payload_iova = tx_payload_iova;
+    dp->payload_size = payload_size;
+}
+
+int datapath_set_varlen(struct datapath* dp)
+{
+    unsigned int c;
+
+    if (dp->payload_size != 0 ||
+        dp->cls[0].rx.entry_size < RING_SLOT_HDR_LEN + IPV4_SRC_OFFSET + 8)
+    {
+        fprintf(stderr, "%s(): Variable-length slots need %u+ byte slots and no split\n",
+            __func__, RING_SLOT_HDR_LEN + IPV4_SRC_OFFSET + 8);
+        return -1;
+    }
+
+    for (c = 0; c < RING_MAX_CLASSES; c++)
+        dp->cls[c].rx.hdr_size = dp->cls[c].tx.hdr_size = RING_SLOT_HDR_LEN;
+    return 0;
+}
+
+int datapath_set_classes(struct datapath* dp, const struct tc_config* tc,
+        void* const* rx_bases, void* const* tx_bases,
+        const uint64_t* rx_iovas, const uint64_t* tx_iovas)
+{
+    volatile struct device_meta_t* meta = dp->meta;
+    struct datapath_class* q;
+    unsigned int c;
+
+    if (dp->payload_size != 0)
+    {
+        fprintf(stderr, "%s(): Traffic classes do not work with the split\n", __func__);
+        return -1;
+    }
+
+    for (c = 1; c < tc->classes; c++)
+    {
+        q = &dp->cls[c];
+        datapath_class_init(q, rx_bases[c - 1], tx_bases[c - 1],
+            dp->cls[0].rx.capacity, dp->cls[0].rx.entry_size);
+        q->rx.hdr_size = q->tx.hdr_size = dp->cls[0].rx.hdr_size;
+        q->rx_iova = rx_iovas[c - 1];
+        q->tx_iova = tx_iovas[c - 1];
+        q->rx_head_db = &meta->class_rings[c - 1].rx_head;
+        q->rx_tail_db = &meta->class_rings[c - 1].rx_tail;
+        q->tx_head_db = &meta->class_rings[c - 1].tx_head;
+        q->tx_tail_db = &meta->class_rings[c - 1].tx_tail;
+    }
+
+    for (c = 0; c < tc->classes; c++)
+        dp->cls[c].weight = tc->weights[c];
+
+    dp->tc = tc;
+    dp->num_classes = tc->classes;
+    return 0;
+}
+
+int datapath_set_workers(struct datapath* dp, unsigned int workers,
+        const char* handler_args)
+{
+    if (dp->num_classes != 1)
+    {
+        fprintf(stderr, "%s(): Workers do not work with traffic classes\n", __func__);
+        return -1;
+    }
+
+    dp->bursts = calloc(DATAPATH_MAX_INFLIGHT, sizeof(*dp->bursts));
+    if (dp->bursts == NULL)
+        return -1;
+
+    dp->dispatch = dispatch_create(workers, dp->handler, handler_args);
+    if (dp->dispatch == NULL)
+    {
+        free(dp->bursts);
+        dp->bursts = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Arrival stamps, shared by latency recording and the overload policy */
+static int datapath_alloc_stamps(struct datapath_class* q)
+{
+    if (q->rx_tsc == NULL)
+        q->rx_tsc = calloc(q->rx.capacity / q->rx.entry_size, sizeof(uint64_t));
+    return q->rx_tsc != NULL ? 0 : -1;
+}
+
+static void datapath_disable_latency(struct datapath* dp)
+{
+    unsigned int c;
+
+    for (c = 0; c < dp->num_classes; c++)
+    {
+        free(dp->cls[c].latency);
+        dp->cls[c].latency = NULL;
+    }
+}
+
+int datapath_enable_latency(struct datapath* dp)
+{
+    struct datapath_class* q;
+    unsigned int c;
+
+    for (c = 0; c < dp->num_classes; c++)
+    {
+        q = &dp->cls[c];
+        q->latency = calloc(1, sizeof(*q->latency));
+        if (q->latency == NULL || datapath_alloc_stamps(q))
+        {
+            datapath_disable_latency(dp);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int datapath_set_overload(struct datapath* dp, uint32_t rx_full_budget_us,
+        enum datapath_overload policy, uint64_t max_age)
+{
+    struct datapath_class* q;
+    unsigned int c, slots;
+
+    for (c = 0; c < dp->num_classes && policy != DATAPATH_OVERLOAD_WAIT; c++)
+    {
+        q = &dp->cls[c];
+        slots = q->rx.capacity / q->rx.entry_size;
+        if (datapath_alloc_stamps(q))
+            return -1;
+        if (q->rx_arrival == NULL)
+            q->rx_arrival = calloc(slots, sizeof(uint64_t));
+        if (policy == DATAPATH_OVERLOAD_TAIL && q->rx_late == NULL)
+            q->rx_late = calloc(slots, 1);
+        if (q->rx_arrival == NULL || (policy == DATAPATH_OVERLOAD_TAIL && q->rx_late == NULL))
+            return -1;
+    }
+
+    dp->rx_full_budget_us = rx_full_budget_us;
+    dp->overload = policy;
+    dp->max_age = max_age;
+    return 0;
+}
+
+/**
+ * Stamp slots that appeared behind the RX tail since the last poll.
+ *
+ * Under an overload policy each also gets the time of the previous poll
+ * of its class, the earliest it can have arrived: the ring may be only
+ * a few slots deep, so how long packets waited for the host mostly
+ * shows as how long since it last looked. For tail drop they are then
+ * marked late, all but the head, if the oldest packet queued is past
+ * max_age.
+ */
+static void datapath_stamp_rx(struct datapath* dp, struct datapath_class* q)
+{
+    uint32_t entry_size = q->rx.entry_size;
+    uint32_t slot = q->rx_seen, head = q->rx.head / entry_size;
+    uint64_t now, since, oldest;
+    uint8_t late = 0;
+
+    if (q->latency != NULL)
+        lat_recorder_poll(q->latency);
+
+    if (slot == q->rx.tail && q->rx_arrival == NULL)
+        return;
+
+    now = lat_tsc();
+    since = q->last_poll != 0 ? q->last_poll : now;
+    q->last_poll = now;
+
+    if (slot == q->rx.tail)
+        return;
+
+    if (q->rx_late != NULL)
+    {
+        oldest = q->rx.head != slot ? q->rx_arrival[head] : since;
+        late = now - oldest > dp->max_age;
+    }
+
+    while (slot != q->rx.tail)
+    {
+        q->rx_tsc[slot / entry_size] = now;
+        if (q->rx_arrival != NULL)
+            q->rx_arrival[slot / entry_size] = since;
+        if (q->rx_late != NULL)
+            q->rx_late[slot / entry_size] = late && slot / entry_size != head;
+        slot += entry_size;
+        if (slot >= q->rx.capacity)
+            slot = 0;
+    }
+    q->rx_seen = slot;
+}
+
+/* Ring configuration for the firmware, all rings empty */
+static void datapath_write_config(struct datapath* dp, volatile struct device_meta_t* meta)
+{
+    unsigned int c;
+
+    meta->packet_size = dp->cls[0].rx.entry_size;
+    meta->buffer_size = dp->cls[0].rx.capacity;
+    meta->rx_buffer_iova = dp->cls[0].rx_iova;
+    meta->tx_buffer_iova = dp->cls[0].tx_iova;
+    meta->rx_payload_iova = dp->rx_payload_iova;
+    meta->tx_payload_iova = dp->tx_payload_iova;
+    meta->payload_size = dp->payload_size;
+    meta->ring_flags = dp->cls[0].rx.hdr_size != 0 ? RING_F_VARLEN : 0;
+    meta->rx_full_budget_us = dp->rx_full_budget_us;
+    meta->rx_head = meta->rx_tail = 0;
+    meta->tx_head = meta->tx_tail = 0;
+
+    meta->num_classes = 1;
+    if (dp->tc != NULL)
+        tc_config_write(dp->tc, meta);
+    for (c = 1; c < dp->num_classes; c++)
+    {
+        meta->class_rings[c - 1].rx_buffer_iova = dp->cls[c].rx_iova;
+        meta->class_rings[c - 1].tx_buffer_iova = dp->cls[c].tx_iova;
+        meta->class_rings[c - 1].rx_head = meta->class_rings[c - 1].rx_tail = 0;
+        meta->class_rings[c - 1].tx_head = meta->class_rings[c - 1].tx_tail = 0;
+    }
+}
+
+void datapath_start(struct datapath* dp, uint64_t rx_iova, uint64_t tx_iova)
+{
+    volatile struct device_meta_t* meta = dp->meta;
+    uint64_t gen = nn_readq(&meta->start_signal), deadline;
+
+    /*
+     * Firmware still running rings of an earlier process: hold it, and
+     * let frames on their way in land, before the rings are rewritten
+     */
+    if (gen != 0)
+    {
+        nn_writeq(RING_RESTARTING, &meta->start_signal);
+        rte_mb();
+
+        deadline = lat_tsc() + DATAPATH_DRAIN_MS * 1000000ull * lat_tsc_per_ns();
+        while (nn_readl(&meta->rx_busy) != 0 && lat_tsc() < deadline)
+            ;
+        if (nn_readl(&meta->rx_busy) != 0)
+            fprintf(stderr, "%s(): Firmware still busy, taking the rings anyway\n",
+                __func__);
+    }
+
+    dp->cls[0].rx_iova = rx_iova;
+    dp->cls[0].tx_iova = tx_iova;
+    datapath_write_config(dp, meta);
+
+    rte_io_wmb();   /* Flush preceding writes! */
+
+    /*
+     * A generation the firmware has not loaded yet. Cut short in a
+     * restart, the one it holds is unknown: count on from the clock.
+     */
+    if (gen == RING_RESTARTING)
+        dp->generation = time(NULL);
+    else
+        dp->generation = gen + 1;
+    nn_writeq(dp->generation, &meta->start_signal);
+}
+
+/* Leave only the configuration words of cfg: clear indices and handshake */
+static void datapath_config_only(struct device_meta_t* cfg)
+{
+    unsigned int c;
+
+    cfg->start_signal = 0;
+    cfg->rx_head = cfg->rx_tail = cfg->tx_head = cfg->tx_tail = 0;
+    cfg->rx_busy = 0;
+    for (c = 0; c < RING_MAX_CLASSES - 1; c++)
+    {
+        cfg->class_rings[c].rx_head = cfg->class_rings[c].rx_tail = 0;
+        cfg->class_rings[c].tx_head = cfg->class_rings[c].tx_tail = 0;
+    }
+}
+
+int datapath_attach(struct datapath* dp, uint64_t rx_iova, uint64_t tx_iova,
+        const uint32_t* rx_head, const uint32_t* tx_tail)
+{
+    volatile struct device_meta_t* meta = dp->meta;
+    uint32_t idx[RING_MAX_CLASSES][4];
+    struct device_meta_t want, have;
+    struct datapath_class* q;
+    uint64_t gen;
+    unsigned int c;
+
+    gen = nn_readq(&meta->start_signal);
+    if (gen == 0 || gen == RING_RESTARTING)
+    {
+        fprintf(stderr, "%s(): Firmware is not running the rings\n", __func__);
+        return -1;
+    }
+
+    dp->cls[0].rx_iova = rx_iova;
+    dp->cls[0].tx_iova = tx_iova;
+    memset(&want, 0, sizeof(want));
+    datapath_write_config(dp, &want);
+    memcpy(&have, (const void*) meta, sizeof(have));
+    datapath_config_only(&want);
+    datapath_config_only(&have);
+    if (memcmp(&want, &have, sizeof(want)) != 0)
+    {
+        fprintf(stderr, "%s(): Firmware runs another ring configuration\n", __func__);
+        return -1;
+    }
+
+    /* Take over where the doorbells are, if the host's are as it left them */
+    for (c = 0; c < dp->num_classes; c++)
+    {
+        q = &dp->cls[c];
+        idx[c][0] = nn_readl(q->rx_head_db);
+        idx[c][1] = nn_readl(q->rx_tail_db);
+        idx[c][2] = nn_readl(q->tx_head_db);
+        idx[c][3] = nn_readl(q->tx_tail_db);
+        if (idx[c][0] != rx_head[c] || idx[c][3] != tx_tail[c])
+        {
+            fprintf(stderr, "%s(): Class %u rings moved on without the host\n",
+                __func__, c);
+            return -1;
+        }
+        if (idx[c][0] >= q->rx.capacity || idx[c][1] >= q->rx.capacity ||
+            idx[c][2] >= q->tx.capacity || idx[c][3] >= q->tx.capacity ||
+            idx[c][0] % q->rx.entry_size != 0 || idx[c][3] % q->tx.entry_size != 0)
+        {
+            fprintf(stderr, "%s(): Class %u indices out of the rings\n", __func__, c);
+            return -1;
+        }
+    }
+
+    for (c = 0; c < dp->num_classes; c++)
+    {
+        q = &dp->cls[c];
+        q->rx.head = idx[c][0];
+        q->rx.tail = idx[c][1];
+        q->tx.head = idx[c][2];
+        q->tx.tail = idx[c][3];
+        q->rx_seen = q->rx.head;
+    }
+
+    dp->generation = gen;
+    return 0;
+}
+
+/**
+ * Number of forwarded whole-slot packets starting at i whose RX slots,
+ * and the TX slots they go to, are both contiguous, so that they can be
+ * copied at once. Runs end where either ring wraps.
+ */
+static unsigned int datapath_forward_run(struct datapath* dp,
+        struct datapath_class* q, unsigned int i, unsigned int n, const void* dst)
+{
+    uint32_t entry_size = q->rx.entry_size;
+    const char* src = dp->views[i].data;
+    unsigned int run = 1;
+
+    for (i++; i < n; i++, run++)
+    {
+        if (dp->actions[i].verdict != PKT_FORWARD ||
+            dp->actions[i].len < entry_size ||
+            (const char*) dp->views[i].data != src + run * entry_size ||
+            (const char*) dst + run * entry_size >=
+                (const char*) q->tx.base_addr + q->tx.capacity)
+            break;
+    }
+
+    return run;
+}
+
+/**
+ * Split mode: copy the payloads of count packets, from view i on, to
+ * the payload slots of TX slots tx on. Callers only pass runs that are
+ * contiguous in both rings, so the payload slots are too.
+ */
+static inline void datapath_copy_payloads(struct datapath* dp, unsigned int i,
+        unsigned int tx, unsigned int count)
+{
+    uint32_t off;
+
+    if (dp->payload_size == 0)
+        return;
+
+    /* One class only, class 0 */
+    off = (char*) ringbuffer_back_at(&dp->cls[0].tx, tx) - (char*) dp->cls[0].tx.base_addr;
+    dp->copy.copy_any_nt(dp->tx_payload + off / dp->cls[0].tx.entry_size * dp->payload_size,
+        dp->views[i].payload, count * dp->payload_size);
+}
+
+/**
+ * Apply the overload policy to the first n views and close up the gaps
+ * left by those dropped.
+ *
+ * @return
+ *   Number of views left.
+ */
+static unsigned int datapath_shed(struct datapath* dp, struct datapath_class* q,
+        unsigned int n)
+{
+    uint64_t now = lat_tsc();
+    unsigned int i, slot, kept = 0;
+    int drop;
+
+    for (i = 0; i < n; i++)
+    {
+        slot = dp->views[i].slot / q->rx.entry_size;
+        if (dp->overload == DATAPATH_OVERLOAD_TAIL)
+            drop = q->rx_late[slot];
+        else
+            drop = now - q->rx_arrival[slot] > dp->max_age;
+        if (drop)
+            continue;
+        dp->views[kept++] = dp->views[i];
+    }
+
+    dp->stats.overload += n - kept;
+    return kept;
+}
+
+/**
+ * Police the IPv4 frames among the first n views and close up the gaps
+ * left by those dropped. Other frames always pass.
+ *
+ * @return
+ *   Number of views left.
+ */
+static unsigned int datapath_police(struct datapath* dp, unsigned int n)
+{
+    uint32_t ips[DATAPATH_MAX_BATCH];
+    uint8_t ip_view[DATAPATH_MAX_BATCH], pass[DATAPATH_MAX_BATCH];
+    unsigned int i, k, m = 0, kept = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        const uint8_t* frame = dp->views[i].data;
+
+        if (dp->views[i].len >= IPV4_SRC_OFFSET + 4 &&
+            frame[ETH_TYPE_OFFSET] == 0x08 && frame[ETH_TYPE_OFFSET + 1] == 0x00)
+        {
+            memcpy(&ips[m], frame + IPV4_SRC_OFFSET, 4);
+            ip_view[m++] = i;
+        }
+    }
+
+    if (m == 0 || policer_run(dp->policer, ips, m, lat_tsc(), pass) == m)
+        return n;
+
+    for (i = 0, k = 0; i < n; i++)
+    {
+        if (k < m && ip_view[k] == i && !pass[k++])
+            continue;
+        dp->views[kept++] = dp->views[i];
+    }
+
+    dp->stats.policed += n - kept;
+    return kept;
+}
+
+/* Read both doorbells of class q and stamp what arrived */
+static void datapath_refresh(struct datapath* dp, struct datapath_class* q)
+{
+    q->rx.tail = nn_readl(q->rx_tail_db);
+    q->tx.head = nn_readl(q->tx_head_db);
+    dp->stats.mmio_reads += 2;
+
+    if (q->rx_tsc != NULL)
+        datapath_stamp_rx(dp, q);
+}
+
+/**
+ * Take up to dp->batch packets off the RX ring of class q into
+ * dp->views, after the first rx_skip, and run them past the capture
+ * tap, the overload policy and the policer. dp->actions are preset with
+ * the TX slots from tx_skip on. Nothing is popped or pushed yet.
+ *
+ * @param rx
+ *   Set to the number of RX slots taken.
+ * @return
+ *   Number of packets for the handler.
+ */
+static unsigned int datapath_take(struct datapath* dp, struct datapath_class* q,
+        uint32_t rx_skip, uint32_t tx_skip, unsigned int* rx)
+{
+    uint32_t entry_size = q->rx.entry_size;
+    unsigned int i, n;
+    uint32_t free;
+
+    *rx = 0;
+    n = ringbuffer_count(&q->rx) - rx_skip;
+    if (n == 0)
+        return 0;
+
+    /* Every packet may produce a TX frame: never take more than fits */
+    free = ringbuffer_free_count(&q->tx) - tx_skip;
+    if (n > free)
+        n = free;
+    if (n > dp->batch)
+        n = dp->batch;
+    if (n == 0)
+        return 0;
+
+    rte_rmb();      /* Read frames only after the RX tail */
+
+    if (dp->capture != NULL)
+    {
+        uint64_t now = lat_tsc();
+
+        for (i = 0; i < n; i++)
+        {
+            void* entry = ringbuffer_front_at(&q->rx, rx_skip + i);
+            uint32_t slot = ((const char*) entry - (const char*) q->rx.base_addr) / entry_size;
+
+            capture_tap(dp->capture, ringbuffer_frame(&q->rx, entry),
+                ringbuffer_frame_len(&q->rx, entry),
+                q->rx_tsc != NULL ? q->rx_tsc[slot] : now);
+        }
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        void* entry = ringbuffer_front_at(&q->rx, rx_skip + i);
+
+        dp->views[i].data = ringbuffer_frame(&q->rx, entry);
+        dp->views[i].len = ringbuffer_frame_len(&q->rx, entry);
+        dp->views[i].slot = (char*) entry - (char*) q->rx.base_addr;
+        dp->views[i].payload = NULL;
+        dp->views[i].payload_len = dp->payload_size;
+        if (dp->payload_size != 0)
+            dp->views[i].payload = dp->rx_payload +
+                dp->views[i].slot / entry_size * dp->payload_size;
+        __builtin_prefetch(entry);
+    }
+
+    /* From here on n counts what the handler sees, rx what was received */
+    *rx = n;
+    if (dp->overload != DATAPATH_OVERLOAD_WAIT)
+        n = datapath_shed(dp, q, n);
+    if (dp->policer != NULL)
+        n = datapath_police(dp, n);
+
+    for (i = 0; i < n; i++)
+    {
+        dp->actions[i].verdict = PKT_FORWARD;
+        dp->actions[i].data = NULL;
+        dp->actions[i].tx = ringbuffer_frame(&q->tx, ringbuffer_back_at(&q->tx, tx_skip + i));
+        dp->actions[i].tx_size = entry_size - q->rx.hdr_size;
+        dp->actions[i].len = dp->views[i].len;
+    }
+
+    return n;
+}
+
+/**
+ * Write the TX frames for the n actions in dp->actions, then retire rx
+ * RX slots and publish both rings.
+ *
+ * @return
+ *   Number of TX frames pushed.
+ */
+static unsigned int datapath_emit(struct datapath* dp, struct datapath_class* q,
+        unsigned int n, unsigned int rx)
+{
+    uint32_t entry_size = q->rx.entry_size;
+    uint32_t hdr_size = q->rx.hdr_size;
+    uint32_t max_len = entry_size - hdr_size;
+    unsigned int i, next, run, tx = 0;
+
+    for (i = 0; i < n; i = next)
+    {
+        const struct pkt_action* act = &dp->actions[i];
+        const void* src;
+        void* dst = ringbuffer_back_at(&q->tx, tx);
+        uint32_t len = act->len < max_len ? act->len : max_len;
+
+        next = i + 1;
+
+        switch (act->verdict)
+        {
+            case PKT_FORWARD:
+                src = dp->views[i].data;
+                if (hdr_size != 0)
+                {
+                    /* Header and frame at once, from the line-aligned slot */
+                    src = (const char*) src - hdr_size;
+                    ringbuffer_set_frame_len((void*) src, len);
+                    len += hdr_size;
+                }
+                else if (len == entry_size)
+                {
+                    run = datapath_forward_run(dp, q, i, n, dst);
+                    next = i + run;
+                    if (run > 1)
+                    {
+                        dp->copy.copy_any_nt(dst, src, run * entry_size);
+                        datapath_copy_payloads(dp, i, tx, run);
+                        tx += run;
+                        continue;
+                    }
+                }
+                break;
+            case PKT_TRANSMIT:
+                src = act->data;
+                if (hdr_size != 0)
+                {
+                    ringbuffer_set_frame_len(dst, len);
+                    dp->copy.copy_any((char*) dst + hdr_size, src, len);
+                    tx++;
+                    continue;
+                }
+                break;
+            case PKT_TX_SLOT:
+                /* Already in place unless an earlier packet was dropped */
+                if (ringbuffer_frame(&q->tx, dst) != act->tx)
+                    memmove(ringbuffer_frame(&q->tx, dst), act->tx, len);
+                if (hdr_size != 0)
+                    ringbuffer_set_frame_len(dst, len);
+                datapath_copy_payloads(dp, i, tx, 1);
+                tx++;
+                continue;
+            default:
+                dp->stats.dropped++;
+                continue;
+        }
+
+        if (len == entry_size)
+            dp->copy.copy_nt(dst, src, len);
+        else
+            dp->copy.copy_any_nt(dst, src, len);
+        datapath_copy_payloads(dp, i, tx, 1);
+        tx++;
+    }
+
+    /* Non-temporal stores are not ordered by rte_io_wmb() */
+    if (tx > 0)
+        pkt_copy_fence();
+
+    ringbuffer_pop_n(&q->rx, rx);
+    ringbuffer_push_n(&q->tx, tx);
+
+    rte_io_wmb();   /* Frames before doorbells */
+
+    if (tx > 0)
+        nn_writel(q->tx.tail, q->tx_tail_db);
+    nn_writel(q->rx.head, q->rx_head_db);
+    dp->stats.mmio_writes += 1 + (tx > 0);
+
+    if (q->latency != NULL && tx > 0)
+    {
+        uint64_t now = lat_tsc();
+
+        for (i = 0; i < n; i++)
+        {
+            if (dp->actions[i].verdict == PKT_DROP)
+                continue;
+            lat_recorder_record(q->latency,
+                now - q->rx_tsc[dp->views[i].slot / entry_size]);
+        }
+    }
+
+    q->rx_packets += rx;
+    q->tx_packets += tx;
+    dp->stats.rx_packets += rx;
+    dp->stats.tx_packets += tx;
+    dp->stats.batches++;
+
+    return tx;
+}
+
+/* One batch from the rings of class q */
+static unsigned int datapath_poll_class(struct datapath* dp, struct datapath_class* q)
+{
+    unsigned int n, rx;
+
+    datapath_refresh(dp, q);
+
+    n = datapath_take(dp, q, 0, 0, &rx);
+    if (rx == 0)
+        return 0;
+
+    dp->handler->process(dp->handler_ctx, dp->views, dp->actions, n);
+    datapath_emit(dp, q, n, rx);
+
+    return rx;
+}
+
+/**
+ * Dispatcher: retire the bursts the workers have finished, in order,
+ * then hand out the next one.
+ */
+static unsigned int datapath_poll_dispatch(struct datapath* dp)
+{
+    struct datapath_class* q = &dp->cls[0];
+    struct datapath_burst* b;
+    unsigned int n, rx;
+
+    datapath_refresh(dp, q);
+
+    while (dp->burst_tail != dp->burst_head)
+    {
+        b = &dp->bursts[dp->burst_tail & (DATAPATH_MAX_INFLIGHT - 1)];
+        if (!__atomic_load_n(&b->job.done, __ATOMIC_ACQUIRE))
+            break;
+
+        dp->views = b->views;
+        dp->actions = b->actions;
+
+        /*
+         * Dropped packets leave the tail short of the burst's slots, but
+         * later bursts keep the slots they were given: a worker may be
+         * building frames in them. The gap is only free once none is out.
+         */
+        dp->tx_reserved -= datapath_emit(dp, q, b->job.count, b->rx);
+        dp->rx_pending -= b->rx;
+        dp->burst_tail++;
+        if (dp->burst_tail == dp->burst_head)
+            dp->tx_reserved = 0;
+    }
+
+    if (dp->burst_head - dp->burst_tail == DATAPATH_MAX_INFLIGHT)
+        return 0;
+
+    b = &dp->bursts[dp->burst_head & (DATAPATH_MAX_INFLIGHT - 1)];
+    dp->views = b->views;
+    dp->actions = b->actions;
+    n = datapath_take(dp, q, dp->rx_pending, dp->tx_reserved, &rx);
+    if (rx == 0)
+        return 0;
+
+    b->rx = rx;
+    b->job.views = b->views;
+    b->job.actions = b->actions;
+    b->job.count = n;
+
+    /*
+     * Nothing left for a worker: retire it in turn all the same. The
+     * queues hold DATAPATH_MAX_INFLIGHT jobs, so they are never full, but
+     * if one were the burst is handled here.
+     */
+    if (n == 0 || dispatch_submit(dp->dispatch, &b->job))
+    {
+        dp->handler->process(dp->handler_ctx, b->views, b->actions, n);
+        b->job.done = 1;
+    }
+
+    dp->rx_pending += rx;
+    dp->tx_reserved += n;
+    dp->burst_head++;
+
+    return rx;
+}
+
+/**
+ * Strict priority: the most urgent class with packets, except that a
+ * class passed over tc->guard times in a row is tried first.
+ */
+static unsigned int datapath_poll_strict(struct datapath* dp)
+{
+    unsigned int c, k, n;
+
+    for (c = 1; dp->tc->guard != 0 && c < dp->num_classes; c++)
+    {
+        if (dp->cls[c].passed < dp->tc->guard)
+            continue;
+        dp->cls[c].passed = 0;
+        n = datapath_poll_class(dp, &dp->cls[c]);
+        if (n > 0)
+            return n;
+    }
+
+    for (c = 0; c < dp->num_classes; c++)
+    {
+        dp->cls[c].passed = 0;
+        n = datapath_poll_class(dp, &dp->cls[c]);
+        if (n > 0)
+        {
+            for (k = c + 1; k < dp->num_classes; k++)
+                dp->cls[k].passed++;
+            return n;
+        }
+    }
+
+    return 0;
+}
+
+/* Weighted round robin: up to weight non-empty batches per turn */
+static unsigned int datapath_poll_wrr(struct datapath* dp)
+{
+    struct datapath_class* q;
+    unsigned int tries, n;
+
+    for (tries = 0; tries < dp->num_classes; tries++)
+    {
+        q = &dp->cls[dp->wrr_next];
+        if (q->credit == 0)
+            q->credit = q->weight;
+
+        n = datapath_poll_class(dp, q);
+        if (n == 0 || --q->credit == 0)
+        {
+            q->credit = 0;
+            if (++dp->wrr_next == dp->num_classes)
+                dp->wrr_next = 0;
+        }
+        if (n > 0)
+            return n;
+    }
+
+    return 0;
+}
+
+unsigned int datapath_poll(struct datapath* dp)
+{
+    if (dp->dispatch != NULL)
+        return datapath_poll_dispatch(dp);
+
+    if (dp->num_classes == 1)
+        return datapath_poll_class(dp, &dp->cls[0]);
+
+    if (dp->tc->sched == TC_SCHED_WRR)
+        return datapath_poll_wrr(dp);
+    return datapath_poll_strict(dp);
+}
+
+unsigned int datapath_generate(struct datapath* dp, struct pkt_gen* gen)
+{
+    struct datapath_class* q = &dp->cls[0];
+    unsigned int i, n, rx, room;
+
+    q->rx.tail = nn_readl(q->rx_tail_db);
+    q->tx.head = nn_readl(q->tx_head_db);
+    dp->stats.mmio_reads += 2;
+
+    room = ringbuffer_free_count(&q->tx);
+    if (room > dp->batch)
+        room = dp->batch;
+
+    n = pkt_gen_due(gen, room, lat_tsc());
+    rx = ringbuffer_count(&q->rx);
+    if (n == 0 && rx == 0)
+        return 0;
+
+    for (i = 0; i < n; i++)
+    {
+        void* entry = ringbuffer_back_at(&q->tx, i);
+
+        if (q->tx.hdr_size != 0)
+            ringbuffer_set_frame_len(entry, gen->size);
+        pkt_gen_write(gen, ringbuffer_frame(&q->tx, entry));
+    }
+
+    if (n > 0)
+        pkt_copy_fence();
+
+    ringbuffer_pop_n(&q->rx, rx);
+    ringbuffer_push_n(&q->tx, n);
+
+    rte_io_wmb();   /* Frames before doorbells */
+
+    if (n > 0)
+        nn_writel(q->tx.tail, q->tx_tail_db);
+    if (rx > 0)
+        nn_writel(q->rx.head, q->rx_head_db);
+    dp->stats.mmio_writes += (n > 0) + (rx > 0);
+
+    q->rx_packets += rx;
+    q->tx_packets += n;
+    dp->stats.rx_packets += rx;
+    dp->stats.dropped += rx;
+    dp->stats.tx_packets += n;
+    dp->stats.batches++;
+
+    return n;
+}
+
+/* Everything the firmware took in has been served and sent back out */
+static int datapath_drained(struct datapath* dp)
+{
+    struct datapath_class* q;
+    unsigned int c;
+
+    /* Busy contexts publish their RX tail before they count themselves out */
+    if (nn_readl(&dp->meta->rx_busy) != 0 || dp->burst_head != dp->burst_tail)
+        return 0;
+
+    for (c = 0; c < dp->num_classes; c++)
+    {
+        q = &dp->cls[c];
+        if (nn_readl(q->rx_tail_db) != q->rx.head || nn_readl(q->tx_head_db) != q->tx.tail)
+            return 0;
+    }
+
+    return 1;
+}
+
+int datapath_restart(struct datapath* dp, uint32_t capacity)
+{
+    volatile struct device_meta_t* meta = dp->meta;
+    uint32_t entry_size = dp->cls[0].rx.entry_size;
+    uint32_t slots = capacity / entry_size;
+    uint64_t* stamps[RING_MAX_CLASSES][2] = { { NULL } };
+    uint8_t* late[RING_MAX_CLASSES] = { NULL };
+    uint64_t deadline;
+    struct datapath_class* q;
+    unsigned int c, k;
+    int ret = 0;
+
+    if (capacity % entry_size != 0 || slots < 2)
+    {
+        fprintf(stderr, "%s(): %u bytes is not 2 or more %u byte slots\n",
+            __func__, capacity, entry_size);
+        return -1;
+    }
+
+    /* Per-slot state for the new size, before anything is stopped */
+    for (c = 0; c < dp->num_classes; c++)
+    {
+        q = &dp->cls[c];
+        if (q->rx_tsc != NULL && (stamps[c][0] = calloc(slots, sizeof(uint64_t))) == NULL)
+            ret = -1;
+        if (q->rx_arrival != NULL && (stamps[c][1] = calloc(slots, sizeof(uint64_t))) == NULL)
+            ret = -1;
+        if (q->rx_late != NULL && (late[c] = calloc(slots, 1)) == NULL)
+            ret = -1;
+    }
+
+    /* Pause RX, then serve what the firmware still holds */
+    if (ret == 0)
+    {
+        nn_writeq(0, &meta->start_signal);
+        rte_mb();   /* The pause before reading who is busy */
+
+        deadline = lat_tsc() + DATAPATH_DRAIN_MS * 1000000ull * lat_tsc_per_ns();
+        while (!datapath_drained(dp))
+        {
+            if (lat_tsc() > deadline)
+            {
+                fprintf(stderr, "%s(): Rings did not drain, resuming\n", __func__);
+                nn_writeq(dp->generation, &meta->start_signal);
+                ret = -1;
+                break;
+            }
+            datapath_poll(dp);
+        }
+    }
+
+    if (ret)
+    {
+        for (c = 0; c < dp->num_classes; c++)
+        {
+            for (k = 0; k < 2; k++)
+                free(stamps[c][k]);
+            free(late[c]);
+        }
+        return -1;
+    }
+
+    /* Hold TX too while the rings are rewritten */
+    nn_writeq(RING_RESTARTING, &meta->start_signal);
+    rte_io_wmb();
+
+    for (c = 0; c < dp->num_classes; c++)
+    {
+        q = &dp->cls[c];
+        q->rx.capacity = q->tx.capacity = capacity;
+        q->rx.head = q->rx.tail = q->tx.head = q->tx.tail = 0;
+        q->rx_seen = 0;
+        q->last_poll = 0;
+        if (stamps[c][0] != NULL)
+        {
+            free(q->rx_tsc);
+            q->rx_tsc = stamps[c][0];
+        }
+        if (stamps[c][1] != NULL)
+        {
+            free(q->rx_arrival);
+            q->rx_arrival = stamps[c][1];
+        }
+        if (late[c] != NULL)
+        {
+            free(q->rx_late);
+            q->rx_late = late[c];
+        }
+    }
+
+    datapath_write_config(dp, meta);
+
+    rte_io_wmb();   /* Configuration before the new generation */
+
+    nn_writeq(++dp->generation, &meta->start_signal);
+    return 0;
+}
+
+void datapath_fini(struct datapath* dp)
+{
+    unsigned int c;
+
+    if (dp->handler != NULL && dp->handler->fini != NULL)
+        dp->handler->fini(dp->handler_ctx);
+    dp->handler = NULL;
+
+    dispatch_destroy(dp->dispatch);
+    free(dp->bursts);
+    dp->dispatch = NULL;
+    dp->bursts = NULL;
+
+    datapath_disable_latency(dp);
+    for (c = 0; c < dp->num_classes; c++)
+    {
+        free(dp->cls[c].rx_tsc);
+        free(dp->cls[c].rx_arrival);
+        free(dp->cls[c].rx_late);
+        dp->cls[c].rx_tsc = NULL;
+        dp->cls[c].rx_arrival = NULL;
+        dp->cls[c].rx_late = NULL;
+    }
+}
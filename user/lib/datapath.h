@@ -0,0 +1,335 @@
+#ifndef _DATAPATH_H_
+#define _DATAPATH_H_
+
+#include <stdint.h>
+
+#include "devcfg.h"
+#include "ring_buffer.h"
+#include "pkt_handler.h"
+#include "latency.h"
+#include "capture.h"
+#include "pkt_copy.h"
+#include "policer.h"
+#include "pkt_gen.h"
+#include "traffic_class.h"
+#include "dispatch.h"
+
+/**
+ * @file
+ * Host side of the device_meta_t RX/TX rings, driving a packet handler.
+ *
+ * Each poll reads the RX tail and TX head doorbells once, hands up to
+ * DATAPATH_MAX_BATCH packets to the handler, copies the resulting
+ * frames into the TX ring and publishes both rings with a single
+ * barrier and one write per doorbell. TX copies use non-temporal
+ * stores (pkt_copy.h), and runs of forwarded packets that wrap neither
+ * ring are copied at once. A batch is never larger than the
+ * free space in the TX ring, so backpressure stalls RX instead of
+ * dropping.
+ *
+ * With latency recording enabled, each packet is stamped with the TSC
+ * when the poll first sees it behind the RX tail, and the time from
+ * there until its TX tail is published goes into a histogram.
+ *
+ * If a capture tap is set, every received frame is offered to it before
+ * the handler sees it.
+ *
+ * If a policer is set, IPv4 frames over their source's rate are dropped
+ * after the capture tap and before the handler; the handler only sees
+ * what passed.
+ *
+ * Without an overload policy a slow handler stalls RX, and the firmware
+ * waits for ring space up to its own budget (rx_full_budget_us). With
+ * one, packets are stamped with the earliest time they can have
+ * arrived and those judged too old are dropped before the policer:
+ * tail drop discards packets that arrived while the oldest one queued
+ * had already waited max_age, oldest drop discards packets that have
+ * themselves waited max_age.
+ *
+ * With the header/payload split, frames are cut at the ring slot size:
+ * the header part lands in the ring slot and the rest in a payload slot
+ * at the same index of a separate payload ring. Only the compact header
+ * ring is touched by the handler; payloads are copied from RX to TX
+ * payload slots without being read on the way.
+ *
+ * With variable-length slots, entry_size is the largest slot and each
+ * frame carries its own length in the slot header (see devcfg.h). The
+ * handler sees the frame after the header, and only the bytes present
+ * are copied to TX.
+ *
+ * With workers (datapath_set_workers()), the handler runs on other
+ * threads (dispatch.h). The poller takes bursts off the RX ring as
+ * before, reserves a TX slot per packet and hands each burst to a
+ * worker, keeping up to DATAPATH_MAX_INFLIGHT bursts out. Bursts form
+ * a reorder buffer: each is retired (TX frames written, RX slots
+ * released, doorbells rung) only once it and every burst before it are
+ * done, so both rings still advance in arrival order. Frames built in
+ * action.tx are moved back over the slots of dropped packets, as in a
+ * single batch; the slots a burst reserved stay out of reach of later
+ * bursts until no burst is out. PKT_TRANSMIT data must stay valid until
+ * the burst is retired.
+ *
+ * The rings can be resized while running (datapath_restart()): RX is
+ * paused, everything in flight is served, and the firmware reloads the
+ * configuration without being restarted (see device_meta_t). A new
+ * process can also take over running rings as they are
+ * (datapath_attach()).
+ *
+ * With traffic classes (traffic_class.h) there is one RX/TX ring pair
+ * per class, each with its own doorbells and latency histogram. Each
+ * poll serves one class, chosen by strict priority or weighted round
+ * robin; a packet always leaves on the TX ring of the class it came in
+ * on.
+ */
+
+#define DATAPATH_MAX_BATCH      32
+#define DATAPATH_MAX_INFLIGHT   16      /* Bursts with the workers, power of two */
+#define DATAPATH_DRAIN_MS       1000    /* Restart gives up draining after this */
+
+enum datapath_overload
+{
+    DATAPATH_OVERLOAD_WAIT,     /*> Backpressure only */
+    DATAPATH_OVERLOAD_TAIL,     /*> Drop arrivals while the queue is too old */
+    DATAPATH_OVERLOAD_OLDEST,   /*> Drop packets that waited too long */
+};
+
+struct datapath_stats
+{
+    uint64_t rx_packets;        /*> Packets taken off the RX ring */
+    uint64_t tx_packets;        /*> Packets written to the TX ring */
+    uint64_t dropped;           /*> PKT_DROP verdicts; RX when generating */
+    uint64_t policed;           /*> Dropped by the policer */
+    uint64_t overload;          /*> Dropped by the overload policy */
+    uint64_t batches;           /*> Non-empty polls */
+    uint64_t mmio_reads;        /*> Doorbell reads */
+    uint64_t mmio_writes;       /*> Doorbell writes */
+};
+
+/* Ring pair of one traffic class */
+struct datapath_class
+{
+    struct ringbuffer_t rx;
+    struct ringbuffer_t tx;
+    volatile void* rx_head_db;              /*> Doorbells in device_meta_t */
+    volatile void* rx_tail_db;
+    volatile void* tx_head_db;
+    volatile void* tx_tail_db;
+    uint64_t rx_iova;
+    uint64_t tx_iova;
+    struct lat_recorder* latency;           /*> NULL unless enabled */
+    uint64_t* rx_tsc;                       /*> Arrival TSC per RX slot */
+    uint64_t* rx_arrival;                   /*> Overload: earliest arrival TSC */
+    uint8_t* rx_late;                       /*> Tail drop: arrived too late */
+    uint64_t last_poll;                     /*> Overload: TSC of the last poll */
+    uint32_t rx_seen;                       /*> RX tail already stamped */
+    uint32_t weight;                        /*> WRR: batches per turn */
+    uint32_t credit;                        /*> WRR: batches left this turn */
+    uint32_t passed;                        /*> Strict: polls passed over */
+    uint64_t rx_packets;
+    uint64_t tx_packets;
+};
+
+/* A burst handed to a worker, in the reorder buffer */
+struct datapath_burst
+{
+    struct dispatch_job job;
+    unsigned int rx;                        /*> RX slots taken */
+    struct pkt_view views[DATAPATH_MAX_BATCH];
+    struct pkt_action actions[DATAPATH_MAX_BATCH];
+};
+
+struct datapath
+{
+    volatile struct device_meta_t* meta;    /*> Firmware config (CLS) */
+    struct datapath_class cls[RING_MAX_CLASSES];
+    uint32_t num_classes;
+    const struct tc_config* tc;             /*> NULL with one class */
+    uint32_t wrr_next;                      /*> WRR: class whose turn it is */
+    const struct pkt_handler* handler;
+    void* handler_ctx;
+    uint32_t batch;                         /*> Max packets per poll */
+    struct pkt_copy_ops copy;               /*> TX copy kernels */
+    struct datapath_stats stats;
+    struct pkt_view* views;                 /*> Batch in hand */
+    struct pkt_action* actions;
+    struct pkt_view view_buf[DATAPATH_MAX_BATCH];
+    struct pkt_action action_buf[DATAPATH_MAX_BATCH];
+    struct capture* capture;                /*> NULL unless capturing */
+    struct policer* policer;                /*> NULL unless policing */
+    enum datapath_overload overload;
+    uint64_t max_age;                       /*> Overload threshold, TSC ticks */
+    uint32_t rx_full_budget_us;             /*> Firmware overload budget */
+    uint8_t* rx_payload;                    /*> Payload slots; NULL unless split */
+    uint8_t* tx_payload;
+    uint64_t rx_payload_iova;
+    uint64_t tx_payload_iova;
+    uint32_t payload_size;                  /*> Bytes per payload slot */
+    struct dispatch* dispatch;              /*> NULL unless using workers */
+    struct datapath_burst* bursts;          /*> Reorder buffer */
+    uint32_t burst_head;                    /*> Bursts submitted */
+    uint32_t burst_tail;                    /*> Bursts retired */
+    uint32_t rx_pending;                    /*> RX slots in unretired bursts */
+    uint32_t tx_reserved;                   /*> TX slots from the tail to their last */
+    uint64_t generation;                    /*> Last start_signal written */
+};
+
+/**
+ * Set up the rings and the handler.
+ *
+ * @param rx_base, tx_base
+ *   Host virtual addresses of the ring buffers.
+ * @param capacity, entry_size
+ *   Ring size and slot size in bytes, as given to the firmware.
+ * @param handler_args
+ *   Passed to the handler's init().
+ * @return
+ *   0 on success, -1 if the handler fails to initialise.
+ */
+int datapath_init(struct datapath* dp, volatile struct device_meta_t* meta,
+        void* rx_base, void* tx_base, uint32_t capacity, uint32_t entry_size,
+        const struct pkt_handler* handler, const char* handler_args);
+
+/**
+ * Hand the rings to the firmware and raise start_signal. Firmware left
+ * running by an earlier process is held first, and moves to a new
+ * generation.
+ *
+ * @param rx_iova, tx_iova
+ *   IO addresses of the ring buffers.
+ */
+void datapath_start(struct datapath* dp, uint64_t rx_iova, uint64_t tx_iova);
+
+/**
+ * Take over rings the firmware is still running for a previous process,
+ * in place of datapath_start(): the configuration must be the one
+ * datapath_start() would write, and the rings carry on from the
+ * indices in device_meta_t, frames queued in them included. Set up the
+ * datapath as the previous process had it first.
+ *
+ * @param rx_iova, tx_iova
+ *   IO addresses of the ring buffers.
+ * @param rx_head, tx_tail
+ *   Per class, the host's doorbells as the previous process left them.
+ * @return
+ *   0 on success, -1 if the firmware is stopped, runs another
+ *   configuration or the host's doorbells moved; nothing is changed,
+ *   and datapath_start() can start the rings over.
+ */
+int datapath_attach(struct datapath* dp, uint64_t rx_iova, uint64_t tx_iova,
+        const uint32_t* rx_head, const uint32_t* tx_tail);
+
+/**
+ * Drain the rings and restart the firmware on them with a new size,
+ * without reloading it. Frames arriving meanwhile are dropped by the
+ * firmware (RX_DROP_PAUSED). Call on the polling thread; not in
+ * generator mode.
+ *
+ * @param capacity
+ *   New size of every ring in bytes, a multiple of the slot size; each
+ *   ring buffer (and payload ring) must have room for it.
+ * @return
+ *   0 on success, -1 if the size is invalid, on allocation failure or
+ *   if the rings do not drain within DATAPATH_DRAIN_MS. On failure the
+ *   rings carry on as they were.
+ */
+int datapath_restart(struct datapath* dp, uint32_t capacity);
+
+/**
+ * Split frames between the rings and payload rings: the first
+ * entry_size bytes of each frame in its ring slot, the next
+ * payload_size bytes in the payload slot at the same index. Call before
+ * datapath_start().
+ *
+ * @param rx_payload, tx_payload
+ *   Host virtual addresses of the payload rings, one payload_size slot
+ *   per ring slot.
+ * @param rx_payload_iova, tx_payload_iova
+ *   Their IO addresses.
+ */
+void datapath_set_split(struct datapath* dp, void* rx_payload, void* tx_payload,
+        uint64_t rx_payload_iova, uint64_t tx_payload_iova, uint32_t payload_size);
+
+/**
+ * Use variable-length slots (RING_F_VARLEN) in both rings. Call before
+ * datapath_start(); not with the header/payload split.
+ *
+ * @return
+ *   0 on success, -1 if the slots cannot hold a frame header.
+ */
+int datapath_set_varlen(struct datapath* dp);
+
+/**
+ * Serve tc->classes ring pairs. Class 0 keeps the rings given to
+ * datapath_init(); the others are given here, the same size. Call
+ * before datapath_enable_latency() and datapath_start(); not with the
+ * header/payload split or generator mode.
+ *
+ * @param tc
+ *   Classification and scheduling, kept by reference.
+ * @param rx_bases, tx_bases, rx_iovas, tx_iovas
+ *   Rings of classes 1 to tc->classes - 1, indexed from 0.
+ * @return
+ *   0 on success, -1 if the split is on.
+ */
+int datapath_set_classes(struct datapath* dp, const struct tc_config* tc,
+        void* const* rx_bases, void* const* tx_bases,
+        const uint64_t* rx_iovas, const uint64_t* tx_iovas);
+
+/**
+ * Run the handler on worker threads instead of the polling thread.
+ * Call before datapath_start(); not with traffic classes or generator
+ * mode.
+ *
+ * @param handler_args
+ *   Passed to the handler's init() for each worker.
+ * @return
+ *   0 on success, -1 on failure.
+ */
+int datapath_set_workers(struct datapath* dp, unsigned int workers,
+        const char* handler_args);
+
+/**
+ * Record RX-visible to TX-published latency in each class's latency
+ * recorder, in TSC ticks. Call before datapath_start().
+ *
+ * @return
+ *   0 on success, -1 on allocation failure.
+ */
+int datapath_enable_latency(struct datapath* dp);
+
+/**
+ * Bound how long packets wait when the handler falls behind. Call after
+ * datapath_set_classes() and before datapath_start().
+ *
+ * @param rx_full_budget_us
+ *   How long the firmware holds a frame for a full RX ring before it
+ *   drops it; 0 to hold it until there is space.
+ * @param policy, max_age
+ *   Host-side policy and its threshold in TSC ticks.
+ * @return
+ *   0 on success, -1 on allocation failure.
+ */
+int datapath_set_overload(struct datapath* dp, uint32_t rx_full_budget_us,
+        enum datapath_overload policy, uint64_t max_age);
+
+/**
+ * Process one batch, from the class the scheduler picks.
+ *
+ * @return
+ *   Number of packets received.
+ */
+unsigned int datapath_poll(struct datapath* dp);
+
+/**
+ * Generator mode, in place of datapath_poll(): fill the free TX slots
+ * with what the generator has due, and drain and discard whatever
+ * arrived on RX, so the TX path is measured on its own.
+ *
+ * @return
+ *   Number of packets generated.
+ */
+unsigned int datapath_generate(struct datapath* dp, struct pkt_gen* gen);
+
+void datapath_fini(struct datapath* dp);
+
+#endif /* _DATAPATH_H_ */
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_atomic.h>
+
+#include "io.h"
+#include "debug_ring.h"
+
+#define CEIL(X, Y)  (((X) + (Y) - 1) / (Y))
+
+int debug_ring_open(struct debug_ring* dr, struct nfp_rtsym_table* rtbl,
+        const char* ring_sym, const char* idx_sym)
+{
+    memset(dr, 0, sizeof(*dr));
+
+    if (ring_sym == NULL)
+        ring_sym = DEBUG_RING_SYMBOL;
+    if (idx_sym == NULL)
+        idx_sym = DEBUG_RING_IDX_SYMBOL;
+
+    dr->ring = (volatile uint32_t*) nfp_rtsym_map(rtbl, ring_sym,
+                    DEBUG_RING_WORDS * sizeof(uint32_t), &dr->ring_area);
+    dr->idx = (volatile uint32_t*) nfp_rtsym_map(rtbl, idx_sym,
+                    sizeof(uint32_t), &dr->idx_area);
+    if (dr->ring == NULL || dr->idx == NULL)
+    {
+        fprintf(stderr, "%s(): Cannot map %s/%s\n", __func__, ring_sym, idx_sym);
+        debug_ring_close(dr);
+        return -1;
+    }
+
+    dr->buf = malloc(DEBUG_RING_WORDS * sizeof(uint32_t));
+    if (dr->buf == NULL)
+    {
+        debug_ring_close(dr);
+        return -1;
+    }
+
+    /* Only report what is logged from now on */
+    dr->next = dr->claimed = nn_readl(dr->idx);
+
+    return 0;
+}
+
+void debug_ring_close(struct debug_ring* dr)
+{
+    if (dr->ring_area != NULL)
+        nfp_cpp_area_release_free(dr->ring_area);
+    if (dr->idx_area != NULL)
+        nfp_cpp_area_release_free(dr->idx_area);
+    free(dr->buf);
+    memset(dr, 0, sizeof(*dr));
+}
+
+/* Copy words [from, from + count) of the ring, unwrapping into buf */
+static void debug_ring_copy(struct debug_ring* dr, uint32_t from, uint32_t count)
+{
+    uint32_t start = from % DEBUG_RING_WORDS;
+    uint32_t first = count;
+
+    if (first > DEBUG_RING_WORDS - start)
+        first = DEBUG_RING_WORDS - start;
+
+    memcpy(dr->buf, (const void*) (dr->ring + start), first * sizeof(uint32_t));
+    if (count > first)
+        memcpy(dr->buf + first, (const void*) dr->ring,
+            (count - first) * sizeof(uint32_t));
+}
+
+/* Decode buf[off, avail), whose first word is word from of the ring */
+static int debug_ring_decode(struct debug_ring* dr, uint32_t from, uint32_t off,
+        uint32_t avail, debug_ring_cb cb, void* arg)
+{
+    struct debug_record rec;
+    int n = 0;
+
+    while (off + DEBUG_RECORD_WORDS <= avail)
+    {
+        const uint32_t* w = dr->buf + off;
+        uint32_t words = DEBUG_RECORD_WORDS;
+
+        memset(&rec, 0, sizeof(rec));
+        rec.idx = from + off;
+
+        if (w[0] == DEBUG_MEM_MAGIC &&
+            DEBUG_RECORD_WORDS * (1 + CEIL(w[3], 16)) <= avail - off)
+        {
+            rec.type = DEBUG_RECORD_MEM;
+            rec.addr = ((uint64_t) w[1] << 32) | w[2];
+            rec.len = w[3];
+            rec.data = (const uint8_t*) (w + DEBUG_RECORD_WORDS);
+            words = DEBUG_RECORD_WORDS * (1 + CEIL(rec.len, 16));
+        }
+        else
+        {
+            rec.type = DEBUG_RECORD_PLAIN;
+            memcpy(rec.words, w, sizeof(rec.words));
+        }
+
+        cb(&rec, arg);
+        off += words;
+        n++;
+    }
+
+    return n;
+}
+
+int debug_ring_poll(struct debug_ring* dr, debug_ring_cb cb, void* arg)
+{
+    uint32_t end, avail, off = 0, lapped;
+    int n;
+
+    /*
+     * Records claimed before the previous poll are complete by now;
+     * the ones claimed since are left for the next poll.
+     */
+    end = dr->claimed;
+    dr->claimed = nn_readl(dr->idx);
+
+    avail = end - dr->next;
+    if (avail == 0)
+        return 0;
+
+    if (avail > DEBUG_RING_WORDS)
+    {
+        dr->lost_words += avail - DEBUG_RING_WORDS;
+        dr->next = end - DEBUG_RING_WORDS;
+        avail = DEBUG_RING_WORDS;
+    }
+
+    debug_ring_copy(dr, dr->next, avail);
+    rte_rmb();
+
+    /* Drop whatever the firmware overwrote while we were copying */
+    lapped = nn_readl(dr->idx) - DEBUG_RING_WORDS - dr->next;
+    if ((int32_t) lapped > 0)
+    {
+        off = lapped < avail ? lapped : avail;
+        dr->lost_words += off;
+    }
+
+    n = debug_ring_decode(dr, dr->next, off, avail, cb, arg);
+
+    dr->next = end;
+    dr->records += n;
+
+    return n;
+}
+
+int debug_ring_recent(struct debug_ring* dr, unsigned int records, debug_ring_cb cb,
+        void* arg)
+{
+    uint32_t end, avail;
+
+    end = nn_readl(dr->idx);
+    avail = records * DEBUG_RECORD_WORDS;
+    if (avail > DEBUG_RING_WORDS)
+        avail = DEBUG_RING_WORDS;
+    if (avail > end)
+        avail = end;
+    if (avail == 0)
+        return 0;
+
+    debug_ring_copy(dr, end - avail, avail);
+    rte_rmb();
+
+    return debug_ring_decode(dr, end - avail, 0, avail, cb, arg);
+}
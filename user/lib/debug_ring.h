@@ -0,0 +1,93 @@
+#ifndef _DEBUG_RING_H_
+#define _DEBUG_RING_H_
+
+#include <stdint.h>
+
+#include "nfp_cpp.h"
+#include "nfp_rtsym.h"
+
+/**
+ * @file
+ * Host-side reader for the firmware DEBUG()/DEBUG_MEM() ring
+ * (firmware/debug.h).
+ *
+ * The firmware claims space by atomically adding to debug_idx (in
+ * words) and then writes 16-byte records at debug[idx % ring size].
+ * Each poll reads debug_idx once and copies only the words added since
+ * the previous poll. A record is only decoded one poll after it was
+ * claimed, so that the firmware has finished writing it; records that
+ * were overwritten before they could be read are counted as lost.
+ */
+
+#define DEBUG_RING_SYMBOL       "_debug"
+#define DEBUG_RING_IDX_SYMBOL   "_debug_idx"
+
+#define DEBUG_RING_WORDS        (1024 * 64)     /*> As in firmware/debug.h */
+#define DEBUG_RECORD_WORDS      4
+#define DEBUG_MEM_MAGIC         0x87654321
+
+enum debug_record_type
+{
+    DEBUG_RECORD_PLAIN,     /*> DEBUG(a, b, c, d) */
+    DEBUG_RECORD_MEM,       /*> DEBUG_MEM(addr, len) */
+};
+
+struct debug_record
+{
+    enum debug_record_type type;
+    uint32_t idx;           /*> Value of debug_idx the record was claimed at */
+    uint32_t words[4];      /*> Plain record */
+    uint64_t addr;          /*> DEBUG_MEM: dumped address */
+    uint32_t len;           /*> DEBUG_MEM: dumped length in bytes */
+    const uint8_t* data;    /*> DEBUG_MEM: dumped bytes (valid during callback) */
+};
+
+typedef void (*debug_ring_cb)(const struct debug_record* rec, void* arg);
+
+struct debug_ring
+{
+    volatile uint32_t* ring;            /*> debug[] through the BAR */
+    volatile uint32_t* idx;             /*> debug_idx through the BAR */
+    struct nfp_cpp_area* ring_area;
+    struct nfp_cpp_area* idx_area;
+    uint32_t* buf;                      /*> Local copy of new words */
+    uint32_t next;                      /*> Next word index to decode */
+    uint32_t claimed;                   /*> debug_idx seen at last poll */
+    uint64_t records;                   /*> Records decoded */
+    uint64_t lost_words;                /*> Words overwritten before read */
+};
+
+/**
+ * Map the debug ring symbols and start reading from the current index.
+ *
+ * @param ring_sym, idx_sym
+ *   Symbol names; NULL selects DEBUG_RING_SYMBOL/DEBUG_RING_IDX_SYMBOL.
+ * @return
+ *   0 on success, -1 if a symbol cannot be mapped.
+ */
+int debug_ring_open(struct debug_ring* dr, struct nfp_rtsym_table* rtbl,
+        const char* ring_sym, const char* idx_sym);
+
+/**
+ * Decode records added since the previous poll.
+ *
+ * @return
+ *   Number of records passed to cb.
+ */
+int debug_ring_poll(struct debug_ring* dr, debug_ring_cb cb, void* arg);
+
+/**
+ * Decode the last records claimed, for a snapshot, without moving the
+ * position of debug_ring_poll(). The newest may still be in the
+ * firmware's hands, and a DEBUG_MEM dump cut at the start shows as
+ * plain records.
+ *
+ * @return
+ *   Number of records passed to cb.
+ */
+int debug_ring_recent(struct debug_ring* dr, unsigned int records, debug_ring_cb cb,
+        void* arg);
+
+void debug_ring_close(struct debug_ring* dr);
+
+#endif /* _DEBUG_RING_H_ */
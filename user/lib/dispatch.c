@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "dispatch.h"
+
+/* Empty polls before an idle worker yields its CPU */
+#define DISPATCH_SPIN           1024
+
+static inline void dispatch_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static void* dispatch_main(void* arg)
+{
+    struct dispatch_worker* w = arg;
+    struct dispatch* d = w->dispatch;
+    struct dispatch_job* job;
+    unsigned int idle = 0;
+    uint32_t tail = w->tail;
+
+    while (1)
+    {
+        if (tail == __atomic_load_n(&w->head, __ATOMIC_ACQUIRE))
+        {
+            if (d->stop)
+                break;
+            if (++idle < DISPATCH_SPIN)
+                dispatch_pause();
+            else
+                sched_yield();
+            continue;
+        }
+        idle = 0;
+
+        job = w->queue[tail & (DISPATCH_QUEUE_SIZE - 1)];
+        d->handler->process(w->handler_ctx, job->views, job->actions, job->count);
+        w->jobs++;
+        w->packets += job->count;
+
+        /* Actions before done, and done before the slot is reused */
+        __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&w->tail, ++tail, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+struct dispatch* dispatch_create(unsigned int workers,
+        const struct pkt_handler* handler, const char* handler_args)
+{
+    struct dispatch* d;
+    struct dispatch_worker* w;
+    unsigned int i;
+
+    if (workers == 0 || workers > DISPATCH_MAX_WORKERS)
+    {
+        fprintf(stderr, "%s(): 1 to %d workers\n", __func__, DISPATCH_MAX_WORKERS);
+        return NULL;
+    }
+
+    if (handler->stateful)
+    {
+        fprintf(stderr, "%s(): Handler %s keeps state across packets\n", __func__,
+            handler->name);
+        return NULL;
+    }
+
+    if (posix_memalign((void**) &d, 64, sizeof(*d)))
+        return NULL;
+    memset(d, 0, sizeof(*d));
+    d->handler = handler;
+
+    for (i = 0; i < workers; i++)
+    {
+        w = &d->worker[i];
+        w->dispatch = d;
+
+        if (handler->init != NULL && handler->init(&w->handler_ctx, handler_args))
+        {
+            fprintf(stderr, "%s(): Handler %s failed to initialise\n", __func__,
+                handler->name);
+            break;
+        }
+
+        if (pthread_create(&w->thread, NULL, dispatch_main, w))
+        {
+            fprintf(stderr, "%s(): Cannot start worker %u\n", __func__, i);
+            if (handler->fini != NULL)
+                handler->fini(w->handler_ctx);
+            break;
+        }
+        d->workers++;
+    }
+
+    if (d->workers < workers)
+    {
+        dispatch_destroy(d);
+        return NULL;
+    }
+
+    return d;
+}
+
+int dispatch_submit(struct dispatch* d, struct dispatch_job* job)
+{
+    struct dispatch_worker* w = &d->worker[d->next];
+    uint32_t head = w->head;
+
+    if (head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == DISPATCH_QUEUE_SIZE)
+        return -1;
+
+    job->done = 0;
+    w->queue[head & (DISPATCH_QUEUE_SIZE - 1)] = job;
+    __atomic_store_n(&w->head, head + 1, __ATOMIC_RELEASE);
+
+    if (++d->next == d->workers)
+        d->next = 0;
+
+    return 0;
+}
+
+void dispatch_destroy(struct dispatch* d)
+{
+    unsigned int i;
+
+    if (d == NULL)
+        return;
+
+    d->stop = 1;
+    for (i = 0; i < d->workers; i++)
+    {
+        pthread_join(d->worker[i].thread, NULL);
+        if (d->handler->fini != NULL)
+            d->handler->fini(d->worker[i].handler_ctx);
+    }
+
+    free(d);
+}
@@ -0,0 +1,80 @@
+#ifndef _DISPATCH_H_
+#define _DISPATCH_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "pkt_handler.h"
+
+/**
+ * @file
+ * Worker threads that run the packet handler on bursts handed over by
+ * the datapath's poller (datapath_set_workers()).
+ *
+ * Each worker has a single-producer/single-consumer queue of jobs fed
+ * by the poller, and its own handler context, so only handlers that
+ * are not stateful can be dispatched. Jobs go to the workers in turn.
+ * A worker marks a job done when the handler returns; the poller
+ * retires jobs in the order it submitted them, so completion order
+ * does not matter.
+ *
+ * Idle workers spin, then yield, so each wants a core of its own.
+ */
+
+#define DISPATCH_MAX_WORKERS    16
+#define DISPATCH_QUEUE_SIZE     16          /* Jobs per worker, power of two */
+
+struct dispatch_job
+{
+    const struct pkt_view* views;
+    struct pkt_action* actions;
+    unsigned int count;
+    uint32_t done;                          /*> Set by the worker, release */
+};
+
+struct dispatch_worker
+{
+    struct dispatch* dispatch;
+    pthread_t thread;
+    void* handler_ctx;
+    struct dispatch_job* queue[DISPATCH_QUEUE_SIZE];
+    uint32_t head __attribute__((aligned(64)));    /*> Written by the poller */
+    uint32_t tail __attribute__((aligned(64)));    /*> Written by the worker */
+    uint64_t jobs;                          /*> Jobs handled */
+    uint64_t packets;                       /*> Packets handled */
+};
+
+struct dispatch
+{
+    const struct pkt_handler* handler;
+    unsigned int workers;
+    unsigned int next;                      /*> Worker for the next job */
+    volatile int stop;
+    struct dispatch_worker worker[DISPATCH_MAX_WORKERS];
+};
+
+/**
+ * Start the worker threads, each with its own handler context.
+ *
+ * @param handler
+ *   Must not be stateful.
+ * @param handler_args
+ *   Passed to the handler's init() once per worker.
+ * @return
+ *   The pool, or NULL on failure.
+ */
+struct dispatch* dispatch_create(unsigned int workers,
+        const struct pkt_handler* handler, const char* handler_args);
+
+/**
+ * Queue a job on the next worker. Poller only.
+ *
+ * @return
+ *   0 on success, -1 if that worker's queue is full.
+ */
+int dispatch_submit(struct dispatch* d, struct dispatch_job* job);
+
+/* Stop the workers once their queues are empty, and free the pool */
+void dispatch_destroy(struct dispatch* d);
+
+#endif /* _DISPATCH_H_ */
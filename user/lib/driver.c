@@ -11,6 +11,8 @@
 #include <sys/mman.h>
 #include <sys/sysmacros.h>
 #include <linux/limits.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <rte_byteorder.h>
 #include <rte_common.h>
@@ -23,6 +25,9 @@
 #include "nfpcore/nfp_mip.h"
 #include "nfpcore/nfp_rtsym.h"
 #include "nfpcore/nfp_nsp.h"
+#include "nfpcore/nfp_cpp_emu.h"
+
+#include "driver.h"
 
 /* Probing Netronome NICs */
 #define PCI_VENDOR_ID_NETRONOME         0x19ee
@@ -271,6 +276,13 @@ pci_setup_device(const char *dirname, const struct rte_pci_addr *addr)
         parse_sysfs_value(path, &tmp) == 0)
         dev->max_vfs = (uint16_t)tmp;
 
+    /* NUMA node the device is attached to, -1 if unknown */
+    dev->device.numa_node = -1;
+    snprintf(path, sizeof(path), "%s/numa_node", dirname);
+    if (!access(path, F_OK) &&
+        parse_sysfs_value(path, &tmp) == 0)
+        dev->device.numa_node = (int)tmp;
+
     /* Set device name */
     snprintf(dev->name, sizeof(dev->name), PCI_PRI_FMT,
                 addr->domain, addr->bus,
@@ -289,23 +301,84 @@ pci_setup_device(const char *dirname, const struct rte_pci_addr *addr)
 }
 
 /**
- * Scan sysfs for PCI devices to connect with Netronome NIC
+ * Device entry for the emulated NIC. It has no BARs: the emulated CPP
+ * transport does not need them.
  */
-struct rte_pci_device*
-pci_scan()
+static struct rte_pci_device*
+pci_emu_device()
+{
+    struct rte_pci_device *dev;
+
+    dev = calloc(1, sizeof(struct rte_pci_device));
+    if (dev == NULL)
+        return NULL;
+
+    dev->id.vendor_id = PCI_VENDOR_ID_NETRONOME;
+    dev->id.device_id = PCI_DEVICE_ID_NFP4000_PF_NIC;
+    snprintf(dev->name, sizeof(dev->name), "emulated");
+    dev->device.name = dev->name;
+    dev->device.numa_node = -1;
+
+    return dev;
+}
+
+/* A Netronome PF found in sysfs, set up once the first max are known */
+struct pci_match
+{
+    struct rte_pci_addr addr;
+    char name[sizeof(((struct dirent *) 0)->d_name)];
+};
+
+/* Order devices by PCI address, so NIC indices are stable across runs */
+static int
+pci_match_cmp(const void *a, const void *b)
+{
+    const struct pci_match *ma = a;
+    const struct pci_match *mb = b;
+
+    uint64_t ka, kb;
+
+    ka = ((uint64_t)ma->addr.domain << 24) | (ma->addr.bus << 16) |
+        (ma->addr.devid << 8) | ma->addr.function;
+    kb = ((uint64_t)mb->addr.domain << 24) | (mb->addr.bus << 16) |
+        (mb->addr.devid << 8) | mb->addr.function;
+
+    return (ka > kb) - (ka < kb);
+}
+
+/**
+ * Scan sysfs for every Netronome PF. All of them are collected and
+ * sorted before any is set up, so the first max by PCI address are
+ * kept whatever order readdir() returns them in.
+ */
+int
+pci_scan_all(struct rte_pci_device **devs, int max)
 {
     struct dirent *e;
     DIR *dir;
     char path[PATH_MAX];
     struct rte_pci_addr addr;
     unsigned long vendor_id, device_id;
+    struct pci_match *matches = NULL, *tmp;
+    size_t found = 0, size = 0, i;
+    int count = 0;
+
+    if (max <= 0)
+        return 0;
+
+    /* The emulated device is a single instance */
+    if (nfp_cpp_emu_enabled())
+    {
+        devs[0] = pci_emu_device();
+        return devs[0] != NULL;
+    }
 
     dir = opendir("/sys/bus/pci/devices/");
     if (dir == NULL)
     {
         fprintf(stderr, "%s(): opendir failed: %s\n",
             __func__, strerror(errno));
-        return NULL;
+        return 0;
     }
 
     /* Read every directory in /sys/bus/pci/devices */
@@ -327,21 +400,103 @@ pci_scan()
         if (parse_sysfs_value(path, &device_id) < 0)
             continue;
 
-        if (vendor_id == PCI_VENDOR_ID_NETRONOME &&
-                (device_id == PCI_DEVICE_ID_NFP4000_PF_NIC ||
-                device_id == PCI_DEVICE_ID_NFP6000_PF_NIC))
-        {
-            /* Setup NIC */
-            closedir(dir);
+        if (vendor_id != PCI_VENDOR_ID_NETRONOME ||
+                (device_id != PCI_DEVICE_ID_NFP4000_PF_NIC &&
+                device_id != PCI_DEVICE_ID_NFP6000_PF_NIC))
+            continue;
 
-            snprintf(path, sizeof(path), "%s/%s",
-                "/sys/bus/pci/devices", e->d_name);
-            return pci_setup_device(path, &addr);
+        if (found == size)
+        {
+            size = size ? 2 * size : PCI_MAX_NICS;
+            tmp = realloc(matches, size * sizeof(*matches));
+            if (tmp == NULL)
+            {
+                fprintf(stderr, "%s(): Out of memory\n", __func__);
+                break;
+            }
+            matches = tmp;
         }
+
+        matches[found].addr = addr;
+        snprintf(matches[found].name, sizeof(matches[found].name), "%s",
+            e->d_name);
+        found++;
     }
 
     closedir(dir);
-    return NULL;
+
+    qsort(matches, found, sizeof(matches[0]), pci_match_cmp);
+
+    /* Setup NICs, in order, skipping any that cannot be */
+    for (i = 0; i < found && count < max; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s",
+            "/sys/bus/pci/devices", matches[i].name);
+        devs[count] = pci_setup_device(path, &matches[i].addr);
+        if (devs[count] != NULL)
+            count++;
+    }
+
+    free(matches);
+    return count;
+}
+
+/**
+ * Scan sysfs for PCI devices to connect with Netronome NIC
+ */
+struct rte_pci_device*
+pci_scan()
+{
+    struct rte_pci_device *devs[PCI_MAX_NICS];
+    int count, i;
+
+    count = pci_scan_all(devs, PCI_MAX_NICS);
+    if (count == 0)
+        return NULL;
+
+    for (i = 1; i < count; i++)
+        free(devs[i]);
+
+    return devs[0];
+}
+
+int
+pci_device_cpus(const struct rte_pci_device *dev, int *cpus, int max)
+{
+    char path[PATH_MAX];
+    char buf[BUFSIZ];
+    char *tok, *save, *end;
+    unsigned long first, last, cpu;
+    FILE *f;
+    int count = 0;
+
+    snprintf(path, sizeof(path), "%s/" PCI_PRI_FMT "/local_cpulist",
+        "/sys/bus/pci/devices", dev->addr.domain, dev->addr.bus,
+        dev->addr.devid, dev->addr.function);
+
+    f = fopen(path, "r");
+    if (f == NULL)
+        return 0;
+    if (fgets(buf, sizeof(buf), f) == NULL)
+    {
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+
+    /* Format: "0-7,16-23" */
+    for (tok = strtok_r(buf, ",\n", &save); tok != NULL;
+            tok = strtok_r(NULL, ",\n", &save))
+    {
+        first = last = strtoul(tok, &end, 10);
+        if (*end == '-')
+            last = strtoul(end + 1, NULL, 10);
+
+        for (cpu = first; cpu <= last && count < max; cpu++)
+            cpus[count++] = (int)cpu;
+    }
+
+    return count;
 }
 
 static int
@@ -687,7 +842,7 @@ pci_probe(struct rte_pci_device *dev, struct nfp_cpp** cppptr)
     if (!dev)
         return ret;
 
-    ret = pci_map_device(dev);
+    ret = nfp_cpp_emu_enabled() ? 0 : pci_map_device(dev);
     if (ret < 0)
     {
         fprintf(stderr, "%s(): Cannot map device\n",
@@ -748,3 +903,67 @@ error:
     free(nfp_eth_table);
     return ret;
 }
+
+struct pci_probe_job
+{
+    struct rte_pci_device *dev;
+    struct nfp_cpp *cpp;
+    int ret;
+    double elapsed_ms;
+};
+
+static void*
+pci_probe_thread(void *arg)
+{
+    struct pci_probe_job *job = arg;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    job->ret = pci_probe(job->dev, &job->cpp);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    job->elapsed_ms = (end.tv_sec - start.tv_sec) * 1e3 +
+        (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    return NULL;
+}
+
+int
+pci_probe_all(struct rte_pci_device **devs, struct nfp_cpp **cpps, int count)
+{
+    struct pci_probe_job jobs[PCI_MAX_NICS];
+    pthread_t threads[PCI_MAX_NICS];
+    int started[PCI_MAX_NICS];
+    int i, probed = 0;
+
+    if (count > PCI_MAX_NICS)
+        count = PCI_MAX_NICS;
+
+    /* Each probe is dominated by PCIe round trips; overlap them */
+    for (i = 0; i < count; i++)
+    {
+        jobs[i].dev = devs[i];
+        jobs[i].cpp = NULL;
+        jobs[i].ret = -ENODEV;
+        started[i] = !pthread_create(&threads[i], NULL,
+                            pci_probe_thread, &jobs[i]);
+        if (!started[i])
+            pci_probe_thread(&jobs[i]);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+
+        cpps[i] = jobs[i].ret == 0 ? jobs[i].cpp : NULL;
+        if (cpps[i] != NULL)
+            probed++;
+
+        fprintf(stderr, "%s: %s in %.1f ms (NUMA node %d)\n",
+            devs[i]->name, cpps[i] ? "probed" : "probe failed",
+            jobs[i].elapsed_ms, devs[i]->device.numa_node);
+    }
+
+    return probed;
+}
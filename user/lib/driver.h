@@ -4,11 +4,44 @@
 #include <rte_pci.h>
 #include <nfp_nsp.h>
 
+/* Upper bound on NICs driven by one process */
+#define PCI_MAX_NICS    8
+
 /**
  * Scan sysfs for PCI devices to connect with Netronome NIC
  */
 struct rte_pci_device* pci_scan();
 
+/**
+ * Scan sysfs for every Netronome PF.
+ *
+ * @param devs
+ *   Filled with the first max devices by PCI address, in that order.
+ * @return
+ *   Number of devices found.
+ */
+int pci_scan_all(struct rte_pci_device** devs, int max);
+
 int pci_probe(struct rte_pci_device *dev, struct nfp_cpp **cppptr);
 
-#endif /* _USERSPACE_DRIVER_H */
\ No newline at end of file
+/**
+ * Probe devices concurrently, reporting the time each one took.
+ *
+ * @param cpps
+ *   cpps[i] is set to the CPP handle of devs[i], or NULL if its probe
+ *   failed.
+ * @return
+ *   Number of devices probed successfully.
+ */
+int pci_probe_all(struct rte_pci_device** devs, struct nfp_cpp** cpps,
+        int count);
+
+/**
+ * CPUs local to the device, from sysfs local_cpulist.
+ *
+ * @return
+ *   Number of CPUs written to cpus, 0 if unknown.
+ */
+int pci_device_cpus(const struct rte_pci_device* dev, int* cpus, int max);
+
+#endif /* _USERSPACE_DRIVER_H */
@@ -0,0 +1,538 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <emmintrin.h>
+
+#include "memzone.h"
+#include "flow_table.h"
+
+#define FLOW_BUCKET_WAYS    8
+#define FLOW_MAX_KICKS      128
+#define FLOW_MAX_BURST      32
+#define FLOW_WHEEL_SLOTS    256
+#define FLOW_WHEEL_SPAN     128         /* Ticks per idle timeout */
+#define FLOW_NONE           UINT32_MAX
+
+struct flow_bucket
+{
+    uint16_t tags[FLOW_BUCKET_WAYS];    /*> 0: empty */
+    uint32_t entries[FLOW_BUCKET_WAYS];
+} __attribute__((__aligned__(64)));
+
+struct flow_table
+{
+    struct flow_bucket* buckets;
+    uint32_t bucket_mask;
+    struct flow_entry* entries;
+    uint32_t max_flows;
+    uint32_t next_entry;                /*> Next entry never handed out */
+    uint32_t free_list;                 /*> Linked through wheel_next */
+    uint64_t idle_timeout;
+    uint64_t tick;                      /*> Length of a wheel tick */
+    uint64_t wheel_now;                 /*> Next tick to process */
+    int wheel_started;
+    uint32_t wheel[FLOW_WHEEL_SLOTS];   /*> Entry lists, by expiry tick */
+    const struct memzone* mz_buckets;
+    const struct memzone* mz_entries;
+    uint32_t rand;                      /*> Cuckoo victim selection */
+    struct flow_stats stats;
+};
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t flow_hash(const struct flow_key* key)
+{
+    uint64_t a, b, h;
+
+    memcpy(&a, key, 8);
+    memcpy(&b, (const uint8_t*) key + 8, 8);
+
+    h = a * 0x9e3779b97f4a7c15ull ^ rotl64(b * 0xc2b2ae3d27d4eb4full, 31);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+
+    return h;
+}
+
+static inline int flow_key_equal(const struct flow_key* a, const struct flow_key* b)
+{
+    uint64_t a0, a1, b0, b1;
+
+    memcpy(&a0, a, 8);
+    memcpy(&a1, (const uint8_t*) a + 8, 8);
+    memcpy(&b0, b, 8);
+    memcpy(&b1, (const uint8_t*) b + 8, 8);
+
+    return a0 == b0 && a1 == b1;
+}
+
+static inline uint16_t flow_tag(uint64_t hash)
+{
+    return (uint16_t) (hash >> 48) | 1;
+}
+
+static inline uint32_t flow_bucket1(const struct flow_table* ft, uint64_t hash)
+{
+    return (uint32_t) hash & ft->bucket_mask;
+}
+
+/* Partial-key cuckoo: the other bucket follows from a bucket and the tag */
+static inline uint32_t flow_alt_bucket(const struct flow_table* ft, uint32_t b,
+        uint16_t tag)
+{
+    return (b ^ (tag * 0x5bd1e995u)) & ft->bucket_mask;
+}
+
+/**
+ * Compare all eight tags of a bucket at once.
+ *
+ * @return
+ *   Bit mask of the ways holding tag.
+ */
+static inline uint32_t flow_match(const struct flow_bucket* bucket, uint16_t tag)
+{
+    __m128i tags = _mm_load_si128((const __m128i*) bucket->tags);
+    __m128i eq = _mm_cmpeq_epi16(tags, _mm_set1_epi16(tag));
+
+    return _mm_movemask_epi8(_mm_packs_epi16(eq, _mm_setzero_si128()));
+}
+
+/**
+ * @return
+ *   Entry index of key, or FLOW_NONE.
+ */
+static uint32_t flow_find(const struct flow_table* ft, uint64_t hash,
+        const struct flow_key* key)
+{
+    uint16_t tag = flow_tag(hash);
+    uint32_t b = flow_bucket1(ft, hash);
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        const struct flow_bucket* bucket = &ft->buckets[b];
+        uint32_t mask = flow_match(bucket, tag);
+
+        while (mask != 0)
+        {
+            uint32_t idx = bucket->entries[__builtin_ctz(mask)];
+
+            if (flow_key_equal(&ft->entries[idx].key, key))
+                return idx;
+            mask &= mask - 1;
+        }
+        b = flow_alt_bucket(ft, b, tag);
+    }
+
+    return FLOW_NONE;
+}
+
+/* Remove the index entry pointing at an entry */
+static void flow_unlink(struct flow_table* ft, uint32_t idx)
+{
+    const struct flow_entry* e = &ft->entries[idx];
+    uint32_t b = flow_bucket1(ft, flow_hash(&e->key));
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        struct flow_bucket* bucket = &ft->buckets[b];
+        uint32_t mask = flow_match(bucket, e->tag);
+
+        while (mask != 0)
+        {
+            int way = __builtin_ctz(mask);
+
+            if (bucket->entries[way] == idx)
+            {
+                bucket->tags[way] = 0;
+                return;
+            }
+            mask &= mask - 1;
+        }
+        b = flow_alt_bucket(ft, b, e->tag);
+    }
+}
+
+static inline void flow_wheel_start(struct flow_table* ft, uint64_t now)
+{
+    if (!ft->wheel_started)
+    {
+        ft->wheel_now = now / ft->tick;
+        ft->wheel_started = 1;
+    }
+}
+
+/**
+ * File an entry in the slot of the tick it expires at, as of its
+ * last_seen; never the slot being processed, nor beyond the wheel.
+ */
+static void flow_wheel_file(struct flow_table* ft, uint32_t idx)
+{
+    struct flow_entry* e = &ft->entries[idx];
+    uint64_t t = (e->last_seen + ft->idle_timeout) / ft->tick;
+    uint32_t slot;
+
+    if (t <= ft->wheel_now)
+        t = ft->wheel_now + 1;
+    if (t >= ft->wheel_now + FLOW_WHEEL_SLOTS)
+        t = ft->wheel_now + FLOW_WHEEL_SLOTS - 1;
+
+    slot = t % FLOW_WHEEL_SLOTS;
+    e->wheel_next = ft->wheel[slot];
+    ft->wheel[slot] = idx;
+}
+
+static void flow_entry_free(struct flow_table* ft, uint32_t idx)
+{
+    ft->entries[idx].flags = 0;
+    ft->entries[idx].wheel_next = ft->free_list;
+    ft->free_list = idx;
+}
+
+static uint32_t flow_entry_alloc(struct flow_table* ft)
+{
+    uint32_t idx;
+
+    if (ft->free_list != FLOW_NONE)
+    {
+        idx = ft->free_list;
+        ft->free_list = ft->entries[idx].wheel_next;
+        return idx;
+    }
+
+    if (ft->next_entry < ft->max_flows)
+        return ft->next_entry++;
+
+    return FLOW_NONE;
+}
+
+/**
+ * Place an index entry, displacing others along a cuckoo path if both
+ * buckets are full. If the path is too long, the flow left over at the
+ * end loses its place; it is marked dead and the wheel frees it.
+ */
+static void flow_insert(struct flow_table* ft, uint64_t hash, uint32_t idx)
+{
+    uint16_t tag = flow_tag(hash);
+    uint32_t b = flow_bucket1(ft, hash);
+    uint32_t mask;
+    int i, way, kick;
+
+    for (i = 0; i < 2; i++)
+    {
+        struct flow_bucket* bucket = &ft->buckets[b];
+
+        mask = flow_match(bucket, 0);
+        if (mask != 0)
+        {
+            way = __builtin_ctz(mask);
+            bucket->tags[way] = tag;
+            bucket->entries[way] = idx;
+            return;
+        }
+        b = flow_alt_bucket(ft, b, tag);
+    }
+
+    for (kick = 0; kick < FLOW_MAX_KICKS; kick++)
+    {
+        struct flow_bucket* bucket = &ft->buckets[b];
+        uint16_t victim_tag;
+        uint32_t victim_idx;
+
+        ft->rand = ft->rand * 1103515245 + 12345;
+        way = (ft->rand >> 16) % FLOW_BUCKET_WAYS;
+
+        victim_tag = bucket->tags[way];
+        victim_idx = bucket->entries[way];
+        bucket->tags[way] = tag;
+        bucket->entries[way] = idx;
+
+        tag = victim_tag;
+        idx = victim_idx;
+        b = flow_alt_bucket(ft, b, tag);
+        bucket = &ft->buckets[b];
+
+        mask = flow_match(bucket, 0);
+        if (mask != 0)
+        {
+            way = __builtin_ctz(mask);
+            bucket->tags[way] = tag;
+            bucket->entries[way] = idx;
+            return;
+        }
+    }
+
+    ft->entries[idx].flags = 0;
+    ft->stats.evictions++;
+    ft->stats.live--;
+}
+
+/* Start tracking a flow; FLOW_NONE if the table is full */
+static uint32_t flow_add(struct flow_table* ft, uint64_t hash,
+        const struct flow_key* key, uint64_t now)
+{
+    struct flow_entry* e;
+    uint32_t idx;
+
+    idx = flow_entry_alloc(ft);
+    if (idx == FLOW_NONE)
+    {
+        ft->stats.insert_failures++;
+        return FLOW_NONE;
+    }
+
+    e = &ft->entries[idx];
+    e->key = *key;
+    e->packets = 0;
+    e->bytes = 0;
+    e->first_seen = now;
+    e->last_seen = now;
+    e->tag = flow_tag(hash);
+    e->flags = FLOW_ENTRY_LIVE;
+
+    ft->stats.inserts++;
+    ft->stats.live++;
+
+    flow_wheel_file(ft, idx);
+    flow_insert(ft, hash, idx);
+
+    /* The cuckoo path may have ended on the new flow itself */
+    return (e->flags & FLOW_ENTRY_LIVE) ? idx : FLOW_NONE;
+}
+
+struct flow_table* flow_table_create(uint32_t max_flows, uint64_t idle_timeout)
+{
+    struct flow_table* ft;
+    size_t buckets = 1024;
+    int slot;
+
+    if (max_flows == 0 || max_flows == FLOW_NONE || idle_timeout == 0)
+    {
+        fprintf(stderr, "%s(): Invalid size or timeout\n", __func__);
+        return NULL;
+    }
+
+    ft = calloc(1, sizeof(*ft));
+    if (ft == NULL)
+        return NULL;
+
+    while (buckets * FLOW_BUCKET_WAYS * 3 / 4 < max_flows)
+        buckets <<= 1;
+
+    ft->mz_buckets = memzone_reserve(buckets * sizeof(struct flow_bucket));
+    ft->mz_entries = memzone_reserve((size_t) max_flows * sizeof(struct flow_entry));
+    if (ft->mz_buckets == NULL || ft->mz_entries == NULL)
+    {
+        fprintf(stderr, "%s(): Cannot reserve memory for %u flows\n",
+            __func__, max_flows);
+        flow_table_destroy(ft);
+        return NULL;
+    }
+
+    ft->buckets = (struct flow_bucket*) ft->mz_buckets->addr;
+    ft->bucket_mask = buckets - 1;
+    memset(ft->buckets, 0, buckets * sizeof(struct flow_bucket));
+
+    ft->entries = (struct flow_entry*) ft->mz_entries->addr;
+    ft->max_flows = max_flows;
+    ft->free_list = FLOW_NONE;
+
+    ft->idle_timeout = idle_timeout;
+    ft->tick = idle_timeout / FLOW_WHEEL_SPAN;
+    if (ft->tick == 0)
+        ft->tick = 1;
+    for (slot = 0; slot < FLOW_WHEEL_SLOTS; slot++)
+        ft->wheel[slot] = FLOW_NONE;
+
+    ft->rand = 0x2545f491;
+
+    return ft;
+}
+
+void flow_table_destroy(struct flow_table* ft)
+{
+    if (ft == NULL)
+        return;
+
+    memzone_free(ft->mz_buckets);
+    memzone_free(ft->mz_entries);
+    free(ft);
+}
+
+const struct flow_stats* flow_table_stats(const struct flow_table* ft)
+{
+    return &ft->stats;
+}
+
+/* One burst of at most FLOW_MAX_BURST packets */
+static void flow_update_burst(struct flow_table* ft, const struct flow_key* keys,
+        const uint32_t* bytes, unsigned int count, uint64_t now,
+        struct flow_entry** entries)
+{
+    uint64_t hashes[FLOW_MAX_BURST];
+    unsigned int i;
+    int j;
+
+    /* Pass 1: hash, prefetch both candidate buckets */
+    for (i = 0; i < count; i++)
+    {
+        uint32_t b1;
+
+        hashes[i] = flow_hash(&keys[i]);
+        b1 = flow_bucket1(ft, hashes[i]);
+        __builtin_prefetch(&ft->buckets[b1]);
+        __builtin_prefetch(&ft->buckets[flow_alt_bucket(ft, b1, flow_tag(hashes[i]))]);
+    }
+
+    /* Pass 2: prefetch the first entry whose tag matches in each bucket */
+    for (i = 0; i < count; i++)
+    {
+        uint16_t tag = flow_tag(hashes[i]);
+        uint32_t b = flow_bucket1(ft, hashes[i]);
+
+        for (j = 0; j < 2; j++)
+        {
+            const struct flow_bucket* bucket = &ft->buckets[b];
+            uint32_t mask = flow_match(bucket, tag);
+
+            if (mask != 0)
+                __builtin_prefetch(&ft->entries[bucket->entries[__builtin_ctz(mask)]]);
+            b = flow_alt_bucket(ft, b, tag);
+        }
+    }
+
+    /* Pass 3: find or add, in order, so repeats of a new flow find it */
+    for (i = 0; i < count; i++)
+    {
+        struct flow_entry* e = NULL;
+        uint32_t idx;
+
+        idx = flow_find(ft, hashes[i], &keys[i]);
+        if (idx == FLOW_NONE)
+            idx = flow_add(ft, hashes[i], &keys[i], now);
+
+        if (idx != FLOW_NONE)
+        {
+            e = &ft->entries[idx];
+            e->packets++;
+            e->bytes += bytes[i];
+            e->last_seen = now;
+        }
+
+        if (entries != NULL)
+            entries[i] = e;
+    }
+}
+
+void flow_table_update(struct flow_table* ft, const struct flow_key* keys,
+        const uint32_t* bytes, unsigned int count, uint64_t now,
+        struct flow_entry** entries)
+{
+    unsigned int n;
+
+    flow_wheel_start(ft, now);
+    ft->stats.lookups += count;
+
+    while (count > 0)
+    {
+        n = count < FLOW_MAX_BURST ? count : FLOW_MAX_BURST;
+        flow_update_burst(ft, keys, bytes, n, now, entries);
+
+        keys += n;
+        bytes += n;
+        if (entries != NULL)
+            entries += n;
+        count -= n;
+    }
+}
+
+unsigned int flow_table_expire(struct flow_table* ft, uint64_t now)
+{
+    uint64_t target;
+    unsigned int removed = 0, ticks = 0;
+
+    flow_wheel_start(ft, now);
+    target = now / ft->tick;
+
+    /* Every entry is at most a wheel ahead: one turn covers any gap */
+    for (; ft->wheel_now <= target && ticks < FLOW_WHEEL_SLOTS;
+         ft->wheel_now++, ticks++)
+    {
+        uint32_t slot = ft->wheel_now % FLOW_WHEEL_SLOTS;
+        uint32_t idx = ft->wheel[slot];
+
+        ft->wheel[slot] = FLOW_NONE;
+
+        while (idx != FLOW_NONE)
+        {
+            struct flow_entry* e = &ft->entries[idx];
+            uint32_t next = e->wheel_next;
+
+            if (!(e->flags & FLOW_ENTRY_LIVE))
+            {
+                /* Evicted from the index already */
+                flow_entry_free(ft, idx);
+            }
+            else if (e->last_seen + ft->idle_timeout <= now)
+            {
+                flow_unlink(ft, idx);
+                flow_entry_free(ft, idx);
+                ft->stats.expired++;
+                ft->stats.live--;
+                removed++;
+            }
+            else
+            {
+                flow_wheel_file(ft, idx);
+            }
+
+            idx = next;
+        }
+    }
+
+    if (ft->wheel_now <= target)
+        ft->wheel_now = target + 1;
+
+    return removed;
+}
+
+static inline uint64_t flow_rank(const struct flow_entry* e, int by_bytes)
+{
+    return by_bytes ? e->bytes : e->packets;
+}
+
+unsigned int flow_table_top(const struct flow_table* ft, struct flow_entry* out,
+        unsigned int n, int by_bytes)
+{
+    unsigned int found = 0, pos;
+    uint32_t idx, end = ft->next_entry;
+    struct flow_entry e;
+
+    if (n == 0)
+        return 0;
+
+    /* Insertion into a short sorted array: most entries fail the first test */
+    for (idx = 0; idx < end; idx++)
+    {
+        e = ft->entries[idx];
+        if (!(e.flags & FLOW_ENTRY_LIVE))
+            continue;
+        if (found == n && flow_rank(&e, by_bytes) <= flow_rank(&out[n - 1], by_bytes))
+            continue;
+
+        pos = found < n ? found++ : n - 1;
+        while (pos > 0 && flow_rank(&out[pos - 1], by_bytes) < flow_rank(&e, by_bytes))
+        {
+            out[pos] = out[pos - 1];
+            pos--;
+        }
+        out[pos] = e;
+    }
+
+    return found;
+}
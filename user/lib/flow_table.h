@@ -0,0 +1,120 @@
+#ifndef _FLOW_TABLE_H_
+#define _FLOW_TABLE_H_
+
+#include <stdint.h>
+
+/**
+ * @file
+ * Per-worker table of IPv4 flows keyed by 5-tuple, with packet and byte
+ * counters and first/last-seen times. Single-threaded: only the worker
+ * that owns it updates it.
+ *
+ * Index: bucketized cuckoo hash, as in kv_store.h. Each 64-byte bucket
+ * holds eight 16-bit tags and entry references; the eight tags of a
+ * bucket are compared at once with SSE2. Entries are 64 bytes, one
+ * cache line each. Buckets and entries are carved out of memzones
+ * (hugepages), sized once for the maximum number of flows.
+ *
+ * Updates take a burst of keys and run in three passes (hash and
+ * prefetch both buckets; prefetch entries whose tags match; find or
+ * insert in arrival order), so the misses of a burst overlap.
+ *
+ * Idle flows are aged out by a timer wheel. Every entry sits in the
+ * slot of the tick it would expire at, as of when it was filed. When a
+ * slot comes up, entries seen since are filed again further on, and
+ * the others are removed. A packet therefore never touches the wheel.
+ *
+ * Times are in whatever unit the caller passes for `now` (the "flow"
+ * handler uses the TSC), as long as the idle timeout is in the same one.
+ */
+
+struct flow_key
+{
+    uint32_t src_ip;            /*> Host order */
+    uint32_t dst_ip;
+    uint16_t src_port;          /*> 0 unless TCP or UDP */
+    uint16_t dst_port;
+    uint8_t proto;
+    uint8_t pad[3];             /*> Must be zero: keys are compared whole */
+};
+
+struct flow_entry
+{
+    struct flow_key key;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t first_seen;
+    uint64_t last_seen;
+    uint32_t wheel_next;        /*> Next entry in the same wheel slot */
+    uint16_t tag;
+    uint8_t flags;              /*> FLOW_ENTRY_* */
+} __attribute__((__aligned__(64)));
+
+#define FLOW_ENTRY_LIVE         0x1
+
+struct flow_stats
+{
+    uint64_t lookups;
+    uint64_t inserts;           /*> New flows */
+    uint64_t expired;           /*> Flows aged out */
+    uint64_t evictions;         /*> Flows lost to a too long cuckoo path */
+    uint64_t insert_failures;   /*> New flows not tracked: table full */
+    uint64_t live;              /*> Flows in the table now */
+};
+
+struct flow_table;
+
+/**
+ * Create a table.
+ *
+ * @param max_flows
+ *   Entries to reserve; the index is sized for them at 75% occupancy.
+ * @param idle_timeout
+ *   A flow not seen for this long is removed, in the unit of `now`.
+ * @return
+ *   Table, or NULL on failure.
+ */
+struct flow_table* flow_table_create(uint32_t max_flows, uint64_t idle_timeout);
+
+void flow_table_destroy(struct flow_table* ft);
+
+const struct flow_stats* flow_table_stats(const struct flow_table* ft);
+
+/**
+ * Account one packet per key: look each flow up, inserting new ones,
+ * and add to its counters.
+ *
+ * @param bytes
+ *   Length of each packet.
+ * @param entries
+ *   Optional. Receives each packet's entry, or NULL if its flow could
+ *   not be inserted. Valid until the next call.
+ */
+void flow_table_update(struct flow_table* ft, const struct flow_key* keys,
+        const uint32_t* bytes, unsigned int count, uint64_t now,
+        struct flow_entry** entries);
+
+/**
+ * Advance the timer wheel to `now` and remove flows idle for longer
+ * than the timeout. Cheap when no tick has passed, so it may be called
+ * on every burst.
+ *
+ * @return
+ *   Number of flows removed.
+ */
+unsigned int flow_table_expire(struct flow_table* ft, uint64_t now);
+
+/**
+ * Copy the top flows by packets (or bytes) into out[], largest first.
+ *
+ * Scans every entry without synchronization, so it may be called from
+ * another thread than the owner's; counters may then be slightly stale
+ * and a flow replaced during the scan may show torn values.
+ *
+ * @return
+ *   Number of flows copied, at most n.
+ */
+unsigned int flow_table_top(const struct flow_table* ft, struct flow_entry* out,
+        unsigned int n, int by_bytes);
+
+#endif /* _FLOW_TABLE_H_ */
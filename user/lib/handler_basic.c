@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "pkt_handler.h"
+
+/**
+ * Echo: the firmware has already swapped the addresses, so every
+ * frame goes back out unchanged.
+ */
+static void echo_process(void* ctx, const struct pkt_view* pkts,
+        struct pkt_action* actions, unsigned int count)
+{
+    (void) ctx;
+    (void) pkts;
+    (void) actions;
+    (void) count;
+
+    /* Actions are preset to PKT_FORWARD */
+}
+
+const struct pkt_handler handler_echo = {
+    .name = "echo",
+    .description = "Send every packet back",
+    .process = echo_process,
+};
+
+/**
+ * Drop: consume RX only, e.g. to measure the receive path alone.
+ */
+static void drop_process(void* ctx, const struct pkt_view* pkts,
+        struct pkt_action* actions, unsigned int count)
+{
+    unsigned int i;
+
+    (void) ctx;
+    (void) pkts;
+
+    for (i = 0; i < count; i++)
+        actions[i].verdict = PKT_DROP;
+}
+
+const struct pkt_handler handler_drop = {
+    .name = "drop",
+    .description = "Drop every packet",
+    .process = drop_process,
+};
+
+/**
+ * Slow: echo, but spend a fixed time on every packet first, to stand in
+ * for an overloaded service. Args: nanoseconds per packet (default
+ * 10000).
+ */
+struct slow_ctx
+{
+    uint64_t ns;
+};
+
+static uint64_t slow_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int slow_init(void** ctx, const char* args)
+{
+    struct slow_ctx* s = malloc(sizeof(*s));
+
+    if (s == NULL)
+        return -1;
+    s->ns = args != NULL ? strtoull(args, NULL, 0) : 10000;
+    *ctx = s;
+    return 0;
+}
+
+static void slow_process(void* ctx, const struct pkt_view* pkts,
+        struct pkt_action* actions, unsigned int count)
+{
+    const struct slow_ctx* s = ctx;
+    uint64_t until = slow_now_ns() + s->ns * count;
+
+    (void) pkts;
+    (void) actions;
+
+    while (slow_now_ns() < until)
+        ;
+}
+
+static void slow_fini(void* ctx)
+{
+    free(ctx);
+}
+
+const struct pkt_handler handler_slow = {
+    .name = "slow",
+    .description = "Echo after a delay per packet (arg: ns, default 10000)",
+    .init = slow_init,
+    .process = slow_process,
+    .fini = slow_fini,
+};
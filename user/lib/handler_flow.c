@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "datapath.h"
+#include "pkt_handler.h"
+#include "flow_table.h"
+#include "latency.h"
+
+/**
+ * Flow accounting: every IPv4 packet is counted against its 5-tuple in
+ * a flow table (flow_table.h), then sent back as by "echo". Flows idle
+ * for longer than the timeout are aged out on the worker, between
+ * bursts. The report lists the busiest flows.
+ *
+ * Arguments: maximum flows and idle timeout in ms, e.g.
+ * -H flow:4000000,10000 (default 1M flows, 30 s).
+ */
+
+#define FLOW_DEFAULT_MAX        (1u << 20)
+#define FLOW_DEFAULT_IDLE_MS    30000
+#define FLOW_REPORT_TOP         5
+
+#define ETH_HLEN                14
+#define ETH_TYPE_IPV4           0x0800
+
+struct flow_handler
+{
+    struct flow_table* table;
+    double tsc_per_ns;
+    uint64_t non_ip;                /*> Frames not counted: not IPv4 */
+};
+
+static int flow_init(void** ctx, const char* args)
+{
+    struct flow_handler* h;
+    unsigned long max_flows = FLOW_DEFAULT_MAX;
+    unsigned long idle_ms = FLOW_DEFAULT_IDLE_MS;
+    char* end;
+
+    if (args != NULL && args[0] != '\0')
+    {
+        max_flows = strtoul(args, &end, 0);
+        if (*end == ',')
+            idle_ms = strtoul(end + 1, NULL, 0);
+    }
+
+    if (max_flows >= UINT32_MAX)
+    {
+        fprintf(stderr, "%s(): At most %u flows\n", __func__, UINT32_MAX - 1);
+        return -1;
+    }
+
+    h = calloc(1, sizeof(*h));
+    if (h == NULL)
+        return -1;
+
+    h->tsc_per_ns = lat_tsc_per_ns();
+    h->table = flow_table_create(max_flows,
+        (uint64_t) (idle_ms * 1e6 * h->tsc_per_ns));
+    if (h->table == NULL)
+    {
+        free(h);
+        return -1;
+    }
+
+    *ctx = h;
+    return 0;
+}
+
+static void flow_fini(void* ctx)
+{
+    struct flow_handler* h = ctx;
+
+    flow_table_destroy(h->table);
+    free(h);
+}
+
+static inline uint32_t be32(const uint8_t* p)
+{
+    return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ * Extract the 5-tuple and the frame length on the wire.
+ *
+ * @return
+ *   0 on success, -1 if not IPv4.
+ */
+static int flow_parse(const struct pkt_view* pkt, struct flow_key* key,
+        uint32_t* bytes)
+{
+    const uint8_t* frame = pkt->data;
+    uint32_t ihl, ip_len;
+
+    if (pkt->len < ETH_HLEN + 20 ||
+        ((frame[12] << 8) | frame[13]) != ETH_TYPE_IPV4)
+        return -1;
+
+    ihl = (frame[ETH_HLEN] & 0xf) * 4;
+    ip_len = (frame[ETH_HLEN + 2] << 8) | frame[ETH_HLEN + 3];
+
+    memset(key, 0, sizeof(*key));
+    key->proto = frame[ETH_HLEN + 9];
+    key->src_ip = be32(frame + ETH_HLEN + 12);
+    key->dst_ip = be32(frame + ETH_HLEN + 16);
+
+    if ((key->proto == IPPROTO_UDP || key->proto == IPPROTO_TCP) &&
+        pkt->len >= ETH_HLEN + ihl + 4)
+    {
+        key->src_port = (frame[ETH_HLEN + ihl] << 8) | frame[ETH_HLEN + ihl + 1];
+        key->dst_port = (frame[ETH_HLEN + ihl + 2] << 8) | frame[ETH_HLEN + ihl + 3];
+    }
+
+    /* Slots are fixed size; the IP length tells what was on the wire */
+    *bytes = ip_len >= 20 ? ETH_HLEN + ip_len : pkt->len;
+    return 0;
+}
+
+static void flow_process(void* ctx, const struct pkt_view* pkts,
+        struct pkt_action* actions, unsigned int count)
+{
+    struct flow_handler* h = ctx;
+    struct flow_key keys[DATAPATH_MAX_BATCH];
+    uint32_t bytes[DATAPATH_MAX_BATCH];
+    unsigned int i, n = 0;
+    uint64_t now = lat_tsc();
+
+    (void) actions;
+
+    for (i = 0; i < count; i++)
+    {
+        if (flow_parse(&pkts[i], &keys[n], &bytes[n]) == 0)
+            n++;
+        else
+            h->non_ip++;
+    }
+
+    /* Actions are preset to PKT_FORWARD */
+    flow_table_update(h->table, keys, bytes, n, now, NULL);
+    flow_table_expire(h->table, now);
+}
+
+static const char* flow_proto_name(uint8_t proto)
+{
+    switch (proto)
+    {
+        case IPPROTO_UDP:
+            return "udp";
+        case IPPROTO_TCP:
+            return "tcp";
+        case IPPROTO_ICMP:
+            return "icmp";
+        default:
+            return "ip";
+    }
+}
+
+static void flow_report(void* ctx, FILE* out)
+{
+    struct flow_handler* h = ctx;
+    const struct flow_stats* st = flow_table_stats(h->table);
+    struct flow_entry top[FLOW_REPORT_TOP];
+    uint64_t now = lat_tsc();
+    unsigned int i, n;
+
+    fprintf(out, "[FLOW] live %lu inserts %lu expired %lu evictions %lu "
+                 "insert_failures %lu non_ip %lu\n",
+        st->live, st->inserts, st->expired, st->evictions,
+        st->insert_failures, h->non_ip);
+
+    n = flow_table_top(h->table, top, FLOW_REPORT_TOP, 0);
+    for (i = 0; i < n; i++)
+    {
+        const struct flow_key* k = &top[i].key;
+
+        fprintf(out, "[FLOW] #%u %u.%u.%u.%u:%u > %u.%u.%u.%u:%u %s "
+                     "pkts %lu bytes %lu idle %.0f ms\n",
+            i + 1,
+            k->src_ip >> 24, (k->src_ip >> 16) & 0xff,
+            (k->src_ip >> 8) & 0xff, k->src_ip & 0xff, k->src_port,
+            k->dst_ip >> 24, (k->dst_ip >> 16) & 0xff,
+            (k->dst_ip >> 8) & 0xff, k->dst_ip & 0xff, k->dst_port,
+            flow_proto_name(k->proto),
+            top[i].packets, top[i].bytes,
+            now > top[i].last_seen ?
+                (now - top[i].last_seen) / h->tsc_per_ns / 1e6 : 0.0);
+    }
+}
+
+const struct pkt_handler handler_flow = {
+    .name = "flow",
+    .description = "Count packets per 5-tuple flow, then echo "
+                   "(args: max flows,idle ms)",
+    .stateful = 1,
+    .init = flow_init,
+    .process = flow_process,
+    .fini = flow_fini,
+    .report = flow_report,
+};
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "datapath.h"
+#include "pkt_handler.h"
+#include "kv_proto.h"
+#include "kv_store.h"
+#include "pkt_csum.h"
+
+/**
+ * UDP key-value cache (see kv_proto.h for the wire format).
+ *
+ * Requests in a burst go through the store in three passes: hash and
+ * prefetch buckets, prefetch matching items, then execute in arrival
+ * order. Responses are built straight into the reserved TX slots.
+ *
+ * Argument: item memory in MB (default 64), e.g. -H kv:256. The items
+ * are carried over a warm restart.
+ */
+
+#define KV_DEFAULT_MEM_MB   64
+
+struct kv_handler
+{
+    struct kv_store* store;
+    uint64_t malformed;
+};
+
+struct kv_req
+{
+    const struct kv_hdr* hdr;
+    const uint8_t* key;
+    uint64_t hash;
+};
+
+static int kv_init(void** ctx, const char* args)
+{
+    struct kv_handler* h;
+    unsigned long mb = KV_DEFAULT_MEM_MB;
+
+    if (args != NULL && args[0] != '\0')
+        mb = strtoul(args, NULL, 0);
+
+    h = calloc(1, sizeof(*h));
+    if (h == NULL)
+        return -1;
+
+    h->store = kv_store_create(mb << 20);
+    if (h->store == NULL)
+    {
+        free(h);
+        return -1;
+    }
+
+    *ctx = h;
+    return 0;
+}
+
+static void kv_fini(void* ctx)
+{
+    struct kv_handler* h = ctx;
+
+    kv_store_destroy(h->store);
+    free(h);
+}
+
+/* Validate a request; on success fill in req */
+static int kv_parse(const struct pkt_view* pkt, struct kv_req* req)
+{
+    const struct kv_hdr* hdr;
+    uint32_t need;
+
+    if (pkt->len < KV_PAYLOAD_OFFSET + sizeof(struct kv_hdr))
+        return -1;
+
+    hdr = (const struct kv_hdr*) ((const uint8_t*) pkt->data + KV_PAYLOAD_OFFSET);
+    need = KV_PAYLOAD_OFFSET + sizeof(*hdr) + hdr->klen;
+    if (hdr->op == KV_OP_SET)
+        need += hdr->vlen;
+    if (need > pkt->len || hdr->klen == 0)
+        return -1;
+    if (hdr->op != KV_OP_GET && hdr->op != KV_OP_SET && hdr->op != KV_OP_DELETE)
+        return -1;
+
+    req->hdr = hdr;
+    req->key = (const uint8_t*) (hdr + 1);
+    return 0;
+}
+
+/**
+ * Write a response into the TX slot: the request's headers (already
+ * addressed back to the client), then status, key and value. The frame
+ * grows or shrinks to fit them, up to the slot size.
+ */
+static void kv_respond(const struct pkt_view* pkt, struct pkt_action* act,
+        const struct kv_hdr* req, uint8_t status,
+        const uint8_t* key, const uint8_t* value, uint32_t vlen)
+{
+    uint8_t* frame = act->tx;
+    struct kv_hdr* hdr = (struct kv_hdr*) (frame + KV_PAYLOAD_OFFSET);
+    uint32_t klen = key != NULL ? req->klen : 0;
+    uint32_t len;
+    uint16_t v16;
+
+    if (KV_PAYLOAD_OFFSET + sizeof(*hdr) + klen + vlen > act->tx_size)
+    {
+        status = KV_STATUS_ERROR;
+        klen = vlen = 0;
+    }
+    len = KV_PAYLOAD_OFFSET + sizeof(*hdr) + klen + vlen;
+
+    memcpy(frame, pkt->data, KV_PAYLOAD_OFFSET);
+    v16 = htons(len - KV_ETH_HLEN);
+    memcpy(frame + KV_ETH_HLEN + 2, &v16, 2);
+    v16 = htons(len - KV_ETH_HLEN - KV_IP_HLEN);
+    memcpy(frame + KV_ETH_HLEN + KV_IP_HLEN + 4, &v16, 2);
+
+    hdr->op = req->op;
+    hdr->status = status;
+    hdr->klen = klen;
+    hdr->vlen = vlen;
+    hdr->opaque = req->opaque;
+    memcpy(hdr + 1, key, klen);
+    memcpy((uint8_t*) (hdr + 1) + klen, value, vlen);
+
+    /* Keep a padded request's frame size, with the padding cleared */
+    if (len < pkt->len)
+    {
+        memset(frame + len, 0, pkt->len - len);
+        len = pkt->len;
+    }
+
+    pkt_csum_fill(frame, len);
+
+    act->verdict = PKT_TX_SLOT;
+    act->len = len;
+}
+
+static void kv_process(void* ctx, const struct pkt_view* pkts,
+        struct pkt_action* actions, unsigned int count)
+{
+    struct kv_handler* h = ctx;
+    struct kv_req reqs[DATAPATH_MAX_BATCH];
+    const struct kv_item* item;
+    unsigned int i;
+
+    /* Pass 1: parse, hash, prefetch both candidate buckets */
+    for (i = 0; i < count; i++)
+    {
+        if (kv_parse(&pkts[i], &reqs[i]))
+        {
+            reqs[i].hdr = NULL;
+            continue;
+        }
+
+        reqs[i].hash = kv_hash(reqs[i].key, reqs[i].hdr->klen);
+        kv_prefetch_buckets(h->store, reqs[i].hash);
+    }
+
+    /* Pass 2: prefetch items whose tags match */
+    for (i = 0; i < count; i++)
+    {
+        if (reqs[i].hdr != NULL && reqs[i].hdr->op == KV_OP_GET)
+            kv_prefetch_items(h->store, reqs[i].hash);
+    }
+
+    /* Pass 3: execute in order, so a GET sees an earlier SET */
+    for (i = 0; i < count; i++)
+    {
+        const struct kv_req* req = &reqs[i];
+        const struct kv_hdr* hdr = req->hdr;
+
+        if (hdr == NULL)
+        {
+            h->malformed++;
+            actions[i].verdict = PKT_DROP;
+            continue;
+        }
+
+        switch (hdr->op)
+        {
+            case KV_OP_GET:
+                item = kv_lookup(h->store, req->hash, req->key, hdr->klen);
+                if (item != NULL)
+                    kv_respond(&pkts[i], &actions[i], hdr, KV_STATUS_OK,
+                        req->key, kv_item_value(item), item->vlen);
+                else
+                    kv_respond(&pkts[i], &actions[i], hdr, KV_STATUS_MISS,
+                        req->key, NULL, 0);
+                break;
+
+            case KV_OP_SET:
+                if (kv_set(h->store, req->hash, req->key, hdr->klen,
+                        req->key + hdr->klen, hdr->vlen))
+                    kv_respond(&pkts[i], &actions[i], hdr, KV_STATUS_ERROR,
+                        NULL, NULL, 0);
+                else
+                    kv_respond(&pkts[i], &actions[i], hdr, KV_STATUS_OK,
+                        NULL, NULL, 0);
+                break;
+
+            case KV_OP_DELETE:
+                kv_respond(&pkts[i], &actions[i], hdr,
+                    kv_delete(h->store, req->hash, req->key, hdr->klen) ?
+                        KV_STATUS_MISS : KV_STATUS_OK,
+                    NULL, NULL, 0);
+                break;
+        }
+    }
+}
+
+static void kv_report(void* ctx, FILE* out)
+{
+    struct kv_handler* h = ctx;
+    const struct kv_stats* st = kv_store_stats(h->store);
+
+    fprintf(out, "[KV] hits %lu misses %lu sets %lu deletes %lu "
+                 "evictions %lu set_failures %lu malformed %lu\n",
+        st->hits, st->misses, st->sets, st->deletes,
+        st->evictions, st->set_failures, h->malformed);
+}
+
+static int kv_save(void* ctx, FILE* out)
+{
+    struct kv_handler* h = ctx;
+
+    return kv_store_save(h->store, out);
+}
+
+static int kv_restore(void* ctx, FILE* in)
+{
+    struct kv_handler* h = ctx;
+
+    return kv_store_load(h->store, in);
+}
+
+const struct pkt_handler handler_kv = {
+    .name = "kv",
+    .description = "UDP key-value cache (arg: memory in MB)",
+    .stateful = 1,
+    .whole_frame = 1,
+    .init = kv_init,
+    .process = kv_process,
+    .fini = kv_fini,
+    .report = kv_report,
+    .save = kv_save,
+    .restore = kv_restore,
+};
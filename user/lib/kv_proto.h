@@ -0,0 +1,47 @@
+#ifndef _KV_PROTO_H_
+#define _KV_PROTO_H_
+
+#include <stdint.h>
+
+/**
+ * @file
+ * Wire format of the UDP key-value cache (handler "kv").
+ *
+ * A memcached-style text protocol does not fit the fixed ring slots
+ * (UDP_PACKET_SIZE bytes, headers included), so requests are binary:
+ * a kv_hdr right after the UDP header, then the key, then the value.
+ * The response reuses the request frame's headers, already addressed
+ * back to the client by the firmware, with status and value filled in,
+ * opaque echoed back and the IP and UDP lengths set to fit. A value that
+ * does not fit the TX slot is answered with KV_STATUS_ERROR.
+ */
+
+#define KV_ETH_HLEN         14
+#define KV_IP_HLEN          20
+#define KV_UDP_HLEN         8
+#define KV_PAYLOAD_OFFSET   (KV_ETH_HLEN + KV_IP_HLEN + KV_UDP_HLEN)
+
+enum kv_op
+{
+    KV_OP_GET = 1,
+    KV_OP_SET = 2,
+    KV_OP_DELETE = 3,
+};
+
+enum kv_status
+{
+    KV_STATUS_OK = 0,
+    KV_STATUS_MISS = 1,
+    KV_STATUS_ERROR = 2,        /*> Malformed request, or item too large */
+};
+
+struct kv_hdr
+{
+    uint8_t op;                 /*> enum kv_op */
+    uint8_t status;             /*> enum kv_status, in responses */
+    uint8_t klen;               /*> Key length */
+    uint8_t vlen;               /*> Value length */
+    uint16_t opaque;            /*> Echoed back in the response */
+} __attribute__((__packed__));
+
+#endif /* _KV_PROTO_H_ */
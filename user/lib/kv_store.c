@@ -0,0 +1,581 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memzone.h"
+#include "kv_store.h"
+
+#define KV_BUCKET_WAYS      8
+#define KV_MAX_KICKS        128
+#define KV_PAGE_SIZE        (64 * 1024)
+#define KV_NUM_CLASSES      6           /* 32 B ... 1 KB */
+#define KV_MIN_ITEM_SHIFT   5
+#define KV_REF_SHIFT        4           /* Item references are in 16 B units */
+#define KV_NONE             UINT32_MAX
+
+struct kv_bucket
+{
+    uint16_t tags[KV_BUCKET_WAYS];      /*> 0: empty */
+    uint32_t items[KV_BUCKET_WAYS];
+} __attribute__((__aligned__(64)));
+
+struct kv_class
+{
+    uint32_t size;                      /*> Item size in bytes */
+    uint32_t per_page;
+    uint32_t free_list;
+    uint32_t* pages;                    /*> Pages owned, in slab pages */
+    uint32_t npages;
+    uint32_t hand;                      /*> CLOCK position, in items */
+};
+
+struct kv_store
+{
+    struct kv_bucket* buckets;
+    uint32_t bucket_mask;
+    uint8_t* slab;
+    uint32_t slab_pages;
+    uint32_t next_page;                 /*> Next page never handed out */
+    struct kv_class classes[KV_NUM_CLASSES];
+    const struct memzone* mz_buckets;
+    const struct memzone* mz_slab;
+    uint32_t rand;                      /*> Cuckoo victim selection */
+    struct kv_stats stats;
+};
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t kv_hash(const void* key, uint32_t klen)
+{
+    const uint8_t* p = key;
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ klen;
+    uint64_t k;
+
+    while (klen >= 8)
+    {
+        memcpy(&k, p, 8);
+        h ^= k * 0xff51afd7ed558ccdull;
+        h = rotl64(h, 31) * 0xc4ceb9fe1a85ec53ull;
+        p += 8;
+        klen -= 8;
+    }
+
+    k = 0;
+    memcpy(&k, p, klen);
+    h ^= k * 0xff51afd7ed558ccdull;
+    h = rotl64(h, 29) * 0x9e3779b97f4a7c15ull;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+
+    return h;
+}
+
+static inline uint16_t kv_tag(uint64_t hash)
+{
+    return (uint16_t) (hash >> 48) | 1;
+}
+
+static inline uint32_t kv_bucket1(const struct kv_store* kv, uint64_t hash)
+{
+    return (uint32_t) hash & kv->bucket_mask;
+}
+
+/* Partial-key cuckoo: the other bucket follows from a bucket and the tag */
+static inline uint32_t kv_alt_bucket(const struct kv_store* kv, uint32_t b,
+        uint16_t tag)
+{
+    return (b ^ (tag * 0x5bd1e995u)) & kv->bucket_mask;
+}
+
+static inline struct kv_item* kv_item_at(const struct kv_store* kv, uint32_t ref)
+{
+    return (struct kv_item*) (kv->slab + ((size_t) ref << KV_REF_SHIFT));
+}
+
+static inline uint32_t kv_item_ref(const struct kv_store* kv,
+        const struct kv_item* item)
+{
+    return ((const uint8_t*) item - kv->slab) >> KV_REF_SHIFT;
+}
+
+static int kv_class_of(uint32_t size)
+{
+    int cls;
+
+    for (cls = 0; cls < KV_NUM_CLASSES; cls++)
+    {
+        if (size <= (1u << (KV_MIN_ITEM_SHIFT + cls)))
+            return cls;
+    }
+
+    return -1;
+}
+
+struct kv_store* kv_store_create(size_t mem_bytes)
+{
+    struct kv_store* kv;
+    size_t buckets = 1024;
+    int cls;
+
+    kv = calloc(1, sizeof(*kv));
+    if (kv == NULL)
+        return NULL;
+
+    /* Size for 64 B items at ~75% occupancy */
+    while (buckets * KV_BUCKET_WAYS * 3 / 4 < mem_bytes / 64)
+        buckets <<= 1;
+
+    kv->mz_buckets = memzone_reserve(buckets * sizeof(struct kv_bucket));
+    kv->mz_slab = memzone_reserve(mem_bytes);
+    if (kv->mz_buckets == NULL || kv->mz_slab == NULL)
+    {
+        fprintf(stderr, "%s(): Cannot reserve %zu bytes\n", __func__, mem_bytes);
+        kv_store_destroy(kv);
+        return NULL;
+    }
+
+    kv->buckets = (struct kv_bucket*) kv->mz_buckets->addr;
+    kv->bucket_mask = buckets - 1;
+    memset(kv->buckets, 0, buckets * sizeof(struct kv_bucket));
+
+    kv->slab = (uint8_t*) kv->mz_slab->addr;
+    kv->slab_pages = kv->mz_slab->len / KV_PAGE_SIZE;
+    kv->rand = 0x2545f491;
+
+    for (cls = 0; cls < KV_NUM_CLASSES; cls++)
+    {
+        kv->classes[cls].size = 1u << (KV_MIN_ITEM_SHIFT + cls);
+        kv->classes[cls].per_page = KV_PAGE_SIZE / kv->classes[cls].size;
+        kv->classes[cls].free_list = KV_NONE;
+        kv->classes[cls].pages = calloc(kv->slab_pages, sizeof(uint32_t));
+        if (kv->classes[cls].pages == NULL)
+        {
+            kv_store_destroy(kv);
+            return NULL;
+        }
+    }
+
+    return kv;
+}
+
+void kv_store_destroy(struct kv_store* kv)
+{
+    int cls;
+
+    if (kv == NULL)
+        return;
+
+    for (cls = 0; cls < KV_NUM_CLASSES; cls++)
+        free(kv->classes[cls].pages);
+    memzone_free(kv->mz_buckets);
+    memzone_free(kv->mz_slab);
+    free(kv);
+}
+
+const struct kv_stats* kv_store_stats(const struct kv_store* kv)
+{
+    return &kv->stats;
+}
+
+void kv_prefetch_buckets(const struct kv_store* kv, uint64_t hash)
+{
+    uint32_t b1 = kv_bucket1(kv, hash);
+
+    __builtin_prefetch(&kv->buckets[b1]);
+    __builtin_prefetch(&kv->buckets[kv_alt_bucket(kv, b1, kv_tag(hash))]);
+}
+
+void kv_prefetch_items(const struct kv_store* kv, uint64_t hash)
+{
+    uint16_t tag = kv_tag(hash);
+    uint32_t b = kv_bucket1(kv, hash);
+    int i, way;
+
+    for (i = 0; i < 2; i++)
+    {
+        const struct kv_bucket* bucket = &kv->buckets[b];
+
+        for (way = 0; way < KV_BUCKET_WAYS; way++)
+        {
+            if (bucket->tags[way] == tag)
+                __builtin_prefetch(kv_item_at(kv, bucket->items[way]));
+        }
+        b = kv_alt_bucket(kv, b, tag);
+    }
+}
+
+/**
+ * Find the index entry of a key.
+ *
+ * @return
+ *   Item, with its bucket and way stored, or NULL.
+ */
+static struct kv_item* kv_find(struct kv_store* kv, uint64_t hash,
+        const void* key, uint32_t klen, uint32_t* bucket_out, int* way_out)
+{
+    uint16_t tag = kv_tag(hash);
+    uint32_t b = kv_bucket1(kv, hash);
+    int i, way;
+
+    for (i = 0; i < 2; i++)
+    {
+        struct kv_bucket* bucket = &kv->buckets[b];
+
+        for (way = 0; way < KV_BUCKET_WAYS; way++)
+        {
+            struct kv_item* item;
+
+            if (bucket->tags[way] != tag)
+                continue;
+
+            item = kv_item_at(kv, bucket->items[way]);
+            if (item->klen == klen && memcmp(item->data, key, klen) == 0)
+            {
+                *bucket_out = b;
+                *way_out = way;
+                return item;
+            }
+        }
+        b = kv_alt_bucket(kv, b, tag);
+    }
+
+    return NULL;
+}
+
+const struct kv_item* kv_lookup(struct kv_store* kv, uint64_t hash,
+        const void* key, uint32_t klen)
+{
+    struct kv_item* item;
+    uint32_t b;
+    int way;
+
+    item = kv_find(kv, hash, key, klen, &b, &way);
+    if (item == NULL)
+    {
+        kv->stats.misses++;
+        return NULL;
+    }
+
+    item->flags |= KV_ITEM_REFERENCED;
+    kv->stats.hits++;
+
+    return item;
+}
+
+static void kv_item_free(struct kv_store* kv, struct kv_item* item)
+{
+    struct kv_class* c = &kv->classes[item->cls];
+
+    item->flags = 0;
+    item->next_free = c->free_list;
+    c->free_list = kv_item_ref(kv, item);
+}
+
+/* Remove the index entry pointing at an item */
+static void kv_unlink(struct kv_store* kv, struct kv_item* item)
+{
+    uint64_t hash = kv_hash(item->data, item->klen);
+    uint16_t tag = kv_tag(hash);
+    uint32_t ref = kv_item_ref(kv, item);
+    uint32_t b = kv_bucket1(kv, hash);
+    int i, way;
+
+    for (i = 0; i < 2; i++)
+    {
+        struct kv_bucket* bucket = &kv->buckets[b];
+
+        for (way = 0; way < KV_BUCKET_WAYS; way++)
+        {
+            if (bucket->tags[way] == tag && bucket->items[way] == ref)
+            {
+                bucket->tags[way] = 0;
+                return;
+            }
+        }
+        b = kv_alt_bucket(kv, b, tag);
+    }
+}
+
+/* Hand a fresh page to a class */
+static int kv_class_grow(struct kv_store* kv, struct kv_class* c, int cls)
+{
+    uint32_t page, i;
+
+    if (kv->next_page == kv->slab_pages)
+        return -1;
+
+    page = kv->next_page++;
+    c->pages[c->npages++] = page;
+
+    /* Push in reverse so items are handed out in address order */
+    for (i = c->per_page; i > 0; i--)
+    {
+        struct kv_item* item = (struct kv_item*)
+            (kv->slab + (size_t) page * KV_PAGE_SIZE + (i - 1) * c->size);
+
+        item->cls = cls;
+        kv_item_free(kv, item);
+    }
+
+    return 0;
+}
+
+/* CLOCK: evict the first item not referenced since the last pass */
+static struct kv_item* kv_class_evict(struct kv_store* kv, struct kv_class* c)
+{
+    uint32_t total = c->npages * c->per_page;
+    uint32_t n;
+
+    for (n = 0; n < 2 * total; n++)
+    {
+        uint32_t idx = c->hand;
+        struct kv_item* item = (struct kv_item*) (kv->slab +
+            (size_t) c->pages[idx / c->per_page] * KV_PAGE_SIZE +
+            (idx % c->per_page) * c->size);
+
+        if (++c->hand == total)
+            c->hand = 0;
+
+        if (item->flags & KV_ITEM_REFERENCED)
+        {
+            item->flags &= ~KV_ITEM_REFERENCED;
+            continue;
+        }
+
+        if (item->flags & KV_ITEM_LIVE)
+        {
+            kv_unlink(kv, item);
+            kv->stats.evictions++;
+        }
+        return item;
+    }
+
+    return NULL;
+}
+
+static struct kv_item* kv_item_alloc(struct kv_store* kv, int cls)
+{
+    struct kv_class* c = &kv->classes[cls];
+    struct kv_item* item;
+
+    if (c->free_list == KV_NONE && kv_class_grow(kv, c, cls) < 0)
+    {
+        if (c->npages == 0)
+            return NULL;
+
+        item = kv_class_evict(kv, c);
+        if (item != NULL)
+            item->cls = cls;
+        return item;
+    }
+
+    item = kv_item_at(kv, c->free_list);
+    c->free_list = item->next_free;
+
+    return item;
+}
+
+/**
+ * Place an entry, displacing others along a cuckoo path if both
+ * buckets are full. If the path is too long, the entry left over at
+ * the end is evicted.
+ */
+static void kv_insert(struct kv_store* kv, uint64_t hash, uint32_t ref)
+{
+    uint16_t tag = kv_tag(hash);
+    uint32_t b = kv_bucket1(kv, hash);
+    int i, way, kick;
+
+    for (i = 0; i < 2; i++)
+    {
+        struct kv_bucket* bucket = &kv->buckets[b];
+
+        for (way = 0; way < KV_BUCKET_WAYS; way++)
+        {
+            if (bucket->tags[way] == 0)
+            {
+                bucket->tags[way] = tag;
+                bucket->items[way] = ref;
+                return;
+            }
+        }
+        b = kv_alt_bucket(kv, b, tag);
+    }
+
+    for (kick = 0; kick < KV_MAX_KICKS; kick++)
+    {
+        struct kv_bucket* bucket = &kv->buckets[b];
+        uint16_t victim_tag;
+        uint32_t victim_ref;
+
+        kv->rand = kv->rand * 1103515245 + 12345;
+        way = (kv->rand >> 16) % KV_BUCKET_WAYS;
+
+        victim_tag = bucket->tags[way];
+        victim_ref = bucket->items[way];
+        bucket->tags[way] = tag;
+        bucket->items[way] = ref;
+
+        tag = victim_tag;
+        ref = victim_ref;
+        b = kv_alt_bucket(kv, b, tag);
+        bucket = &kv->buckets[b];
+
+        for (way = 0; way < KV_BUCKET_WAYS; way++)
+        {
+            if (bucket->tags[way] == 0)
+            {
+                bucket->tags[way] = tag;
+                bucket->items[way] = ref;
+                return;
+            }
+        }
+    }
+
+    kv_item_free(kv, kv_item_at(kv, ref));
+    kv->stats.evictions++;
+}
+
+int kv_set(struct kv_store* kv, uint64_t hash, const void* key,
+        uint32_t klen, const void* value, uint32_t vlen)
+{
+    struct kv_item *old, *item;
+    uint32_t b = 0;
+    int way = 0, cls;
+
+    cls = kv_class_of(sizeof(struct kv_item) + klen + vlen);
+    if (cls < 0 || klen > UINT8_MAX || vlen > UINT8_MAX)
+    {
+        kv->stats.set_failures++;
+        return -1;
+    }
+
+    old = kv_find(kv, hash, key, klen, &b, &way);
+
+    if (old != NULL && old->cls == cls)
+    {
+        /* Same class: update in place */
+        old->vlen = vlen;
+        memcpy(old->data + klen, value, vlen);
+        old->flags |= KV_ITEM_REFERENCED;
+        kv->stats.sets++;
+        return 0;
+    }
+
+    item = kv_item_alloc(kv, cls);
+    if (item == NULL)
+    {
+        kv->stats.set_failures++;
+        return -1;
+    }
+
+    /* Eviction may have removed the old entry; look it up again */
+    if (old != NULL)
+        old = kv_find(kv, hash, key, klen, &b, &way);
+
+    item->klen = klen;
+    item->vlen = vlen;
+    item->flags = KV_ITEM_LIVE;
+    memcpy(item->data, key, klen);
+    memcpy(item->data + klen, value, vlen);
+
+    if (old != NULL)
+    {
+        kv->buckets[b].items[way] = kv_item_ref(kv, item);
+        kv_item_free(kv, old);
+    }
+    else
+    {
+        kv_insert(kv, hash, kv_item_ref(kv, item));
+    }
+
+    kv->stats.sets++;
+    return 0;
+}
+
+int kv_delete(struct kv_store* kv, uint64_t hash, const void* key,
+        uint32_t klen)
+{
+    struct kv_item* item;
+    uint32_t b;
+    int way;
+
+    item = kv_find(kv, hash, key, klen, &b, &way);
+    if (item == NULL)
+        return -1;
+
+    kv->buckets[b].tags[way] = 0;
+    kv_item_free(kv, item);
+    kv->stats.deletes++;
+
+    return 0;
+}
+
+/*
+ * Saved store: KV_SAVE_MAGIC, the stats, then per item klen and vlen
+ * (one byte each), key and value; a zero klen ends it.
+ */
+#define KV_SAVE_MAGIC       0x4b565331u     /* "KVS1" */
+
+int kv_store_save(const struct kv_store* kv, FILE* out)
+{
+    uint32_t magic = KV_SAVE_MAGIC, b;
+    const struct kv_item* item;
+    uint8_t lens[2];
+    int way;
+
+    if (fwrite(&magic, sizeof(magic), 1, out) != 1 ||
+        fwrite(&kv->stats, sizeof(kv->stats), 1, out) != 1)
+        return -1;
+
+    for (b = 0; b <= kv->bucket_mask; b++)
+    {
+        for (way = 0; way < KV_BUCKET_WAYS; way++)
+        {
+            if (kv->buckets[b].tags[way] == 0)
+                continue;
+
+            item = kv_item_at(kv, kv->buckets[b].items[way]);
+            lens[0] = item->klen;
+            lens[1] = item->vlen;
+            if (fwrite(lens, sizeof(lens), 1, out) != 1 ||
+                fwrite(item->data, item->klen + item->vlen, 1, out) != 1)
+                return -1;
+        }
+    }
+
+    return fputc(0, out) == EOF || ferror(out) ? -1 : 0;
+}
+
+int kv_store_load(struct kv_store* kv, FILE* in)
+{
+    uint8_t lens[2], data[2 * UINT8_MAX];
+    struct kv_stats stats;
+    uint32_t magic;
+
+    if (fread(&magic, sizeof(magic), 1, in) != 1 || magic != KV_SAVE_MAGIC ||
+        fread(&stats, sizeof(stats), 1, in) != 1)
+        return -1;
+
+    while (1)
+    {
+        if (fread(lens, 1, 1, in) != 1)
+            return -1;
+        if (lens[0] == 0)
+            break;
+        if (fread(lens + 1, 1, 1, in) != 1 ||
+            (lens[0] + lens[1] > 0 && fread(data, lens[0] + lens[1], 1, in) != 1))
+            return -1;
+
+        kv_set(kv, kv_hash(data, lens[0]), data, lens[0], data + lens[0], lens[1]);
+    }
+
+    /* The counters carry on from where they were */
+    kv->stats = stats;
+    return 0;
+}
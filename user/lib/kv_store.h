@@ -0,0 +1,122 @@
+#ifndef _KV_STORE_H_
+#define _KV_STORE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @file
+ * Single-threaded in-memory cache behind the "kv" packet handler.
+ *
+ * Index: bucketized cuckoo hash. Each 64-byte bucket holds eight
+ * (16-bit tag, item reference) pairs, and every key has two candidate
+ * buckets, so a lookup touches at most two cache lines before the
+ * item itself. Items live in a slab store: 64 KB pages are handed out
+ * on demand to power-of-two size classes. When a class runs out, a
+ * CLOCK hand over its items evicts one that was not read since the
+ * hand last passed.
+ *
+ * Lookups are split into stages (kv_hash(), kv_prefetch_buckets(),
+ * kv_prefetch_items(), kv_lookup()) so a caller can run each stage
+ * over a whole burst and hide the memory latency.
+ *
+ * Buckets and slabs are carved out of memzones (hugepages).
+ */
+
+struct kv_store;
+
+struct kv_stats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t sets;
+    uint64_t deletes;
+    uint64_t evictions;         /*> Items dropped to make room */
+    uint64_t set_failures;      /*> No memory in the item's class */
+};
+
+struct kv_item
+{
+    uint8_t klen;
+    uint8_t vlen;
+    uint8_t flags;              /*> KV_ITEM_* */
+    uint8_t cls;                /*> Slab class */
+    uint32_t next_free;         /*> Free list link */
+    uint8_t data[];             /*> Key, then value */
+};
+
+#define KV_ITEM_LIVE            0x1
+#define KV_ITEM_REFERENCED      0x2     /*> Read since the CLOCK hand passed */
+
+static inline const uint8_t* kv_item_value(const struct kv_item* item)
+{
+    return item->data + item->klen;
+}
+
+/**
+ * Create a store.
+ *
+ * @param mem_bytes
+ *   Memory for items; the index is sized from it.
+ * @return
+ *   Store, or NULL on failure.
+ */
+struct kv_store* kv_store_create(size_t mem_bytes);
+
+void kv_store_destroy(struct kv_store* kv);
+
+const struct kv_stats* kv_store_stats(const struct kv_store* kv);
+
+uint64_t kv_hash(const void* key, uint32_t klen);
+
+/* Stage 1: bring both candidate buckets into cache */
+void kv_prefetch_buckets(const struct kv_store* kv, uint64_t hash);
+
+/* Stage 2: bring items whose tag matches into cache */
+void kv_prefetch_items(const struct kv_store* kv, uint64_t hash);
+
+/**
+ * Stage 3: find an item.
+ *
+ * @return
+ *   Item, or NULL on miss. Valid until the next update of the store.
+ */
+const struct kv_item* kv_lookup(struct kv_store* kv, uint64_t hash,
+        const void* key, uint32_t klen);
+
+/**
+ * Insert or replace an item.
+ *
+ * @return
+ *   0 on success, -1 if the item does not fit any class or its class
+ *   has no memory.
+ */
+int kv_set(struct kv_store* kv, uint64_t hash, const void* key,
+        uint32_t klen, const void* value, uint32_t vlen);
+
+/**
+ * @return
+ *   0 if the key was present, -1 otherwise.
+ */
+int kv_delete(struct kv_store* kv, uint64_t hash, const void* key,
+        uint32_t klen);
+
+/**
+ * Write every item to out, key and value, for kv_store_load().
+ *
+ * @return
+ *   0 on success, -1 on write error.
+ */
+int kv_store_save(const struct kv_store* kv, FILE* out);
+
+/**
+ * Set the items kv_store_save() wrote. Items that no longer fit are
+ * left out, as kv_set() would.
+ *
+ * @return
+ *   0 on success, -1 on a short or malformed file.
+ */
+int kv_store_load(struct kv_store* kv, FILE* in);
+
+#endif /* _KV_STORE_H_ */
@@ -0,0 +1,122 @@
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "latency.h"
+
+#define LAT_CALIBRATE_NS    10000000
+
+static double tsc_per_ns;
+static pthread_once_t tsc_once = PTHREAD_ONCE_INIT;
+
+void lat_hist_reset(struct lat_hist* h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void lat_hist_merge(struct lat_hist* dst, const struct lat_hist* src)
+{
+    unsigned int i;
+
+    if (src->count == 0)
+        return;
+
+    for (i = 0; i < LAT_HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/* Largest value that falls in bucket idx */
+static uint64_t lat_hist_upper(unsigned int idx)
+{
+    unsigned int k, shift;
+    uint64_t sub;
+
+    if (idx < LAT_HIST_SUB)
+        return idx;
+
+    k = idx - LAT_HIST_SUB;
+    shift = k / LAT_HIST_HALF + 1;
+    sub = k % LAT_HIST_HALF + LAT_HIST_HALF;
+    return ((sub + 1) << shift) - 1;
+}
+
+uint64_t lat_hist_percentile(const struct lat_hist* h, double p)
+{
+    uint64_t rank, seen = 0, upper;
+    unsigned int i;
+
+    if (h->count == 0)
+        return 0;
+
+    rank = (uint64_t) (p / 100.0 * h->count + 0.5);
+    if (rank == 0)
+        rank = 1;
+    if (rank > h->count)
+        rank = h->count;
+
+    for (i = 0; i < LAT_HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+        {
+            upper = lat_hist_upper(i);
+            return upper < h->max ? upper : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+int lat_recorder_collect(struct lat_recorder* r, struct lat_hist* dst,
+        unsigned int timeout_ms)
+{
+    uint32_t req = r->swap_req + 1;
+    struct lat_hist* done;
+    unsigned int waited = 0;
+
+    if (r->swap_ack == r->swap_req)
+        __atomic_store_n(&r->swap_req, req, __ATOMIC_RELEASE);
+    else
+        req = r->swap_req;      /* Still pending from a timed out call */
+
+    while (__atomic_load_n(&r->swap_ack, __ATOMIC_ACQUIRE) != req)
+    {
+        if (waited++ >= timeout_ms)
+            return -1;
+        usleep(1000);
+    }
+
+    /* The worker has moved on to the other histogram */
+    done = &r->hist[r->active ^ 1];
+    lat_hist_merge(dst, done);
+    lat_hist_reset(done);
+
+    return 0;
+}
+
+static void lat_calibrate(void)
+{
+    struct timespec t0, t1;
+    uint64_t c0, c1, ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    c0 = lat_tsc();
+    do
+    {
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ns = (t1.tv_sec - t0.tv_sec) * 1000000000ull + t1.tv_nsec - t0.tv_nsec;
+    } while (ns < LAT_CALIBRATE_NS);
+    c1 = lat_tsc();
+
+    tsc_per_ns = (double) (c1 - c0) / ns;
+}
+
+double lat_tsc_per_ns(void)
+{
+    pthread_once(&tsc_once, lat_calibrate);
+    return tsc_per_ns;
+}
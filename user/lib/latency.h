@@ -0,0 +1,114 @@
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <stdint.h>
+#include <x86intrin.h>
+
+/**
+ * @file
+ * TSC latency histograms.
+ *
+ * Log-linear (HDR style) buckets: values below 2^LAT_HIST_SUB_BITS are
+ * exact, above that every power of two is split into
+ * 2^(LAT_HIST_SUB_BITS-1) linear buckets, so the relative error stays
+ * under 2^-(LAT_HIST_SUB_BITS-1) across the whole 64-bit range.
+ *
+ * A lat_recorder lets one worker record without atomics while another
+ * thread collects: the collector asks for a swap, the worker switches
+ * to the other histogram at its next poll, and the collector then owns
+ * the one it left.
+ */
+
+#define LAT_HIST_SUB_BITS   5
+#define LAT_HIST_SUB        (1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_HALF       (LAT_HIST_SUB / 2)
+#define LAT_HIST_BUCKETS    (LAT_HIST_SUB + (64 - LAT_HIST_SUB_BITS) * LAT_HIST_HALF)
+
+struct lat_hist
+{
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[LAT_HIST_BUCKETS];
+};
+
+struct lat_recorder
+{
+    struct lat_hist hist[2];
+    volatile uint32_t active;       /*> Histogram the worker records into */
+    volatile uint32_t swap_req;     /*> Bumped by the collector */
+    volatile uint32_t swap_ack;     /*> Set to swap_req by the worker */
+};
+
+static inline uint64_t lat_tsc(void)
+{
+    return __rdtsc();
+}
+
+static inline unsigned int lat_hist_index(uint64_t v)
+{
+    unsigned int shift;
+
+    if (v < LAT_HIST_SUB)
+        return v;
+
+    shift = 63 - __builtin_clzll(v) - LAT_HIST_SUB_BITS + 1;
+    return LAT_HIST_SUB + (shift - 1) * LAT_HIST_HALF +
+        ((v >> shift) - LAT_HIST_HALF);
+}
+
+static inline void lat_hist_record(struct lat_hist* h, uint64_t v)
+{
+    h->buckets[lat_hist_index(v)]++;
+    h->count++;
+    if (v > h->max)
+        h->max = v;
+}
+
+static inline void lat_recorder_record(struct lat_recorder* r, uint64_t v)
+{
+    lat_hist_record(&r->hist[r->active], v);
+}
+
+/**
+ * Worker side: honour a pending swap request. Call once per poll.
+ */
+static inline void lat_recorder_poll(struct lat_recorder* r)
+{
+    if (r->swap_ack != r->swap_req)
+    {
+        r->active ^= 1;
+        __atomic_store_n(&r->swap_ack, r->swap_req, __ATOMIC_RELEASE);
+    }
+}
+
+void lat_hist_reset(struct lat_hist* h);
+
+void lat_hist_merge(struct lat_hist* dst, const struct lat_hist* src);
+
+/**
+ * @param p
+ *   Percentile, 0 to 100.
+ * @return
+ *   Upper bound of the bucket holding the p-th percentile, or the
+ *   exact maximum for the last one.
+ */
+uint64_t lat_hist_percentile(const struct lat_hist* h, double p);
+
+/**
+ * Collector side: swap out what the worker recorded since the last
+ * collection and merge it into dst.
+ *
+ * @return
+ *   0 on success, -1 if the worker did not respond within timeout_ms
+ *   (nothing is merged; the request stays pending).
+ */
+int lat_recorder_collect(struct lat_recorder* r, struct lat_hist* dst,
+        unsigned int timeout_ms);
+
+/**
+ * TSC ticks per nanosecond, measured against CLOCK_MONOTONIC on first
+ * use.
+ */
+double lat_tsc_per_ns(void);
+
+#endif /* _LATENCY_H_ */
@@ -7,6 +7,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <pthread.h>
 
 #include <config.h>
 #include <memzone.h>
@@ -15,6 +16,7 @@
 #define MEMZONE_HANDLE_INVALID  (MAX_MEMZONES + 1)
 #define PFN_MASK_SIZE           8
 #define MEMZONE_FILENAME_FMT    "/mnt/huge/memzone-%d"
+#define MEMZONE_SHM_FILENAME_FMT "/dev/shm/nfp-memzone-%d"
 #define MEMZONE_FILENAME_LEN    64
 
 /**
@@ -22,6 +24,9 @@
  */
 static struct memzone _mz[MAX_MEMZONES];
 static uint16_t _free_mz = MAX_MEMZONES;
+static int _iova_va = 0;
+static int _shared = 0;         /* IOVA=VA, but file-backed */
+static pthread_mutex_t _mz_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * Macro to align a value to a given power-of-two. The resultant value
@@ -112,23 +117,48 @@ alloc_memzone()
     uint16_t idx;
     struct memzone* alloc_mz = NULL;
 
+    pthread_mutex_lock(&_mz_lock);
+
     if (_free_mz == 0)
-        return NULL;
+        goto out;
 
     for (idx = 0; idx < MAX_MEMZONES; idx++)
     {
-        alloc_mz = &_mz[idx];
-
-        if (alloc_mz->handle == MEMZONE_HANDLE_INVALID)
+        if (_mz[idx].handle == MEMZONE_HANDLE_INVALID)
         {
+            alloc_mz = &_mz[idx];
             alloc_mz->handle = idx;
             _free_mz--;
-
-            return alloc_mz;
+            break;
         }
     }
 
-    return NULL;
+out:
+    pthread_mutex_unlock(&_mz_lock);
+    return alloc_mz;
+}
+
+/**
+ * Claim the memzone of a given handle, if it is free.
+ */
+static struct memzone*
+claim_memzone(uint16_t handle)
+{
+    struct memzone* mz = NULL;
+
+    if (handle >= MAX_MEMZONES)
+        return NULL;
+
+    pthread_mutex_lock(&_mz_lock);
+    if (_mz[handle].handle == MEMZONE_HANDLE_INVALID)
+    {
+        mz = &_mz[handle];
+        mz->handle = handle;
+        _free_mz--;
+    }
+    pthread_mutex_unlock(&_mz_lock);
+
+    return mz;
 }
 
 /**
@@ -147,9 +177,11 @@ free_memzone(const struct memzone* mz)
         return;
     if (mz != &_mz[idx])
         return;
-    
+
+    pthread_mutex_lock(&_mz_lock);
     _mz[idx].handle = MEMZONE_HANDLE_INVALID;
     _free_mz++;
+    pthread_mutex_unlock(&_mz_lock);
 }
 
 const struct memzone* memzone_reserve(size_t len)
@@ -172,8 +204,24 @@ const struct memzone* memzone_reserve(size_t len)
         return NULL;
     }
 
+    if (_iova_va && !_shared)
+    {
+        addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (addr == MAP_FAILED)
+        {
+            fprintf(stderr, "%s(): Cannot allocate memory: %s\n",
+                __func__, strerror(errno));
+            free_memzone(mz);
+            return NULL;
+        }
+
+        phyaddr = (uint64_t) addr;
+        goto done;
+    }
+
     snprintf(filename, MEMZONE_FILENAME_LEN, 
-            MEMZONE_FILENAME_FMT, mz->handle);
+            _shared ? MEMZONE_SHM_FILENAME_FMT : MEMZONE_FILENAME_FMT, mz->handle);
     fd = open(filename, O_CREAT | O_RDWR, 0755);
     if (fd < 0)
     {
@@ -183,6 +231,16 @@ const struct memzone* memzone_reserve(size_t len)
         return NULL;
     }
 
+    /* Hugepage files grow as they are mapped; shared memory does not */
+    if (_shared && ftruncate(fd, len))
+    {
+        fprintf(stderr, "%s(): Cannot size %s: %s\n",
+            __func__, filename, strerror(errno));
+        close(fd);
+        free_memzone(mz);
+        return NULL;
+    }
+
     addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
         MAP_SHARED | MAP_POPULATE,
         fd, 0);
@@ -195,7 +253,9 @@ const struct memzone* memzone_reserve(size_t len)
         return NULL;
     }
 
-    if ((phyaddr = mem_virt2phy(addr)) == MEMZONE_BAD_IOVA)
+    if (_shared)
+        phyaddr = (uint64_t) addr;
+    else if ((phyaddr = mem_virt2phy(addr)) == MEMZONE_BAD_IOVA)
     {
         fprintf(stderr, "%s(): Unable to convert virtual address to physical address\n",
             __func__);
@@ -203,6 +263,75 @@ const struct memzone* memzone_reserve(size_t len)
         return NULL;
     }
 
+done:
+    mz->addr = (uint64_t) addr;
+    mz->len = len;
+    mz->iova = phyaddr;
+    mz->flags = 0;
+
+    return mz;
+}
+
+const struct memzone* memzone_attach(uint16_t handle, size_t len, uint64_t iova)
+{
+    char filename[MEMZONE_FILENAME_LEN];
+    struct memzone* mz;
+    struct stat st;
+    void* addr;
+    uint64_t phyaddr;
+    int fd;
+
+    len = ALIGN_CEIL(len, HUGE_PAGE_SIZE);
+
+    if (_iova_va && !_shared)
+    {
+        fprintf(stderr, "%s(): Anonymous memzones cannot be attached\n", __func__);
+        return NULL;
+    }
+
+    mz = claim_memzone(handle);
+    if (mz == NULL)
+    {
+        fprintf(stderr, "%s(): Memzone %u is in use\n", __func__, handle);
+        return NULL;
+    }
+
+    snprintf(filename, MEMZONE_FILENAME_LEN,
+            _shared ? MEMZONE_SHM_FILENAME_FMT : MEMZONE_FILENAME_FMT, handle);
+    fd = open(filename, O_RDWR);
+    if (fd < 0 || fstat(fd, &st) || (size_t) st.st_size < len)
+    {
+        fprintf(stderr, "%s(): No memzone of %zu bytes in %s\n",
+            __func__, len, filename);
+        if (fd >= 0)
+            close(fd);
+        free_memzone(mz);
+        return NULL;
+    }
+
+    /* The device holds IO addresses; with IOVA=VA that is where to map */
+    addr = mmap(_shared ? (void*) iova : NULL, len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE | (_shared ? MAP_FIXED_NOREPLACE : 0),
+        fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        fprintf(stderr, "%s(): Cannot map %s: %s\n",
+            __func__, filename, strerror(errno));
+        free_memzone(mz);
+        return NULL;
+    }
+
+    phyaddr = _shared ? (uint64_t) addr : mem_virt2phy(addr);
+    if (phyaddr != iova)
+    {
+        fprintf(stderr, "%s(): %s moved from 0x%lx to 0x%lx\n",
+            __func__, filename, iova, phyaddr);
+        munmap(addr, len);
+        free_memzone(mz);
+        return NULL;
+    }
+
     mz->addr = (uint64_t) addr;
     mz->len = len;
     mz->iova = phyaddr;
@@ -245,3 +374,17 @@ memzone_init()
     }
     _free_mz = MAX_MEMZONES;
 }
+
+void
+memzone_init_iova_va()
+{
+    memzone_init();
+    _iova_va = 1;
+}
+
+void
+memzone_init_iova_va_shared()
+{
+    memzone_init_iova_va();
+    _shared = 1;
+}
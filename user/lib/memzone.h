@@ -23,10 +23,12 @@
  * - Allocate memory using hugepages
  * - Read the PA from /proc/self/pagemap
  * 
+ * Reservation and free are thread-safe. Pages are faulted in by the
+ * reserving thread, so with the default memory policy a memzone lands
+ * on the NUMA node of the CPU that reserved it.
+ *
  * @todo
  *      1. Freelist management
- *      2. Thread-safety!
- *      3. NUMA
  */
 
 struct memzone
@@ -63,6 +65,19 @@ struct memzone
  */
 const struct memzone* memzone_reserve(size_t len);
 
+/**
+ * Map a memzone a previous process reserved, as it left it, e.g. to
+ * take over rings a device is still using. The backing file is found by
+ * handle, and must still be there and map to the same IO address.
+ *
+ * @param handle, len, iova
+ *   As the previous process's memzone descriptor had them.
+ * @return
+ *   The memzone, holding handle, or NULL if the handle is taken, the
+ *   file is missing or short, or its memory moved.
+ */
+const struct memzone* memzone_attach(uint16_t handle, size_t len, uint64_t iova);
+
 /**
  * Free a memzone.
  *
@@ -81,4 +96,21 @@ int memzone_free(const struct memzone *mz);
  */
 void memzone_init();
 
+/**
+ * Initialize memzone allocator for an emulated device.
+ *
+ * Memzones are backed by anonymous memory and their IO address is
+ * their virtual address, which is what the emulated device expects
+ * to DMA to. No hugepages or pagemap access are needed.
+ */
+void memzone_init_iova_va();
+
+/**
+ * As memzone_init_iova_va(), but memzones are backed by files in
+ * /dev/shm, named by handle as the hugepage files are, so that another
+ * process can memzone_attach() them at the same address. The files
+ * stay behind, as hugepage files do.
+ */
+void memzone_init_iova_va_shared();
+
 #endif /* _MEMZONE_H_ */
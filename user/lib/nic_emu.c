@@ -0,0 +1,654 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include <rte_atomic.h>
+
+#include "devcfg.h"
+#include "io.h"
+#include "nic_emu.h"
+#include "pcap_replay.h"
+#include "pkt_csum.h"
+#include "traffic_class.h"
+#include "nfpcore/nfp_cpp.h"
+#include "nfpcore/nfp_cpp_emu.h"
+#include "nfpcore/nfp6000/nfp6000.h"
+
+/* Symbols as exported by firmware/multi_rx.c and multi_tx.c */
+#define EMU_SYMBOL_DEVICE_META  "i32._cfg"
+#define EMU_SYMBOL_RX_STATS     "_rx_counters"
+#define EMU_SYMBOL_TX_STATS     "_tx_counters"
+#define EMU_SYMBOL_RX_DROPS     "_rx_drops"
+
+#define EMU_ISL_CLS             32
+#define EMU_ISL_IMEM0           28
+#define EMU_NUM_COUNTERS        8
+
+/* Smallest frame the built-in generator makes, FCS excluded */
+#define EMU_MIN_FRAME           60
+
+/* Headers of the frame handed to the host */
+#define EMU_ETH_HLEN            14
+#define EMU_IP_HLEN             20
+#define EMU_UDP_HLEN            8
+#define EMU_HDRS_LEN            NIC_EMU_PAYLOAD_OFFSET
+
+/* Packet buffer layout of the firmware (firmware/config.h) */
+#define EMU_PKT_NBI_OFFSET      64
+#define EMU_MAC_PREPEND_BYTES   4
+#define EMU_CTM_RX_LEN          (256 - EMU_PKT_NBI_OFFSET - 2 * EMU_MAC_PREPEND_BYTES)
+#define EMU_CTM_TX_LEN          (256 - EMU_PKT_NBI_OFFSET - EMU_MAC_PREPEND_BYTES)
+
+#define EMU_MIN(a, b)           ((a) < (b) ? (a) : (b))
+
+struct nic_emu
+{
+    volatile struct device_meta_t* meta;    /*> Firmware config (CLS) */
+    volatile uint64_t* rx_counters;         /*> RX packet counters (IMEM) */
+    volatile uint64_t* tx_counters;         /*> TX packet counters (IMEM) */
+    volatile uint64_t* rx_drops;            /*> RX drops per reason (IMEM) */
+    uint64_t interval_ns;                   /*> RX inter-packet gap */
+    struct nic_emu_client client;           /*> Optional traffic source */
+    volatile uint64_t rx_dropped;           /*> Lossy client, ring full */
+    const char* resume;                     /*> State to pick up, or NULL */
+    int suspend;                            /*> Asked to stop where it is */
+    int suspended;                          /*> Stopped so, state intact */
+    int exited;                             /*> NIC thread returned, either way */
+};
+
+/* State file: magic, device_meta_t, then the counters as registered */
+#define EMU_STATE_MAGIC         0x4e454d31u     /* "NEM1" */
+
+static struct nic_emu nic;
+
+static uint64_t nic_emu_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Build a UDP frame as multi_rx hands it to the host: addresses are
+ * already swapped, so it is addressed back to the original sender.
+ */
+static void nic_emu_build_frame(uint8_t* frame, uint32_t len)
+{
+    static const uint8_t dst_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+    static const uint8_t src_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    uint8_t* ip = frame + EMU_ETH_HLEN;
+    uint8_t* udp = ip + EMU_IP_HLEN;
+    uint16_t v16;
+    uint32_t v32;
+
+    memset(frame, 0, len);
+
+    memcpy(frame, dst_mac, 6);
+    memcpy(frame + 6, src_mac, 6);
+    v16 = htons(0x0800);
+    memcpy(frame + 12, &v16, 2);
+
+    ip[0] = 0x45;
+    v16 = htons(len - EMU_ETH_HLEN);
+    memcpy(ip + 2, &v16, 2);
+    ip[8] = 64;
+    ip[9] = 17;
+    v32 = htonl(0x0a000001);
+    memcpy(ip + 12, &v32, 4);
+    v32 = htonl(0x0a000002);
+    memcpy(ip + 16, &v32, 4);
+    v16 = pkt_csum_ipv4_hdr(ip);
+    memcpy(ip + 10, &v16, 2);
+
+    v16 = htons(7);
+    memcpy(udp, &v16, 2);
+    v16 = htons(5000);
+    memcpy(udp + 2, &v16, 2);
+    v16 = htons(len - EMU_ETH_HLEN - EMU_IP_HLEN);
+    memcpy(udp + 4, &v16, 2);
+}
+
+/**
+ * One DMA command: len bytes between the packet buffer at off and the
+ * host at addr.
+ */
+static inline void nic_emu_dma(uint8_t* pkt, uint32_t off, uint32_t len,
+        uint8_t* addr, int to_host)
+{
+    if (len == 0)
+        return;
+
+    if (to_host)
+        memcpy(addr, pkt + off, len);
+    else
+        memcpy(pkt + off, addr, len);
+}
+
+/**
+ * Reference model of the DMA commands firmware/dma.c issues for one
+ * frame, with pkt standing in for its packet buffer: the first ctm_len
+ * bytes are the CTM part, the rest the MU part.
+ *
+ * Without the split (payload_size 0) that is dma_packet_send() and
+ * dma_packet_recv(): the CTM part, then the MU part right after it, to
+ * or from the ring slot. With it, dma_packet_send_split() and
+ * dma_packet_recv_split(): the header (CTM only) to or from the ring
+ * slot, then the rest of the CTM part and the MU part to or from the
+ * payload slot, cut short at payload_size.
+ */
+static void nic_emu_dma_frame(uint8_t* pkt, uint32_t len, int to_host,
+        uint8_t* slot, uint32_t slot_size, uint8_t* payload, uint32_t payload_size)
+{
+    uint32_t ctm_len = EMU_MIN(to_host ? EMU_CTM_RX_LEN : EMU_CTM_TX_LEN, len);
+    uint32_t hdr_len, pay_len, ctm_pay_len;
+
+    if (payload_size == 0)
+    {
+        nic_emu_dma(pkt, 0, ctm_len, slot, to_host);
+        nic_emu_dma(pkt, ctm_len, len - ctm_len, slot + ctm_len, to_host);
+        return;
+    }
+
+    hdr_len = EMU_MIN(slot_size, ctm_len);
+    pay_len = EMU_MIN(payload_size, len - hdr_len);
+    ctm_pay_len = EMU_MIN(ctm_len - hdr_len, pay_len);
+
+    nic_emu_dma(pkt, 0, hdr_len, slot, to_host);
+    nic_emu_dma(pkt, hdr_len, ctm_pay_len, payload, to_host);
+    nic_emu_dma(pkt, ctm_len, pay_len - ctm_pay_len, payload + ctm_pay_len, to_host);
+}
+
+/**
+ * Variable-length slots, as dma_packet_send_varlen() and
+ * dma_packet_recv_varlen(): the slot header goes in front of the frame
+ * in the same transfer. TX reads the whole slot and takes the length
+ * from the header.
+ *
+ * @return
+ *   Frame length.
+ */
+static uint32_t nic_emu_dma_varlen(uint8_t* pkt, uint32_t len, int to_host,
+        uint8_t* slot, uint32_t slot_size)
+{
+    struct ring_slot_hdr hdr;
+
+    if (to_host)
+    {
+        hdr.len = htons(len);
+        hdr.flags = 0;
+        hdr.reserved = 0;
+        memcpy(slot, &hdr, sizeof(hdr));
+        memcpy(slot + RING_SLOT_HDR_LEN, pkt, len);
+        return len;
+    }
+
+    memcpy(&hdr, slot, sizeof(hdr));
+    memcpy(pkt, slot + RING_SLOT_HDR_LEN, slot_size - RING_SLOT_HDR_LEN);
+    return EMU_MIN(ntohs(hdr.len), slot_size - RING_SLOT_HDR_LEN);
+}
+
+/* Mark a built-in frame with a DSCP, as a sender would */
+static void nic_emu_set_dscp(uint8_t* frame, uint8_t dscp)
+{
+    uint8_t* ip = frame + EMU_ETH_HLEN;
+    uint16_t v16;
+
+    ip[1] = dscp << 2;
+    memset(ip + 10, 0, 2);
+    v16 = pkt_csum_ipv4_hdr(ip);
+    memcpy(ip + 10, &v16, 2);
+}
+
+static void* nic_emu_main(void* arg)
+{
+    volatile struct device_meta_t* meta = nic.meta;
+    struct device_meta_t rules;
+    uint32_t capacity, packet_size, payload_size, frame_len, len = 0, tx_len;
+    uint32_t num_classes, c, rx_class = 0;
+    uint32_t rx_tail[RING_MAX_CLASSES] = { 0 };
+    uint32_t tx_head[RING_MAX_CLASSES] = { 0 };
+    volatile void *rx_head_db[RING_MAX_CLASSES], *rx_tail_db[RING_MAX_CLASSES];
+    volatile void *tx_head_db[RING_MAX_CLASSES], *tx_tail_db[RING_MAX_CLASSES];
+    uint8_t *rx_ring[RING_MAX_CLASSES], *tx_ring[RING_MAX_CLASSES];
+    uint8_t *rx_payload, *tx_payload, *frame = NULL, *scratch = NULL;
+    uint64_t seq = 0, deadline, now, full_since = 0, full_budget, gen, start, tx_gen = 0;
+    uint32_t next;
+    int varlen, pending = 0, restarts = 0;
+    int resumed = nic.resume != NULL || nic.suspended;
+
+    (void) arg;
+    nic.suspended = 0;
+
+restart:
+    /* Wait for the host to configure the rings, as the firmware does */
+    while ((gen = nn_readq(&meta->start_signal)) == 0 || gen == RING_RESTARTING)
+    {
+        if (__atomic_load_n(&nic.suspend, __ATOMIC_ACQUIRE))
+            goto suspend;
+        usleep(1000);
+    }
+    rte_rmb();
+
+    capacity = meta->buffer_size;
+    packet_size = meta->packet_size;
+    payload_size = meta->payload_size;
+    varlen = (meta->ring_flags & RING_F_VARLEN) != 0;
+    frame_len = varlen ? packet_size - RING_SLOT_HDR_LEN : packet_size + payload_size;
+    rx_payload = (uint8_t*) (uintptr_t) meta->rx_payload_iova;
+    tx_payload = (uint8_t*) (uintptr_t) meta->tx_payload_iova;
+    full_budget = meta->rx_full_budget_us * 1000ull;
+
+    /* The classification rules, as multi_rx keeps them in local memory */
+    memcpy(&rules, (const void*) meta, sizeof(rules));
+    num_classes = rules.num_classes != 0 ? rules.num_classes : 1;
+
+    rx_ring[0] = (uint8_t*) (uintptr_t) meta->rx_buffer_iova;
+    tx_ring[0] = (uint8_t*) (uintptr_t) meta->tx_buffer_iova;
+    rx_head_db[0] = &meta->rx_head;
+    rx_tail_db[0] = &meta->rx_tail;
+    tx_head_db[0] = &meta->tx_head;
+    tx_tail_db[0] = &meta->tx_tail;
+    for (c = 1; c < num_classes && c < RING_MAX_CLASSES; c++)
+    {
+        rx_ring[c] = (uint8_t*) (uintptr_t) meta->class_rings[c - 1].rx_buffer_iova;
+        tx_ring[c] = (uint8_t*) (uintptr_t) meta->class_rings[c - 1].tx_buffer_iova;
+        rx_head_db[c] = &meta->class_rings[c - 1].rx_head;
+        rx_tail_db[c] = &meta->class_rings[c - 1].rx_tail;
+        tx_head_db[c] = &meta->class_rings[c - 1].tx_head;
+        tx_tail_db[c] = &meta->class_rings[c - 1].tx_tail;
+    }
+
+    if (frame_len < EMU_HDRS_LEN + sizeof(seq) || capacity < packet_size ||
+        (payload_size != 0 && packet_size > EMU_CTM_TX_LEN) ||
+        num_classes > RING_MAX_CLASSES)
+    {
+        fprintf(stderr, "%s(): Unsupported ring config: %u/%u/%u/%u\n",
+            __func__, packet_size, payload_size, capacity, num_classes);
+        goto exit;
+    }
+
+    /*
+     * Rings start empty in each generation, or where a suspend left them.
+     * TX loads the generation itself, below.
+     */
+    for (c = 0; c < num_classes; c++)
+    {
+        rx_tail[c] = resumed ? nn_readl(rx_tail_db[c]) : 0;
+        if (resumed)
+            tx_head[c] = nn_readl(tx_head_db[c]);
+    }
+    if (resumed)
+        tx_gen = gen;
+    pending = 0;
+    full_since = 0;
+
+    free(frame);
+    free(scratch);
+    frame = malloc(frame_len);
+    scratch = malloc(frame_len);
+    if (frame == NULL || scratch == NULL)
+        goto exit;
+    nic_emu_build_frame(frame, frame_len);
+
+    fprintf(stderr, "Emulated NIC %s: %u byte packets, %u byte rings\n",
+        resumed ? "resumed" : restarts ? "restarted" : "started", frame_len, capacity);
+    restarts++;
+    resumed = 0;
+    if (payload_size != 0)
+        fprintf(stderr, "Emulated NIC: headers split at %u bytes, %u byte payload slots\n",
+            packet_size, payload_size);
+    if (varlen)
+        fprintf(stderr, "Emulated NIC: variable-length slots, frames up to %u bytes\n",
+            frame_len);
+    if (num_classes > 1)
+        fprintf(stderr, "Emulated NIC: %u traffic classes\n", num_classes);
+
+    deadline = nic_emu_now_ns();
+
+    while (1)
+    {
+        /* Suspend: a frame not in its ring yet is lost with the process */
+        if (__atomic_load_n(&nic.suspend, __ATOMIC_ACQUIRE))
+            goto suspend;
+
+        /* Restart: paused, only a frame already held goes to the rings */
+        start = nn_readq(&meta->start_signal);
+        if (start != gen && start != 0 && start != RING_RESTARTING)
+            goto restart;
+
+        /* RX: paced, waits for space rather than dropping */
+        now = nic.interval_ns ? nic_emu_now_ns() : deadline;
+        if (now >= deadline)
+        {
+            /* A frame waiting for its ring is not asked for again */
+            if (!pending)
+            {
+                len = frame_len;
+                if (nic.client.rx != NULL)
+                {
+                    int ret = nic.client.rx(nic.client.ctx, frame, frame_len);
+
+                    /* Oversized frames fail the firmware's length filter */
+                    if (ret < 0 || (varlen && (uint32_t) ret > frame_len))
+                        goto tx;
+                    if (varlen)
+                        len = ret;
+                }
+                else
+                {
+                    /* Cycle through the sizes that fit */
+                    if (varlen && frame_len > EMU_MIN_FRAME)
+                    {
+                        len = EMU_MIN_FRAME + seq * 61 % (frame_len - EMU_MIN_FRAME + 1);
+                        nic_emu_build_frame(frame, len);
+                    }
+                    /* Every 8th frame is expedited forwarding */
+                    if (num_classes > 1)
+                        nic_emu_set_dscp(frame, seq % 8 == 0 ? 46 : 0);
+                    memcpy(frame + EMU_HDRS_LEN, &seq, sizeof(seq));
+                    seq++;
+                }
+
+                rx_class = tc_classify(&rules, frame, len);
+
+                /* Counted busy before looking, as the firmware does */
+                meta->rx_busy = 1;
+                rte_mb();
+                if (nn_readq(&meta->start_signal) != gen)
+                {
+                    meta->rx_busy = 0;
+                    nic.rx_drops[RX_DROP_PAUSED]++;
+                    deadline += nic.interval_ns;
+                    if (deadline + nic.interval_ns < now)
+                        deadline = now;
+                    goto tx;
+                }
+                pending = 1;
+            }
+
+            next = rx_tail[rx_class] + packet_size;
+            if (next >= capacity)
+                next = 0;
+
+            if (next == nn_readl(rx_head_db[rx_class]))
+            {
+                /* Ring full: a lossy client's frame is lost */
+                if (nic.client.lossy)
+                {
+                    nic.rx_dropped++;
+                    pending = 0;
+                }
+                /* Held past the budget, the firmware drops it */
+                else if (full_budget != 0)
+                {
+                    now = nic_emu_now_ns();
+                    if (full_since == 0)
+                        full_since = now;
+                    else if (now - full_since > full_budget)
+                    {
+                        nic.rx_drops[RX_DROP_RING_FULL]++;
+                        pending = 0;
+                        full_since = 0;
+                    }
+                }
+            }
+            else
+            {
+                uint32_t tail = rx_tail[rx_class];
+
+                if (varlen)
+                    nic_emu_dma_varlen(frame, len, 1, rx_ring[rx_class] + tail, packet_size);
+                else
+                    nic_emu_dma_frame(frame, frame_len, 1, rx_ring[rx_class] + tail, packet_size,
+                        rx_payload + tail / packet_size * payload_size, payload_size);
+                rte_wmb();
+
+                rx_tail[rx_class] = next;
+                nn_writel(rx_tail[rx_class], rx_tail_db[rx_class]);
+                nic.rx_counters[0]++;
+                pending = 0;
+                full_since = 0;
+
+                /* Keep the schedule, but don't burst to catch up */
+                deadline += nic.interval_ns;
+                if (deadline + nic.interval_ns < now)
+                    deadline = now;
+            }
+        }
+
+tx:
+        if (!pending)
+            meta->rx_busy = 0;
+
+        /* TX: consume whatever the host has queued, most urgent class first */
+        if (start == RING_RESTARTING)
+            continue;
+        for (c = 0; c < num_classes; c++)
+        {
+            if (tx_head[c] != nn_readl(tx_tail_db[c]))
+                break;
+        }
+
+        /*
+         * As multi_tx.c, TX reloads on a new generation both when a ring
+         * looks non-empty against its old head and after a round that
+         * found them all empty: the new tail may match the old head.
+         */
+        if (start != tx_gen && start != 0)
+        {
+            for (c = 0; c < num_classes; c++)
+                tx_head[c] = 0;
+            tx_gen = start;
+            continue;
+        }
+
+        if (c < num_classes)
+        {
+            rte_rmb();
+            tx_len = frame_len;
+            if (varlen)
+                tx_len = nic_emu_dma_varlen(scratch, 0, 0, tx_ring[c] + tx_head[c], packet_size);
+            else
+                nic_emu_dma_frame(scratch, frame_len, 0, tx_ring[c] + tx_head[c], packet_size,
+                    tx_payload + tx_head[c] / packet_size * payload_size, payload_size);
+            if (nic.client.tx != NULL)
+                nic.client.tx(nic.client.ctx, scratch, tx_len);
+
+            tx_head[c] += packet_size;
+            if (tx_head[c] >= capacity)
+                tx_head[c] = 0;
+            nn_writel(tx_head[c], tx_head_db[c]);
+            nic.tx_counters[0]++;
+        }
+    }
+
+suspend:
+    meta->rx_busy = 0;
+    nic.suspended = 1;
+exit:
+    free(frame);
+    free(scratch);
+    __atomic_store_n(&nic.exited, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static int nic_emu_start(void)
+{
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, nic_emu_main, NULL))
+    {
+        fprintf(stderr, "%s(): Cannot start NIC thread\n", __func__);
+        return -1;
+    }
+    pthread_detach(thread);
+
+    return 0;
+}
+
+void nic_emu_set_client(const struct nic_emu_client* client)
+{
+    nic.client = *client;
+}
+
+uint64_t nic_emu_rx_dropped(void)
+{
+    return nic.rx_dropped;
+}
+
+void nic_emu_set_resume(const char* path)
+{
+    nic.resume = path;
+}
+
+/* The firmware's memory, in the order of the state file */
+static void nic_emu_state_parts(void** parts, size_t* sizes)
+{
+    parts[0] = (void*) nic.meta;
+    sizes[0] = sizeof(struct device_meta_t);
+    parts[1] = (void*) nic.rx_counters;
+    sizes[1] = EMU_NUM_COUNTERS * sizeof(uint64_t);
+    parts[2] = (void*) nic.tx_counters;
+    sizes[2] = EMU_NUM_COUNTERS * sizeof(uint64_t);
+    parts[3] = (void*) nic.rx_drops;
+    sizes[3] = RX_DROP_REASONS * sizeof(uint64_t);
+}
+
+int nic_emu_suspend(const char* path)
+{
+    uint32_t magic = EMU_STATE_MAGIC;
+    void* parts[4];
+    size_t sizes[4];
+    FILE* f;
+    int i, ret = 0;
+
+    __atomic_store_n(&nic.suspend, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&nic.exited, __ATOMIC_ACQUIRE))
+        usleep(100);
+
+    if (!nic.suspended)
+    {
+        fprintf(stderr, "%s(): NIC thread had stopped\n", __func__);
+        return -1;
+    }
+
+    f = fopen(path, "w");
+    if (f != NULL)
+    {
+        nic_emu_state_parts(parts, sizes);
+        ret = fwrite(&magic, sizeof(magic), 1, f) != 1;
+        for (i = 0; i < 4; i++)
+            ret |= fwrite(parts[i], sizes[i], 1, f) != 1;
+        ret |= fclose(f) != 0;
+        if (ret == 0)
+            return 0;
+        remove(path);
+    }
+
+    /* Not saved: carry on where it stopped, in this process */
+    fprintf(stderr, "%s(): Cannot write %s\n", __func__, path);
+    nic.suspend = 0;
+    nic.exited = 0;
+    nic_emu_start();
+    return -1;
+}
+
+/* Load the state file over the freshly registered symbols */
+static int nic_emu_load(const char* path)
+{
+    uint32_t magic;
+    void* parts[4];
+    size_t sizes[4];
+    FILE* f;
+    int i, ret;
+
+    f = fopen(path, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, "%s(): Cannot open %s\n", __func__, path);
+        return -1;
+    }
+
+    nic_emu_state_parts(parts, sizes);
+    ret = fread(&magic, sizeof(magic), 1, f) != 1 || magic != EMU_STATE_MAGIC;
+    for (i = 0; i < 4 && !ret; i++)
+        ret = fread(parts[i], sizes[i], 1, f) != 1;
+    fclose(f);
+
+    if (ret)
+    {
+        fprintf(stderr, "%s(): Bad state file %s\n", __func__, path);
+        memset(parts[0], 0, sizes[0]);
+        return -1;
+    }
+
+    unlink(path);
+    return 0;
+}
+
+int nic_emu_init()
+{
+    const char* rate_env;
+    uint64_t rate = NIC_EMU_RATE_DEFAULT;
+
+    rate_env = getenv(NIC_EMU_RATE_ENV);
+    if (rate_env != NULL && rate_env[0] != '\0')
+        rate = strtoull(rate_env, NULL, 0);
+    nic.interval_ns = rate ? 1000000000ull / rate : 0;
+
+    if (nic.client.rx == NULL && getenv(PCAP_REPLAY_ENV) != NULL)
+    {
+        const char* loops = getenv(PCAP_REPLAY_LOOPS_ENV);
+        struct pcap_replay* replay;
+
+        replay = pcap_replay_open(getenv(PCAP_REPLAY_ENV),
+                    getenv(PCAP_REPLAY_SPEED_ENV),
+                    loops != NULL ? strtoul(loops, NULL, 0) : 1);
+        if (replay == NULL)
+            return -1;
+        pcap_replay_client(replay, &nic.client);
+
+        /* The replay keeps its own time */
+        rate = 0;
+        nic.interval_ns = 0;
+    }
+
+    nic.meta = nfp_cpp_emu_symbol_add(EMU_SYMBOL_DEVICE_META,
+                    NFP_CPP_TARGET_CLS, EMU_ISL_CLS,
+                    sizeof(struct device_meta_t));
+    nic.rx_counters = nfp_cpp_emu_symbol_add(EMU_SYMBOL_RX_STATS,
+                    NFP_CPP_TARGET_MU, EMU_ISL_IMEM0,
+                    EMU_NUM_COUNTERS * sizeof(uint64_t));
+    nic.tx_counters = nfp_cpp_emu_symbol_add(EMU_SYMBOL_TX_STATS,
+                    NFP_CPP_TARGET_MU, EMU_ISL_IMEM0,
+                    EMU_NUM_COUNTERS * sizeof(uint64_t));
+
+    nic.rx_drops = nfp_cpp_emu_symbol_add(EMU_SYMBOL_RX_DROPS,
+                    NFP_CPP_TARGET_MU, EMU_ISL_IMEM0,
+                    RX_DROP_REASONS * sizeof(uint64_t));
+
+    if (nic.meta == NULL || nic.rx_counters == NULL || nic.tx_counters == NULL ||
+        nic.rx_drops == NULL)
+    {
+        fprintf(stderr, "%s(): Cannot register firmware symbols\n", __func__);
+        return -1;
+    }
+
+    /* Nothing to resume: start from scratch */
+    if (nic.resume != NULL && nic_emu_load(nic.resume))
+        nic.resume = NULL;
+
+    if (nic_emu_start())
+        return -1;
+
+    fprintf(stderr, "Emulated NIC: %lu packets/s%s\n", rate,
+        rate ? "" : " (unthrottled)");
+
+    return 0;
+}
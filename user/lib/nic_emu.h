@@ -0,0 +1,107 @@
+#ifndef _NIC_EMU_H_
+#define _NIC_EMU_H_
+
+/**
+ * @file
+ * Host-side stand-in for the multi_rx/multi_tx firmware, for use with
+ * the emulated NFP (see nfpcore/nfp_cpp_emu.h).
+ *
+ * Registers the firmware's runtime symbols with the emulated device and
+ * starts a thread that follows the device_meta_t ring protocol: once
+ * start_signal is set it delivers UDP frames into the RX ring and
+ * consumes the TX ring, updating rx_tail/tx_head and the per-context
+ * counters the way the firmware does. Like the firmware it waits for
+ * ring space rather than dropping, unless rx_full_budget_us is set and
+ * runs out. It follows restarts too: paused, it drops arrivals, and it
+ * reloads the configuration on each new generation. It can also be
+ * suspended and resumed in the next process (nic_emu_suspend()), for
+ * warm restarts of the host.
+ *
+ * The RX rate is taken from NFP_EMU_RATE in packets per second; 0 runs
+ * as fast as the host drains the ring. With variable-length slots the
+ * built-in frames cycle through sizes from 60 bytes to the largest
+ * that fits. With traffic classes, frames are sorted into the class
+ * rings by tc_classify() and every 8th built-in frame carries DSCP 46
+ * (EF); TX drains the most urgent class first. With NFP_EMU_REPLAY set,
+ * frames come from a capture file instead (see pcap_replay.h).
+ */
+
+#include <stdint.h>
+
+#define NIC_EMU_RATE_ENV        "NFP_EMU_RATE"
+#define NIC_EMU_RATE_DEFAULT    1000000
+
+/* Start of the UDP payload in emulated frames */
+#define NIC_EMU_PAYLOAD_OFFSET  42
+
+/**
+ * Traffic source and sink in place of the built-in generator, e.g. a
+ * closed-loop benchmark client. Called from the NIC thread.
+ */
+struct nic_emu_client
+{
+    /**
+     * Fill in the payload of the next RX frame, of at most len bytes.
+     * The headers are already set up; the client may also replace them.
+     *
+     * @return
+     *   Length of the frame to deliver, -1 to deliver nothing for now.
+     *   Fixed-size slots always take len bytes. With variable-length
+     *   slots a frame over len is dropped, as the firmware would.
+     */
+    int (*rx)(void* ctx, uint8_t* frame, uint32_t len);
+
+    /* A frame the host put in the TX ring */
+    void (*tx)(void* ctx, const uint8_t* frame, uint32_t len);
+
+    void* ctx;
+
+    /**
+     * Ask for frames even when the RX ring is full, and drop them
+     * (see nic_emu_rx_dropped()), as a NIC at line rate would.
+     */
+    int lossy;
+};
+
+/**
+ * Register firmware symbols and start the emulated NIC thread.
+ * Must be called before the symbol table is read.
+ *
+ * @return
+ *   0 on success, -1 on failure.
+ */
+int nic_emu_init();
+
+/**
+ * Replace the built-in generator. Must be called before nic_emu_init().
+ */
+void nic_emu_set_client(const struct nic_emu_client* client);
+
+/**
+ * @return
+ *   Frames a lossy client produced while the RX ring was full.
+ */
+uint64_t nic_emu_rx_dropped(void);
+
+/**
+ * Stop the NIC thread where it is and save what the firmware keeps
+ * (device_meta_t and the counters) to path, so that the next process
+ * can carry on with it, as a real NIC carries on across host restarts.
+ * The rings are left as they are; frames stop flowing until then.
+ *
+ * @return
+ *   0 on success. -1 if the state cannot be written, and the NIC then
+ *   carries on; or if its thread had stopped already, on a ring config
+ *   it could not run.
+ */
+int nic_emu_suspend(const char* path);
+
+/**
+ * Pick up the state nic_emu_suspend() saved to path: the NIC runs the
+ * rings on from where they were, without waiting for the host to start
+ * them. The file is removed once read; without it the NIC starts from
+ * scratch. Must be called before nic_emu_init().
+ */
+void nic_emu_set_resume(const char* path);
+
+#endif /* _NIC_EMU_H_ */
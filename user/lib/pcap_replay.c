@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pcap_replay.h"
+
+#define PCAP_MAGIC_US           0xa1b2c3d4
+#define PCAP_MAGIC_NS           0xa1b23c4d
+#define PCAPNG_SHB              0x0a0d0d0a
+#define PCAPNG_BYTE_ORDER       0x1a2b3c4d
+#define PCAPNG_IDB              1
+#define PCAPNG_SPB              3
+#define PCAPNG_EPB              6
+#define PCAPNG_OPT_TSRESOL      9
+#define PCAPNG_MAX_IFACES       32
+
+/* Finest if_tsresol ts_to_ns() can convert: 10^-19 and 2^-63 */
+#define PCAPNG_TSRESOL_MAX_DEC  19
+#define PCAPNG_TSRESOL_MAX_BIN  63
+#define LINKTYPE_ETHERNET       1
+
+/* Preamble, start of frame delimiter, FCS and inter-frame gap */
+#define WIRE_OVERHEAD           24
+
+enum replay_speed
+{
+    REPLAY_MAX,
+    REPLAY_TIMED,           /*> Capture timestamps, scaled */
+    REPLAY_LINE,            /*> Wire time at a fixed link rate */
+};
+
+struct replay_pkt
+{
+    uint64_t ts_ns;         /*> From the first frame */
+    uint64_t off;           /*> Into data */
+    uint32_t len;           /*> Bytes in data */
+    uint32_t wire_len;      /*> Original length */
+};
+
+struct pcap_replay
+{
+    struct replay_pkt* pkts;
+    uint8_t* data;
+    uint64_t count;
+    uint64_t skipped;       /*> Not Ethernet, or malformed */
+    uint64_t duration_ns;   /*> First to last timestamp */
+
+    enum replay_speed speed;
+    double scale;           /*> REPLAY_TIMED: speed-up factor */
+    double ns_per_bit;      /*> REPLAY_LINE */
+    unsigned int loops;
+
+    /* Playback, on the NIC thread */
+    uint64_t next;
+    unsigned int loop;
+    uint64_t start_ns;      /*> Start of the current loop */
+    uint64_t due_ns;        /*> REPLAY_LINE: when the next frame may go */
+    uint64_t sent;
+    uint64_t dropped_base;  /*> NIC drop count at start */
+    int done;
+};
+
+/* Parser state while loading */
+struct replay_loader
+{
+    const uint8_t* p;
+    const uint8_t* end;
+    int swap;
+    uint64_t first_ts;
+    int have_first;
+    uint64_t data_len;
+};
+
+static uint64_t replay_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t rd32(const struct replay_loader* ld, const uint8_t* p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return ld->swap ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t rd16(const struct replay_loader* ld, const uint8_t* p)
+{
+    uint16_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return ld->swap ? __builtin_bswap16(v) : v;
+}
+
+static int tsresol_valid(uint8_t resol)
+{
+    if (resol & 0x80)
+        return (resol & 0x7f) <= PCAPNG_TSRESOL_MAX_BIN;
+    return resol <= PCAPNG_TSRESOL_MAX_DEC;
+}
+
+/**
+ * Convert a timestamp in units of the interface resolution (pcapng
+ * if_tsresol encoding: 10^-n, or 2^-n with the top bit set) to ns.
+ * resol must pass tsresol_valid().
+ */
+static uint64_t ts_to_ns(uint64_t ts, uint8_t resol)
+{
+    unsigned int n = resol & 0x7f;
+    uint64_t div = 1;
+
+    if (resol & 0x80)
+        return (uint64_t) ((long double) ts * 1e9L / (long double) (1ull << n));
+
+    if (n <= 9)
+    {
+        while (n++ < 9)
+            div *= 10;
+        return ts * div;
+    }
+
+    while (n-- > 9)
+        div *= 10;
+    return ts / div;
+}
+
+/* Add one frame; first pass (pkts NULL) only counts */
+static void replay_add(struct pcap_replay* r, struct replay_loader* ld,
+        const uint8_t* frame, uint32_t len, uint32_t wire_len, uint64_t ts_ns)
+{
+    struct replay_pkt* pkt;
+
+    if (!ld->have_first)
+    {
+        ld->first_ts = ts_ns;
+        ld->have_first = 1;
+    }
+
+    if (r->pkts != NULL)
+    {
+        pkt = &r->pkts[r->count];
+        pkt->ts_ns = ts_ns >= ld->first_ts ? ts_ns - ld->first_ts : 0;
+        pkt->off = ld->data_len;
+        pkt->len = len;
+        pkt->wire_len = wire_len;
+        memcpy(r->data + ld->data_len, frame, len);
+        if (pkt->ts_ns > r->duration_ns)
+            r->duration_ns = pkt->ts_ns;
+    }
+
+    r->count++;
+    ld->data_len += len;
+}
+
+static int replay_parse_pcap(struct pcap_replay* r, struct replay_loader* ld)
+{
+    const uint8_t* p = ld->p;
+    uint32_t magic, caplen, wire_len;
+    int nsec;
+
+    magic = rd32(ld, p);
+    if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS)
+        ld->swap = 0;
+    else if (__builtin_bswap32(magic) == PCAP_MAGIC_US ||
+             __builtin_bswap32(magic) == PCAP_MAGIC_NS)
+        ld->swap = 1;
+    else
+        return -1;
+    nsec = rd32(ld, p) == PCAP_MAGIC_NS;
+
+    if (rd32(ld, p + 20) != LINKTYPE_ETHERNET)
+    {
+        fprintf(stderr, "%s(): Not an Ethernet capture\n", __func__);
+        return -1;
+    }
+
+    for (p += 24; p + 16 <= ld->end; p += 16 + caplen)
+    {
+        caplen = rd32(ld, p + 8);
+        wire_len = rd32(ld, p + 12);
+        if (p + 16 + caplen > ld->end)
+        {
+            r->skipped++;
+            break;
+        }
+
+        replay_add(r, ld, p + 16, caplen, wire_len,
+            rd32(ld, p) * 1000000000ull +
+            (uint64_t) rd32(ld, p + 4) * (nsec ? 1 : 1000));
+    }
+
+    return 0;
+}
+
+static int replay_parse_pcapng(struct pcap_replay* r, struct replay_loader* ld)
+{
+    uint8_t replayable[PCAPNG_MAX_IFACES];  /* Ethernet, with a usable tsresol */
+    uint8_t tsresol[PCAPNG_MAX_IFACES];
+    unsigned int ifaces = 0, iface;
+    const uint8_t *p, *opt, *end;
+    uint32_t type, blen, caplen, wire_len;
+    uint16_t code, olen;
+
+    for (p = ld->p; p + 12 <= ld->end; p += blen)
+    {
+        type = rd32(ld, p);
+
+        if (type == PCAPNG_SHB)
+        {
+            /* Each section sets its own byte order and interfaces */
+            uint32_t bom;
+
+            memcpy(&bom, p + 8, sizeof(bom));
+            if (bom == PCAPNG_BYTE_ORDER)
+                ld->swap = 0;
+            else if (__builtin_bswap32(bom) == PCAPNG_BYTE_ORDER)
+                ld->swap = 1;
+            else
+                return -1;
+            ifaces = 0;
+        }
+
+        blen = rd32(ld, p + 4);
+        if (blen < 12 || (blen & 3) || p + blen > ld->end)
+        {
+            r->skipped++;
+            break;
+        }
+
+        switch (type)
+        {
+            case PCAPNG_IDB:
+                if (ifaces == PCAPNG_MAX_IFACES)
+                    break;
+                replayable[ifaces] = rd16(ld, p + 8) == LINKTYPE_ETHERNET;
+                tsresol[ifaces] = 6;
+                end = p + blen - 4;
+                for (opt = p + 16; opt + 4 <= end; opt += 4 + ((olen + 3) & ~3))
+                {
+                    code = rd16(ld, opt);
+                    olen = rd16(ld, opt + 2);
+                    if (code == 0)
+                        break;
+                    if (code == PCAPNG_OPT_TSRESOL && olen >= 1)
+                        tsresol[ifaces] = opt[4];
+                }
+                /* Its frames are skipped, rather than timed with garbage */
+                if (!tsresol_valid(tsresol[ifaces]))
+                    replayable[ifaces] = 0;
+                ifaces++;
+                break;
+
+            case PCAPNG_EPB:
+                /* 28 bytes of header and the trailing length around the data */
+                if (blen < 32)
+                {
+                    r->skipped++;
+                    break;
+                }
+                iface = rd32(ld, p + 8);
+                caplen = rd32(ld, p + 20);
+                wire_len = rd32(ld, p + 24);
+                if (iface >= ifaces || !replayable[iface] || caplen > blen - 32)
+                {
+                    r->skipped++;
+                    break;
+                }
+                replay_add(r, ld, p + 28, caplen, wire_len,
+                    ts_to_ns(((uint64_t) rd32(ld, p + 12) << 32) | rd32(ld, p + 16),
+                        tsresol[iface]));
+                break;
+
+            case PCAPNG_SPB:
+                /* No timestamp; plays back to back */
+                if (blen < 16 || ifaces == 0 || !replayable[0])
+                {
+                    r->skipped++;
+                    break;
+                }
+                wire_len = rd32(ld, p + 8);
+                caplen = wire_len < blen - 16 ? wire_len : blen - 16;
+                replay_add(r, ld, p + 12, caplen, wire_len,
+                    ld->have_first ? ld->first_ts : 0);
+                break;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Walk the file. With r->pkts NULL only counts frames and their bytes,
+ * otherwise fills in r->pkts and r->data.
+ */
+static int replay_parse(struct pcap_replay* r, const uint8_t* map, size_t size,
+        uint64_t* data_len)
+{
+    struct replay_loader ld = { .p = map, .end = map + size };
+    uint32_t magic;
+    int ret;
+
+    if (size < 24)
+        return -1;
+
+    memcpy(&magic, map, sizeof(magic));
+    if (magic == PCAPNG_SHB)
+        ret = replay_parse_pcapng(r, &ld);
+    else
+        ret = replay_parse_pcap(r, &ld);
+
+    *data_len = ld.data_len;
+    return ret;
+}
+
+static int replay_set_speed(struct pcap_replay* r, const char* speed)
+{
+    char* end;
+    double v;
+
+    r->speed = REPLAY_MAX;
+    if (speed == NULL || speed[0] == '\0' || strcmp(speed, "max") == 0)
+        return 0;
+
+    if (strcmp(speed, "orig") == 0)
+    {
+        r->speed = REPLAY_TIMED;
+        r->scale = 1;
+        return 0;
+    }
+
+    v = strtod(speed, &end);
+    if (v <= 0 || end[0] == '\0' || end[1] != '\0')
+        return -1;
+
+    if (end[0] == 'x')
+    {
+        r->speed = REPLAY_TIMED;
+        r->scale = v;
+        return 0;
+    }
+
+    if (end[0] == 'g')
+    {
+        r->speed = REPLAY_LINE;
+        r->ns_per_bit = 1 / v;
+        return 0;
+    }
+
+    return -1;
+}
+
+static void replay_report(struct pcap_replay* r)
+{
+    uint64_t dropped = nic_emu_rx_dropped() - r->dropped_base;
+
+    fprintf(stderr, "Replay done: %lu frames sent, %lu absorbed by the host, "
+                    "%lu dropped (RX ring full)\n",
+        r->sent, r->sent - dropped, dropped);
+}
+
+/* NIC thread: produce the next frame if it is due */
+static int replay_rx(void* ctx, uint8_t* frame, uint32_t len)
+{
+    struct pcap_replay* r = ctx;
+    const struct replay_pkt* pkt;
+    uint64_t now;
+
+    if (r->done)
+        return -1;
+
+    if (r->next == r->count)
+    {
+        r->next = 0;
+        r->loop++;
+        if (r->loops != 0 && r->loop == r->loops)
+        {
+            r->done = 1;
+            replay_report(r);
+            return -1;
+        }
+        r->start_ns = 0;
+    }
+
+    pkt = &r->pkts[r->next];
+
+    switch (r->speed)
+    {
+        case REPLAY_TIMED:
+            now = replay_now_ns();
+            if (r->start_ns == 0)
+                r->start_ns = now;
+            if (now - r->start_ns < pkt->ts_ns / r->scale)
+                return -1;
+            break;
+
+        case REPLAY_LINE:
+            now = replay_now_ns();
+            if (r->due_ns == 0)
+                r->due_ns = now;
+            if (now < r->due_ns)
+                return -1;
+            r->due_ns += (pkt->wire_len + WIRE_OVERHEAD) * 8 * r->ns_per_bit;
+            if (r->due_ns < now)
+                r->due_ns = now;    /* Don't burst to catch up */
+            break;
+
+        default:
+            break;
+    }
+
+    if (r->sent == 0)
+        r->dropped_base = nic_emu_rx_dropped();
+
+    if (pkt->len >= len)
+    {
+        memcpy(frame, r->data + pkt->off, len);
+    }
+    else
+    {
+        memcpy(frame, r->data + pkt->off, pkt->len);
+        memset(frame + pkt->len, 0, len - pkt->len);
+    }
+
+    r->next++;
+    r->sent++;
+    return pkt->len;
+}
+
+struct pcap_replay* pcap_replay_open(const char* path, const char* speed,
+        unsigned int loops)
+{
+    struct pcap_replay* r;
+    struct stat st;
+    uint8_t* map;
+    uint64_t data_len;
+    int fd;
+
+    r = calloc(1, sizeof(*r));
+    if (r == NULL)
+        return NULL;
+
+    if (replay_set_speed(r, speed))
+    {
+        fprintf(stderr, "%s(): Bad speed: %s\n", __func__, speed);
+        free(r);
+        return NULL;
+    }
+    r->loops = loops;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        fprintf(stderr, "%s(): Cannot open %s\n", __func__, path);
+        if (fd >= 0)
+            close(fd);
+        free(r);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        free(r);
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    /* First pass counts, second fills the packed array */
+    if (replay_parse(r, map, st.st_size, &data_len) || r->count == 0)
+    {
+        fprintf(stderr, "%s(): No Ethernet frames in %s\n", __func__, path);
+        munmap(map, st.st_size);
+        free(r);
+        return NULL;
+    }
+
+    r->pkts = calloc(r->count, sizeof(*r->pkts));
+    r->data = malloc(data_len ? data_len : 1);
+    if (r->pkts == NULL || r->data == NULL)
+    {
+        munmap(map, st.st_size);
+        pcap_replay_close(r);
+        return NULL;
+    }
+
+    r->count = r->skipped = 0;
+    replay_parse(r, map, st.st_size, &data_len);
+    munmap(map, st.st_size);
+
+    fprintf(stderr, "Replay: %lu frames (%lu skipped) over %.3f s from %s\n",
+        r->count, r->skipped, r->duration_ns / 1e9, path);
+
+    return r;
+}
+
+void pcap_replay_client(struct pcap_replay* replay,
+        struct nic_emu_client* client)
+{
+    memset(client, 0, sizeof(*client));
+    client->rx = replay_rx;
+    client->ctx = replay;
+    /* Timed modes behave like a NIC at line rate: drop when full */
+    client->lossy = replay->speed != REPLAY_MAX;
+}
+
+void pcap_replay_close(struct pcap_replay* replay)
+{
+    free(replay->pkts);
+    free(replay->data);
+    free(replay);
+}
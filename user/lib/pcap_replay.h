@@ -0,0 +1,61 @@
+#ifndef _PCAP_REPLAY_H_
+#define _PCAP_REPLAY_H_
+
+#include <stdint.h>
+
+#include "nic_emu.h"
+
+/**
+ * @file
+ * Replay a capture file into the RX ring of the emulated NIC.
+ *
+ * pcap (micro- or nanosecond, either byte order) and pcapng files are
+ * mmapped and parsed once into a packed array of frames, so the NIC
+ * thread only copies. With fixed-size slots, frames longer than a
+ * slot are truncated and shorter ones zero-padded; variable-length
+ * slots take them as they are. Non-Ethernet frames are skipped.
+ *
+ * Speeds:
+ *   max        As fast as the host drains the ring. Waits for space.
+ *   orig       The capture's own inter-packet gaps.
+ *   <f>x       Those gaps divided by f, e.g. 2x or 0.5x.
+ *   <g>g       Back to back at g Gb/s line rate (framing overhead
+ *              included), e.g. 10g.
+ * In the timed modes a frame that finds the RX ring full is dropped,
+ * as it would be by a NIC, and counted. When the last loop is done the
+ * replay reports how many frames the host absorbed and how many were
+ * dropped.
+ *
+ * nic_emu_init() sets this up by itself when NFP_EMU_REPLAY names a
+ * file; NFP_EMU_REPLAY_SPEED and NFP_EMU_REPLAY_LOOPS (0 for forever,
+ * default 1) configure it.
+ */
+
+#define PCAP_REPLAY_ENV         "NFP_EMU_REPLAY"
+#define PCAP_REPLAY_SPEED_ENV   "NFP_EMU_REPLAY_SPEED"
+#define PCAP_REPLAY_LOOPS_ENV   "NFP_EMU_REPLAY_LOOPS"
+
+struct pcap_replay;
+
+/**
+ * Load a capture file.
+ *
+ * @param speed
+ *   One of the speeds above; NULL for max.
+ * @param loops
+ *   Times to play the file, 0 for forever.
+ * @return
+ *   NULL if the file cannot be read or holds no Ethernet frames.
+ */
+struct pcap_replay* pcap_replay_open(const char* path, const char* speed,
+        unsigned int loops);
+
+/**
+ * Fill in a NIC emulator client that plays the file.
+ */
+void pcap_replay_client(struct pcap_replay* replay,
+        struct nic_emu_client* client);
+
+void pcap_replay_close(struct pcap_replay* replay);
+
+#endif /* _PCAP_REPLAY_H_ */
@@ -0,0 +1,116 @@
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+/**
+ * @file
+ * Helpers for overlapping the cache misses of a burst of lookups, for
+ * handlers whose state does not fit in cache (flow tables, caches).
+ *
+ * Both work on indexes into a burst, so the caller keeps its per-packet
+ * state in its own arrays. Both are inline so that, called with
+ * functions from the same file, the callbacks are inlined as well.
+ *
+ * pipeline_run() is a software pipeline for lookups with a fixed number
+ * of dependent loads, one stage per load: each stage prefetches what the
+ * next one reads and runs `ahead` items before it. E.g. with three
+ * stages (hash and prefetch the bucket; read it and prefetch the entry;
+ * use the entry) the bucket of item i + 2 * ahead and the entry of item
+ * i + ahead are in flight while item i finishes. Items finish in order.
+ * The distance must cover a miss: a few items of cheap work take far
+ * less than one trip to DRAM.
+ *
+ * amac_run() interleaves lookups whose number of dependent loads varies,
+ * e.g. walking hash chains (asynchronous memory access chaining). Each
+ * lookup is a state machine: one call of step() does one stage,
+ * prefetches what the next stage needs and returns AMAC_PENDING, or
+ * returns AMAC_DONE. A window of `width` lookups is stepped round robin
+ * and a finished one is replaced at once by the next, so there are
+ * always `width` misses in flight regardless of chain lengths. Items
+ * finish out of order: do anything that must follow arrival order in a
+ * later pass.
+ */
+
+#define PIPELINE_AHEAD      8       /*> Default prefetch distance */
+#define AMAC_MAX_WIDTH      32
+
+#define AMAC_DONE           0
+#define AMAC_PENDING        1
+
+/* Work on item i of a burst */
+typedef void (*pipeline_fn)(void* ctx, unsigned int i);
+
+/**
+ * One stage of the lookup for item i. The first call for an item is
+ * the first stage; the caller tracks the stage in its own state.
+ *
+ * @return
+ *   AMAC_PENDING if more stages are left, AMAC_DONE when finished.
+ */
+typedef int (*amac_step_fn)(void* ctx, unsigned int i);
+
+/**
+ * Run up to three stages over count items: first() for item
+ * i + 2 * ahead, then middle() for item i + ahead, then last() for item
+ * i. middle may be NULL for lookups with a single dependent load, in
+ * which case first() runs `ahead` items before last().
+ *
+ * The stages are separate arguments rather than an array so that they
+ * are inlined; called through a table they cost more than the misses
+ * they hide.
+ */
+static inline void pipeline_run(void* ctx, unsigned int count,
+        unsigned int ahead, pipeline_fn first, pipeline_fn middle,
+        pipeline_fn last)
+{
+    unsigned int step, depth = middle != NULL ? 2 * ahead : ahead;
+
+    for (step = 0; step < count + depth; step++)
+    {
+        if (step >= depth)
+            last(ctx, step - depth);
+        if (middle != NULL && step >= ahead && step - ahead < count)
+            middle(ctx, step - ahead);
+        if (step < count)
+            first(ctx, step);
+    }
+}
+
+/**
+ * Step count lookups to completion, at most width at a time.
+ */
+static inline void amac_run(void* ctx, unsigned int count,
+        unsigned int width, amac_step_fn step)
+{
+    unsigned int window[AMAC_MAX_WIDTH];
+    unsigned int next = 0, active = 0, k = 0;
+
+    if (width > AMAC_MAX_WIDTH)
+        width = AMAC_MAX_WIDTH;
+    if (width == 0)
+        width = 1;
+
+    while (active < width && next < count)
+        window[active++] = next++;
+
+    while (active > 0)
+    {
+        if (step(ctx, window[k]) == AMAC_DONE)
+        {
+            if (next < count)
+                window[k] = next++;
+            else
+            {
+                /* Close the gap; the moved lookup is stepped next */
+                window[k] = window[--active];
+                if (k >= active)
+                    k = 0;
+                continue;
+            }
+        }
+
+        if (++k >= active)
+            k = 0;
+    }
+}
+
+#endif /* _PIPELINE_H_ */
@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "pkt_copy.h"
+
+/**
+ * Kernel bodies are always_inline so that each fixed-size wrapper gets a
+ * fully unrolled copy. The non-temporal bodies need a line-aligned
+ * destination and fall back to cached stores otherwise.
+ *
+ * Tails shorter than a vector are finished with one overlapping vector
+ * ending at the last byte, or with memcpy below the vector width.
+ *
+ * Non-temporal stores only ever cover whole 64 byte lines; the bytes
+ * past the last full line go through the cache. A line written partly
+ * with streaming stores and partly with cached ones forces a partial
+ * write-combining flush, which costs more than the whole copy, so the
+ * tail is also copied strictly forward, never overlapping a streamed
+ * line.
+ */
+
+#define ALWAYS_INLINE   static inline __attribute__((always_inline))
+
+/* memcpy */
+
+static void copy_memcpy(void* dst, const void* src, size_t len)
+{
+    memcpy(dst, src, len);
+}
+
+/**
+ * Copy under 64 bytes without touching anything before dst. The
+ * barriers keep the compiler from merging the pieces back into one
+ * overlapping store.
+ */
+#define TAIL_PIECE(n)                                                       \
+    if (len & (n))                                                          \
+    {                                                                       \
+        memcpy(d, s, n);                                                    \
+        d += n;                                                             \
+        s += n;                                                             \
+        __asm__ volatile("" ::: "memory");                                  \
+    }
+
+ALWAYS_INLINE void copy_tail_forward(uint8_t* d, const uint8_t* s, size_t len)
+{
+    TAIL_PIECE(32)
+    TAIL_PIECE(16)
+    TAIL_PIECE(8)
+    TAIL_PIECE(4)
+    TAIL_PIECE(2)
+    TAIL_PIECE(1)
+}
+
+/* SSE2, 16 bytes per store */
+
+ALWAYS_INLINE void copy_sse2_body(void* dst, const void* src, size_t len, int nt)
+{
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    size_t i, lines;
+
+    if (len < 16)
+    {
+        memcpy(d, s, len);
+        return;
+    }
+
+    if (nt && ((uintptr_t) d & 63))
+        nt = 0;
+
+    lines = nt ? len & ~(size_t) 63 : 0;
+
+    for (i = 0; i < lines; i += 16)
+        _mm_stream_si128((__m128i*) (d + i),
+            _mm_loadu_si128((const __m128i*) (s + i)));
+    for (; i + 16 <= len; i += 16)
+        _mm_storeu_si128((__m128i*) (d + i),
+            _mm_loadu_si128((const __m128i*) (s + i)));
+
+    if (i < len && nt)
+        copy_tail_forward(d + i, s + i, len - i);
+    else if (i < len)
+        _mm_storeu_si128((__m128i*) (d + len - 16),
+            _mm_loadu_si128((const __m128i*) (s + len - 16)));
+}
+
+/* AVX2, 32 bytes per store */
+
+__attribute__((target("avx2")))
+ALWAYS_INLINE void copy_avx2_body(void* dst, const void* src, size_t len, int nt)
+{
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    size_t i, lines;
+
+    if (len < 32)
+    {
+        copy_sse2_body(d, s, len, 0);
+        return;
+    }
+
+    if (nt && ((uintptr_t) d & 63))
+        nt = 0;
+
+    lines = nt ? len & ~(size_t) 63 : 0;
+
+    for (i = 0; i < lines; i += 32)
+        _mm256_stream_si256((__m256i*) (d + i),
+            _mm256_loadu_si256((const __m256i*) (s + i)));
+    for (; i + 32 <= len; i += 32)
+        _mm256_storeu_si256((__m256i*) (d + i),
+            _mm256_loadu_si256((const __m256i*) (s + i)));
+
+    if (i < len && nt)
+        copy_tail_forward(d + i, s + i, len - i);
+    else if (i < len)
+        _mm256_storeu_si256((__m256i*) (d + len - 32),
+            _mm256_loadu_si256((const __m256i*) (s + len - 32)));
+}
+
+/* AVX-512, 64 bytes (one cache line) per store */
+
+__attribute__((target("avx512f")))
+ALWAYS_INLINE void copy_avx512_body(void* dst, const void* src, size_t len, int nt)
+{
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    size_t i, lines;
+
+    if (len < 64)
+    {
+        copy_sse2_body(d, s, len, 0);
+        return;
+    }
+
+    if (nt && ((uintptr_t) d & 63))
+        nt = 0;
+
+    lines = nt ? len & ~(size_t) 63 : 0;
+
+    for (i = 0; i < lines; i += 64)
+        _mm512_stream_si512((void*) (d + i),
+            _mm512_loadu_si512((const void*) (s + i)));
+    for (; i + 64 <= len; i += 64)
+        _mm512_storeu_si512((void*) (d + i),
+            _mm512_loadu_si512((const void*) (s + i)));
+
+    if (i < len && nt)
+        copy_tail_forward(d + i, s + i, len - i);
+    else if (i < len)
+        _mm512_storeu_si512((void*) (d + len - 64),
+            _mm512_loadu_si512((const void*) (s + len - 64)));
+}
+
+/* Fixed-size and any-length wrappers per instruction set */
+
+#define COPY_KERNEL(isa, attr, suffix, size, nt)                            \
+    attr static void copy_##isa##_##suffix(void* dst, const void* src,      \
+            size_t len)                                                     \
+    {                                                                       \
+        copy_##isa##_body(dst, src, size, nt);                              \
+    }
+
+#define COPY_KERNELS(isa, attr)                                             \
+    COPY_KERNEL(isa, attr, any, len, 0)                                     \
+    COPY_KERNEL(isa, attr, any_nt, len, 1)                                  \
+    COPY_KERNEL(isa, attr, 64, 64, 0)                                       \
+    COPY_KERNEL(isa, attr, 64_nt, 64, 1)                                    \
+    COPY_KERNEL(isa, attr, 128, 128, 0)                                     \
+    COPY_KERNEL(isa, attr, 128_nt, 128, 1)                                  \
+    COPY_KERNEL(isa, attr, 256, 256, 0)                                     \
+    COPY_KERNEL(isa, attr, 256_nt, 256, 1)                                  \
+    COPY_KERNEL(isa, attr, 512, 512, 0)                                     \
+    COPY_KERNEL(isa, attr, 512_nt, 512, 1)                                  \
+    COPY_KERNEL(isa, attr, 1518, 1518, 0)                                   \
+    COPY_KERNEL(isa, attr, 1518_nt, 1518, 1)                                \
+    static const struct copy_set copy_set_##isa = {                        \
+        .name = #isa,                                                       \
+        .any = copy_##isa##_any,                                            \
+        .any_nt = copy_##isa##_any_nt,                                      \
+        .fixed = {                                                          \
+            { 64, copy_##isa##_64, copy_##isa##_64_nt },                    \
+            { 128, copy_##isa##_128, copy_##isa##_128_nt },                 \
+            { 256, copy_##isa##_256, copy_##isa##_256_nt },                 \
+            { 512, copy_##isa##_512, copy_##isa##_512_nt },                 \
+            { 1518, copy_##isa##_1518, copy_##isa##_1518_nt },              \
+        },                                                                  \
+    };
+
+#define COPY_FIXED_SIZES    5
+
+struct copy_set
+{
+    const char* name;
+    pkt_copy_fn any;
+    pkt_copy_fn any_nt;
+    struct
+    {
+        size_t size;
+        pkt_copy_fn copy;
+        pkt_copy_fn copy_nt;
+    } fixed[COPY_FIXED_SIZES];
+};
+
+COPY_KERNELS(sse2, )
+COPY_KERNELS(avx2, __attribute__((target("avx2"))))
+COPY_KERNELS(avx512, __attribute__((target("avx512f"))))
+
+/* No non-temporal memcpy; plain memcpy stands in for every slot */
+static const struct copy_set copy_set_memcpy = {
+    .name = "memcpy",
+    .any = copy_memcpy,
+    .any_nt = copy_memcpy,
+};
+
+/* Worst to best */
+static const struct copy_set* const copy_sets[] = {
+    &copy_set_memcpy,
+    &copy_set_sse2,
+    &copy_set_avx2,
+    &copy_set_avx512,
+};
+
+#define NUM_COPY_SETS   (sizeof(copy_sets) / sizeof(copy_sets[0]))
+
+static const char* const copy_names[] = {
+    "memcpy", "sse2", "avx2", "avx512", NULL,
+};
+
+static int copy_supported(const struct copy_set* set)
+{
+    __builtin_cpu_init();
+
+    if (set == &copy_set_avx512)
+        return __builtin_cpu_supports("avx512f");
+    if (set == &copy_set_avx2)
+        return __builtin_cpu_supports("avx2");
+    return 1;
+}
+
+static void copy_fill(struct pkt_copy_ops* ops, const struct copy_set* set,
+        size_t slot_size)
+{
+    unsigned int i;
+
+    ops->name = set->name;
+    ops->copy = set->any;
+    ops->copy_nt = set->any_nt;
+    ops->copy_any = set->any;
+    ops->copy_any_nt = set->any_nt;
+
+    for (i = 0; i < COPY_FIXED_SIZES; i++)
+    {
+        if (set->fixed[i].size == slot_size)
+        {
+            ops->copy = set->fixed[i].copy;
+            ops->copy_nt = set->fixed[i].copy_nt;
+        }
+    }
+}
+
+int pkt_copy_select_named(struct pkt_copy_ops* ops, const char* name,
+        size_t slot_size)
+{
+    unsigned int i;
+
+    for (i = 0; i < NUM_COPY_SETS; i++)
+    {
+        if (strcmp(copy_sets[i]->name, name) == 0)
+        {
+            if (!copy_supported(copy_sets[i]))
+                return -1;
+            copy_fill(ops, copy_sets[i], slot_size);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+void pkt_copy_select(struct pkt_copy_ops* ops, size_t slot_size)
+{
+    const char* forced = getenv(PKT_COPY_ENV);
+    int i;
+
+    if (forced != NULL && forced[0] != '\0')
+    {
+        if (pkt_copy_select_named(ops, forced, slot_size) == 0)
+            return;
+        fprintf(stderr, "%s(): %s kernels unavailable, using the best supported\n",
+            __func__, forced);
+    }
+
+    for (i = NUM_COPY_SETS - 1; i >= 0; i--)
+    {
+        if (copy_supported(copy_sets[i]))
+        {
+            copy_fill(ops, copy_sets[i], slot_size);
+            return;
+        }
+    }
+}
+
+const char* const* pkt_copy_names(void)
+{
+    return copy_names;
+}
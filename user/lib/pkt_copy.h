@@ -0,0 +1,68 @@
+#ifndef _PKT_COPY_H_
+#define _PKT_COPY_H_
+
+#include <stddef.h>
+
+/**
+ * @file
+ * Packet copy kernels, picked once at startup by CPUID.
+ *
+ * Each kernel set has a cached variant and a non-temporal one. The
+ * non-temporal one is for TX ring slots, which only the NIC reads back,
+ * so writing them need not evict the working set. Non-temporal stores
+ * are weakly ordered: call pkt_copy_fence() after them and before
+ * ringing a doorbell.
+ *
+ * pkt_copy_select() returns kernels specialised for the common slot
+ * sizes (64, 128, 256, 512 and 1518 bytes), with the length fixed at
+ * compile time so the loop is fully unrolled. Other sizes fall back to
+ * the kernel's generic length loop. Any kernel also accepts any length,
+ * e.g. a run of several slots copied at once.
+ *
+ * NFP_COPY=memcpy|sse2|avx2|avx512 forces a kernel set, if the CPU
+ * supports it.
+ */
+
+#define PKT_COPY_ENV    "NFP_COPY"
+
+typedef void (*pkt_copy_fn)(void* dst, const void* src, size_t len);
+
+struct pkt_copy_ops
+{
+    const char* name;
+    pkt_copy_fn copy;           /*> Cached stores, for slot_size */
+    pkt_copy_fn copy_nt;        /*> Non-temporal stores, for slot_size */
+    pkt_copy_fn copy_any;       /*> Cached stores, any length */
+    pkt_copy_fn copy_any_nt;    /*> Non-temporal stores, any length */
+};
+
+/**
+ * Pick the best kernels the CPU supports (or NFP_COPY asks for).
+ *
+ * @param slot_size
+ *   Length copy and copy_nt are specialised for.
+ */
+void pkt_copy_select(struct pkt_copy_ops* ops, size_t slot_size);
+
+/**
+ * Pick a named kernel set.
+ *
+ * @return
+ *   0 on success, -1 if unknown or not supported by this CPU.
+ */
+int pkt_copy_select_named(struct pkt_copy_ops* ops, const char* name,
+        size_t slot_size);
+
+/**
+ * @return
+ *   Names of the kernel sets, NULL terminated, best last.
+ */
+const char* const* pkt_copy_names(void);
+
+/* Order non-temporal stores before later stores */
+static inline void pkt_copy_fence(void)
+{
+    __builtin_ia32_sfence();
+}
+
+#endif /* _PKT_COPY_H_ */
@@ -0,0 +1,475 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <immintrin.h>
+
+#include "pkt_csum.h"
+
+/**
+ * The vector kernels zero-extend each 16-bit word into a 32-bit lane and
+ * add lanes, two vectors per iteration into four accumulators. Lanes are
+ * reduced every CSUM_BLOCK bytes: a block holds at most 32K words, whose
+ * total fits in 32 bits, so neither the lanes nor their sum can carry
+ * out. What is left after the last whole vector goes through the scalar
+ * kernel.
+ *
+ * Words are loaded little endian, so a trailing odd byte is the low
+ * half of its word. x86 only, like the rest of the kernels.
+ */
+
+#define CSUM_BLOCK          65536
+
+#define ETH_HLEN            14
+#define ETH_TYPE_IPV4       0x0800
+#define IPV4_MIN_HLEN       20
+#define IPV4_FRAG_MASK      0x3fff      /*> MF flag and fragment offset */
+#define UDP_HLEN            8
+
+static inline uint32_t csum_fold64(uint64_t sum)
+{
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+
+    return (uint32_t) sum;
+}
+
+uint32_t pkt_csum_reference(const void* buf, size_t len, uint32_t sum)
+{
+    const uint8_t* p = buf;
+    uint32_t acc;
+    size_t i;
+
+    /* RFC 1071 as written: big endian words, folded as we go */
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    acc = __builtin_bswap16(sum);
+
+    for (i = 0; i + 1 < len; i += 2)
+    {
+        acc += (p[i] << 8) | p[i + 1];
+        acc = (acc & 0xffff) + (acc >> 16);
+    }
+    if (i < len)
+    {
+        acc += p[i] << 8;
+        acc = (acc & 0xffff) + (acc >> 16);
+    }
+
+    return __builtin_bswap16(acc);
+}
+
+static uint32_t csum_scalar(const void* buf, size_t len, uint32_t sum)
+{
+    const uint8_t* p = buf;
+    uint64_t acc = sum, q;
+    uint32_t w;
+    uint16_t h;
+
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        memcpy(&q, p, 8);
+        acc += (q & 0xffffffff) + (q >> 32);
+    }
+    if (len >= 4)
+    {
+        memcpy(&w, p, 4);
+        acc += w;
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2)
+    {
+        memcpy(&h, p, 2);
+        acc += h;
+        p += 2;
+        len -= 2;
+    }
+    if (len != 0)
+        acc += *p;
+
+    return csum_fold64(acc);
+}
+
+/* SSE2, 16 bytes per vector */
+
+static inline uint32_t csum_hsum_sse2(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return (uint32_t) _mm_cvtsi128_si32(v);
+}
+
+static uint32_t csum_sse2(const void* buf, size_t len, uint32_t sum)
+{
+    const uint8_t* p = buf;
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t acc = sum;
+
+    while (len >= 16)
+    {
+        size_t block = (len < CSUM_BLOCK ? len : CSUM_BLOCK) & ~(size_t) 15;
+        __m128i a = zero, b = zero, c = zero, d = zero, v0, v1;
+        size_t i;
+
+        for (i = 0; i + 32 <= block; i += 32)
+        {
+            v0 = _mm_loadu_si128((const __m128i*) (p + i));
+            v1 = _mm_loadu_si128((const __m128i*) (p + i + 16));
+            a = _mm_add_epi32(a, _mm_unpacklo_epi16(v0, zero));
+            b = _mm_add_epi32(b, _mm_unpackhi_epi16(v0, zero));
+            c = _mm_add_epi32(c, _mm_unpacklo_epi16(v1, zero));
+            d = _mm_add_epi32(d, _mm_unpackhi_epi16(v1, zero));
+        }
+        if (i < block)
+        {
+            v0 = _mm_loadu_si128((const __m128i*) (p + i));
+            a = _mm_add_epi32(a, _mm_unpacklo_epi16(v0, zero));
+            b = _mm_add_epi32(b, _mm_unpackhi_epi16(v0, zero));
+        }
+
+        a = _mm_add_epi32(_mm_add_epi32(a, b), _mm_add_epi32(c, d));
+        acc += csum_hsum_sse2(a);
+        p += block;
+        len -= block;
+    }
+
+    return csum_scalar(p, len, csum_fold64(acc));
+}
+
+/* AVX2, 32 bytes per vector */
+
+__attribute__((target("avx2")))
+static uint32_t csum_avx2(const void* buf, size_t len, uint32_t sum)
+{
+    const uint8_t* p = buf;
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t acc = sum;
+
+    while (len >= 32)
+    {
+        size_t block = (len < CSUM_BLOCK ? len : CSUM_BLOCK) & ~(size_t) 31;
+        __m256i a = zero, b = zero, c = zero, d = zero, v0, v1;
+        size_t i;
+
+        for (i = 0; i + 64 <= block; i += 64)
+        {
+            v0 = _mm256_loadu_si256((const __m256i*) (p + i));
+            v1 = _mm256_loadu_si256((const __m256i*) (p + i + 32));
+            a = _mm256_add_epi32(a, _mm256_unpacklo_epi16(v0, zero));
+            b = _mm256_add_epi32(b, _mm256_unpackhi_epi16(v0, zero));
+            c = _mm256_add_epi32(c, _mm256_unpacklo_epi16(v1, zero));
+            d = _mm256_add_epi32(d, _mm256_unpackhi_epi16(v1, zero));
+        }
+        if (i < block)
+        {
+            v0 = _mm256_loadu_si256((const __m256i*) (p + i));
+            a = _mm256_add_epi32(a, _mm256_unpacklo_epi16(v0, zero));
+            b = _mm256_add_epi32(b, _mm256_unpackhi_epi16(v0, zero));
+        }
+
+        a = _mm256_add_epi32(_mm256_add_epi32(a, b), _mm256_add_epi32(c, d));
+        acc += csum_hsum_sse2(_mm_add_epi32(_mm256_castsi256_si128(a),
+            _mm256_extracti128_si256(a, 1)));
+        p += block;
+        len -= block;
+    }
+
+    return csum_scalar(p, len, csum_fold64(acc));
+}
+
+/* AVX-512BW, 64 bytes per vector */
+
+__attribute__((target("avx512bw")))
+static uint32_t csum_avx512(const void* buf, size_t len, uint32_t sum)
+{
+    const uint8_t* p = buf;
+    const __m512i zero = _mm512_setzero_si512();
+    uint64_t acc = sum;
+
+    while (len >= 64)
+    {
+        size_t block = (len < CSUM_BLOCK ? len : CSUM_BLOCK) & ~(size_t) 63;
+        __m512i a = zero, b = zero, c = zero, d = zero, v0, v1;
+        size_t i;
+
+        for (i = 0; i + 128 <= block; i += 128)
+        {
+            v0 = _mm512_loadu_si512((const void*) (p + i));
+            v1 = _mm512_loadu_si512((const void*) (p + i + 64));
+            a = _mm512_add_epi32(a, _mm512_unpacklo_epi16(v0, zero));
+            b = _mm512_add_epi32(b, _mm512_unpackhi_epi16(v0, zero));
+            c = _mm512_add_epi32(c, _mm512_unpacklo_epi16(v1, zero));
+            d = _mm512_add_epi32(d, _mm512_unpackhi_epi16(v1, zero));
+        }
+        if (i < block)
+        {
+            v0 = _mm512_loadu_si512((const void*) (p + i));
+            a = _mm512_add_epi32(a, _mm512_unpacklo_epi16(v0, zero));
+            b = _mm512_add_epi32(b, _mm512_unpackhi_epi16(v0, zero));
+        }
+
+        a = _mm512_add_epi32(_mm512_add_epi32(a, b), _mm512_add_epi32(c, d));
+        acc += (uint32_t) _mm512_reduce_add_epi32(a);
+        p += block;
+        len -= block;
+    }
+
+    return csum_scalar(p, len, csum_fold64(acc));
+}
+
+/* Kernel selection */
+
+struct csum_kernel
+{
+    const char* name;
+    pkt_csum_fn fn;
+};
+
+/* Worst to best */
+static const struct csum_kernel csum_kernels[] = {
+    { "scalar", csum_scalar },
+    { "sse2", csum_sse2 },
+    { "avx2", csum_avx2 },
+    { "avx512", csum_avx512 },
+};
+
+#define NUM_CSUM_KERNELS    (sizeof(csum_kernels) / sizeof(csum_kernels[0]))
+
+static const char* const csum_names[] = {
+    "scalar", "sse2", "avx2", "avx512", NULL,
+};
+
+static uint32_t csum_resolve(const void* buf, size_t len, uint32_t sum);
+
+/* Written once on first use; any thread may race to do it */
+static pkt_csum_fn csum_active = csum_resolve;
+static const char* csum_active_name = "none";
+
+static int csum_supported(const struct csum_kernel* k)
+{
+    __builtin_cpu_init();
+
+    if (k->fn == csum_avx512)
+        return __builtin_cpu_supports("avx512bw");
+    if (k->fn == csum_avx2)
+        return __builtin_cpu_supports("avx2");
+    return 1;
+}
+
+static const struct csum_kernel* csum_find(const char* name)
+{
+    unsigned int i;
+
+    for (i = 0; i < NUM_CSUM_KERNELS; i++)
+    {
+        if (strcmp(csum_kernels[i].name, name) == 0)
+            return csum_supported(&csum_kernels[i]) ? &csum_kernels[i] : NULL;
+    }
+
+    return NULL;
+}
+
+static void csum_use(const struct csum_kernel* k)
+{
+    csum_active_name = k->name;
+    __atomic_store_n(&csum_active, k->fn, __ATOMIC_RELAXED);
+}
+
+static uint32_t csum_resolve(const void* buf, size_t len, uint32_t sum)
+{
+    const char* forced = getenv(PKT_CSUM_ENV);
+    const struct csum_kernel* k = NULL;
+    int i;
+
+    if (forced != NULL && forced[0] != '\0')
+    {
+        k = csum_find(forced);
+        if (k == NULL)
+            fprintf(stderr, "%s(): %s kernel unavailable, using the best supported\n",
+                __func__, forced);
+    }
+
+    for (i = NUM_CSUM_KERNELS - 1; k == NULL && i >= 0; i--)
+    {
+        if (csum_supported(&csum_kernels[i]))
+            k = &csum_kernels[i];
+    }
+
+    csum_use(k);
+    return k->fn(buf, len, sum);
+}
+
+uint32_t pkt_csum_partial(const void* buf, size_t len, uint32_t sum)
+{
+    return __atomic_load_n(&csum_active, __ATOMIC_RELAXED)(buf, len, sum);
+}
+
+int pkt_csum_select_named(const char* name)
+{
+    const struct csum_kernel* k = csum_find(name);
+
+    if (k == NULL)
+        return -1;
+
+    csum_use(k);
+    return 0;
+}
+
+const char* pkt_csum_name(void)
+{
+    if (__atomic_load_n(&csum_active, __ATOMIC_RELAXED) == csum_resolve)
+        csum_resolve(NULL, 0, 0);
+
+    return csum_active_name;
+}
+
+const char* const* pkt_csum_names(void)
+{
+    return csum_names;
+}
+
+pkt_csum_fn pkt_csum_kernel(const char* name)
+{
+    const struct csum_kernel* k = csum_find(name);
+
+    return k != NULL ? k->fn : NULL;
+}
+
+/* IPv4 and UDP */
+
+/**
+ * @return
+ *   IPv4 header length, or 0 if the frame is not IPv4 or is truncated.
+ */
+static uint32_t csum_ipv4_hlen(const uint8_t* frame, uint32_t len)
+{
+    const uint8_t* ip = frame + ETH_HLEN;
+    uint32_t ihl;
+
+    if (len < ETH_HLEN + IPV4_MIN_HLEN ||
+        ((frame[12] << 8) | frame[13]) != ETH_TYPE_IPV4 ||
+        (ip[0] >> 4) != 4)
+        return 0;
+
+    ihl = (ip[0] & 0xf) * 4;
+    if (ihl < IPV4_MIN_HLEN || len < ETH_HLEN + ihl)
+        return 0;
+
+    return ihl;
+}
+
+/**
+ * @return
+ *   UDP length from its header, or 0 if the frame does not hold a whole
+ *   unfragmented UDP datagram.
+ */
+static uint32_t csum_udp_len(const uint8_t* ip, uint32_t ihl, uint32_t len)
+{
+    const uint8_t* udp = ip + ihl;
+    uint32_t udp_len;
+
+    if (ip[9] != IPPROTO_UDP || (((ip[6] << 8) | ip[7]) & IPV4_FRAG_MASK) ||
+        len < ETH_HLEN + ihl + UDP_HLEN)
+        return 0;
+
+    udp_len = (udp[4] << 8) | udp[5];
+    if (udp_len < UDP_HLEN || len < ETH_HLEN + ihl + udp_len)
+        return 0;
+
+    return udp_len;
+}
+
+enum pkt_csum_status pkt_csum_verify(const void* frame, uint32_t len)
+{
+    const uint8_t* ip = (const uint8_t*) frame + ETH_HLEN;
+    uint32_t ihl, udp_len, sum;
+
+    ihl = csum_ipv4_hlen(frame, len);
+    if (ihl == 0)
+        return PKT_CSUM_NONE;
+
+    if (pkt_csum_ipv4_hdr(ip) != 0)
+        return PKT_CSUM_BAD_IP;
+
+    udp_len = csum_udp_len(ip, ihl, len);
+    if (udp_len == 0)
+        return ip[9] == IPPROTO_UDP ? PKT_CSUM_NONE : PKT_CSUM_OK;
+
+    /* Zero: the sender did not compute one */
+    if (ip[ihl + 6] == 0 && ip[ihl + 7] == 0)
+        return PKT_CSUM_OK;
+
+    sum = pkt_csum_partial(ip + ihl, udp_len,
+        pkt_csum_pseudo4(ip, IPPROTO_UDP, udp_len));
+
+    return pkt_csum_fold(sum) == 0 ? PKT_CSUM_OK : PKT_CSUM_BAD_UDP;
+}
+
+int pkt_csum_fill(void* frame, uint32_t len)
+{
+    uint8_t* ip = (uint8_t*) frame + ETH_HLEN;
+    uint32_t ihl, udp_len, sum;
+    uint16_t old, csum;
+
+    ihl = csum_ipv4_hlen(frame, len);
+    if (ihl == 0)
+        return -1;
+
+    /*
+     * Sum over the old field and take it back out, rather than zero it
+     * first: reading back a just-stored field would stall on a failed
+     * store forward, longer than summing a small frame.
+     */
+    memcpy(&old, ip + 10, 2);
+    csum = pkt_csum_update16(pkt_csum_ipv4_hdr(ip), old, 0);
+    memcpy(ip + 10, &csum, 2);
+
+    udp_len = csum_udp_len(ip, ihl, len);
+    if (udp_len == 0)
+        return ip[9] == IPPROTO_UDP ? -1 : 0;
+
+    memcpy(&old, ip + ihl + 6, 2);
+    sum = pkt_csum_partial(ip + ihl, udp_len,
+        pkt_csum_pseudo4(ip, IPPROTO_UDP, udp_len));
+    csum = pkt_csum_fold(csum_fold64((uint64_t) sum + (uint16_t) ~old));
+    /* Zero would mean no checksum; send its other form (RFC 768) */
+    if (csum == 0)
+        csum = 0xffff;
+    memcpy(ip + ihl + 6, &csum, 2);
+
+    return 0;
+}
+
+unsigned int pkt_csum_verify_burst(const struct pkt_view* pkts,
+        unsigned int count, uint8_t* status)
+{
+    unsigned int i, bad = 0;
+    enum pkt_csum_status st;
+
+    for (i = 0; i < count; i++)
+    {
+        st = pkt_csum_verify(pkts[i].data, pkts[i].len);
+        if (st == PKT_CSUM_BAD_IP || st == PKT_CSUM_BAD_UDP)
+            bad++;
+        if (status != NULL)
+            status[i] = st;
+    }
+
+    return bad;
+}
+
+unsigned int pkt_csum_fill_burst(const struct pkt_view* pkts, unsigned int count)
+{
+    unsigned int i, failed = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        if (pkt_csum_fill(pkts[i].data, pkts[i].len))
+            failed++;
+    }
+
+    return failed;
+}
@@ -0,0 +1,190 @@
+#ifndef _PKT_CSUM_H_
+#define _PKT_CSUM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pkt_handler.h"
+
+/**
+ * @file
+ * Internet checksum (RFC 1071) for IPv4 and UDP, for handlers that build
+ * or rewrite packets on the host instead of leaving it to the MAC.
+ *
+ * Sums are computed over 16-bit words as they lie in memory, without
+ * byte swapping; the one's complement sum is byte order independent, so
+ * a folded checksum is stored back with memcpy as is. Every value the
+ * helpers below take or return is in that same memory (network) order.
+ *
+ * pkt_csum_partial() runs a kernel picked once by CPUID on first use:
+ * scalar, SSE2, AVX2 or AVX-512BW, summing 16-bit words into 32-bit
+ * vector lanes. NFP_CSUM=scalar|sse2|avx2|avx512 forces one, if the CPU
+ * supports it. pkt_csum_reference() is the plain byte-pair loop the
+ * kernels are checked against (see tools/csum_bench.c).
+ */
+
+#define PKT_CSUM_ENV    "NFP_CSUM"
+
+typedef uint32_t (*pkt_csum_fn)(const void* buf, size_t len, uint32_t sum);
+
+enum pkt_csum_status
+{
+    PKT_CSUM_OK = 0,
+    PKT_CSUM_NONE,              /*> Not IPv4, or truncated: not checked */
+    PKT_CSUM_BAD_IP,
+    PKT_CSUM_BAD_UDP,
+};
+
+/**
+ * Add the 16-bit words of buf to sum.
+ *
+ * Partial sums chain: the result may be passed back in as sum. Only the
+ * last buffer of a chain may have an odd length.
+ *
+ * @return
+ *   Unfolded 32-bit partial sum.
+ */
+uint32_t pkt_csum_partial(const void* buf, size_t len, uint32_t sum);
+
+/* Byte-pair loop, no vector code; the reference for the kernels */
+uint32_t pkt_csum_reference(const void* buf, size_t len, uint32_t sum);
+
+/**
+ * Pick a named kernel for pkt_csum_partial().
+ *
+ * @return
+ *   0 on success, -1 if unknown or not supported by this CPU.
+ */
+int pkt_csum_select_named(const char* name);
+
+/* Name of the kernel in use */
+const char* pkt_csum_name(void);
+
+/**
+ * @return
+ *   Names of the kernels, NULL terminated, best last.
+ */
+const char* const* pkt_csum_names(void);
+
+/**
+ * @return
+ *   Kernel by name, or NULL if unknown or not supported by this CPU.
+ */
+pkt_csum_fn pkt_csum_kernel(const char* name);
+
+/* Fold a partial sum to 16 bits and complement it: the checksum field */
+static inline uint16_t pkt_csum_fold(uint32_t sum)
+{
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+
+    return (uint16_t) ~sum;
+}
+
+/**
+ * Incremental update (RFC 1624, eqn. 3) of a checksum field after one
+ * 16-bit word covered by it changes from old to new.
+ */
+static inline uint16_t pkt_csum_update16(uint16_t csum, uint16_t old, uint16_t new)
+{
+    uint32_t sum = (uint16_t) ~csum + (uint32_t) (uint16_t) ~old + new;
+
+    return pkt_csum_fold(sum);
+}
+
+/* As pkt_csum_update16(), for a 32-bit field such as an IPv4 address */
+static inline uint16_t pkt_csum_update32(uint16_t csum, uint32_t old, uint32_t new)
+{
+    uint32_t sum = (uint16_t) ~csum;
+
+    sum += (uint16_t) ~old + (uint32_t) (uint16_t) ~(old >> 16);
+    sum += (new & 0xffff) + (new >> 16);
+
+    return pkt_csum_fold(sum);
+}
+
+/**
+ * IPv4 header checksum, computed with the checksum field as it is:
+ * 0 over a header whose field is correct, the field's value if it was
+ * zeroed first.
+ */
+static inline uint16_t pkt_csum_ipv4_hdr(const uint8_t* ip)
+{
+    unsigned int i, words = (ip[0] & 0xf);
+    uint64_t sum = 0;
+    uint32_t w;
+
+    /* At most 15 32-bit words: no vector kernel beats this */
+    for (i = 0; i < words; i++)
+    {
+        memcpy(&w, ip + i * 4, 4);
+        sum += w;
+    }
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+
+    return pkt_csum_fold((uint32_t) sum);
+}
+
+/**
+ * Sum of the IPv4 pseudo-header for an L4 checksum.
+ *
+ * @param ip
+ *   IPv4 header, for the addresses.
+ * @param proto
+ *   IP protocol number.
+ * @param l4_len
+ *   L4 header and payload length, host order.
+ */
+static inline uint32_t pkt_csum_pseudo4(const uint8_t* ip, uint8_t proto,
+        uint16_t l4_len)
+{
+    uint64_t sum;
+    uint32_t src, dst;
+
+    memcpy(&src, ip + 12, 4);
+    memcpy(&dst, ip + 16, 4);
+    sum = (uint64_t) src + dst + __builtin_bswap16(proto) +
+        __builtin_bswap16(l4_len);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+
+    return (uint32_t) sum + (uint32_t) (sum >> 32);
+}
+
+/**
+ * Check the IPv4 header checksum and, if the datagram carries one, the
+ * UDP checksum of a frame.
+ */
+enum pkt_csum_status pkt_csum_verify(const void* frame, uint32_t len);
+
+/**
+ * Write the IPv4 header checksum and the UDP checksum of a frame, e.g.
+ * after rewriting its payload. Frames that are not UDP over IPv4 only
+ * get the IP header checksum.
+ *
+ * @return
+ *   0 on success, -1 if the frame is not IPv4 or is truncated.
+ */
+int pkt_csum_fill(void* frame, uint32_t len);
+
+/**
+ * pkt_csum_verify() over a burst.
+ *
+ * @param status
+ *   Set to each frame's pkt_csum_status; may be NULL.
+ * @return
+ *   Number of frames with a bad checksum.
+ */
+unsigned int pkt_csum_verify_burst(const struct pkt_view* pkts,
+        unsigned int count, uint8_t* status);
+
+/**
+ * pkt_csum_fill() over a burst, in place.
+ *
+ * @return
+ *   Number of frames that could not be filled in.
+ */
+unsigned int pkt_csum_fill_burst(const struct pkt_view* pkts, unsigned int count);
+
+#endif /* _PKT_CSUM_H_ */
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "latency.h"
+#include "pkt_csum.h"
+#include "pkt_gen.h"
+
+#define GEN_ETH_HLEN        14
+#define GEN_IP_HLEN         20
+#define GEN_SEQ_OFFSET      PKT_GEN_MIN_SIZE
+#define GEN_LINE            64
+
+/* Further behind than this and the schedule is given up, not caught up */
+#define GEN_MAX_LAG         64
+
+static int gen_parse_ip(const char* s, uint32_t* ip)
+{
+    struct in_addr addr;
+
+    if (inet_pton(AF_INET, s, &addr) != 1)
+        return -1;
+
+    *ip = ntohl(addr.s_addr);
+    return 0;
+}
+
+static int gen_parse(struct pkt_gen* gen, const char* spec)
+{
+    char *copy, *tok, *save, *val, *end;
+    unsigned long v;
+    int ret = 0;
+
+    if (spec == NULL || spec[0] == '\0')
+        return 0;
+
+    copy = strdup(spec);
+    if (copy == NULL)
+        return -1;
+
+    for (tok = strtok_r(copy, ",", &save); tok != NULL && ret == 0;
+         tok = strtok_r(NULL, ",", &save))
+    {
+        val = strchr(tok, '=');
+        if (val == NULL)
+        {
+            fprintf(stderr, "%s(): Expected key=value: %s\n", __func__, tok);
+            ret = -1;
+            break;
+        }
+        *val++ = '\0';
+
+        if (strcmp(tok, "src") == 0)
+        {
+            ret = gen_parse_ip(val, &gen->src_ip);
+        }
+        else if (strcmp(tok, "dst") == 0)
+        {
+            ret = gen_parse_ip(val, &gen->dst_ip);
+        }
+        else
+        {
+            v = strtoul(val, &end, 0);
+            if (*end != '\0' || val[0] == '\0')
+                ret = -1;
+            else if (strcmp(tok, "size") == 0)
+                gen->size = v;
+            else if (strcmp(tok, "rate") == 0)
+                gen->rate = v;
+            else if (strcmp(tok, "flows") == 0)
+                gen->flows = v;
+            else if (strcmp(tok, "sport") == 0)
+                gen->src_port = v;
+            else if (strcmp(tok, "dport") == 0)
+                gen->dst_port = v;
+            else if (strcmp(tok, "src_step") == 0)
+                gen->src_step = v;
+            else if (strcmp(tok, "dst_step") == 0)
+                gen->dst_step = v;
+            else if (strcmp(tok, "sport_step") == 0)
+                gen->sport_step = v;
+            else if (strcmp(tok, "dport_step") == 0)
+                gen->dport_step = v;
+            else
+                ret = -1;
+        }
+
+        if (ret)
+            fprintf(stderr, "%s(): Bad generator option: %s=%s\n", __func__, tok, val);
+    }
+
+    free(copy);
+    return ret;
+}
+
+/* Headers and payload of the template; the fields patched per packet are zero */
+static void gen_build_template(struct pkt_gen* gen)
+{
+    static const uint8_t dst_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    static const uint8_t src_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+    uint8_t* frame = gen->tmpl;
+    uint8_t* ip = frame + GEN_ETH_HLEN;
+    uint8_t* udp = ip + GEN_IP_HLEN;
+    uint16_t v16;
+    uint32_t i;
+
+    memcpy(frame, dst_mac, 6);
+    memcpy(frame + 6, src_mac, 6);
+    v16 = htons(0x0800);
+    memcpy(frame + 12, &v16, 2);
+
+    ip[0] = 0x45;
+    v16 = htons(gen->size - GEN_ETH_HLEN);
+    memcpy(ip + 2, &v16, 2);
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP;
+
+    v16 = htons(gen->size - GEN_ETH_HLEN - GEN_IP_HLEN);
+    memcpy(udp + 4, &v16, 2);
+
+    for (i = PKT_GEN_MIN_SIZE; i < gen->size; i++)
+        frame[i] = (uint8_t) i;
+
+    /* Un-complemented: the sum the addresses are added to */
+    gen->hdr_sum = (uint16_t) ~pkt_csum_ipv4_hdr(ip);
+}
+
+struct pkt_gen* pkt_gen_create(const char* spec, uint32_t slot_size,
+        const struct pkt_copy_ops* copy)
+{
+    struct pkt_gen* gen;
+    double ticks;
+
+    gen = calloc(1, sizeof(*gen));
+    if (gen == NULL)
+        return NULL;
+
+    gen->size = slot_size;
+    gen->flows = 1;
+    gen->src_ip = 0x0a000002;
+    gen->dst_ip = 0x0a000001;
+    gen->src_port = 5000;
+    gen->dst_port = 7;
+    gen->sport_step = 1;
+
+    if (gen_parse(gen, spec))
+    {
+        free(gen);
+        return NULL;
+    }
+
+    if (gen->size < PKT_GEN_MIN_SIZE || gen->size > slot_size || gen->flows == 0)
+    {
+        fprintf(stderr, "%s(): Frames are %d to %u bytes, flows at least 1\n",
+            __func__, PKT_GEN_MIN_SIZE, slot_size);
+        free(gen);
+        return NULL;
+    }
+
+    gen->tmpl = aligned_alloc(GEN_LINE, (slot_size + GEN_LINE - 1) & ~(GEN_LINE - 1));
+    if (gen->tmpl == NULL)
+    {
+        free(gen);
+        return NULL;
+    }
+    memset(gen->tmpl, 0, slot_size);
+
+    gen->slot_size = slot_size;
+    gen->copy = copy;
+    gen->cur_src = gen->src_ip;
+    gen->cur_dst = gen->dst_ip;
+    gen->cur_sport = gen->src_port;
+    gen->cur_dport = gen->dst_port;
+    gen_build_template(gen);
+
+    gen->tsc_per_ns = lat_tsc_per_ns();
+    if (gen->rate != 0)
+    {
+        ticks = gen->tsc_per_ns * 1e9 / gen->rate;
+        gen->interval = ticks * 65536.0;
+        if (gen->interval == 0)
+            gen->interval = 1;
+        gen->next_due = lat_tsc();
+    }
+
+    return gen;
+}
+
+void pkt_gen_destroy(struct pkt_gen* gen)
+{
+    if (gen == NULL)
+        return;
+
+    free(gen->tmpl);
+    free(gen);
+}
+
+unsigned int pkt_gen_due(struct pkt_gen* gen, unsigned int room, uint64_t now)
+{
+    unsigned int due = room;
+    uint64_t lag;
+
+    if (gen->rate != 0)
+    {
+        if (now < gen->next_due)
+            return 0;
+
+        lag = now - gen->next_due;
+        if (lag >= (1ull << 40) || (lag << 16) / gen->interval >= GEN_MAX_LAG)
+        {
+            gen->stats.behind++;
+            gen->next_due = now;
+            gen->due_frac = 0;
+            lag = 0;
+        }
+        due = (lag << 16) / gen->interval + 1;
+    }
+
+    if (room == 0)
+    {
+        if (gen->full_since == 0)
+            gen->full_since = now;
+        return 0;
+    }
+
+    if (gen->full_since != 0)
+    {
+        gen->stats.full_tsc += now - gen->full_since;
+        gen->full_since = 0;
+    }
+
+    if (due > room)
+        due = room;
+
+    if (gen->rate != 0)
+    {
+        gen->due_frac += due * gen->interval;
+        gen->next_due += gen->due_frac >> 16;
+        gen->due_frac &= 0xffff;
+    }
+
+    return due;
+}
+
+void pkt_gen_write(struct pkt_gen* gen, void* slot)
+{
+    uint8_t line[GEN_LINE] __attribute__((aligned(GEN_LINE)));
+    uint8_t* ip = line + GEN_ETH_HLEN;
+    uint8_t* udp = ip + GEN_IP_HLEN;
+    uint32_t head = gen->slot_size < GEN_LINE ? gen->slot_size : GEN_LINE;
+    uint32_t src = htonl(gen->cur_src), dst = htonl(gen->cur_dst);
+    uint16_t v16;
+
+    /* Patch the headers in a hot line, then stream the whole slot */
+    memcpy(line, gen->tmpl, GEN_LINE);
+
+    memcpy(ip + 12, &src, 4);
+    memcpy(ip + 16, &dst, 4);
+    v16 = pkt_csum_fold(gen->hdr_sum + (src & 0xffff) + (src >> 16) +
+        (dst & 0xffff) + (dst >> 16));
+    memcpy(ip + 10, &v16, 2);
+
+    v16 = htons(gen->cur_sport);
+    memcpy(udp, &v16, 2);
+    v16 = htons(gen->cur_dport);
+    memcpy(udp + 2, &v16, 2);
+
+    if (gen->size >= GEN_SEQ_OFFSET + sizeof(gen->seq))
+        memcpy(line + GEN_SEQ_OFFSET, &gen->seq, sizeof(gen->seq));
+    gen->seq++;
+
+    if (head == gen->slot_size)
+    {
+        gen->copy->copy_nt(slot, line, head);
+    }
+    else
+    {
+        gen->copy->copy_any_nt(slot, line, head);
+        gen->copy->copy_any_nt((uint8_t*) slot + head, gen->tmpl + head,
+            gen->slot_size - head);
+    }
+
+    if (++gen->flow == gen->flows)
+    {
+        gen->flow = 0;
+        gen->cur_src = gen->src_ip;
+        gen->cur_dst = gen->dst_ip;
+        gen->cur_sport = gen->src_port;
+        gen->cur_dport = gen->dst_port;
+    }
+    else
+    {
+        gen->cur_src += gen->src_step;
+        gen->cur_dst += gen->dst_step;
+        gen->cur_sport += gen->sport_step;
+        gen->cur_dport += gen->dport_step;
+    }
+
+    gen->stats.packets++;
+}
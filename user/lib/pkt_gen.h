@@ -0,0 +1,104 @@
+#ifndef _PKT_GEN_H_
+#define _PKT_GEN_H_
+
+#include <stdint.h>
+
+#include "pkt_copy.h"
+
+/**
+ * @file
+ * UDP packet generator, for driving the TX path on its own (see
+ * datapath_generate()).
+ *
+ * The frame is built once, as a template: Ethernet, IPv4 and UDP
+ * headers, the payload, and the IP header sum without the addresses.
+ * Generating a packet is then copying the template's first line into a
+ * hot buffer, patching the addresses, ports, IP checksum and a 64-bit
+ * sequence number at the start of the payload, and streaming the frame
+ * into the TX slot (pkt_copy.h). The UDP checksum is left zero; the MAC
+ * fills it in on egress.
+ *
+ * Packets cycle through `flows` flows. Flow f has each address and
+ * port set to its base plus f times its step.
+ *
+ * The spec is a comma separated list of key=value, all optional:
+ *   size=N          Frame length, at most the TX slot (default: slot)
+ *   rate=N          Packets per second, 0 for flat out (default)
+ *   flows=N         Flows to cycle through (default 1)
+ *   src=A.B.C.D     Source address (default 10.0.0.2)
+ *   dst=A.B.C.D     Destination address (default 10.0.0.1)
+ *   sport=N         Source port (default 5000)
+ *   dport=N         Destination port (default 7)
+ *   src_step=N, dst_step=N, sport_step=N, dport_step=N
+ *                   Per-flow increments (default 0, sport_step 1)
+ */
+
+#define PKT_GEN_MIN_SIZE    42      /* Headers only */
+
+struct pkt_gen_stats
+{
+    uint64_t packets;               /*> Written to the TX ring */
+    uint64_t full_tsc;              /*> Packets due but the TX ring full */
+    uint64_t behind;                /*> Times the schedule was given up */
+};
+
+struct pkt_gen
+{
+    uint32_t size;
+    uint32_t slot_size;
+    uint32_t flows;
+    uint64_t rate;
+    uint32_t src_ip, dst_ip;                /*> Host order */
+    uint16_t src_port, dst_port;
+    uint32_t src_step, dst_step;
+    uint16_t sport_step, dport_step;
+
+    uint32_t flow;                          /*> Next flow */
+    uint32_t cur_src, cur_dst;              /*> Fields of the next flow */
+    uint16_t cur_sport, cur_dport;
+    uint64_t seq;
+    uint32_t hdr_sum;                       /*> IP header sum less addresses */
+
+    uint64_t interval;                      /*> TSC ticks per packet << 16 */
+    uint64_t next_due;                      /*> TSC of the next packet */
+    uint64_t due_frac;                      /*> and its fraction, 1/65536 ticks */
+    uint64_t full_since;                    /*> TSC, 0 unless ring full */
+    double tsc_per_ns;
+
+    const struct pkt_copy_ops* copy;
+    uint8_t* tmpl;                          /*> The frame, one slot */
+    struct pkt_gen_stats stats;
+};
+
+/**
+ * Parse the spec and build the template.
+ *
+ * @param slot_size
+ *   TX slot size; frames are at most this long.
+ * @param copy
+ *   Copy kernels for slot_size, kept by reference.
+ * @return
+ *   Generator, or NULL if the spec does not parse.
+ */
+struct pkt_gen* pkt_gen_create(const char* spec, uint32_t slot_size,
+        const struct pkt_copy_ops* copy);
+
+void pkt_gen_destroy(struct pkt_gen* gen);
+
+/**
+ * Packets due now, given the rate.
+ *
+ * @param room
+ *   Free TX slots; backpressure is timed while this is 0.
+ * @return
+ *   How many to generate, at most room. Flat out that is room.
+ */
+unsigned int pkt_gen_due(struct pkt_gen* gen, unsigned int room, uint64_t now);
+
+/**
+ * Write the next packet into a TX slot; non-temporal stores, so fence
+ * before ringing the doorbell (pkt_copy_fence()).
+ */
+void pkt_gen_write(struct pkt_gen* gen, void* slot);
+
+#endif /* _PKT_GEN_H_ */
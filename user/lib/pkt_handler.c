@@ -0,0 +1,53 @@
+#include <string.h>
+
+#include "pkt_handler.h"
+
+/* Built-in handlers */
+extern const struct pkt_handler handler_echo;
+extern const struct pkt_handler handler_drop;
+extern const struct pkt_handler handler_slow;
+extern const struct pkt_handler handler_kv;
+extern const struct pkt_handler handler_flow;
+
+static const struct pkt_handler* handlers[] = {
+    &handler_echo,
+    &handler_drop,
+    &handler_slow,
+    &handler_kv,
+    &handler_flow,
+};
+
+#define NUM_HANDLERS    (sizeof(handlers) / sizeof(handlers[0]))
+
+const struct pkt_handler* pkt_handler_find(const char* spec)
+{
+    size_t len;
+    unsigned int i;
+
+    len = strcspn(spec, ":");
+
+    for (i = 0; i < NUM_HANDLERS; i++)
+    {
+        if (strlen(handlers[i]->name) == len &&
+            strncmp(handlers[i]->name, spec, len) == 0)
+            return handlers[i];
+    }
+
+    return NULL;
+}
+
+const char* pkt_handler_args(const char* spec)
+{
+    const char* sep = strchr(spec, ':');
+
+    return sep != NULL ? sep + 1 : NULL;
+}
+
+void pkt_handler_list(FILE* out)
+{
+    unsigned int i;
+
+    for (i = 0; i < NUM_HANDLERS; i++)
+        fprintf(out, "  %-12s %s\n", handlers[i]->name,
+            handlers[i]->description);
+}
@@ -0,0 +1,132 @@
+#ifndef _PKT_HANDLER_H_
+#define _PKT_HANDLER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * @file
+ * Packet handlers: the service logic run on top of the datapath
+ * (see datapath.h).
+ *
+ * A handler is given a batch of received packets and fills in one
+ * action per packet. Working on a batch lets handlers prefetch and
+ * look up several packets at once (see pipeline.h); the first line of
+ * every frame has already been prefetched. Ring mechanics, doorbells
+ * and stats are left to the datapath.
+ *
+ * Handlers are compiled in and registered in pkt_handler.c; one is
+ * selected by name at startup.
+ */
+
+/**
+ * A received packet. The data lives in the RX ring and may be modified
+ * in place until the handler returns.
+ *
+ * With the header/payload split (datapath_set_split()), data and len
+ * cover only the ring slot and the rest of the frame is in payload.
+ * The payload is not prefetched, and whatever the verdict it is sent
+ * on unchanged after the header.
+ */
+struct pkt_view
+{
+    void* data;             /*> Frame, starting at the Ethernet header */
+    uint32_t len;           /*> Frame length, or header length if split */
+    uint32_t slot;          /*> Offset of the frame in the RX ring */
+    void* payload;          /*> Rest of the frame if split, else NULL */
+    uint32_t payload_len;
+};
+
+enum pkt_verdict
+{
+    PKT_FORWARD,            /*> Transmit the (possibly modified) frame */
+    PKT_TRANSMIT,           /*> Transmit action.data instead */
+    PKT_TX_SLOT,            /*> Transmit the frame built in action.tx */
+    PKT_DROP,               /*> Transmit nothing */
+};
+
+struct pkt_action
+{
+    enum pkt_verdict verdict;
+    const void* data;       /*> PKT_TRANSMIT: frame to send */
+    void* tx;               /*> Frame in the TX slot reserved for this packet */
+    uint32_t tx_size;       /*> Room for a frame at tx */
+    uint32_t len;           /*> Bytes to send; preset to the RX length */
+};
+
+struct pkt_handler
+{
+    const char* name;
+    const char* description;
+
+    /**
+     * Set if the handler keeps state across packets (a cache, a flow
+     * table), so one context has to see all of them: such a handler
+     * cannot be spread over dispatch workers.
+     */
+    int stateful;
+
+    /**
+     * Set if the handler needs the whole frame in data: it cannot work
+     * on a header/payload split frame (-X).
+     */
+    int whole_frame;
+
+    /**
+     * Optional. Set up per-datapath state.
+     *
+     * @param args
+     *   Text after "name:" on the command line, or NULL.
+     * @return
+     *   0 on success, -1 on failure.
+     */
+    int (*init)(void** ctx, const char* args);
+
+    /**
+     * Decide what to do with count packets. actions[] is preset to
+     * PKT_FORWARD with the RX length.
+     */
+    void (*process)(void* ctx, const struct pkt_view* pkts,
+            struct pkt_action* actions, unsigned int count);
+
+    /* Optional. Release per-datapath state. */
+    void (*fini)(void* ctx);
+
+    /* Optional. Print handler statistics, from the stats thread. */
+    void (*report)(void* ctx, FILE* out);
+
+    /**
+     * Optional. Write the state a warm restart carries over to the next
+     * process, which hands it to restore() of a freshly initialised
+     * ctx. Called between two process() calls.
+     *
+     * @return
+     *   0 on success, -1 on failure.
+     */
+    int (*save)(void* ctx, FILE* out);
+
+    /* Optional. Load what save() wrote; 0 on success, -1 on failure. */
+    int (*restore)(void* ctx, FILE* in);
+};
+
+#define PKT_HANDLER_DEFAULT     "echo"
+
+/**
+ * Look up a handler by name. Anything after a ':' is ignored, so
+ * "name:args" can be passed as is.
+ *
+ * @return
+ *   Handler, or NULL if there is none by that name.
+ */
+const struct pkt_handler* pkt_handler_find(const char* spec);
+
+/**
+ * @return
+ *   Arguments in a "name:args" handler spec, or NULL.
+ */
+const char* pkt_handler_args(const char* spec);
+
+/* Print the registered handlers */
+void pkt_handler_list(FILE* out);
+
+#endif /* _PKT_HANDLER_H_ */
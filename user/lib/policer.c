@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <emmintrin.h>
+
+#include "memzone.h"
+#include "latency.h"
+#include "policer.h"
+
+#define POLICER_WAYS        4
+#define POLICER_MAX_BURST   32
+
+struct policer_bucket
+{
+    uint32_t ips[POLICER_WAYS];
+    uint64_t tat[POLICER_WAYS];         /*> Theoretical arrival time, TSC */
+} __attribute__((__aligned__(64)));
+
+struct policer
+{
+    struct policer_bucket* buckets;
+    uint32_t bucket_mask;
+    const struct memzone* mz;
+    uint64_t limit;                     /*> rate << 32 | burst; any thread */
+    uint64_t applied;                   /*> limit the two below come from */
+    uint64_t cost;                      /*> TSC ticks per packet, 0: off */
+    uint64_t tolerance;                 /*> burst * cost */
+    double tsc_per_ns;
+    struct policer_stats stats;
+};
+
+static inline uint32_t policer_bucket_of(const struct policer* p, uint32_t ip)
+{
+    return (uint32_t) ((ip * 0x9e3779b97f4a7c15ull) >> 32) & p->bucket_mask;
+}
+
+/**
+ * @return
+ *   Bit mask of the ways holding ip.
+ */
+static inline uint32_t policer_match(const struct policer_bucket* bucket, uint32_t ip)
+{
+    __m128i ips = _mm_load_si128((const __m128i*) bucket->ips);
+    __m128i eq = _mm_cmpeq_epi32(ips, _mm_set1_epi32(ip));
+
+    return _mm_movemask_ps(_mm_castsi128_ps(eq));
+}
+
+static void policer_apply(struct policer* p, uint64_t limit)
+{
+    uint32_t rate = limit >> 32, burst = (uint32_t) limit;
+
+    p->cost = 0;
+    if (rate != 0)
+    {
+        p->cost = p->tsc_per_ns * 1e9 / rate;
+        if (p->cost == 0)
+            p->cost = 1;
+    }
+    p->tolerance = (uint64_t) burst * p->cost;
+    p->applied = limit;
+}
+
+struct policer* policer_create(uint32_t max_sources, uint32_t rate, uint32_t burst)
+{
+    struct policer* p;
+    size_t buckets = 1024;
+
+    p = calloc(1, sizeof(*p));
+    if (p == NULL)
+        return NULL;
+
+    /* Room for every source with half the ways to spare */
+    while (buckets * POLICER_WAYS / 2 < max_sources)
+        buckets <<= 1;
+
+    p->mz = memzone_reserve(buckets * sizeof(struct policer_bucket));
+    if (p->mz == NULL)
+    {
+        fprintf(stderr, "%s(): Cannot reserve memory for %u sources\n",
+            __func__, max_sources);
+        free(p);
+        return NULL;
+    }
+
+    p->buckets = (struct policer_bucket*) p->mz->addr;
+    p->bucket_mask = buckets - 1;
+    memset(p->buckets, 0, buckets * sizeof(struct policer_bucket));
+
+    p->tsc_per_ns = lat_tsc_per_ns();
+    policer_set_limit(p, rate, burst);
+    policer_apply(p, p->limit);
+
+    return p;
+}
+
+void policer_destroy(struct policer* p)
+{
+    if (p == NULL)
+        return;
+
+    memzone_free(p->mz);
+    free(p);
+}
+
+void policer_set_limit(struct policer* p, uint32_t rate, uint32_t burst)
+{
+    if (burst == 0)
+        burst = 1;
+
+    __atomic_store_n(&p->limit, ((uint64_t) rate << 32) | burst, __ATOMIC_RELAXED);
+}
+
+void policer_get_limit(const struct policer* p, uint32_t* rate, uint32_t* burst)
+{
+    uint64_t limit = __atomic_load_n(&p->limit, __ATOMIC_RELAXED);
+
+    *rate = limit >> 32;
+    *burst = (uint32_t) limit;
+}
+
+const struct policer_stats* policer_stats(const struct policer* p)
+{
+    return &p->stats;
+}
+
+/* One burst of at most POLICER_MAX_BURST packets */
+static unsigned int policer_burst(struct policer* p, const uint32_t* src_ips,
+        unsigned int count, uint64_t now, uint8_t* pass)
+{
+    uint32_t buckets[POLICER_MAX_BURST];
+    unsigned int i, passed = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        buckets[i] = policer_bucket_of(p, src_ips[i]);
+        __builtin_prefetch(&p->buckets[buckets[i]]);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        struct policer_bucket* bucket = &p->buckets[buckets[i]];
+        uint32_t mask = policer_match(bucket, src_ips[i]);
+        uint64_t tat;
+        int way, w;
+
+        if (mask != 0)
+        {
+            way = __builtin_ctz(mask);
+        }
+        else
+        {
+            /* New source: take the way that has been idle longest */
+            way = 0;
+            for (w = 1; w < POLICER_WAYS; w++)
+            {
+                if (bucket->tat[w] < bucket->tat[way])
+                    way = w;
+            }
+            if (bucket->tat[way] > now)
+                p->stats.evictions++;
+
+            bucket->ips[way] = src_ips[i];
+            bucket->tat[way] = 0;
+        }
+
+        tat = bucket->tat[way] > now ? bucket->tat[way] : now;
+        tat += p->cost;
+
+        if (tat - now <= p->tolerance)
+        {
+            bucket->tat[way] = tat;
+            pass[i] = 1;
+            passed++;
+        }
+        else
+        {
+            pass[i] = 0;
+        }
+    }
+
+    return passed;
+}
+
+unsigned int policer_run(struct policer* p, const uint32_t* src_ips,
+        unsigned int count, uint64_t now, uint8_t* pass)
+{
+    uint64_t limit = __atomic_load_n(&p->limit, __ATOMIC_RELAXED);
+    unsigned int done, n, passed = 0;
+
+    if (limit != p->applied)
+        policer_apply(p, limit);
+
+    if (p->cost == 0)
+    {
+        memset(pass, 1, count);
+        p->stats.passed += count;
+        return count;
+    }
+
+    for (done = 0; done < count; done += n)
+    {
+        n = count - done < POLICER_MAX_BURST ? count - done : POLICER_MAX_BURST;
+        passed += policer_burst(p, src_ips + done, n, now, pass + done);
+    }
+
+    p->stats.passed += passed;
+    p->stats.dropped += count - passed;
+
+    return passed;
+}
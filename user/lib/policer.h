@@ -0,0 +1,75 @@
+#ifndef _POLICER_H_
+#define _POLICER_H_
+
+#include <stdint.h>
+
+/**
+ * @file
+ * Per-source-IP rate limiting, run by the datapath on each burst before
+ * the handler sees it (see datapath_set_policer()).
+ *
+ * Every source has a token bucket of `burst` packets refilled at `rate`
+ * packets per second. The bucket is kept as one theoretical arrival
+ * time in TSC ticks (GCRA): a packet conforms if, after adding the cost
+ * of one packet, the TAT is no more than `burst` packets ahead of now.
+ * Refill is therefore implicit and lazy, and a source idle long enough
+ * to have a full bucket is indistinguishable from a new one.
+ *
+ * Sources live in a compact hash: 64-byte buckets of four (IP, TAT)
+ * pairs, the four IPs compared at once with SSE2. There is no empty
+ * marker: a zeroed way is a source with a full bucket. A new source
+ * takes the way with the oldest TAT, which only loses state if that
+ * source was still being limited (counted in evictions). Lookups for a
+ * burst are hashed and prefetched first, then decided in order.
+ *
+ * Only the owning worker touches the table; no locks. The limit may be
+ * changed from any thread with policer_set_limit(): it is one 64-bit
+ * word, read once per burst.
+ */
+
+struct policer_stats
+{
+    uint64_t passed;
+    uint64_t dropped;           /*> Over the source's limit */
+    uint64_t evictions;         /*> Sources forgotten while being limited */
+};
+
+struct policer;
+
+/**
+ * Create a policer.
+ *
+ * @param max_sources
+ *   Sources to size the table for.
+ * @param rate
+ *   Packets per second per source; 0 disables policing.
+ * @param burst
+ *   Bucket depth in packets, at least 1.
+ * @return
+ *   Policer, or NULL on failure.
+ */
+struct policer* policer_create(uint32_t max_sources, uint32_t rate, uint32_t burst);
+
+void policer_destroy(struct policer* p);
+
+/* Change the limit, from any thread; takes effect on the next burst */
+void policer_set_limit(struct policer* p, uint32_t rate, uint32_t burst);
+
+void policer_get_limit(const struct policer* p, uint32_t* rate, uint32_t* burst);
+
+const struct policer_stats* policer_stats(const struct policer* p);
+
+/**
+ * Police a burst of packets.
+ *
+ * @param src_ips
+ *   Source address of each packet.
+ * @param pass
+ *   Set to 1 for each packet that conforms, 0 for each to drop.
+ * @return
+ *   Number of packets that conform.
+ */
+unsigned int policer_run(struct policer* p, const uint32_t* src_ips,
+        unsigned int count, uint64_t now, uint8_t* pass);
+
+#endif /* _POLICER_H_ */
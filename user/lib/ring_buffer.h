@@ -4,8 +4,11 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <arpa/inet.h>
 #include <rte_atomic.h>
 
+#include "devcfg.h"
+
 struct ringbuffer_t
 {
     void*       base_addr;      /*> Base address */
@@ -13,6 +16,7 @@ struct ringbuffer_t
     uint32_t    capacity;       /*> Ring buffer capacity */
     uint32_t    head;           /*> Head pointer */
     uint32_t    tail;           /*> Tail pointer */
+    uint32_t    hdr_size;       /*> RING_SLOT_HDR_LEN if variable-length */
 } __attribute__((__packed__));
 
 static inline int ringbuffer_empty(struct ringbuffer_t* rb)
@@ -47,6 +51,86 @@ static inline void* ringbuffer_back(struct ringbuffer_t* rb)
     return (char*) rb->base_addr + rb->tail;
 }
 
+/* Number of entries queued */
+static inline uint32_t ringbuffer_count(struct ringbuffer_t* rb)
+{
+    return ringbuffer_size(rb) / rb->entry_size;
+}
+
+/* Number of entries that can be pushed; one slot is kept empty */
+static inline uint32_t ringbuffer_free_count(struct ringbuffer_t* rb)
+{
+    return (rb->capacity - ringbuffer_size(rb)) / rb->entry_size - 1;
+}
+
+/* i-th queued entry from the head */
+static inline void* ringbuffer_front_at(struct ringbuffer_t* rb, uint32_t i)
+{
+    uint32_t off = rb->head + i * rb->entry_size;
+
+    if (off >= rb->capacity)
+        off -= rb->capacity;
+    return (char*) rb->base_addr + off;
+}
+
+/* i-th free entry from the tail */
+static inline void* ringbuffer_back_at(struct ringbuffer_t* rb, uint32_t i)
+{
+    uint32_t off = rb->tail + i * rb->entry_size;
+
+    if (off >= rb->capacity)
+        off -= rb->capacity;
+    return (char*) rb->base_addr + off;
+}
+
+/**
+ * Batch variants of ringbuffer_pop()/ringbuffer_push(). No barrier:
+ * the caller orders its data accesses once for the whole batch.
+ */
+static inline void ringbuffer_pop_n(struct ringbuffer_t* rb, uint32_t n)
+{
+    rb->head += n * rb->entry_size;
+    if (rb->head >= rb->capacity)
+        rb->head -= rb->capacity;
+}
+
+static inline void ringbuffer_push_n(struct ringbuffer_t* rb, uint32_t n)
+{
+    rb->tail += n * rb->entry_size;
+    if (rb->tail >= rb->capacity)
+        rb->tail -= rb->capacity;
+}
+
+/**
+ * Frame in an entry, and its length. Fixed-size entries are all frame;
+ * variable-length ones start with a ring_slot_hdr (see devcfg.h).
+ */
+static inline void* ringbuffer_frame(struct ringbuffer_t* rb, void* entry)
+{
+    return (char*) entry + rb->hdr_size;
+}
+
+static inline uint32_t ringbuffer_frame_len(struct ringbuffer_t* rb, const void* entry)
+{
+    uint32_t len;
+
+    if (rb->hdr_size == 0)
+        return rb->entry_size;
+
+    len = ntohs(((const struct ring_slot_hdr*) entry)->len);
+    return len < rb->entry_size - rb->hdr_size ? len : rb->entry_size - rb->hdr_size;
+}
+
+/* Variable-length entries only: write the slot header */
+static inline void ringbuffer_set_frame_len(void* entry, uint32_t len)
+{
+    struct ring_slot_hdr* hdr = entry;
+
+    hdr->len = htons(len);
+    hdr->flags = 0;
+    hdr->reserved = 0;
+}
+
 extern void ringbuffer_push(struct ringbuffer_t* rb);
 extern void ringbuffer_pop(struct ringbuffer_t* rb);
 
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats_shm.h"
+
+#define STATS_READ_RETRIES  1000
+
+struct stats_shm* stats_shm_create(unsigned int nic_count)
+{
+    struct stats_shm* shm;
+    unsigned int i;
+    int fd;
+
+    if (nic_count > STATS_SHM_MAX_NICS)
+        nic_count = STATS_SHM_MAX_NICS;
+
+    /* Start from scratch so attached viewers see a fresh layout */
+    shm_unlink(STATS_SHM_NAME);
+
+    fd = shm_open(STATS_SHM_NAME, O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s(): Cannot create %s\n", __func__, STATS_SHM_NAME);
+        return NULL;
+    }
+
+    if (ftruncate(fd, sizeof(*shm)) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED)
+        return NULL;
+
+    memset(shm, 0, sizeof(*shm));
+    shm->version = STATS_SHM_VERSION;
+    shm->size = sizeof(*shm);
+    shm->nic_count = nic_count;
+    shm->pid = getpid();
+    for (i = 0; i < nic_count; i++)
+        shm->nics[i].index = i;
+
+    __atomic_store_n(&shm->magic, STATS_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return shm;
+}
+
+const struct stats_shm* stats_shm_attach(void)
+{
+    const struct stats_shm* shm;
+    struct stat st;
+    int fd;
+
+    fd = shm_open(STATS_SHM_NAME, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(*shm))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED)
+        return NULL;
+
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != STATS_SHM_MAGIC ||
+        shm->version != STATS_SHM_VERSION || shm->size != sizeof(*shm))
+    {
+        fprintf(stderr, "%s(): Incompatible statistics segment\n", __func__);
+        munmap((void*) shm, sizeof(*shm));
+        return NULL;
+    }
+
+    return shm;
+}
+
+int stats_shm_read(const struct stats_shm* shm, unsigned int index,
+        struct stats_nic* out)
+{
+    const struct stats_nic* s = &shm->nics[index];
+    uint32_t seq;
+    int i;
+
+    for (i = 0; i < STATS_READ_RETRIES; i++)
+    {
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+
+        memcpy(out, s, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+            return 0;
+    }
+
+    return -1;
+}
@@ -0,0 +1,125 @@
+#ifndef _STATS_SHM_H_
+#define _STATS_SHM_H_
+
+#include <stdint.h>
+
+/**
+ * @file
+ * Statistics published to a POSIX shared-memory segment, for viewers
+ * such as nfp-top.out to attach to read-only.
+ *
+ * The application's stats thread gathers everything once per interval
+ * (one read of the firmware counters, plain loads of the worker's own
+ * counters) and copies it into its NIC's slot under a seqlock: the
+ * sequence number is odd while a write is in progress, and readers
+ * retry until they see the same even number before and after copying.
+ * Writers never wait for readers.
+ */
+
+#define STATS_SHM_NAME      "/nfp_udp_echo_stats"
+#define STATS_SHM_MAGIC     0x5354464eu     /* "NFTS" */
+#define STATS_SHM_VERSION   6
+#define STATS_SHM_MAX_NICS  8
+#define STATS_FW_CONTEXTS   8
+#define STATS_MAX_CLASSES   4       /* RING_MAX_CLASSES */
+#define STATS_FW_DROPS      4       /* RX_DROP_REASONS */
+
+struct stats_nic
+{
+    uint32_t seq;                           /*> Seqlock, odd while writing */
+    uint32_t index;                         /*> NIC index, by PCI address */
+    char name[32];                          /*> PCI address */
+    uint64_t timestamp_ns;                  /*> CLOCK_MONOTONIC of this sample */
+
+    /* Firmware, per ME context (zero unless built with PKT_STATS) */
+    uint64_t fw_rx[STATS_FW_CONTEXTS];
+    uint64_t fw_tx[STATS_FW_CONTEXTS];
+
+    /* Host worker */
+    uint64_t rx_packets;
+    uint64_t tx_packets;
+    uint64_t dropped;
+    uint64_t policed;                       /*> Dropped by the policer */
+    uint64_t overload;                      /*> Dropped by the overload policy */
+    uint64_t batches;
+    uint64_t mmio_reads;                    /*> Doorbell reads */
+    uint64_t mmio_writes;                   /*> Doorbell writes */
+    uint32_t rx_ring_used;                  /*> Slots, as last seen by the worker */
+    uint32_t tx_ring_used;
+    uint32_t ring_slots;
+    uint32_t pad;
+
+    /* Firmware RX drops per reason (RX_DROP_*, devcfg.h) */
+    uint64_t fw_drops[STATS_FW_DROPS];
+
+    /* Capture tap (zero unless capturing) */
+    uint64_t cap_written;                   /*> Records written */
+    uint64_t cap_dropped;                   /*> Capture queue full */
+
+    /* Generator mode (zero otherwise) */
+    uint64_t gen_packets;
+    uint64_t gen_full_ns;                   /*> TX ring full with packets due */
+
+    /* Latency over the last interval, in ns (zero unless recorded) */
+    uint64_t lat_count;
+    uint64_t lat_p50;
+    uint64_t lat_p99;
+    uint64_t lat_p999;
+    uint64_t lat_max;
+
+    /* Per traffic class (classes 0 unless there are several) */
+    uint32_t classes;
+    uint32_t pad2;
+    uint64_t class_rx[STATS_MAX_CLASSES];
+    uint64_t class_lat_count[STATS_MAX_CLASSES];
+    uint64_t class_lat_p50[STATS_MAX_CLASSES];
+    uint64_t class_lat_p99[STATS_MAX_CLASSES];
+} __attribute__((aligned(64)));
+
+struct stats_shm
+{
+    uint32_t magic;                         /*> STATS_SHM_MAGIC once initialised */
+    uint32_t version;                       /*> STATS_SHM_VERSION */
+    uint32_t size;                          /*> sizeof(struct stats_shm) */
+    uint32_t nic_count;
+    uint64_t pid;                           /*> Publishing process */
+    struct stats_nic nics[STATS_SHM_MAX_NICS];
+};
+
+/**
+ * Create (or replace) the segment.
+ *
+ * @return
+ *   The mapped segment, or NULL on failure.
+ */
+struct stats_shm* stats_shm_create(unsigned int nic_count);
+
+/**
+ * Map an existing segment read-only and check its layout.
+ *
+ * @return
+ *   The mapped segment, or NULL if it is missing or incompatible.
+ */
+const struct stats_shm* stats_shm_attach(void);
+
+static inline void stats_shm_write_begin(struct stats_nic* s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void stats_shm_write_end(struct stats_nic* s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Take a consistent copy of one NIC's slot.
+ *
+ * @return
+ *   0 on success, -1 if the writer kept it busy for too long.
+ */
+int stats_shm_read(const struct stats_shm* shm, unsigned int index,
+        struct stats_nic* out);
+
+#endif /* _STATS_SHM_H_ */
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "traffic_class.h"
+
+#define TC_ETH_HLEN         14
+#define TC_IP_HLEN          20      /* The firmware assumes no options */
+#define TC_IP_PROTO_ICMP    1
+#define TC_IP_PROTO_UDP     17
+
+/* "A:B", both numbers */
+static int tc_parse_pair(const char* s, unsigned long* a, unsigned long* b)
+{
+    char* end;
+
+    *a = strtoul(s, &end, 0);
+    if (end == s || *end != ':')
+        return -1;
+    s = end + 1;
+    *b = strtoul(s, &end, 0);
+    if (end == s || *end != '\0')
+        return -1;
+
+    return 0;
+}
+
+static int tc_parse_weights(struct tc_config* tc, const char* s)
+{
+    unsigned int c;
+    char* end;
+
+    for (c = 0; c < RING_MAX_CLASSES; c++)
+    {
+        tc->weights[c] = strtoul(s, &end, 0);
+        if (end == s || tc->weights[c] == 0)
+            return -1;
+        if (*end == '\0')
+            return 0;
+        if (*end != ':')
+            return -1;
+        s = end + 1;
+    }
+
+    return -1;
+}
+
+int tc_config_parse(struct tc_config* tc, const char* spec)
+{
+    char *copy, *tok, *save, *val, *end;
+    unsigned long a, b, dflt = ~0ul;
+    unsigned int c, ports = 0;
+    uint8_t dscp_set[64] = { 0 };
+    int ret = 0;
+
+    memset(tc, 0, sizeof(*tc));
+    tc->classes = 2;
+    tc->sched = TC_SCHED_STRICT;
+    tc->guard = TC_DEFAULT_GUARD;
+    for (c = 0; c < RING_MAX_CLASSES; c++)
+        tc->weights[c] = 1;
+
+    copy = strdup(spec != NULL ? spec : "");
+    if (copy == NULL)
+        return -1;
+
+    for (tok = strtok_r(copy, ",", &save); tok != NULL && ret == 0;
+         tok = strtok_r(NULL, ",", &save))
+    {
+        val = strchr(tok, '=');
+        if (val == NULL)
+        {
+            fprintf(stderr, "%s(): Expected key=value: %s\n", __func__, tok);
+            ret = -1;
+            break;
+        }
+        *val++ = '\0';
+
+        if (strcmp(tok, "sched") == 0)
+        {
+            if (strcmp(val, "strict") == 0)
+                tc->sched = TC_SCHED_STRICT;
+            else if (strcmp(val, "wrr") == 0)
+                tc->sched = TC_SCHED_WRR;
+            else
+                ret = -1;
+        }
+        else if (strcmp(tok, "weights") == 0)
+        {
+            ret = tc_parse_weights(tc, val);
+        }
+        else if (strcmp(tok, "port") == 0)
+        {
+            ret = tc_parse_pair(val, &a, &b);
+            if (ret == 0 && (ports == RING_CLASS_PORTS || a == 0 || a > 0xffff ||
+                             b >= RING_MAX_CLASSES))
+                ret = -1;
+            if (ret == 0)
+            {
+                tc->ports[ports] = a;
+                tc->port_class[ports++] = b;
+            }
+        }
+        else if (strcmp(tok, "dscp") == 0)
+        {
+            ret = tc_parse_pair(val, &a, &b);
+            if (ret == 0 && (a >= 64 || b >= RING_MAX_CLASSES))
+                ret = -1;
+            if (ret == 0)
+            {
+                tc->dscp_class[a] = b;
+                dscp_set[a] = 1;
+            }
+        }
+        else
+        {
+            a = strtoul(val, &end, 0);
+            if (*end != '\0' || val[0] == '\0')
+                ret = -1;
+            else if (strcmp(tok, "classes") == 0)
+                tc->classes = a;
+            else if (strcmp(tok, "guard") == 0)
+                tc->guard = a;
+            else if (strcmp(tok, "icmp") == 0)
+                tc->icmp_class = a;
+            else if (strcmp(tok, "default") == 0)
+                dflt = a;
+            else
+                ret = -1;
+        }
+
+        if (ret)
+            fprintf(stderr, "%s(): Bad class option: %s=%s\n", __func__, tok, val);
+    }
+
+    free(copy);
+    if (ret)
+        return -1;
+
+    if (tc->classes < 2 || tc->classes > RING_MAX_CLASSES)
+    {
+        fprintf(stderr, "%s(): 2 to %d classes\n", __func__, RING_MAX_CLASSES);
+        return -1;
+    }
+
+    if (dflt == ~0ul)
+        dflt = tc->classes - 1;
+    for (c = 0; c < 64; c++)
+    {
+        if (!dscp_set[c])
+            tc->dscp_class[c] = dflt;
+    }
+
+    /* Every rule must name a class that exists */
+    ret = tc->icmp_class >= tc->classes;
+    for (c = 0; c < ports; c++)
+        ret |= tc->port_class[c] >= tc->classes;
+    for (c = 0; c < 64; c++)
+        ret |= tc->dscp_class[c] >= tc->classes;
+    if (ret)
+    {
+        fprintf(stderr, "%s(): Classes are 0 to %u\n", __func__, tc->classes - 1);
+        return -1;
+    }
+
+    return 0;
+}
+
+void tc_config_write(const struct tc_config* tc, volatile struct device_meta_t* meta)
+{
+    unsigned int i;
+
+    meta->num_classes = tc->classes;
+    for (i = 0; i < RING_CLASS_PORTS; i++)
+    {
+        meta->class_port[i] = tc->ports[i];
+        meta->port_class[i] = tc->port_class[i];
+    }
+    meta->icmp_class = tc->icmp_class;
+    for (i = 0; i < 64 / 16; i++)
+        meta->dscp_class[i] = 0;
+    for (i = 0; i < 64; i++)
+        meta->dscp_class[i >> 4] |= tc->dscp_class[i] << ((i & 15) * 2);
+}
+
+unsigned int tc_classify(const struct device_meta_t* meta, const uint8_t* frame,
+        uint32_t len)
+{
+    const uint8_t* ip = frame + TC_ETH_HLEN;
+    unsigned int i;
+    uint16_t dport;
+
+    if (meta->num_classes <= 1)
+        return 0;
+
+    if (len < TC_ETH_HLEN + TC_IP_HLEN)
+        return RING_DSCP_CLASS(meta->dscp_class, 0);
+
+    if (ip[9] == TC_IP_PROTO_ICMP)
+        return meta->icmp_class;
+
+    if (ip[9] == TC_IP_PROTO_UDP && len >= TC_ETH_HLEN + TC_IP_HLEN + 4)
+    {
+        dport = (ip[TC_IP_HLEN + 2] << 8) | ip[TC_IP_HLEN + 3];
+        for (i = 0; i < RING_CLASS_PORTS; i++)
+        {
+            if (meta->class_port[i] != 0 && meta->class_port[i] == dport)
+                return meta->port_class[i];
+        }
+    }
+
+    return RING_DSCP_CLASS(meta->dscp_class, ip[1] >> 2);
+}
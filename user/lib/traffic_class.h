@@ -0,0 +1,70 @@
+#ifndef _TRAFFIC_CLASS_H_
+#define _TRAFFIC_CLASS_H_
+
+#include <stdint.h>
+
+#include "devcfg.h"
+
+/**
+ * @file
+ * Traffic classes: each has its own RX/TX ring pair (device_meta_t),
+ * the firmware sorts received frames into them, and the datapath serves
+ * them in turn (datapath_set_classes()).
+ *
+ * Class 0 is the most urgent. A frame goes to the ICMP class if it is
+ * ICMP, else to the class of its UDP destination port if one is listed,
+ * else to the class of its DSCP.
+ *
+ * The spec is a comma separated list of key=value:
+ *   classes=N       Number of classes, 2 to RING_MAX_CLASSES (default 2)
+ *   sched=strict    Always the most urgent class with packets, except
+ *                   that a class passed over guard times gets a turn
+ *                   (default)
+ *   sched=wrr       Weighted round robin, weight batches per turn
+ *   guard=N         Starvation guard for strict (default 64, 0 for off)
+ *   weights=A:B:..  WRR weights of class 0, 1, ... (default 1 each)
+ *   icmp=C          Class of ICMP (default 0)
+ *   port=P:C        UDP destination port P goes to class C; up to
+ *                   RING_CLASS_PORTS of them
+ *   dscp=D:C        DSCP D goes to class C
+ *   default=C       Class of the remaining DSCPs (default the last)
+ * e.g. "classes=2,icmp=0,dscp=46:0,port=3784:0".
+ */
+
+enum tc_sched
+{
+    TC_SCHED_STRICT,
+    TC_SCHED_WRR,
+};
+
+#define TC_DEFAULT_GUARD    64
+
+struct tc_config
+{
+    uint32_t classes;
+    enum tc_sched sched;
+    uint32_t guard;                         /*> Strict only */
+    uint32_t weights[RING_MAX_CLASSES];     /*> WRR only */
+    uint8_t icmp_class;
+    uint16_t ports[RING_CLASS_PORTS];       /*> 0 for unused */
+    uint8_t port_class[RING_CLASS_PORTS];
+    uint8_t dscp_class[64];
+};
+
+/**
+ * @return
+ *   0 on success, -1 if the spec does not parse.
+ */
+int tc_config_parse(struct tc_config* tc, const char* spec);
+
+/* Hand the classification rules to the firmware */
+void tc_config_write(const struct tc_config* tc, volatile struct device_meta_t* meta);
+
+/**
+ * Class of a frame under the rules in meta, as the firmware works it
+ * out. Frames too short to tell go by DSCP 0.
+ */
+unsigned int tc_classify(const struct device_meta_t* meta, const uint8_t* frame,
+        uint32_t len);
+
+#endif /* _TRAFFIC_CLASS_H_ */
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "warm_restart.h"
+
+static const char* const warm_zone_names[WARM_MAX_ZONES] = {
+    "rx", "tx", "payload_rx", "payload_tx",
+    "class1_rx", "class1_tx", "class2_rx", "class2_tx", "class3_rx", "class3_tx",
+};
+
+static int warm_zone_index(const char* name)
+{
+    int i;
+
+    for (i = 0; i < WARM_MAX_ZONES; i++)
+    {
+        if (strcmp(warm_zone_names[i], name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static void warm_write_nic(FILE* f, const struct warm_nic* w)
+{
+    unsigned int c;
+    int i;
+
+    fprintf(f, "nic %s\n", w->name);
+    fprintf(f, "layout %u %u %u %u %u\n", w->capacity, w->slot_size,
+        w->payload_size, w->ring_flags, w->classes);
+    fprintf(f, "generation %lu\n", w->generation);
+
+    for (i = 0; i < WARM_MAX_ZONES; i++)
+    {
+        if (w->zones[i].len != 0)
+            fprintf(f, "zone %s %u %lu 0x%lx\n", warm_zone_names[i],
+                w->zones[i].handle, w->zones[i].len, w->zones[i].iova);
+    }
+
+    for (c = 0; c < w->classes && c < RING_MAX_CLASSES; c++)
+        fprintf(f, "ring %u %u %u\n", c, w->rx_head[c], w->tx_tail[c]);
+
+    if (w->handler[0] != '\0')
+        fprintf(f, "handler %s\n", w->handler);
+    fprintf(f, "end\n");
+}
+
+int warm_save(const char* path, const struct warm_nic* nics, int count)
+{
+    char tmp[PATH_MAX];
+    FILE* f;
+    int i, err;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "%s(): Cannot create %s: %s\n", __func__, tmp, strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < count; i++)
+        warm_write_nic(f, &nics[i]);
+
+    err = ferror(f);
+    err |= fflush(f) != 0 || fsync(fileno(f)) != 0;
+    err |= fclose(f) != 0;
+    if (err || rename(tmp, path))
+    {
+        fprintf(stderr, "%s(): Cannot write %s\n", __func__, path);
+        remove(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+int warm_load(const char* path, struct warm_nic* nics, int max)
+{
+    char line[WARM_SPEC_LEN + 16], key[16], name[16];
+    struct warm_nic* w = NULL;
+    struct warm_zone zone;
+    unsigned int c, head, tail;
+    int count = 0, ok = 1, z;
+    FILE* f;
+
+    f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+
+    while (ok && fgets(line, sizeof(line), f) != NULL)
+    {
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%15s", key) != 1)
+            continue;
+
+        if (strcmp(key, "nic") == 0)
+        {
+            if (w != NULL || count == max)
+                ok = 0;
+            else
+            {
+                w = &nics[count];
+                memset(w, 0, sizeof(*w));
+                ok = sscanf(line, "nic %31s", w->name) == 1;
+            }
+            continue;
+        }
+
+        if (w == NULL)
+        {
+            ok = 0;
+        }
+        else if (strcmp(key, "layout") == 0)
+        {
+            ok = sscanf(line, "layout %u %u %u %u %u", &w->capacity, &w->slot_size,
+                    &w->payload_size, &w->ring_flags, &w->classes) == 5 &&
+                w->classes <= RING_MAX_CLASSES;
+        }
+        else if (strcmp(key, "generation") == 0)
+        {
+            ok = sscanf(line, "generation %lu", &w->generation) == 1;
+        }
+        else if (strcmp(key, "zone") == 0)
+        {
+            ok = sscanf(line, "zone %15s %hu %lu %lx", name, &zone.handle,
+                    &zone.len, &zone.iova) == 4 &&
+                (z = warm_zone_index(name)) >= 0;
+            if (ok)
+                w->zones[z] = zone;
+        }
+        else if (strcmp(key, "ring") == 0)
+        {
+            ok = sscanf(line, "ring %u %u %u", &c, &head, &tail) == 3 &&
+                c < RING_MAX_CLASSES;
+            if (ok)
+            {
+                w->rx_head[c] = head;
+                w->tx_tail[c] = tail;
+            }
+        }
+        else if (strcmp(key, "handler") == 0)
+        {
+            const char* spec = line + strlen(key);
+
+            snprintf(w->handler, sizeof(w->handler), "%s", spec + strspn(spec, " "));
+        }
+        else if (strcmp(key, "end") == 0)
+        {
+            w = NULL;
+            count++;
+        }
+        else
+        {
+            ok = 0;
+        }
+    }
+
+    fclose(f);
+
+    if (!ok || w != NULL)
+    {
+        fprintf(stderr, "%s(): Malformed manifest %s\n", __func__, path);
+        return -1;
+    }
+
+    return count;
+}
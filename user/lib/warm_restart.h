@@ -0,0 +1,85 @@
+#ifndef _WARM_RESTART_H_
+#define _WARM_RESTART_H_
+
+#include <stdint.h>
+
+#include "devcfg.h"
+
+/**
+ * @file
+ * Manifest of a warm restart: what a process hands over so that the
+ * next one can take over its rings while the firmware keeps running,
+ * instead of starting them over.
+ *
+ * Per NIC, it records the memzones behind the rings (memzone_attach()
+ * maps them again by handle and checks their IO address), the ring
+ * layout the firmware was given, the generation it runs, the indices
+ * the host had published, and the handler whose state was saved
+ * alongside. The indices are a check only: the rings carry on from
+ * device_meta_t, where the firmware may have moved on since.
+ *
+ * It is a text file, one "key values..." line each, so it can be read
+ * by eye:
+ *
+ *   nic 0000:04:00.0
+ *   layout 2097152 256 0 0 1       capacity, slot, payload, flags, classes
+ *   generation 3
+ *   zone rx 0 2097152 0x1f4000000  handle, length, IO address
+ *   ring 0 512 768                 class, rx_head, tx_tail
+ *   handler kv:256
+ *   end
+ */
+
+/* Zones: rings, payload rings, then the rings of classes 1.. */
+#define WARM_ZONE_RX            0
+#define WARM_ZONE_TX            1
+#define WARM_ZONE_PAYLOAD_RX    2
+#define WARM_ZONE_PAYLOAD_TX    3
+#define WARM_ZONE_CLASS_RX(c)   (4 + 2 * ((c) - 1))
+#define WARM_ZONE_CLASS_TX(c)   (5 + 2 * ((c) - 1))
+#define WARM_MAX_ZONES          (2 * (RING_MAX_CLASSES + 1))
+
+#define WARM_NAME_LEN           32
+#define WARM_SPEC_LEN           256
+
+struct warm_zone
+{
+    uint16_t handle;
+    uint64_t len;                           /*> 0 if the NIC has none */
+    uint64_t iova;
+};
+
+struct warm_nic
+{
+    char name[WARM_NAME_LEN];               /*> PCI address */
+    uint32_t capacity;                      /*> Ring size in bytes */
+    uint32_t slot_size;
+    uint32_t payload_size;                  /*> Header/payload split, 0 if off */
+    uint32_t ring_flags;                    /*> RING_F_* */
+    uint32_t classes;
+    uint64_t generation;
+    struct warm_zone zones[WARM_MAX_ZONES];
+    uint32_t rx_head[RING_MAX_CLASSES];
+    uint32_t tx_tail[RING_MAX_CLASSES];
+    char handler[WARM_SPEC_LEN];            /*> Spec of the saved state, "" if none */
+};
+
+/**
+ * Write the manifest. It goes to a temporary file first, so that path
+ * holds either the previous manifest or the whole new one.
+ *
+ * @return
+ *   0 on success, -1 on failure.
+ */
+int warm_save(const char* path, const struct warm_nic* nics, int count);
+
+/**
+ * Read a manifest.
+ *
+ * @return
+ *   Number of NICs read, or -1 if there is no manifest or it is
+ *   malformed.
+ */
+int warm_load(const char* path, struct warm_nic* nics, int max);
+
+#endif /* _WARM_RESTART_H_ */
@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "watchdog.h"
+
+/* Indices of one ring pair, in watchdog_ring() order */
+#define RX_HEAD     0
+#define RX_TAIL     1
+#define TX_HEAD     2
+#define TX_TAIL     3
+
+static const char* const watchdog_names[WATCHDOG_EVENT_TYPES] = {
+    "rx_head_stuck", "tx_head_stuck", "rx_tail_stuck",
+    "rx_ctx_idle", "tx_ctx_idle", "poller_stall", "worker_stall",
+};
+
+/* What the subject of each event type is, NULL if it has none */
+static const char* const watchdog_subjects[WATCHDOG_EVENT_TYPES] = {
+    "class", "class", NULL, "context", "context", NULL, "worker",
+};
+
+struct watchdog_events
+{
+    struct watchdog_event* events;
+    unsigned int count;
+    unsigned int max;
+};
+
+struct watchdog_trace
+{
+    FILE* out;
+    const char* prefix;
+};
+
+void watchdog_init(struct watchdog* wd, uint32_t stall_periods)
+{
+    memset(wd, 0, sizeof(*wd));
+    wd->stall_periods = stall_periods != 0 ? stall_periods : 1;
+}
+
+const char* watchdog_event_name(enum watchdog_event_type type)
+{
+    return type < WATCHDOG_EVENT_TYPES ? watchdog_names[type] : "unknown";
+}
+
+static unsigned int watchdog_classes(const struct device_meta_t* meta)
+{
+    if (meta->num_classes <= 1)
+        return 1;
+    return meta->num_classes < RING_MAX_CLASSES ? meta->num_classes : RING_MAX_CLASSES;
+}
+
+static void watchdog_ring(const struct device_meta_t* meta, unsigned int c, uint32_t idx[4])
+{
+    const struct ring_pair_t* r;
+
+    if (c == 0)
+    {
+        idx[RX_HEAD] = meta->rx_head;
+        idx[RX_TAIL] = meta->rx_tail;
+        idx[TX_HEAD] = meta->tx_head;
+        idx[TX_TAIL] = meta->tx_tail;
+        return;
+    }
+
+    r = &meta->class_rings[c - 1];
+    idx[RX_HEAD] = r->rx_head;
+    idx[RX_TAIL] = r->rx_tail;
+    idx[TX_HEAD] = r->tx_head;
+    idx[TX_TAIL] = r->tx_tail;
+}
+
+static void watchdog_emit(struct watchdog_events* ev, const struct watchdog_check* chk,
+        enum watchdog_event_type type, unsigned int subject)
+{
+    struct watchdog_event* e;
+
+    if (ev->count == ev->max)
+        return;
+
+    e = &ev->events[ev->count++];
+    e->type = type;
+    e->subject = subject;
+    e->periods = chk->periods;
+    e->raised = chk->raised;
+}
+
+/**
+ * One subject for one sample: progress clears it, work without progress
+ * counts towards raising it, and neither leaves a raised event be.
+ */
+static void watchdog_step(struct watchdog* wd, struct watchdog_events* ev,
+        enum watchdog_event_type type, unsigned int subject, int progress, int stuck)
+{
+    struct watchdog_check* chk = &wd->checks[type][subject];
+
+    if (progress)
+    {
+        if (chk->raised)
+        {
+            chk->raised = 0;
+            wd->active--;
+            watchdog_emit(ev, chk, type, subject);
+        }
+        chk->periods = 0;
+    }
+    else if (stuck)
+    {
+        chk->periods++;
+        if (!chk->raised && chk->periods >= wd->stall_periods)
+        {
+            chk->raised = 1;
+            wd->raised++;
+            wd->active++;
+            watchdog_emit(ev, chk, type, subject);
+        }
+    }
+    else if (!chk->raised)
+    {
+        chk->periods = 0;
+    }
+}
+
+/* Clear whatever is raised, and start every check over */
+static void watchdog_reset(struct watchdog* wd, struct watchdog_events* ev)
+{
+    unsigned int t, i;
+
+    for (t = 0; t < WATCHDOG_EVENT_TYPES; t++)
+    {
+        for (i = 0; i < WATCHDOG_SUBJECTS; i++)
+        {
+            if (wd->checks[t][i].raised)
+                watchdog_step(wd, ev, t, i, 1, 0);
+        }
+    }
+
+    memset(wd->checks, 0, sizeof(wd->checks));
+    memset(wd->ctx_active, 0, sizeof(wd->ctx_active));
+    wd->have_prev = 0;
+}
+
+static void watchdog_check_rings(struct watchdog* wd, struct watchdog_events* ev,
+        const struct device_meta_t* prev, const struct device_meta_t* meta)
+{
+    uint32_t a[4], b[4], used, size = meta->buffer_size;
+    unsigned int c;
+    int landed = 0, crowded = 0;
+
+    for (c = 0; c < watchdog_classes(meta); c++)
+    {
+        watchdog_ring(prev, c, a);
+        watchdog_ring(meta, c, b);
+
+        watchdog_step(wd, ev, WATCHDOG_RX_HEAD_STUCK, c,
+            b[RX_HEAD] != a[RX_HEAD], b[RX_HEAD] != b[RX_TAIL]);
+        watchdog_step(wd, ev, WATCHDOG_TX_HEAD_STUCK, c,
+            b[TX_HEAD] != a[TX_HEAD], b[TX_HEAD] != b[TX_TAIL]);
+
+        /* Room for every busy context: if not, they wait on the host */
+        landed |= b[RX_TAIL] != a[RX_TAIL];
+        if (size != 0)
+        {
+            used = (b[RX_TAIL] + size - b[RX_HEAD]) % size;
+            crowded |= size - used <= (uint64_t) meta->packet_size * (meta->rx_busy + 1);
+        }
+    }
+
+    watchdog_step(wd, ev, WATCHDOG_RX_TAIL_STUCK, 0,
+        landed || meta->rx_busy == 0, !crowded);
+}
+
+static void watchdog_check_contexts(struct watchdog* wd, struct watchdog_events* ev,
+        enum watchdog_event_type type, uint8_t* active, const uint64_t* prev,
+        const uint64_t* now)
+{
+    uint64_t delta[WATCHDOG_CONTEXTS], total = 0;
+    unsigned int k;
+
+    for (k = 0; k < WATCHDOG_CONTEXTS; k++)
+    {
+        delta[k] = now[k] - prev[k];
+        total += delta[k];
+    }
+
+    /* Only contexts that have counted: the firmware may not run them all */
+    for (k = 0; k < WATCHDOG_CONTEXTS; k++)
+    {
+        watchdog_step(wd, ev, type, k, delta[k] != 0,
+            active[k] && total - delta[k] >= WATCHDOG_IDLE_PACKETS);
+        if (delta[k] != 0)
+            active[k] = 1;
+    }
+}
+
+unsigned int watchdog_check(struct watchdog* wd, const struct watchdog_sample* s,
+        struct watchdog_event* events, unsigned int max)
+{
+    struct watchdog_events ev = { events, 0, max };
+    const struct watchdog_sample* prev = &wd->prev;
+    uint64_t gen = s->meta.start_signal;
+    unsigned int w;
+
+    /* Paused, restarting, or restarted: the indices start over */
+    if (gen == 0 || gen == RING_RESTARTING ||
+        (wd->have_prev && prev->meta.start_signal != gen))
+    {
+        watchdog_reset(wd, &ev);
+        if (gen == 0 || gen == RING_RESTARTING)
+            return ev.count;
+    }
+
+    if (!wd->have_prev)
+    {
+        wd->prev = *s;
+        wd->have_prev = 1;
+        return ev.count;
+    }
+
+    watchdog_check_rings(wd, &ev, &prev->meta, &s->meta);
+
+    if (s->have_counters && prev->have_counters)
+    {
+        watchdog_check_contexts(wd, &ev, WATCHDOG_RX_CTX_IDLE, wd->ctx_active[0],
+            prev->fw_rx, s->fw_rx);
+        watchdog_check_contexts(wd, &ev, WATCHDOG_TX_CTX_IDLE, wd->ctx_active[1],
+            prev->fw_tx, s->fw_tx);
+    }
+
+    watchdog_step(wd, &ev, WATCHDOG_POLLER_STALL, 0, s->polls != prev->polls,
+        s->polling && prev->polling);
+
+    for (w = 0; w < s->workers && w < DISPATCH_MAX_WORKERS; w++)
+    {
+        watchdog_step(wd, &ev, WATCHDOG_WORKER_STALL, w,
+            w < prev->workers && s->worker_done[w] != prev->worker_done[w],
+            s->worker_queued[w] != s->worker_done[w]);
+    }
+
+    wd->prev = *s;
+
+    return ev.count;
+}
+
+static void watchdog_print_record(const struct debug_record* rec, void* arg)
+{
+    const struct watchdog_trace* t = arg;
+
+    if (rec->type == DEBUG_RECORD_MEM)
+        fprintf(t->out, "%s trace idx=%u mem addr=0x%lx len=%u\n",
+            t->prefix, rec->idx, rec->addr, rec->len);
+    else
+        fprintf(t->out, "%s trace idx=%u %08x %08x %08x %08x\n", t->prefix, rec->idx,
+            rec->words[0], rec->words[1], rec->words[2], rec->words[3]);
+}
+
+static void watchdog_print_counters(FILE* out, const char* prefix, const char* name,
+        const uint64_t* counters)
+{
+    unsigned int k;
+
+    fprintf(out, "%s %s=", prefix, name);
+    for (k = 0; k < WATCHDOG_CONTEXTS; k++)
+        fprintf(out, "%s%lu", k > 0 ? "," : "", counters[k]);
+    fprintf(out, "\n");
+}
+
+void watchdog_report(FILE* out, const char* prefix, const struct watchdog_event* events,
+        unsigned int count, const struct watchdog_sample* s, struct debug_ring* trace)
+{
+    const struct device_meta_t* meta = &s->meta;
+    struct watchdog_trace t = { out, prefix };
+    uint32_t idx[4];
+    unsigned int i, c, w;
+    int raised = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        fprintf(out, "%s event=%s", prefix, watchdog_event_name(events[i].type));
+        if (watchdog_subjects[events[i].type] != NULL)
+            fprintf(out, " %s=%u", watchdog_subjects[events[i].type], events[i].subject);
+        fprintf(out, " periods=%u state=%s\n", events[i].periods,
+            events[i].raised ? "raised" : "cleared");
+        raised |= events[i].raised;
+    }
+
+    if (!raised)
+    {
+        fflush(out);
+        return;
+    }
+
+    fprintf(out, "%s meta generation=%lu buffer_size=%u packet_size=%u payload_size=%u "
+                 "ring_flags=0x%x classes=%u rx_busy=%u rx_full_budget_us=%u\n",
+        prefix, meta->start_signal, meta->buffer_size, meta->packet_size,
+        meta->payload_size, meta->ring_flags, meta->num_classes, meta->rx_busy,
+        meta->rx_full_budget_us);
+
+    for (c = 0; c < watchdog_classes(meta); c++)
+    {
+        watchdog_ring(meta, c, idx);
+        fprintf(out, "%s ring class=%u rx_head=%u rx_tail=%u tx_head=%u tx_tail=%u\n",
+            prefix, c, idx[RX_HEAD], idx[RX_TAIL], idx[TX_HEAD], idx[TX_TAIL]);
+    }
+
+    if (s->have_counters)
+    {
+        watchdog_print_counters(out, prefix, "fw_rx", s->fw_rx);
+        watchdog_print_counters(out, prefix, "fw_tx", s->fw_tx);
+    }
+
+    fprintf(out, "%s host polling=%d polls=%lu workers=%u\n",
+        prefix, s->polling, s->polls, s->workers);
+    for (w = 0; w < s->workers && w < DISPATCH_MAX_WORKERS; w++)
+        fprintf(out, "%s worker=%u queued=%u done=%u\n",
+            prefix, w, s->worker_queued[w], s->worker_done[w]);
+
+    if (trace == NULL)
+        fprintf(out, "%s trace unavailable\n", prefix);
+    else if (debug_ring_recent(trace, WATCHDOG_TRACE_RECORDS, watchdog_print_record, &t) == 0)
+        fprintf(out, "%s trace empty\n", prefix);
+
+    fflush(out);
+}
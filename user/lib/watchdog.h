@@ -0,0 +1,125 @@
+#ifndef _WATCHDOG_H_
+#define _WATCHDOG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "devcfg.h"
+#include "dispatch.h"
+#include "debug_ring.h"
+
+/**
+ * @file
+ * Stall and liveness watchdog for one NIC: compares samples of the ring
+ * doorbells, the firmware's per-context counters and the host threads'
+ * progress, taken every period, and raises an event for whatever has
+ * not moved for stall_periods samples in a row while it had work:
+ *
+ *   rx_head_stuck   frames wait in an RX ring, the host takes none
+ *   tx_head_stuck   frames wait in a TX ring, the firmware sends none
+ *   rx_tail_stuck   firmware contexts hold frames (rx_busy) for rings
+ *                   with room, none land: one waits on another that
+ *                   died, as in the in-order tail update of multi_rx.c
+ *   rx_ctx_idle     a firmware context that counted frames stopped
+ *   tx_ctx_idle     while the others went on (PKT_STATS firmware)
+ *   poller_stall    the poller has read no doorbell
+ *   worker_stall    a worker has jobs queued and finishes none
+ *
+ * Each event is raised once, and cleared once its subject moves again.
+ * Nothing is checked while the rings are paused or restarting, and a
+ * new generation starts every check over.
+ *
+ * The caller takes the samples; a sample is one read of device_meta_t
+ * and of the counters, which is cheap enough to leave on at a period
+ * of a second or so. The trace ring is only read for a report.
+ */
+
+#define WATCHDOG_CONTEXTS       8           /* Per-context firmware counters */
+#define WATCHDOG_SUBJECTS       DISPATCH_MAX_WORKERS
+#define WATCHDOG_TRACE_RECORDS  16          /* Trace records in a report */
+
+/* Packets the other contexts count per period for one to be idle */
+#define WATCHDOG_IDLE_PACKETS   256
+
+#define WATCHDOG_DEFAULT_PERIOD_MS  1000
+#define WATCHDOG_DEFAULT_PERIODS    3
+
+enum watchdog_event_type
+{
+    WATCHDOG_RX_HEAD_STUCK,                 /*> Subject: class */
+    WATCHDOG_TX_HEAD_STUCK,                 /*> Subject: class */
+    WATCHDOG_RX_TAIL_STUCK,                 /*> Subject: none */
+    WATCHDOG_RX_CTX_IDLE,                   /*> Subject: context */
+    WATCHDOG_TX_CTX_IDLE,                   /*> Subject: context */
+    WATCHDOG_POLLER_STALL,                  /*> Subject: none */
+    WATCHDOG_WORKER_STALL,                  /*> Subject: worker */
+    WATCHDOG_EVENT_TYPES
+};
+
+/* Most events one sample can raise or clear */
+#define WATCHDOG_MAX_EVENTS     (WATCHDOG_EVENT_TYPES * WATCHDOG_SUBJECTS)
+
+struct watchdog_event
+{
+    enum watchdog_event_type type;
+    unsigned int subject;
+    uint32_t periods;                       /*> Samples without progress */
+    int raised;                             /*> 1 raised, 0 cleared */
+};
+
+/* What the caller reads each period; all counters only ever go up */
+struct watchdog_sample
+{
+    struct device_meta_t meta;
+    int have_counters;                      /*> fw_rx/fw_tx valid */
+    uint64_t fw_rx[WATCHDOG_CONTEXTS];
+    uint64_t fw_tx[WATCHDOG_CONTEXTS];
+    int polling;                            /*> Poller meant to be polling */
+    uint64_t polls;                         /*> Poller progress, e.g. doorbell reads */
+    unsigned int workers;
+    uint32_t worker_queued[DISPATCH_MAX_WORKERS];   /*> Jobs given */
+    uint32_t worker_done[DISPATCH_MAX_WORKERS];     /*> Jobs finished */
+};
+
+struct watchdog_check
+{
+    uint32_t periods;                       /*> Samples with work and no progress */
+    int raised;
+};
+
+struct watchdog
+{
+    uint32_t stall_periods;
+    struct watchdog_sample prev;
+    int have_prev;
+    uint8_t ctx_active[2][WATCHDOG_CONTEXTS];   /*> RX/TX context has counted */
+    struct watchdog_check checks[WATCHDOG_EVENT_TYPES][WATCHDOG_SUBJECTS];
+    uint64_t raised;                        /*> Events raised so far */
+    uint32_t active;                        /*> Events raised, not cleared */
+};
+
+void watchdog_init(struct watchdog* wd, uint32_t stall_periods);
+
+/**
+ * Compare a sample with the previous one.
+ *
+ * @param events
+ *   Filled with the events raised or cleared by this sample.
+ * @return
+ *   Number of events, at most max.
+ */
+unsigned int watchdog_check(struct watchdog* wd, const struct watchdog_sample* s,
+        struct watchdog_event* events, unsigned int max);
+
+/* Name of an event type in reports, e.g. "rx_head_stuck" */
+const char* watchdog_event_name(enum watchdog_event_type type);
+
+/**
+ * Report events, one line each prefixed with prefix, then, if any was
+ * raised, the sample they were raised on and the latest records of
+ * trace (NULL if there is no trace ring).
+ */
+void watchdog_report(FILE* out, const char* prefix, const struct watchdog_event* events,
+        unsigned int count, const struct watchdog_sample* s, struct debug_ring* trace);
+
+#endif /* _WATCHDOG_H_ */
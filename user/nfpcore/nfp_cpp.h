@@ -12,6 +12,7 @@
 #include "nfp-common/nfp_resid.h"
 
 struct nfp_cpp_mutex;
+struct nfp_cpp_trace;
 
 /*
  * NFP CPP handle
@@ -35,6 +36,9 @@ struct nfp_cpp {
 	uint32_t imb_cat_table[16];
 
 	int driver_lock_needed;
+
+	/* Access trace, NULL unless NFP_CPP_TRACE is set */
+	struct nfp_cpp_trace *trace;
 };
 
 /*
@@ -43,6 +47,7 @@ struct nfp_cpp {
 struct nfp_cpp_area {
 	struct nfp_cpp *cpp;
 	char *name;
+	uint32_t cpp_id;
 	unsigned long long offset;
 	unsigned long size;
 	/* Here follows the 'priv' part of nfp_cpp_area. */
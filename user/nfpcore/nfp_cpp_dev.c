@@ -21,6 +21,7 @@
 #include "nfp_nsp.h"
 #include "nfp_nffw.h"
 #include "nfp_cpp_dev.h"
+#include "nfp_cpp_trace.h"
 
 static int nfp_cpp_dev_handle_cmd(struct nfp_cpp_dev_data* data, int fd)
 {
@@ -34,6 +35,9 @@ static int nfp_cpp_dev_handle_cmd(struct nfp_cpp_dev_data* data, int fd)
     if (ret < 0)
         return ret;
 
+    /* Attribute the CPP accesses below to this connection */
+    nfp_cpp_trace_set_client(fd);
+
     switch(tmp)
     {
     case OP_PREAD:
@@ -47,6 +51,10 @@ static int nfp_cpp_dev_handle_cmd(struct nfp_cpp_dev_data* data, int fd)
             return ret;
         offset = (off_t) tmp;
 
+        if (data->cpp->trace)
+            nfp_cpp_trace_record(data->cpp->trace, NFP_CPP_TRACE_DEV_PREAD,
+                (offset >> 40) << 8, offset, count, NULL);
+
         return nfp_cpp_dev_read(data, fd, count, offset);
     case OP_PWRITE:
         ret = read(fd, &tmp, sizeof(tmp));
@@ -59,6 +67,10 @@ static int nfp_cpp_dev_handle_cmd(struct nfp_cpp_dev_data* data, int fd)
             return ret;
         offset = (off_t) tmp;
 
+        if (data->cpp->trace)
+            nfp_cpp_trace_record(data->cpp->trace, NFP_CPP_TRACE_DEV_PWRITE,
+                (offset >> 40) << 8, offset, count, NULL);
+
         return nfp_cpp_dev_write(data, fd, count, offset);
     case OP_IOCTL:
         ret = read(fd, &tmp, sizeof(tmp));
@@ -66,6 +78,10 @@ static int nfp_cpp_dev_handle_cmd(struct nfp_cpp_dev_data* data, int fd)
             return ret;
         request = (unsigned long) tmp;
 
+        if (data->cpp->trace)
+            nfp_cpp_trace_record(data->cpp->trace, NFP_CPP_TRACE_DEV_IOCTL,
+                request, 0, 0, NULL);
+
         return nfp_cpp_dev_ioctl(data, fd, request);
     default:
         return -1;
@@ -283,10 +299,12 @@ static int nfp_enable_bars(struct nfp_cpp_dev_data *data)
     return 0;
 }
 
-int nfp_cpp_dev_main(struct rte_pci_device* dev, struct nfp_cpp* cpp)
+int nfp_cpp_dev_main(struct rte_pci_device* dev, struct nfp_cpp* cpp,
+        int index)
 {
     int ret;
     struct sockaddr address;
+    char path[sizeof(address.sa_data)];
     struct nfp_cpp_dev_data* data =
             malloc(sizeof(struct nfp_cpp_dev_data));
     if (!data)
@@ -295,13 +313,25 @@ int nfp_cpp_dev_main(struct rte_pci_device* dev, struct nfp_cpp* cpp)
         return -1;
     }
 
-    unlink("/tmp/nfp_cpp");
+    if (index < 0 || index >= NFP_CPP_DEV_MAX)
+    {
+        fprintf(stderr, "%s(): No socket for NIC %d\n", __func__, index);
+        free(data);
+        return -1;
+    }
+
+    if (index == 0)
+        snprintf(path, sizeof(path), "%s", NFP_CPP_DEV_SOCKET);
+    else
+        snprintf(path, sizeof(path), "%s%d", NFP_CPP_DEV_SOCKET, index);
+
+    unlink(path);
     data->cpp = cpp;
     memset(data->connections, 0, sizeof(data->connections));
     data->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
 	memset(&address, 0, sizeof(struct sockaddr));
 	address.sa_family = AF_UNIX;
-	strcpy(address.sa_data, "/tmp/nfp_cpp");
+	memcpy(address.sa_data, path, sizeof(path));
 	ret = bind(data->listen_fd, (const struct sockaddr *)&address,
 		   sizeof(struct sockaddr));
     if (ret < 0)
@@ -11,6 +11,13 @@
 #define LISTEN_BACKLOG 8
 #define MAX_CONNECTIONS 64
 
+/*
+ * Socket of the CPP device server for NIC 0; NIC n > 0 listens on the
+ * same path with n appended. Must fit struct sockaddr's sa_data.
+ */
+#define NFP_CPP_DEV_SOCKET      "/tmp/nfp_cpp"
+#define NFP_CPP_DEV_MAX         10
+
 #define NFP_CPP_MEMIO_BOUNDARY		(1 << 20)
 #define PCI_64BIT_BAR_COUNT             3
 #define NFP_PCI_BAR_MAX    (PCI_64BIT_BAR_COUNT * 8)
@@ -0,0 +1,54 @@
+#ifndef _NFP_CPP_EMU_H_
+#define _NFP_CPP_EMU_H_
+
+#include <stdint.h>
+
+#include "nfp_cpp.h"
+
+/**
+ * @file
+ * In-memory NFP device, usable in place of the PCIe transport.
+ *
+ * Setting NFP_CPP_EMU=1 makes nfp_cpp_from_device_name() back every CPP
+ * target with host memory instead of PCIe BARs. The emulated device
+ * carries the structures the host side walks at probe time: resource
+ * table, NSP (enough for ETH_RESCAN), hwinfo, nffw info, MIP and a
+ * runtime symbol table. Symbols are registered with
+ * nfp_cpp_emu_symbol_add(), which returns their backing memory so a
+ * host thread can play the firmware's part.
+ *
+ * Area iomem pointers point straight into the backing memory, so
+ * nfp_rtsym_map() and nn_readl()/nn_writel() work unchanged.
+ */
+
+#define NFP_CPP_EMU_ENV         "NFP_CPP_EMU"
+
+/**
+ * @return
+ *   Non-zero if NFP_CPP_EMU is set to a non-empty value other than "0".
+ */
+int nfp_cpp_emu_enabled(void);
+
+/**
+ * CPP transport backed by the emulated device.
+ */
+const struct nfp_cpp_operations* nfp_cpp_emu_operations(void);
+
+/**
+ * Add a runtime symbol to the emulated firmware.
+ *
+ * @param name
+ *   Symbol name as the host looks it up, e.g. "i32._cfg".
+ * @param target
+ *   CPP target (NFP_CPP_TARGET_CLS, NFP_CPP_TARGET_MU, ...).
+ * @param domain
+ *   Island the symbol lives in.
+ * @param size
+ *   Size in bytes.
+ * @return
+ *   Zeroed backing memory of the symbol, or NULL on failure.
+ */
+void* nfp_cpp_emu_symbol_add(const char* name, int target, int domain,
+        uint64_t size);
+
+#endif /* _NFP_CPP_EMU_H_ */
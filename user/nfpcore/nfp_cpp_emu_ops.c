@@ -0,0 +1,559 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "nfp_cpp.h"
+#include "nfp_cpp_emu.h"
+#include "nfp_target.h"
+#include "nfp_crc.h"
+#include "nfp_nsp.h"
+#include "nfp_nffw.h"
+#include "nfp_hwinfo.h"
+#include "nfp_resource.h"
+#include "nfp_rtsym.h"
+#include "nfp6000/nfp6000.h"
+
+#define EMU_PAGE_SIZE           4096
+#define EMU_MAX_SYMBOLS         64
+#define EMU_STRTAB_SIZE         (EMU_MAX_SYMBOLS * 64)
+
+/* Chip ID 0x4000: takes the NFP6000-family paths in nfpcore */
+#define EMU_MODEL               0x40010010
+#define EMU_INTERFACE           NFP_CPP_INTERFACE(NFP_CPP_INTERFACE_TYPE_PCI, 0, 0xff)
+
+/* IMB address translation: island ID in address bits, 40-bit mode */
+#define EMU_IMB_DEFAULT         0x1000
+#define EMU_IMB_XPB             0x2000
+#define EMU_IMB_XPB_BASE        0x000a0000
+
+/* Device layout. Resource-described blocks live on MU island 0. */
+#define EMU_RES_TBL_BASE        0x8100000000ULL     /*> nfp_resource.c */
+#define EMU_RES_TBL_SIZE        4096
+#define EMU_NSP_BASE            0x8100010000ULL
+#define EMU_NSP_SIZE            256
+#define EMU_HWINFO_BASE         0x8100020000ULL
+#define EMU_HWINFO_SIZE         4096
+#define EMU_NFFW_BASE           0x8100030000ULL
+#define EMU_MIP_BASE            0x8100040000ULL
+#define EMU_NSP_BUF_BASE        0x0100000000ULL     /*> Fits NSP_BUFFER_ADDRESS */
+#define EMU_NSP_BUF_MB          1
+
+/* Symbol tables are read through EMEM0; addresses are 32-bit in the MIP */
+#define EMU_SYMTAB_ADDR         0x00100000
+#define EMU_STRTAB_ADDR         0x00200000
+#define EMU_SYMBOL_BASE         0x00400000ULL
+
+#define EMU_NSP_MINOR           24
+#define EMU_ETH_ENTRY_SIZE      32
+
+/* NSP ETH table fields, see nfp_nsp_eth.c */
+#define EMU_ETH_PORT_LANES      GENMASK_ULL(3, 0)
+#define EMU_ETH_STATE_ENABLED   (BIT_ULL(0) | BIT_ULL(1) | BIT_ULL(2) | BIT_ULL(3))
+#define EMU_ETH_STATE_RATE      GENMASK_ULL(11, 8)
+#define EMU_ETH_RATE_10G        4
+
+/* Layout of struct nfp_resource_entry, private to nfp_resource.c */
+struct emu_resource_entry
+{
+    uint32_t owner;
+    uint32_t key;
+    uint8_t name[8];
+    uint8_t reserved[5];
+    uint8_t cpp_action;
+    uint8_t cpp_token;
+    uint8_t cpp_target;
+    uint32_t page_offset;
+    uint32_t page_size;
+};
+
+/* Layout of struct nfp_mip, private to nfp_mip.c */
+struct emu_mip
+{
+    uint32_t signature;
+    uint32_t mip_version;
+    uint32_t mip_size;
+    uint32_t first_entry;
+    uint32_t version;
+    uint32_t buildnum;
+    uint32_t buildtime;
+    uint32_t loadtime;
+    uint32_t symtab_addr;
+    uint32_t symtab_size;
+    uint32_t strtab_addr;
+    uint32_t strtab_size;
+    char name[16];
+    char toolchain[32];
+};
+
+/* Layout of struct nfp_rtsym_entry, private to nfp_rtsym.c */
+struct emu_rtsym_entry
+{
+    uint8_t type;
+    uint8_t target;
+    uint8_t island;
+    uint8_t addr_hi;
+    uint32_t addr_lo;
+    uint16_t name;
+    uint8_t menum;
+    uint8_t size_hi;
+    uint32_t size_lo;
+};
+
+struct emu_region
+{
+    struct emu_region* next;
+    uint32_t target;
+    uint64_t base;
+    uint64_t size;
+    uint8_t* mem;
+};
+
+struct emu_device
+{
+    pthread_mutex_t lock;
+    struct emu_region* regions;
+    uint32_t imb_table[16];
+
+    uint8_t* nsp;
+    struct emu_mip* mip;
+    struct emu_rtsym_entry* symtab;
+    char* strtab;
+    uint32_t strtab_used;
+    int nb_symbols;
+    uint64_t symbol_next;
+};
+
+struct emu_area_priv
+{
+    struct emu_region* region;
+    uint8_t* mem;
+    uint32_t target;
+    uint32_t action;
+};
+
+static struct emu_device emu = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+static pthread_once_t emu_once = PTHREAD_ONCE_INIT;
+static int emu_ready;
+
+int nfp_cpp_emu_enabled(void)
+{
+    const char* env = getenv(NFP_CPP_EMU_ENV);
+
+    return env != NULL && env[0] != '\0' && strcmp(env, "0") != 0;
+}
+
+/**
+ * Find the region holding [addr, addr + size) of target, creating a
+ * page-aligned one if nothing there is backed yet. Ranges that straddle
+ * an existing region are refused: iomem pointers into it may be live.
+ * Caller holds emu.lock.
+ */
+static struct emu_region* emu_region_get(uint32_t target, uint64_t addr,
+        uint64_t size)
+{
+    struct emu_region* r;
+    uint64_t base, end;
+    void* mem;
+
+    for (r = emu.regions; r != NULL; r = r->next)
+    {
+        if (r->target != target)
+            continue;
+        if (addr >= r->base && addr + size <= r->base + r->size)
+            return r;
+        if (addr < r->base + r->size && addr + size > r->base)
+        {
+            fprintf(stderr, "%s(): [%u:0x%lx +%lu] straddles [0x%lx +%lu]\n",
+                __func__, target, addr, size, r->base, r->size);
+            return NULL;
+        }
+    }
+
+    base = addr & ~((uint64_t) EMU_PAGE_SIZE - 1);
+    end = (addr + size + EMU_PAGE_SIZE - 1) & ~((uint64_t) EMU_PAGE_SIZE - 1);
+
+    /* Trim the new region so it does not run into a neighbour */
+    for (r = emu.regions; r != NULL; r = r->next)
+    {
+        if (r->target != target)
+            continue;
+        if (r->base + r->size > base && r->base + r->size <= addr)
+            base = r->base + r->size;
+        if (r->base < end && r->base >= addr + size)
+            end = r->base;
+    }
+
+    mem = mmap(NULL, end - base, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return NULL;
+
+    r = malloc(sizeof(*r));
+    if (r == NULL)
+    {
+        munmap(mem, end - base);
+        return NULL;
+    }
+
+    r->target = target;
+    r->base = base;
+    r->size = end - base;
+    r->mem = mem;
+    r->next = emu.regions;
+    emu.regions = r;
+
+    return r;
+}
+
+static void* emu_map(uint32_t target, uint64_t addr, uint64_t size)
+{
+    struct emu_region* r = emu_region_get(target, addr, size);
+
+    return r ? r->mem + (addr - r->base) : NULL;
+}
+
+/**
+ * Translate an island-relative CPP ID and address the way nfp_cppcore.c
+ * does with the IMB table, so lookups land on the same region.
+ */
+static void* emu_map_island(int target, int island, uint64_t addr,
+        uint64_t size)
+{
+    uint32_t cpp_id;
+    uint64_t taddr;
+
+    if (nfp_target_cpp(NFP_CPP_ISLAND_ID(target, NFP_CPP_ACTION_RW, 0, island),
+            addr, &cpp_id, &taddr, emu.imb_table) < 0)
+        return NULL;
+
+    return emu_map(NFP_CPP_ID_TARGET_of(cpp_id), taddr, size);
+}
+
+static void emu_resource_add(struct emu_resource_entry* entry,
+        const char* name, uint64_t addr, uint64_t size)
+{
+    char name_pad[8] = { 0 };
+
+    memcpy(name_pad, name, strnlen(name, sizeof(name_pad)));
+
+    entry->owner = 0;
+    entry->key = nfp_crc32_posix(name_pad, sizeof(name_pad));
+    memcpy(entry->name, name_pad, sizeof(name_pad));
+    entry->cpp_action = NFP_CPP_ACTION_RW;
+    entry->cpp_token = 0;
+    entry->cpp_target = NFP_CPP_TARGET_MU;
+    entry->page_offset = addr >> 8;
+    entry->page_size = (size + 255) >> 8;
+}
+
+static void emu_hwinfo_init(struct nfp_hwinfo* db)
+{
+    static const char* const kv[] = {
+        "assembly.vendor",      "Netronome",
+        "assembly.partno",      "EMULATED",
+        "assembly.model",       "emulated",
+        "assembly.serial",      "00000000",
+        "board.state",          "15",
+    };
+    char* p = db->data;
+    uint32_t crc;
+    size_t i;
+
+    for (i = 0; i < sizeof(kv) / sizeof(kv[0]); i++)
+    {
+        strcpy(p, kv[i]);
+        p += strlen(kv[i]) + 1;
+    }
+    *p++ = '\0';    /* Empty key ends the table */
+
+    db->version = NFP_HWINFO_VERSION_2;
+    db->size = (p - (char*) db) + sizeof(crc);
+    db->limit = EMU_HWINFO_SIZE;
+    db->resv = 0;
+
+    crc = nfp_crc32_posix(db, db->size - sizeof(crc));
+    memcpy(p, &crc, sizeof(crc));
+}
+
+static void emu_setup(void)
+{
+    struct emu_resource_entry* res;
+    struct nfp_nffw_info_data* nffw;
+    uint32_t* imb;
+    uint64_t* nsp;
+    int i;
+
+    pthread_mutex_lock(&emu.lock);
+
+    for (i = 0; i < 16; i++)
+        emu.imb_table[i] = EMU_IMB_DEFAULT;
+    emu.imb_table[NFP6000_CPPTGT_CTXPB] = EMU_IMB_XPB;
+
+    /* Island 0 XPB view of the IMB table, read by nfp_cpp_alloc() */
+    imb = emu_map(NFP6000_CPPTGT_CTXPB, EMU_IMB_XPB_BASE, sizeof(emu.imb_table));
+    res = emu_map(NFP_CPP_TARGET_MU, EMU_RES_TBL_BASE, EMU_RES_TBL_SIZE);
+    emu.nsp = emu_map(NFP_CPP_TARGET_MU, EMU_NSP_BASE, EMU_NSP_SIZE);
+    nffw = emu_map(NFP_CPP_TARGET_MU, EMU_NFFW_BASE, sizeof(*nffw));
+    emu.mip = emu_map(NFP_CPP_TARGET_MU, EMU_MIP_BASE, sizeof(*emu.mip));
+    if (!imb || !res || !emu.nsp || !nffw || !emu.mip ||
+            !emu_map(NFP_CPP_TARGET_MU, EMU_NSP_BUF_BASE, EMU_NSP_BUF_MB << 20) ||
+            !emu_map(NFP_CPP_TARGET_MU, EMU_HWINFO_BASE, EMU_HWINFO_SIZE))
+        goto out;
+
+    emu.symtab = emu_map_island(NFP_CPP_TARGET_MU, NFP_ISL_EMEM0,
+                    EMU_SYMTAB_ADDR, EMU_MAX_SYMBOLS * sizeof(*emu.symtab));
+    emu.strtab = emu_map_island(NFP_CPP_TARGET_MU, NFP_ISL_EMEM0,
+                    EMU_STRTAB_ADDR, EMU_STRTAB_SIZE);
+    if (!emu.symtab || !emu.strtab)
+        goto out;
+
+    memcpy(imb, emu.imb_table, sizeof(emu.imb_table));
+
+    /* Entry 0 is the table's own lock (key 0), left zeroed */
+    emu_resource_add(&res[1], NFP_RESOURCE_NSP, EMU_NSP_BASE, EMU_NSP_SIZE);
+    emu_resource_add(&res[2], NFP_RESOURCE_NFP_HWINFO,
+        EMU_HWINFO_BASE, EMU_HWINFO_SIZE);
+    emu_resource_add(&res[3], NFP_RESOURCE_NFP_NFFW,
+        EMU_NFFW_BASE, sizeof(*nffw));
+
+    nsp = (uint64_t*) emu.nsp;
+    nsp[NSP_STATUS / 8] = FIELD_PREP(NSP_STATUS_MAGIC, NSP_MAGIC) |
+            FIELD_PREP(NSP_STATUS_MAJOR, NSP_MAJOR) |
+            FIELD_PREP(NSP_STATUS_MINOR, EMU_NSP_MINOR);
+    nsp[NSP_DFLT_BUFFER / 8] =
+            FIELD_PREP(NSP_BUFFER_CPP,
+                NFP_CPP_ID(NFP_CPP_TARGET_MU, NFP_CPP_ACTION_RW, 0) >> 8) |
+            FIELD_PREP(NSP_BUFFER_ADDRESS, EMU_NSP_BUF_BASE);
+    nsp[NSP_DFLT_BUFFER_CONFIG / 8] =
+            FIELD_PREP(NSP_DFLT_BUFFER_SIZE_MB, EMU_NSP_BUF_MB);
+
+    emu_hwinfo_init(emu_map(NFP_CPP_TARGET_MU, EMU_HWINFO_BASE,
+                        EMU_HWINFO_SIZE));
+
+    /* Version 2, initialised; one loaded firmware with its MIP on MU */
+    nffw->flags[0] = (2 << 16) | 1;
+    nffw->info.v2.fwinfo[0].loaded__mu_da__mip_off_hi =
+            (1u << 31) | ((EMU_MIP_BASE >> 32) & 0xff);
+    nffw->info.v2.fwinfo[0].mip_cppid =
+            NFP_CPP_ID(NFP_CPP_TARGET_MU, NFP_CPP_ACTION_RW, 0);
+    nffw->info.v2.fwinfo[0].mip_offset_lo = EMU_MIP_BASE & 0xffffffff;
+
+    emu.mip->signature = 0x0050494d;   /* "MIP\0" */
+    emu.mip->mip_version = 1;
+    emu.mip->mip_size = sizeof(*emu.mip);
+    emu.mip->symtab_addr = EMU_SYMTAB_ADDR;
+    emu.mip->strtab_addr = EMU_STRTAB_ADDR;
+    strncpy(emu.mip->name, "emulated", sizeof(emu.mip->name) - 1);
+
+    /* Offset 0 of the string table is the empty name */
+    emu.strtab_used = 1;
+    emu.symbol_next = EMU_SYMBOL_BASE;
+    emu_ready = 1;
+
+out:
+    if (!emu_ready)
+        fprintf(stderr, "%s(): Cannot lay out emulated device\n", __func__);
+    pthread_mutex_unlock(&emu.lock);
+}
+
+void* nfp_cpp_emu_symbol_add(const char* name, int target, int domain,
+        uint64_t size)
+{
+    struct emu_rtsym_entry* sym;
+    size_t name_len = strlen(name) + 1;
+    uint64_t addr;
+    void* mem = NULL;
+
+    pthread_once(&emu_once, emu_setup);
+    if (!emu_ready)
+        return NULL;
+
+    pthread_mutex_lock(&emu.lock);
+
+    if (emu.nb_symbols == EMU_MAX_SYMBOLS ||
+            emu.strtab_used + name_len > EMU_STRTAB_SIZE)
+    {
+        fprintf(stderr, "%s(): Symbol table full\n", __func__);
+        goto out;
+    }
+
+    addr = emu.symbol_next;
+    mem = emu_map_island(target, domain, addr, size);
+    if (mem == NULL)
+        goto out;
+    emu.symbol_next += (size + EMU_PAGE_SIZE - 1) & ~((uint64_t) EMU_PAGE_SIZE - 1);
+
+    sym = &emu.symtab[emu.nb_symbols++];
+    sym->type = NFP_RTSYM_TYPE_OBJECT;
+    sym->target = target;
+    sym->island = domain;
+    sym->menum = 0xff;
+    sym->addr_hi = addr >> 32;
+    sym->addr_lo = addr & 0xffffffff;
+    sym->name = emu.strtab_used;
+    sym->size_hi = size >> 32;
+    sym->size_lo = size & 0xffffffff;
+
+    memcpy(emu.strtab + emu.strtab_used, name, name_len);
+    emu.strtab_used += name_len;
+
+    emu.mip->symtab_size = emu.nb_symbols * sizeof(*sym);
+    emu.mip->strtab_size = emu.strtab_used;
+
+out:
+    pthread_mutex_unlock(&emu.lock);
+    return mem;
+}
+
+/**
+ * Run the command the host just started, synchronously: by the time the
+ * write that set NSP_COMMAND_START returns, the NSP is idle again.
+ */
+static void emu_nsp_command(void)
+{
+    uint64_t* regs = (uint64_t*) emu.nsp;
+    uint64_t command = regs[NSP_COMMAND / 8];
+    uint64_t buffer = regs[NSP_BUFFER / 8];
+    uint32_t option = FIELD_GET(NSP_COMMAND_OPTION, command);
+    uint64_t result = 0, ret = 0;
+    uint8_t* buf;
+
+    if (!(command & NSP_COMMAND_START))
+        return;
+
+    switch (FIELD_GET(NSP_COMMAND_CODE, command))
+    {
+    case SPCODE_NOOP:
+        break;
+
+    case SPCODE_ETH_RESCAN:
+        pthread_mutex_lock(&emu.lock);
+        buf = emu_map(FIELD_GET(NSP_BUFFER_CPP, buffer) >> 16,
+                    FIELD_GET(NSP_BUFFER_ADDRESS, buffer), option);
+        pthread_mutex_unlock(&emu.lock);
+        if (buf == NULL || option < EMU_ETH_ENTRY_SIZE)
+        {
+            result = EINVAL;
+            break;
+        }
+
+        /* One 10G port, lanes = 1, index 0 */
+        memset(buf, 0, option);
+        ((uint64_t*) buf)[0] = FIELD_PREP(EMU_ETH_PORT_LANES, 1);
+        ((uint64_t*) buf)[1] = EMU_ETH_STATE_ENABLED |
+                FIELD_PREP(EMU_ETH_STATE_RATE, EMU_ETH_RATE_10G);
+        ret = 1;
+        break;
+
+    default:
+        result = EOPNOTSUPP;
+        break;
+    }
+
+    regs[NSP_COMMAND / 8] = FIELD_PREP(NSP_COMMAND_OPTION, ret) |
+            (command & NSP_COMMAND_CODE);
+    regs[NSP_STATUS / 8] = (regs[NSP_STATUS / 8] &
+            ~(NSP_STATUS_RESULT | NSP_STATUS_BUSY | NSP_STATUS_CODE)) |
+            FIELD_PREP(NSP_STATUS_RESULT, result);
+}
+
+static int nfp_emu_init(struct nfp_cpp* cpp, struct rte_pci_device* dev)
+{
+    static const uint8_t serial[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+    (void) dev;
+
+    pthread_once(&emu_once, emu_setup);
+    if (!emu_ready)
+        return -1;
+
+    nfp_cpp_model_set(cpp, EMU_MODEL);
+    nfp_cpp_interface_set(cpp, EMU_INTERFACE);
+    if (nfp_cpp_serial_set(cpp, serial, sizeof(serial)) < 0)
+        return -1;
+    nfp_cpp_priv_set(cpp, &emu);
+
+    return 0;
+}
+
+static int nfp_emu_area_init(struct nfp_cpp_area* area, uint32_t dest,
+        unsigned long long address, unsigned long size)
+{
+    struct emu_area_priv* priv = nfp_cpp_area_priv(area);
+
+    priv->target = NFP_CPP_ID_TARGET_of(dest);
+    priv->action = NFP_CPP_ID_ACTION_of(dest);
+
+    pthread_mutex_lock(&emu.lock);
+    priv->region = emu_region_get(priv->target, address, size);
+    pthread_mutex_unlock(&emu.lock);
+
+    if (priv->region == NULL)
+        return -EINVAL;
+
+    priv->mem = priv->region->mem + (address - priv->region->base);
+    return 0;
+}
+
+static void* nfp_emu_area_iomem(struct nfp_cpp_area* area)
+{
+    struct emu_area_priv* priv = nfp_cpp_area_priv(area);
+
+    return priv->mem;
+}
+
+static int nfp_emu_area_read(struct nfp_cpp_area* area, void* kernel_vaddr,
+        unsigned long offset, unsigned int length)
+{
+    struct emu_area_priv* priv = nfp_cpp_area_priv(area);
+
+    /* MU test_set_imm (nfp_mutex.c): return old value, set the low nibble */
+    if (priv->target == NFP_CPP_TARGET_MU && priv->action == 5 &&
+            length == sizeof(uint32_t))
+    {
+        uint32_t old = __atomic_fetch_or((uint32_t*) (priv->mem + offset),
+                        0xf, __ATOMIC_SEQ_CST);
+
+        memcpy(kernel_vaddr, &old, sizeof(old));
+        return length;
+    }
+
+    memcpy(kernel_vaddr, priv->mem + offset, length);
+    return length;
+}
+
+static int nfp_emu_area_write(struct nfp_cpp_area* area,
+        const void* kernel_vaddr, unsigned long offset, unsigned int length)
+{
+    struct emu_area_priv* priv = nfp_cpp_area_priv(area);
+    uint8_t* dst = priv->mem + offset;
+
+    memcpy(dst, kernel_vaddr, length);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (dst <= emu.nsp + NSP_COMMAND && dst + length > emu.nsp + NSP_COMMAND)
+        emu_nsp_command();
+
+    return length;
+}
+
+static const struct nfp_cpp_operations nfp_emu_ops = {
+    .init = nfp_emu_init,
+
+    .area_priv_size = sizeof(struct emu_area_priv),
+    .area_init = nfp_emu_area_init,
+    .area_mapped = nfp_emu_area_iomem,
+    .area_read = nfp_emu_area_read,
+    .area_write = nfp_emu_area_write,
+    .area_iomem = nfp_emu_area_iomem,
+};
+
+const struct nfp_cpp_operations* nfp_cpp_emu_operations(void)
+{
+    return &nfp_emu_ops;
+}
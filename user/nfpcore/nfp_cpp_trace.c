@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "nfp_cpp_trace.h"
+
+/* Large stdio buffer: records are small and frequent */
+#define TRACE_BUFFER_SIZE   (1 << 20)
+
+/* Most trace lost when the process is killed */
+#define TRACE_FLUSH_MS      100
+
+static __thread uint16_t trace_client;
+
+/* Traces opened by this process, to name the files apart */
+static unsigned int trace_count;
+
+static uint64_t trace_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Write out what stdio holds. Called with the lock held.
+ */
+static void trace_flush(struct nfp_cpp_trace* trace)
+{
+    if (trace->pending == 0)
+        return;
+
+    fflush(trace->file);
+    trace->pending = 0;
+}
+
+/**
+ * Flush the trace every TRACE_FLUSH_MS, so a process ended by a signal
+ * leaves the records it had up to shortly before.
+ */
+static void* trace_flusher(void* arg)
+{
+    struct nfp_cpp_trace* trace = arg;
+    struct timespec ts = {
+        .tv_sec = 0,
+        .tv_nsec = TRACE_FLUSH_MS * 1000000L,
+    };
+
+    while (!__atomic_load_n(&trace->stop, __ATOMIC_ACQUIRE))
+    {
+        nanosleep(&ts, NULL);
+
+        pthread_mutex_lock(&trace->lock);
+        trace_flush(trace);
+        pthread_mutex_unlock(&trace->lock);
+    }
+
+    return NULL;
+}
+
+struct nfp_cpp_trace* nfp_cpp_trace_open_env(const char* dev_name)
+{
+    struct nfp_cpp_trace* trace;
+    struct nfp_cpp_trace_hdr hdr;
+    const char* env;
+    char path[4096];
+    unsigned int index;
+    int err;
+
+    env = getenv(NFP_CPP_TRACE_ENV);
+    if (env == NULL || env[0] == '\0')
+        return NULL;
+
+    /* Each handle gets its own file: NICs probed in parallel would
+     * otherwise truncate and interleave one another's trace */
+    index = __atomic_fetch_add(&trace_count, 1, __ATOMIC_RELAXED);
+    if (index > 0)
+        snprintf(path, sizeof(path), "%s.%u", env, index);
+    else
+        snprintf(path, sizeof(path), "%s", env);
+
+    trace = calloc(1, sizeof(*trace));
+    if (trace == NULL)
+        return NULL;
+
+    trace->file = fopen(path, "wb");
+    if (trace->file == NULL)
+    {
+        fprintf(stderr, "%s(): Cannot create %s: %s\n",
+            __func__, path, strerror(errno));
+        free(trace);
+        return NULL;
+    }
+    setvbuf(trace->file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+    pthread_mutex_init(&trace->lock, NULL);
+
+    trace->start_ns = trace_now_ns();
+
+    hdr.magic = NFP_CPP_TRACE_MAGIC;
+    hdr.version = NFP_CPP_TRACE_VERSION;
+    hdr.start_ns = trace->start_ns;
+    fwrite(&hdr, sizeof(hdr), 1, trace->file);
+    trace->pending = sizeof(hdr);
+
+    err = pthread_create(&trace->flusher, NULL, trace_flusher, trace);
+    if (err != 0)
+    {
+        fprintf(stderr, "%s(): Cannot start trace flusher: %s\n",
+            __func__, strerror(err));
+        fclose(trace->file);
+        pthread_mutex_destroy(&trace->lock);
+        free(trace);
+        return NULL;
+    }
+
+    if (dev_name != NULL)
+        fprintf(stderr, "Recording CPP trace of %s to %s\n", dev_name, path);
+    else
+        fprintf(stderr, "Recording CPP trace to %s\n", path);
+
+    return trace;
+}
+
+void nfp_cpp_trace_close(struct nfp_cpp_trace* trace)
+{
+    if (trace == NULL)
+        return;
+
+    __atomic_store_n(&trace->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(trace->flusher, NULL);
+
+    pthread_mutex_lock(&trace->lock);
+    fclose(trace->file);
+    trace->file = NULL;
+    pthread_mutex_unlock(&trace->lock);
+
+    pthread_mutex_destroy(&trace->lock);
+    free(trace);
+}
+
+void nfp_cpp_trace_record(struct nfp_cpp_trace* trace, uint8_t op,
+        uint32_t cpp_id, uint64_t addr, uint32_t len, const void* data)
+{
+    struct nfp_cpp_trace_rec rec;
+    size_t size;
+
+    rec.ts_ns = trace_now_ns() - trace->start_ns;
+    rec.addr = addr;
+    rec.cpp_id = cpp_id;
+    rec.len = len;
+    rec.op = op;
+    rec.client = trace_client;
+    rec.reserved = 0;
+
+    size = sizeof(rec);
+    if (data != NULL && len > 0)
+        size += len;
+
+    /* Record and payload must not interleave with other threads */
+    pthread_mutex_lock(&trace->lock);
+    if (trace->file != NULL)
+    {
+        /* Never let stdio write out part of a record: the file on disk
+         * then always ends on a record boundary */
+        if (trace->pending + size > TRACE_BUFFER_SIZE)
+            trace_flush(trace);
+        trace->pending += size;
+
+        fwrite(&rec, sizeof(rec), 1, trace->file);
+        if (data != NULL && len > 0)
+            fwrite(data, 1, len, trace->file);
+    }
+    pthread_mutex_unlock(&trace->lock);
+}
+
+void nfp_cpp_trace_set_client(uint16_t client)
+{
+    trace_client = client;
+}
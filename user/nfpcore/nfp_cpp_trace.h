@@ -0,0 +1,101 @@
+#ifndef _NFP_CPP_TRACE_H_
+#define _NFP_CPP_TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+/**
+ * @file
+ * Binary trace of CPP accesses, for offline replay and benchmarking.
+ *
+ * Recording is enabled by setting NFP_CPP_TRACE=<path> before the CPP
+ * handle is created. The first handle of a process records to <path>,
+ * later ones to <path>.1, <path>.2 and so on, in the order they are
+ * created; the device each file belongs to is logged. Records are
+ * flushed at least every 100 ms and whole, so a process killed by a
+ * signal leaves a replayable trace. Every area acquire/read/write issued through
+ * nfp_cppcore.c is logged, and the CPP device server tags the requests
+ * it handles so replay can attribute time to client operations.
+ *
+ * @note
+ * Accesses done directly through an iomem pointer (nn_readl() and
+ * friends on a mapped rtsym) bypass the CPP core and are not recorded.
+ *
+ * File layout: one struct nfp_cpp_trace_hdr followed by records. Each
+ * record is a struct nfp_cpp_trace_rec followed by @len data bytes for
+ * reads and writes (the data read from or written to the device).
+ */
+
+#define NFP_CPP_TRACE_ENV       "NFP_CPP_TRACE"
+#define NFP_CPP_TRACE_MAGIC     0x5450434e  /* "NCPT" */
+#define NFP_CPP_TRACE_VERSION   1
+
+enum nfp_cpp_trace_op {
+    NFP_CPP_TRACE_ACQUIRE = 1,  /*> Area acquired (BAR reconfigured) */
+    NFP_CPP_TRACE_READ,         /*> Area read, data follows */
+    NFP_CPP_TRACE_WRITE,        /*> Area write, data follows */
+    NFP_CPP_TRACE_DEV_PREAD,    /*> CPP device server: client pread */
+    NFP_CPP_TRACE_DEV_PWRITE,   /*> CPP device server: client pwrite */
+    NFP_CPP_TRACE_DEV_IOCTL,    /*> CPP device server: client ioctl */
+    NFP_CPP_TRACE_OP_MAX
+};
+
+struct nfp_cpp_trace_hdr
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t start_ns;          /*> CLOCK_MONOTONIC at trace start */
+} __attribute__((__packed__));
+
+struct nfp_cpp_trace_rec
+{
+    uint64_t ts_ns;             /*> Time since trace start */
+    uint64_t addr;              /*> CPP address, or device server offset */
+    uint32_t cpp_id;            /*> CPP ID, or ioctl request */
+    uint32_t len;               /*> Access length in bytes */
+    uint16_t op;                /*> enum nfp_cpp_trace_op */
+    uint16_t client;            /*> Device server connection, 0 in-process */
+    uint32_t reserved;
+} __attribute__((__packed__));
+
+struct nfp_cpp_trace
+{
+    FILE* file;
+    uint64_t start_ns;
+    pthread_mutex_t lock;
+    size_t pending;             /*> Bytes written since the last flush */
+    pthread_t flusher;          /*> Periodic flush thread */
+    int stop;                   /*> Tells the flusher to exit */
+};
+
+/**
+ * Open a trace file named by NFP_CPP_TRACE, if set, for the handle of
+ * device @dev_name (NULL if unknown).
+ *
+ * @return
+ *   Trace handle, or NULL if tracing is disabled or the file cannot be
+ *   created.
+ */
+struct nfp_cpp_trace* nfp_cpp_trace_open_env(const char* dev_name);
+
+/**
+ * Flush and close a trace.
+ */
+void nfp_cpp_trace_close(struct nfp_cpp_trace* trace);
+
+/**
+ * Append one record, tagged with the calling thread's current client.
+ * @data may be NULL when @len bytes of payload are not part of the
+ * record (acquire and device server tags).
+ */
+void nfp_cpp_trace_record(struct nfp_cpp_trace* trace, uint8_t op,
+        uint32_t cpp_id, uint64_t addr, uint32_t len, const void* data);
+
+/**
+ * Attribute subsequent records from this thread to a device server
+ * client connection. Pass 0 to return to in-process attribution.
+ */
+void nfp_cpp_trace_set_client(uint16_t client);
+
+#endif /* _NFP_CPP_TRACE_H_ */
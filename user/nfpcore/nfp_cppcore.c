@@ -19,6 +19,8 @@
 #include "nfp6000/nfp6000.h"
 #include "nfp6000/nfp_xpb.h"
 #include "nfp_nffw.h"
+#include "nfp_cpp_trace.h"
+#include "nfp_cpp_emu.h"
 
 #define NFP_PL_DEVICE_ID                        0x00000004
 #define NFP_PL_DEVICE_ID_MASK                   0xff
@@ -175,6 +177,7 @@ nfp_cpp_area_alloc_with_name(struct nfp_cpp *cpp, uint32_t dest,
 	/* Restore errno */
 	errno = tmp;
 
+	area->cpp_id = dest;
 	area->offset = address;
 	area->size = size;
 
@@ -265,6 +268,11 @@ nfp_cpp_area_acquire(struct nfp_cpp_area *area)
 			return -1;
 	}
 
+	if (area->cpp->trace)
+		nfp_cpp_trace_record(area->cpp->trace, NFP_CPP_TRACE_ACQUIRE,
+				     area->cpp_id, area->offset, area->size,
+				     NULL);
+
 	return 0;
 }
 
@@ -321,10 +329,19 @@ int
 nfp_cpp_area_read(struct nfp_cpp_area *area, unsigned long offset,
 		  void *kernel_vaddr, size_t length)
 {
+	int ret;
+
 	if ((offset + length) > area->size)
 		return NFP_ERRNO(EFAULT);
 
-	return area->cpp->op->area_read(area, kernel_vaddr, offset, length);
+	ret = area->cpp->op->area_read(area, kernel_vaddr, offset, length);
+
+	if (area->cpp->trace && ret > 0)
+		nfp_cpp_trace_record(area->cpp->trace, NFP_CPP_TRACE_READ,
+				     area->cpp_id, area->offset + offset, ret,
+				     kernel_vaddr);
+
+	return ret;
 }
 
 /*
@@ -345,10 +362,19 @@ int
 nfp_cpp_area_write(struct nfp_cpp_area *area, unsigned long offset,
 		   const void *kernel_vaddr, size_t length)
 {
+	int ret;
+
 	if ((offset + length) > area->size)
 		return NFP_ERRNO(EFAULT);
 
-	return area->cpp->op->area_write(area, kernel_vaddr, offset, length);
+	ret = area->cpp->op->area_write(area, kernel_vaddr, offset, length);
+
+	if (area->cpp->trace && ret > 0)
+		nfp_cpp_trace_record(area->cpp->trace, NFP_CPP_TRACE_WRITE,
+				     area->cpp_id, area->offset + offset, ret,
+				     kernel_vaddr);
+
+	return ret;
 }
 
 void *
@@ -549,7 +575,10 @@ nfp_cpp_alloc(struct rte_pci_device *dev, int driver_lock_needed)
 	struct nfp_cpp *cpp;
 	int err;
 
-	ops = nfp_cpp_transport_operations();
+	if (nfp_cpp_emu_enabled())
+		ops = nfp_cpp_emu_operations();
+	else
+		ops = nfp_cpp_transport_operations();
 
 	if (!ops || !ops->init)
 		return NFP_ERRPTR(EINVAL);
@@ -560,10 +589,12 @@ nfp_cpp_alloc(struct rte_pci_device *dev, int driver_lock_needed)
 
 	cpp->op = ops;
 	cpp->driver_lock_needed = driver_lock_needed;
+	cpp->trace = nfp_cpp_trace_open_env(dev ? dev->name : NULL);
 
 	if (cpp->op->init) {
 		err = cpp->op->init(cpp, dev);
 		if (err < 0) {
+			nfp_cpp_trace_close(cpp->trace);
 			free(cpp);
 			return NULL;
 		}
@@ -579,6 +610,7 @@ nfp_cpp_alloc(struct rte_pci_device *dev, int driver_lock_needed)
 			err = nfp_xpb_readl(cpp, xpbaddr,
 				(uint32_t *)&cpp->imb_cat_table[tgt]);
 			if (err < 0) {
+				nfp_cpp_trace_close(cpp->trace);
 				free(cpp);
 				return NULL;
 			}
@@ -601,6 +633,7 @@ nfp_cpp_free(struct nfp_cpp *cpp)
 	if (cpp->serial_len)
 		free(cpp->serial);
 
+	nfp_cpp_trace_close(cpp->trace);
 	free(cpp);
 }
 
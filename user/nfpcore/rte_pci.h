@@ -62,6 +62,7 @@ struct rte_pci_addr {
  */
 struct rte_device {
     const char *name;             /**< Device name */
+    int numa_node;                /**< NUMA node connection, -1 if unknown */
 };
 
 /**
@@ -0,0 +1,160 @@
+/**
+ * Benchmark of the packet copy kernels (pkt_copy.h) for each slot size,
+ * with cached and non-temporal stores, hot and cold caches.
+ *
+ * Hot copies cycle through a few KB that stay in L1. Cold copies walk
+ * buffers much larger than the LLC, so every source line is a miss.
+ * A last table compares copying a batch of 64 byte slots one at a time
+ * with copying the same run at once, as the datapath does.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "pkt_copy.h"
+
+#define HOT_BYTES       (16 << 10)
+#define COLD_BYTES      (512ul << 20)
+#define BATCH_SLOTS     8
+
+static const size_t sizes[] = { 64, 128, 256, 512, 1518 };
+
+#define NUM_SIZES       (sizeof(sizes) / sizeof(sizes[0]))
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Copy `size` bytes `iters` times, source and destination advancing by
+ * a cache-line-rounded stride through `span` bytes.
+ *
+ * @return
+ *   ns per copy.
+ */
+static double run(pkt_copy_fn fn, uint8_t* dst, const uint8_t* src,
+        size_t size, size_t span, uint64_t iters)
+{
+    size_t stride = (size + 63) & ~63ul, off = 0;
+    uint64_t i, start;
+
+    start = now_ns();
+    for (i = 0; i < iters; i++)
+    {
+        fn(dst + off, src + off, size);
+        off += stride;
+        if (off + stride > span)
+            off = 0;
+    }
+    pkt_copy_fence();
+
+    return (double) (now_ns() - start) / iters;
+}
+
+/* As run() for a batch of 64 byte slots, copied one at a time */
+static double run_slots(pkt_copy_fn fn, uint8_t* dst, const uint8_t* src,
+        size_t span, uint64_t iters)
+{
+    size_t size = BATCH_SLOTS * 64, off = 0;
+    uint64_t i, start;
+    unsigned int s;
+
+    start = now_ns();
+    for (i = 0; i < iters; i++)
+    {
+        for (s = 0; s < BATCH_SLOTS; s++)
+            fn(dst + off + s * 64, src + off + s * 64, 64);
+        off += size;
+        if (off + size > span)
+            off = 0;
+    }
+    pkt_copy_fence();
+
+    return (double) (now_ns() - start) / iters;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-n ITERATIONS]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* const* names = pkt_copy_names();
+    uint64_t iters = 2000000;
+    struct pkt_copy_ops ops;
+    uint8_t *src, *dst;
+    unsigned int k, s;
+    double ns, one, batch;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                iters = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    src = aligned_alloc(4096, COLD_BYTES);
+    dst = aligned_alloc(4096, COLD_BYTES);
+    if (src == NULL || dst == NULL)
+    {
+        fprintf(stderr, "Cannot allocate buffers\n");
+        return 1;
+    }
+    memset(src, 0xa5, COLD_BYTES);
+    memset(dst, 0, COLD_BYTES);
+
+    printf("%-8s %6s %12s %12s %12s %12s\n", "kernel", "size",
+        "hot ns", "hot nt ns", "cold ns", "cold nt ns");
+
+    for (k = 0; names[k] != NULL; k++)
+    {
+        for (s = 0; s < NUM_SIZES; s++)
+        {
+            if (pkt_copy_select_named(&ops, names[k], sizes[s]))
+                break;
+
+            printf("%-8s %6zu", ops.name, sizes[s]);
+
+            ns = run(ops.copy, dst, src, sizes[s], HOT_BYTES, iters);
+            printf(" %12.2f", ns);
+            ns = run(ops.copy_nt, dst, src, sizes[s], HOT_BYTES, iters);
+            printf(" %12.2f", ns);
+            ns = run(ops.copy, dst, src, sizes[s], COLD_BYTES, iters);
+            printf(" %12.2f", ns);
+            ns = run(ops.copy_nt, dst, src, sizes[s], COLD_BYTES, iters);
+            printf(" %12.2f", ns);
+            printf("   (%.1f GB/s cold nt)\n", sizes[s] / ns);
+        }
+    }
+
+    printf("\n%d x 64 byte slots, hot, non-temporal\n", BATCH_SLOTS);
+    printf("%-8s %12s %12s\n", "kernel", "slot by slot", "one run");
+
+    for (k = 0; names[k] != NULL; k++)
+    {
+        if (pkt_copy_select_named(&ops, names[k], 64))
+            break;
+
+        one = run_slots(ops.copy_nt, dst, src, HOT_BYTES, iters);
+        batch = run(ops.copy_any_nt, dst, src, BATCH_SLOTS * 64, HOT_BYTES, iters);
+
+        printf("%-8s %12.2f %12.2f\n", ops.name, one, batch);
+    }
+
+    return 0;
+}
@@ -0,0 +1,454 @@
+/**
+ * Replay a CPP access trace (see nfp_cpp_trace.h) through the CPP core
+ * against the emulated device (nfp_cpp_emu.h), and report where the
+ * time would go on real hardware under a simple PCIe latency model.
+ *
+ * Model: every access through a PCIe2CPP BAR is split into words of
+ * --word bytes (the width nfp6000_area_read/write use). Each word read
+ * is a non-posted round trip (--read-ns); each word write is posted
+ * (--write-ns). Acquiring an area reprograms a BAR (--acquire-ns).
+ * On top of that, payload is charged at --bw MB/s.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "nfp_cpp.h"
+#include "nfp_cpp_emu.h"
+#include "nfp_cpp_trace.h"
+#include "nfp-common/nfp_resid.h"
+
+#define PAGE_SHIFT          12
+#define PAGE_SIZE           (1u << PAGE_SHIFT)
+#define HASH_BUCKETS        (1u << 16)
+#define MAX_TARGETS         16          /*> CPP targets nfp_target_cpp() takes */
+#define MAX_CLIENTS         (1u << 16)
+
+struct page
+{
+    struct page* next;
+    uint64_t key;
+    uint8_t written[PAGE_SIZE / 8];     /*> Bytes written during replay */
+};
+
+struct stat_entry
+{
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t model_ns;
+};
+
+struct latency_model
+{
+    uint64_t read_ns;
+    uint64_t write_ns;
+    uint64_t acquire_ns;
+    uint64_t word;
+    uint64_t bw_mbps;
+};
+
+static struct page* pages[HASH_BUCKETS];
+
+static struct stat_entry by_op[NFP_CPP_TRACE_OP_MAX];
+static struct stat_entry by_target[MAX_TARGETS];
+static struct stat_entry by_request[NFP_CPP_TRACE_OP_MAX];
+static uint8_t client_request[MAX_CLIENTS];
+
+static const char* op_names[NFP_CPP_TRACE_OP_MAX] = {
+    [NFP_CPP_TRACE_ACQUIRE]     = "acquire",
+    [NFP_CPP_TRACE_READ]        = "read",
+    [NFP_CPP_TRACE_WRITE]       = "write",
+    [NFP_CPP_TRACE_DEV_PREAD]   = "dev pread",
+    [NFP_CPP_TRACE_DEV_PWRITE]  = "dev pwrite",
+    [NFP_CPP_TRACE_DEV_IOCTL]   = "dev ioctl",
+};
+
+static const char* target_names[MAX_TARGETS] = {
+    [1]  = "NBI",
+    [2]  = "QDR",
+    [6]  = "ILA",
+    [7]  = "MU",
+    [9]  = "PCIE",
+    [10] = "ARM",
+    [12] = "CRYPTO",
+    [14] = "XPB/CAP",
+    [15] = "CLS",
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline uint64_t page_key(uint32_t cpp_id, uint64_t addr)
+{
+    /* Action and token do not select storage */
+    return ((uint64_t) NFP_CPP_ID_TARGET_of(cpp_id) << 56) |
+            ((uint64_t) (cpp_id & 0xff) << 48) |
+            (addr >> PAGE_SHIFT);
+}
+
+static struct page* page_lookup(uint64_t key)
+{
+    uint32_t bucket = (key * 0x9e3779b97f4a7c15ull) >> 48;
+    struct page* pg;
+
+    for (pg = pages[bucket]; pg != NULL; pg = pg->next)
+    {
+        if (pg->key == key)
+            return pg;
+    }
+
+    pg = calloc(1, sizeof(*pg));
+    if (pg == NULL)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    pg->key = key;
+    pg->next = pages[bucket];
+    pages[bucket] = pg;
+
+    return pg;
+}
+
+static inline int page_written(const struct page* pg, uint32_t b)
+{
+    return (pg->written[b / 8] >> (b % 8)) & 1;
+}
+
+/**
+ * Replay one read or write through a CPP area of the emulated device.
+ * Before a read, bytes never written during replay are seeded from the
+ * trace (they came from the device); bytes that were written are then
+ * compared against what the device returned.
+ *
+ * @return
+ *   Bytes read back differently, or -1 if the area cannot be acquired.
+ */
+static int64_t replay_access(struct nfp_cpp* cpp, int is_write, uint32_t cpp_id,
+        uint64_t addr, const uint8_t* buf, uint8_t* dev, uint32_t len)
+{
+    struct nfp_cpp_area* area;
+    int64_t mismatches = 0;
+    uint32_t done, run;
+
+    area = nfp_cpp_area_alloc_acquire(cpp, cpp_id, addr, len);
+    if (area == NULL)
+        return -1;
+
+    if (is_write && nfp_cpp_area_write(area, 0, buf, len) != (int) len)
+        goto fail;
+
+    for (done = 0; done < len; )
+    {
+        uint64_t a = addr + done;
+        uint32_t off = a & (PAGE_SIZE - 1);
+        uint32_t chunk = PAGE_SIZE - off;
+        struct page* pg = page_lookup(page_key(cpp_id, a));
+        uint32_t i;
+
+        if (chunk > len - done)
+            chunk = len - done;
+
+        for (i = 0; i < chunk; i += run)
+        {
+            uint32_t b = off + i;
+            int written = page_written(pg, b);
+
+            for (run = 1; i + run < chunk && page_written(pg, b + run) == written; run++)
+                ;
+
+            if (is_write)
+            {
+                for (b = off + i; b < off + i + run; b++)
+                    pg->written[b / 8] |= 1 << (b % 8);
+            }
+            else if (!written && nfp_cpp_area_write(area, done + i, buf + done + i, run) !=
+                    (int) run)
+            {
+                goto fail;
+            }
+        }
+
+        done += chunk;
+    }
+
+    if (!is_write)
+    {
+        if (nfp_cpp_area_read(area, 0, dev, len) != (int) len)
+            goto fail;
+
+        for (done = 0; done < len; done += run)
+        {
+            uint64_t a = addr + done;
+            uint32_t off = a & (PAGE_SIZE - 1);
+            struct page* pg = page_lookup(page_key(cpp_id, a));
+            uint32_t i;
+
+            run = PAGE_SIZE - off < len - done ? PAGE_SIZE - off : len - done;
+            for (i = 0; i < run; i++)
+            {
+                if (page_written(pg, off + i) && dev[done + i] != buf[done + i])
+                    mismatches++;
+            }
+        }
+    }
+
+    nfp_cpp_area_release_free(area);
+    return mismatches;
+
+fail:
+    nfp_cpp_area_release_free(area);
+    return -1;
+}
+
+static uint64_t model_cost(const struct latency_model* m,
+        const struct nfp_cpp_trace_rec* rec)
+{
+    uint64_t words = (rec->len + m->word - 1) / m->word;
+    uint64_t xfer_ns = m->bw_mbps ? (rec->len * 1000ull) / m->bw_mbps : 0;
+
+    switch (rec->op)
+    {
+    case NFP_CPP_TRACE_ACQUIRE:
+        return m->acquire_ns;
+    case NFP_CPP_TRACE_READ:
+        return words * m->read_ns + xfer_ns;
+    case NFP_CPP_TRACE_WRITE:
+        return words * m->write_ns + xfer_ns;
+    default:
+        return 0;
+    }
+}
+
+static void account(struct stat_entry* e, uint64_t bytes, uint64_t ns)
+{
+    e->count++;
+    e->bytes += bytes;
+    e->model_ns += ns;
+}
+
+static void print_entry(const char* name, const struct stat_entry* e,
+        uint64_t total_ns)
+{
+    if (e->count == 0)
+        return;
+
+    printf("  %-12s %10lu %12lu %12.3f %6.1f%%\n", name,
+        e->count, e->bytes, e->model_ns / 1e6,
+        total_ns ? 100.0 * e->model_ns / total_ns : 0.0);
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [options] <trace>\n"
+        "  --read-ns N     non-posted read round trip per word (default 1000)\n"
+        "  --write-ns N    posted write cost per word (default 100)\n"
+        "  --acquire-ns N  BAR reconfiguration cost (default 1500)\n"
+        "  --word N        bytes per BAR access (default 4)\n"
+        "  --bw N          payload bandwidth in MB/s, 0 = ignore (default 0)\n",
+        prog);
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option options[] = {
+        { "read-ns",    required_argument, NULL, 'r' },
+        { "write-ns",   required_argument, NULL, 'w' },
+        { "acquire-ns", required_argument, NULL, 'a' },
+        { "word",       required_argument, NULL, 'W' },
+        { "bw",         required_argument, NULL, 'b' },
+        { "help",       no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    struct latency_model model = {
+        .read_ns = 1000,
+        .write_ns = 100,
+        .acquire_ns = 1500,
+        .word = 4,
+        .bw_mbps = 0,
+    };
+    struct nfp_cpp_trace_hdr hdr;
+    struct nfp_cpp_trace_rec rec;
+    struct stat_entry total = { 0 };
+    uint64_t mismatches = 0, refused = 0, last_ts = 0, host_ns, start;
+    uint8_t *buf = NULL, *dev = NULL;
+    uint32_t buf_len = 0;
+    struct nfp_cpp* cpp;
+    int64_t ret;
+    FILE* f;
+    int opt, i;
+
+    while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'r': model.read_ns = strtoull(optarg, NULL, 0); break;
+        case 'w': model.write_ns = strtoull(optarg, NULL, 0); break;
+        case 'a': model.acquire_ns = strtoull(optarg, NULL, 0); break;
+        case 'W': model.word = strtoull(optarg, NULL, 0); break;
+        case 'b': model.bw_mbps = strtoull(optarg, NULL, 0); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind != argc - 1 || model.word == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    f = fopen(argv[optind], "rb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+            hdr.magic != NFP_CPP_TRACE_MAGIC ||
+            hdr.version != NFP_CPP_TRACE_VERSION)
+    {
+        fprintf(stderr, "%s: not a CPP trace (version %u)\n",
+            argv[optind], NFP_CPP_TRACE_VERSION);
+        fclose(f);
+        return 1;
+    }
+
+    /* Replay into the emulated device, and do not trace the replay */
+    setenv(NFP_CPP_EMU_ENV, "1", 1);
+    unsetenv(NFP_CPP_TRACE_ENV);
+    cpp = nfp_cpp_from_device_name(NULL, 0);
+    if (cpp == NULL)
+    {
+        fprintf(stderr, "Cannot open the emulated device\n");
+        fclose(f);
+        return 1;
+    }
+
+    host_ns = 0;
+    while (fread(&rec, sizeof(rec), 1, f) == 1)
+    {
+        uint64_t cost;
+        int has_data = (rec.op == NFP_CPP_TRACE_READ ||
+                        rec.op == NFP_CPP_TRACE_WRITE);
+
+        if (rec.op == 0 || rec.op >= NFP_CPP_TRACE_OP_MAX ||
+                (rec.op < NFP_CPP_TRACE_DEV_PREAD &&
+                 NFP_CPP_ID_TARGET_of(rec.cpp_id) >= MAX_TARGETS))
+        {
+            fprintf(stderr, "Corrupt record at ts %lu ns\n", rec.ts_ns);
+            break;
+        }
+
+        if (has_data)
+        {
+            if (rec.len > buf_len)
+            {
+                buf = realloc(buf, rec.len);
+                dev = realloc(dev, rec.len);
+                if (buf == NULL || dev == NULL)
+                {
+                    perror("realloc");
+                    return 1;
+                }
+                buf_len = rec.len;
+            }
+
+            if (fread(buf, 1, rec.len, f) != rec.len)
+            {
+                fprintf(stderr, "Truncated record at ts %lu ns\n", rec.ts_ns);
+                break;
+            }
+
+            start = now_ns();
+            ret = replay_access(cpp, rec.op == NFP_CPP_TRACE_WRITE,
+                    rec.cpp_id, rec.addr, buf, dev, rec.len);
+            host_ns += now_ns() - start;
+
+            if (ret < 0)
+                refused++;
+            else
+                mismatches += ret;
+        }
+
+        if (rec.op >= NFP_CPP_TRACE_DEV_PREAD)
+        {
+            /* Tag: following accesses of this client serve this request */
+            client_request[rec.client] = rec.op;
+            account(&by_op[rec.op], rec.len, 0);
+            last_ts = rec.ts_ns;
+            continue;
+        }
+
+        cost = model_cost(&model, &rec);
+        account(&total, has_data ? rec.len : 0, cost);
+        account(&by_op[rec.op], has_data ? rec.len : 0, cost);
+        account(&by_target[NFP_CPP_ID_TARGET_of(rec.cpp_id)],
+            has_data ? rec.len : 0, cost);
+        account(&by_request[rec.client ? client_request[rec.client] : 0],
+            has_data ? rec.len : 0, cost);
+        last_ts = rec.ts_ns;
+    }
+
+    fclose(f);
+    free(buf);
+    free(dev);
+    nfp_cpp_free(cpp);
+
+    printf("Latency model: read %lu ns/word, write %lu ns/word, "
+        "acquire %lu ns, word %lu B, bw %lu MB/s\n",
+        model.read_ns, model.write_ns, model.acquire_ns,
+        model.word, model.bw_mbps);
+    printf("Accesses: %lu, %lu bytes, recorded span %.3f ms\n",
+        total.count, total.bytes, last_ts / 1e6);
+    printf("Modeled PCIe time: %.3f ms, replay host time: %.3f ms\n",
+        total.model_ns / 1e6, host_ns / 1e6);
+    printf("Reads differing from replayed writes: %lu bytes\n", mismatches);
+    printf("Accesses the emulated device refused: %lu\n\n", refused);
+
+    printf("  %-12s %10s %12s %12s %7s\n",
+        "operation", "count", "bytes", "model ms", "share");
+    for (i = 1; i < NFP_CPP_TRACE_OP_MAX; i++)
+    {
+        if (i >= NFP_CPP_TRACE_DEV_PREAD)
+        {
+            if (by_op[i].count)
+                printf("  %-12s %10lu %12lu\n", op_names[i],
+                    by_op[i].count, by_op[i].bytes);
+            continue;
+        }
+        print_entry(op_names[i], &by_op[i], total.model_ns);
+    }
+
+    printf("\n  %-12s %10s %12s %12s %7s\n",
+        "target", "count", "bytes", "model ms", "share");
+    for (i = 0; i < MAX_TARGETS; i++)
+    {
+        char name[16];
+
+        if (target_names[i] == NULL)
+            snprintf(name, sizeof(name), "target %d", i);
+        print_entry(target_names[i] ? target_names[i] : name,
+            &by_target[i], total.model_ns);
+    }
+
+    printf("\n  %-12s %10s %12s %12s %7s\n",
+        "issued by", "count", "bytes", "model ms", "share");
+    print_entry("in-process", &by_request[0], total.model_ns);
+    for (i = NFP_CPP_TRACE_DEV_PREAD; i < NFP_CPP_TRACE_OP_MAX; i++)
+        print_entry(op_names[i], &by_request[i], total.model_ns);
+
+    return 0;
+}
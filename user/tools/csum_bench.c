@@ -0,0 +1,363 @@
+/**
+ * Check and benchmark of the checksum kernels (pkt_csum.h).
+ *
+ * Every kernel is first checked bit for bit against the byte-pair
+ * reference: all lengths up to 2 KB at every alignment in a cache line,
+ * chained partial sums, and long runs of 0xff that would overflow a lane
+ * that was not reduced in time. The incremental update helpers are
+ * checked against recomputing the header, and frames filled in by
+ * pkt_csum_fill() must verify, and stop verifying once corrupted.
+ *
+ * Then each kernel is timed on hot buffers of common sizes, and the
+ * burst fill and verify calls on 64 and 1518 byte frames.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "pkt_csum.h"
+
+#define CHECK_MAX_LEN   2048
+#define CHECK_ALIGN     64
+#define LONG_LEN        (300 << 10)
+#define BURST           32
+#define ETH_HLEN        14
+#define IP_HLEN         20
+#define UDP_HLEN        8
+
+static const size_t sizes[] = { 20, 64, 128, 256, 512, 1518, 9000 };
+
+#define NUM_SIZES       (sizeof(sizes) / sizeof(sizes[0]))
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void fill_random(uint8_t* buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        buf[i] = (uint8_t) rng();
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @return
+ *   Number of mismatches against the reference.
+ */
+static unsigned int check_kernel(const char* name, pkt_csum_fn fn, uint8_t* buf)
+{
+    unsigned int errors = 0;
+    size_t len, align, cut;
+    uint32_t seed, want, got;
+
+    for (len = 0; len <= CHECK_MAX_LEN; len++)
+    {
+        for (align = 0; align < CHECK_ALIGN; align++)
+        {
+            seed = (uint32_t) rng();
+            want = pkt_csum_fold(pkt_csum_reference(buf + align, len, seed));
+            got = pkt_csum_fold(fn(buf + align, len, seed));
+            if (got != want && errors++ < 5)
+                fprintf(stderr, "%s: len %zu align %zu: %04x, want %04x\n",
+                    name, len, align, got, want);
+        }
+
+        /* Two even pieces chained give the sum of the whole */
+        cut = (len / 2) & ~(size_t) 1;
+        want = pkt_csum_fold(pkt_csum_reference(buf, len, 0));
+        got = pkt_csum_fold(fn(buf + cut, len - cut, fn(buf, cut, 0)));
+        if (got != want && errors++ < 5)
+            fprintf(stderr, "%s: len %zu chained at %zu: %04x, want %04x\n",
+                name, len, cut, got, want);
+    }
+
+    return errors;
+}
+
+static unsigned int check_long(const char* name, pkt_csum_fn fn, uint8_t* buf)
+{
+    unsigned int errors = 0;
+    size_t len;
+    uint32_t want, got;
+
+    memset(buf, 0xff, LONG_LEN);
+    for (len = LONG_LEN - 3; len <= LONG_LEN; len++)
+    {
+        want = pkt_csum_fold(pkt_csum_reference(buf, len, 0xffffffff));
+        got = pkt_csum_fold(fn(buf, len, 0xffffffff));
+        if (got != want && errors++ < 5)
+            fprintf(stderr, "%s: %zu bytes of 0xff: %04x, want %04x\n",
+                name, len, got, want);
+    }
+
+    return errors;
+}
+
+static unsigned int check_update(void)
+{
+    uint8_t ip[IP_HLEN];
+    unsigned int i, errors = 0;
+    uint16_t csum, want, got, old16, new16;
+    uint32_t old32, new32;
+    size_t off;
+
+    for (i = 0; i < 1000000; i++)
+    {
+        fill_random(ip, sizeof(ip));
+        ip[0] = 0x45;
+        ip[10] = ip[11] = 0;
+        csum = pkt_csum_ipv4_hdr(ip);
+        memcpy(ip + 10, &csum, 2);
+
+        /* A 16-bit word after the version and IHL: length, TTL, ... */
+        off = 2 + (rng() % 4) * 2;
+        memcpy(&old16, ip + off, 2);
+        new16 = i & 1 ? (uint16_t) rng() : (uint16_t) ~old16;
+        memcpy(ip + off, &new16, 2);
+        got = pkt_csum_update16(csum, old16, new16);
+
+        ip[10] = ip[11] = 0;
+        want = pkt_csum_ipv4_hdr(ip);
+        if (got != want && errors++ < 5)
+            fprintf(stderr, "update16: %04x, want %04x\n", got, want);
+        memcpy(ip + 10, &want, 2);
+        csum = want;
+
+        /* An address */
+        off = 12 + (rng() & 1) * 4;
+        memcpy(&old32, ip + off, 4);
+        new32 = (uint32_t) rng();
+        memcpy(ip + off, &new32, 4);
+        got = pkt_csum_update32(csum, old32, new32);
+
+        ip[10] = ip[11] = 0;
+        want = pkt_csum_ipv4_hdr(ip);
+        if (got != want && errors++ < 5)
+            fprintf(stderr, "update32: %04x, want %04x\n", got, want);
+    }
+
+    return errors;
+}
+
+/* UDP over IPv4, with random addresses, ports and payload */
+static void build_frame(uint8_t* frame, uint32_t len)
+{
+    uint8_t* ip = frame + ETH_HLEN;
+    uint8_t* udp = ip + IP_HLEN;
+    uint32_t ip_len = len - ETH_HLEN, udp_len = ip_len - IP_HLEN;
+
+    fill_random(frame, len);
+    frame[12] = 0x08;
+    frame[13] = 0x00;
+    ip[0] = 0x45;
+    ip[2] = ip_len >> 8;
+    ip[3] = ip_len;
+    ip[6] = ip[7] = 0;
+    ip[9] = IPPROTO_UDP;
+    udp[4] = udp_len >> 8;
+    udp[5] = udp_len;
+}
+
+static unsigned int check_frames(uint8_t* frame)
+{
+    unsigned int errors = 0, i;
+    uint8_t* ip = frame + ETH_HLEN;
+    uint32_t len, sum;
+    uint16_t udp_len, field;
+
+    for (i = 0; i < 100000; i++)
+    {
+        len = ETH_HLEN + IP_HLEN + UDP_HLEN + rng() % 1500;
+        build_frame(frame, len);
+
+        if (pkt_csum_fill(frame, len) ||
+            pkt_csum_verify(frame, len) != PKT_CSUM_OK)
+        {
+            if (errors++ < 5)
+                fprintf(stderr, "frame %u bytes does not verify\n", len);
+            continue;
+        }
+
+        /* The field matches an independent computation */
+        udp_len = len - ETH_HLEN - IP_HLEN;
+        memcpy(&field, ip + IP_HLEN + 6, 2);
+        ip[IP_HLEN + 6] = ip[IP_HLEN + 7] = 0;
+        sum = pkt_csum_reference(ip + IP_HLEN, udp_len,
+            pkt_csum_pseudo4(ip, IPPROTO_UDP, udp_len));
+        if (pkt_csum_fold(sum) != field &&
+            !(field == 0xffff && pkt_csum_fold(sum) == 0) && errors++ < 5)
+            fprintf(stderr, "frame %u bytes: UDP checksum %04x, want %04x\n",
+                len, field, pkt_csum_fold(sum));
+        memcpy(ip + IP_HLEN + 6, &field, 2);
+
+        ip[8] ^= 1;
+        if (pkt_csum_verify(frame, len) != PKT_CSUM_BAD_IP && errors++ < 5)
+            fprintf(stderr, "frame %u bytes: bad IP header verifies\n", len);
+        ip[8] ^= 1;
+
+        frame[len - 1] ^= 0x10;
+        if (pkt_csum_verify(frame, len) != PKT_CSUM_BAD_UDP && errors++ < 5)
+            fprintf(stderr, "frame %u bytes: bad payload verifies\n", len);
+    }
+
+    return errors;
+}
+
+/* @return ns per call */
+static double run(pkt_csum_fn fn, const uint8_t* buf, size_t size, uint64_t iters)
+{
+    uint64_t i, start;
+    uint32_t sum = 0;
+
+    start = now_ns();
+    for (i = 0; i < iters; i++)
+    {
+        sum = fn(buf, size, sum);
+        /* Keep each call dependent on the last */
+        __asm__ volatile("" : "+r"(sum));
+    }
+
+    return (double) (now_ns() - start) / iters;
+}
+
+/* @return ns per frame */
+static double run_burst(uint8_t* frames, uint32_t len, int verify, uint64_t iters)
+{
+    struct pkt_view views[BURST];
+    uint8_t status[BURST];
+    uint64_t i, start;
+    unsigned int p;
+
+    for (p = 0; p < BURST; p++)
+    {
+        views[p].data = frames + p * 2048;
+        views[p].len = len;
+        views[p].slot = p;
+        build_frame(views[p].data, len);
+        pkt_csum_fill(views[p].data, len);
+    }
+
+    start = now_ns();
+    for (i = 0; i < iters / BURST; i++)
+    {
+        if (verify)
+            pkt_csum_verify_burst(views, BURST, status);
+        else
+            pkt_csum_fill_burst(views, BURST);
+    }
+
+    return (double) (now_ns() - start) / (iters / BURST * BURST);
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-n ITERATIONS]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* const* names = pkt_csum_names();
+    uint64_t iters = 2000000;
+    unsigned int k, s, errors = 0;
+    pkt_csum_fn fn;
+    uint8_t* buf;
+    double ns;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                iters = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    buf = aligned_alloc(4096, LONG_LEN + 4096);
+    if (buf == NULL)
+    {
+        fprintf(stderr, "Cannot allocate buffers\n");
+        return 1;
+    }
+
+    for (k = 0; names[k] != NULL; k++)
+    {
+        fn = pkt_csum_kernel(names[k]);
+        if (fn == NULL)
+        {
+            printf("%-8s not supported\n", names[k]);
+            continue;
+        }
+
+        fill_random(buf, CHECK_MAX_LEN + CHECK_ALIGN);
+        s = check_kernel(names[k], fn, buf) + check_long(names[k], fn, buf);
+        printf("%-8s %s\n", names[k], s ? "MISMATCH" : "matches reference");
+        errors += s;
+    }
+
+    s = check_update();
+    printf("%-8s %s\n", "update", s ? "MISMATCH" : "matches recompute");
+    errors += s;
+
+    s = check_frames(buf);
+    printf("%-8s %s (%s kernel)\n", "frames", s ? "FAILED" : "fill and verify",
+        pkt_csum_name());
+    errors += s;
+
+    if (errors != 0)
+        return 1;
+
+    fill_random(buf, LONG_LEN);
+
+    printf("\n%-8s %6s %10s %10s\n", "kernel", "size", "ns", "GB/s");
+    for (k = 0; names[k] != NULL; k++)
+    {
+        fn = pkt_csum_kernel(names[k]);
+        if (fn == NULL)
+            continue;
+
+        for (s = 0; s < NUM_SIZES; s++)
+        {
+            ns = run(fn, buf, sizes[s], iters);
+            printf("%-8s %6zu %10.2f %10.2f\n", names[k], sizes[s], ns,
+                sizes[s] / ns);
+        }
+    }
+
+    printf("\nBursts of %d frames, %s kernel, ns per frame\n", BURST,
+        pkt_csum_name());
+    printf("%6s %10s %10s\n", "size", "fill", "verify");
+    for (s = 0; s < NUM_SIZES; s++)
+    {
+        if (sizes[s] != 64 && sizes[s] != 1518)
+            continue;
+
+        printf("%6zu %10.2f", sizes[s], run_burst(buf, sizes[s], 0, iters));
+        printf(" %10.2f\n", run_burst(buf, sizes[s], 1, iters));
+    }
+
+    return 0;
+}
@@ -0,0 +1,116 @@
+/**
+ * Client for the control socket of nfp-user.out -C PATH (control.h).
+ *
+ * Sends one command, made of the remaining arguments, and prints the
+ * reply; with no command, sends each line of stdin in turn. Exits 1 if
+ * a command fails.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "control.h"
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [-s PATH] [COMMAND [ARGS...]]\n"
+        "  -s PATH   Control socket (default %s)\n"
+        "Without a command, commands are read from stdin. \"help\" lists them.\n",
+        prog, CONTROL_DEFAULT_PATH);
+}
+
+/* Send one line and print the reply up to its status line */
+static int ctl_command(FILE* in, FILE* out, const char* line)
+{
+    char reply[CONTROL_MAX_LINE];
+
+    fprintf(out, "%s\n", line);
+    fflush(out);
+
+    while (fgets(reply, sizeof(reply), in) != NULL)
+    {
+        if (strcmp(reply, "ok\n") == 0)
+            return 0;
+        if (strcmp(reply, "error\n") == 0)
+            return -1;
+        fputs(reply, stdout);
+    }
+
+    fprintf(stderr, "Connection closed\n");
+    return -1;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* path = CONTROL_DEFAULT_PATH;
+    char line[CONTROL_MAX_LINE];
+    struct sockaddr_un addr;
+    FILE *in, *out;
+    size_t used = 0;
+    int fd, opt, i, ret = 0;
+
+    while ((opt = getopt(argc, argv, "+s:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)))
+    {
+        perror(path);
+        return 1;
+    }
+
+    in = fdopen(fd, "r");
+    out = fdopen(dup(fd), "w");
+    if (in == NULL || out == NULL)
+        return 1;
+
+    if (optind < argc)
+    {
+        line[0] = '\0';
+        for (i = optind; i < argc && used < sizeof(line); i++)
+            used += snprintf(line + used, sizeof(line) - used, "%s%s",
+                        i > optind ? " " : "", argv[i]);
+        ret = ctl_command(in, out, line);
+    }
+    else
+    {
+        while (ret == 0 && fgets(line, sizeof(line), stdin) != NULL)
+        {
+            line[strcspn(line, "\n")] = '\0';
+            if (line[0] != '\0')
+                ret = ctl_command(in, out, line);
+        }
+    }
+
+    if (ret)
+        fprintf(stderr, "Command failed\n");
+
+    fclose(out);
+    fclose(in);
+    return ret ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+/**
+ * Stream the firmware DEBUG()/DEBUG_MEM() ring (firmware/debug.h) to a
+ * file or stdout, tagged with the host time of the poll that read it.
+ *
+ * Each poll costs one 4-byte read of debug_idx plus the new records, so
+ * the default 10 ms interval stays well clear of the datapath's PCIe
+ * budget. Records overwritten before they were read are reported on
+ * exit.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "driver.h"
+#include "debug_ring.h"
+#include "nfp_cpp.h"
+#include "nfp_rtsym.h"
+
+#define DEFAULT_INTERVAL_MS     10
+
+static volatile sig_atomic_t stop;
+static struct timespec poll_time;
+
+static void on_signal(int sig)
+{
+    (void) sig;
+    stop = 1;
+}
+
+static void print_record(const struct debug_record* rec, void* arg)
+{
+    FILE* out = (FILE*) arg;
+    uint32_t i;
+
+    fprintf(out, "%ld.%09ld %08x: ",
+        (long) poll_time.tv_sec, poll_time.tv_nsec, rec->idx);
+
+    if (rec->type == DEBUG_RECORD_PLAIN)
+    {
+        fprintf(out, "%08x %08x %08x %08x\n",
+            rec->words[0], rec->words[1], rec->words[2], rec->words[3]);
+        return;
+    }
+
+    fprintf(out, "MEM 0x%010lx %u bytes\n", rec->addr, rec->len);
+    for (i = 0; i < rec->len; i++)
+    {
+        if (i % 16 == 0)
+            fprintf(out, "    %04x:", i);
+        fprintf(out, " %02x", rec->data[i]);
+        if (i % 16 == 15 || i == rec->len - 1)
+            fputc('\n', out);
+    }
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [-o FILE] [-i MS] [-r SYMBOL] [-x SYMBOL]\n"
+        "  -o FILE     Write records to FILE (default stdout)\n"
+        "  -i MS       Poll interval in milliseconds (default %d)\n"
+        "  -r SYMBOL   Ring symbol (default %s)\n"
+        "  -x SYMBOL   Index symbol (default %s)\n",
+        prog, DEFAULT_INTERVAL_MS, DEBUG_RING_SYMBOL, DEBUG_RING_IDX_SYMBOL);
+}
+
+int main(int argc, char* argv[])
+{
+    const char *ring_sym = NULL, *idx_sym = NULL, *path = NULL;
+    unsigned long interval_ms = DEFAULT_INTERVAL_MS;
+    struct rte_pci_device* dev;
+    struct nfp_cpp* cpp;
+    struct nfp_rtsym_table* rtbl;
+    struct debug_ring dr;
+    FILE* out = stdout;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:i:r:x:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'o':
+                path = optarg;
+                break;
+            case 'i':
+                interval_ms = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                ring_sym = optarg;
+                break;
+            case 'x':
+                idx_sym = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    dev = pci_scan();
+    if (!dev)
+    {
+        fprintf(stderr, "Cannot find Netronome NIC\n");
+        return 1;
+    }
+
+    if (pci_probe(dev, &cpp))
+    {
+        fprintf(stderr, "Probe unsuccessful\n");
+        return 1;
+    }
+
+    rtbl = nfp_rtsym_table_read(cpp);
+    if (rtbl == NULL)
+    {
+        fprintf(stderr, "Cannot read symbol table\n");
+        return 1;
+    }
+
+    if (debug_ring_open(&dr, rtbl, ring_sym, idx_sym))
+        return 1;
+
+    if (path != NULL)
+    {
+        out = fopen(path, "w");
+        if (out == NULL)
+        {
+            perror("fopen");
+            return 1;
+        }
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    while (!stop)
+    {
+        clock_gettime(CLOCK_REALTIME, &poll_time);
+        if (debug_ring_poll(&dr, print_record, out) > 0)
+            fflush(out);
+
+        usleep(interval_ms * 1000);
+    }
+
+    fprintf(stderr, "%lu records, %lu words lost\n", dr.records, dr.lost_words);
+
+    debug_ring_close(&dr);
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,211 @@
+/**
+ * Scaling of the dispatcher (datapath_set_workers()) against the
+ * emulated NIC (nfp_cpp_emu.h, nic_emu.h), with a CPU-heavy handler.
+ * Nothing leaves the host.
+ *
+ * For each configuration, from the handler on the polling thread
+ * ("inline") through 1 to -n workers, a fresh process runs the "slow"
+ * handler for -d seconds at an unthrottled offered load
+ * and reports the packet rate. The emulated NIC numbers every frame it
+ * delivers and checks that they come back in the same order.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "config.h"
+#include "devcfg.h"
+#include "driver.h"
+#include "memzone.h"
+#include "datapath.h"
+#include "nic_emu.h"
+#include "nfp_cpp.h"
+#include "nfp_cpp_emu.h"
+#include "nfp_rtsym.h"
+
+#define SYMBOL_DEVICE_META  "i32._cfg"
+
+struct bench
+{
+    uint64_t next_rx;               /*> Sequence of the next frame delivered */
+    uint64_t next_tx;               /*> Sequence expected back next */
+    volatile uint64_t tx;
+    volatile uint64_t out_of_order;
+};
+
+static struct bench bench;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int client_rx(void* ctx, uint8_t* frame, uint32_t len)
+{
+    struct bench* b = ctx;
+
+    memcpy(frame + NIC_EMU_PAYLOAD_OFFSET, &b->next_rx, sizeof(b->next_rx));
+    b->next_rx++;
+    return len;
+}
+
+static void client_tx(void* ctx, const uint8_t* frame, uint32_t len)
+{
+    struct bench* b = ctx;
+    uint64_t seq;
+
+    memcpy(&seq, frame + NIC_EMU_PAYLOAD_OFFSET, sizeof(seq));
+    if (seq != b->next_tx)
+        b->out_of_order++;
+    b->next_tx = seq + 1;
+    b->tx++;
+}
+
+/* One configuration, in its own process: 0 workers runs inline */
+static int run(unsigned int workers, unsigned int duration, uint32_t slots,
+        const char* handler_args)
+{
+    struct nic_emu_client client = {
+        .rx = client_rx,
+        .tx = client_tx,
+        .ctx = &bench,
+    };
+    const struct memzone *buffer_rx, *buffer_tx;
+    uint32_t capacity = slots * UDP_PACKET_SIZE;
+    struct nfp_rtsym_table* rtbl;
+    struct nfp_cpp_area* area;
+    struct device_meta_t* meta;
+    struct rte_pci_device* dev;
+    struct nfp_cpp* cpp;
+    struct datapath dp;
+    uint64_t start, warm, elapsed, tx;
+
+    setenv(NFP_CPP_EMU_ENV, "1", 1);
+    setenv(NIC_EMU_RATE_ENV, "0", 1);
+
+    memzone_init_iova_va();
+    nic_emu_set_client(&client);
+    if (nic_emu_init())
+        return 1;
+
+    dev = pci_scan();
+    if (dev == NULL || pci_probe(dev, &cpp))
+    {
+        fprintf(stderr, "Cannot probe the emulated device\n");
+        return 1;
+    }
+
+    rtbl = nfp_rtsym_table_read(cpp);
+    meta = (struct device_meta_t*) nfp_rtsym_map(rtbl, SYMBOL_DEVICE_META,
+                sizeof(struct device_meta_t), &area);
+    buffer_rx = memzone_reserve(capacity);
+    buffer_tx = memzone_reserve(capacity);
+    if (meta == NULL || buffer_rx == NULL || buffer_tx == NULL)
+        return 1;
+
+    if (datapath_init(&dp, meta, (void*) buffer_rx->addr,
+            (void*) buffer_tx->addr, capacity, UDP_PACKET_SIZE,
+            pkt_handler_find("slow"), handler_args))
+        return 1;
+    if (workers > 0 && datapath_set_workers(&dp, workers, handler_args))
+        return 1;
+    datapath_start(&dp, buffer_rx->iova, buffer_tx->iova);
+
+    /* Warm up for a tenth of the run, then measure */
+    warm = now_ns();
+    while (now_ns() - warm < duration * 100000000ull)
+        datapath_poll(&dp);
+
+    tx = bench.tx;
+    start = now_ns();
+    while (now_ns() - start < duration * 1000000000ull)
+        datapath_poll(&dp);
+    elapsed = now_ns() - start;
+    tx = bench.tx - tx;
+
+    if (workers == 0)
+        printf("inline   ");
+    else
+        printf("%2u worker%s", workers, workers > 1 ? "s" : " ");
+    printf("  %10.0f pps  out of order %lu\n", tx / (elapsed / 1e9), bench.out_of_order);
+    fflush(stdout);
+
+    return 0;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [-d SECONDS] [-n WORKERS] [-c NS] [-r SLOTS]\n"
+        "  -d SECONDS  Measured duration per configuration (default 3)\n"
+        "  -n WORKERS  Largest number of workers (default 4, max %d)\n"
+        "  -c NS       Handler cost per packet (default 2000)\n"
+        "  -r SLOTS    Ring slots (default 1024)\n",
+        prog, DISPATCH_MAX_WORKERS);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int duration = 3, max_workers = 4, w;
+    uint32_t slots = 1024;
+    const char* cost = "2000";
+    int opt, status;
+    pid_t pid;
+
+    while ((opt = getopt(argc, argv, "d:n:c:r:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                duration = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                max_workers = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                cost = optarg;
+                break;
+            case 'r':
+                slots = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (max_workers > DISPATCH_MAX_WORKERS || slots < 2 || duration == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("slow handler, %s ns per packet, %u slot rings, %ld CPUs\n",
+        cost, slots, sysconf(_SC_NPROCESSORS_ONLN));
+    fflush(stdout);
+
+    /* The emulated NIC starts once per process: one process each */
+    for (w = 0; w <= max_workers; w++)
+    {
+        pid = fork();
+        if (pid < 0)
+            return 1;
+        if (pid == 0)
+            _exit(run(w, duration, slots, cost));
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+        {
+            fprintf(stderr, "Run with %u workers failed\n", w);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,322 @@
+/**
+ * Closed-loop benchmark of the "kv" packet handler against the emulated
+ * NIC (nfp_cpp_emu.h, nic_emu.h). Nothing leaves the host.
+ *
+ * The emulated NIC plays the client. It keeps --window requests
+ * outstanding and sends the next one as soon as a response comes back.
+ * All keys are SET once first, then the measured phase issues a
+ * GET/SET mix over uniformly random keys. Reports ops/s and latency
+ * percentiles, measured from RX delivery to TX pickup.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "devcfg.h"
+#include "driver.h"
+#include "memzone.h"
+#include "datapath.h"
+#include "kv_proto.h"
+#include "nic_emu.h"
+#include "nfp_cpp.h"
+#include "nfp_cpp_emu.h"
+#include "nfp_rtsym.h"
+
+#define SYMBOL_DEVICE_META  "i32._cfg"
+#define MAX_WINDOW          64
+#define MAX_SAMPLES         (1 << 22)
+#define KEY_LEN             8
+#define VALUE_LEN           8
+
+struct bench
+{
+    /* Parameters */
+    uint64_t keys;
+    unsigned int get_pct;
+    unsigned int window;
+
+    /* Client state, owned by the NIC thread */
+    uint64_t send_ns[MAX_WINDOW];
+    uint16_t free_ids[MAX_WINDOW];
+    unsigned int nfree;
+    uint64_t prefill_next;
+    uint64_t rand;
+
+    /* Shared with the main thread */
+    volatile int measuring;
+    volatile int stop;
+    volatile uint64_t prefilled;
+    volatile uint64_t ops, hits, misses, errors, bad_values;
+    uint64_t* samples;
+    volatile uint64_t nsamples;
+};
+
+static struct bench bench;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t next_rand(struct bench* b)
+{
+    /* xorshift64 */
+    b->rand ^= b->rand << 13;
+    b->rand ^= b->rand >> 7;
+    b->rand ^= b->rand << 17;
+    return b->rand;
+}
+
+static uint64_t value_of(uint64_t key)
+{
+    return key * 0x9e3779b97f4a7c15ull + 1;
+}
+
+static int client_rx(void* ctx, uint8_t* frame, uint32_t len)
+{
+    struct bench* b = ctx;
+    struct kv_hdr* hdr = (struct kv_hdr*) (frame + KV_PAYLOAD_OFFSET);
+    uint8_t* body = (uint8_t*) (hdr + 1);
+    uint64_t key, value;
+    uint16_t id;
+    int set;
+
+    if (b->stop || b->nfree == 0)
+        return -1;
+
+    if (b->prefill_next < b->keys)
+    {
+        key = b->prefill_next++;
+        set = 1;
+    }
+    else if (b->measuring)
+    {
+        key = next_rand(b) % b->keys;
+        set = next_rand(b) % 100 >= b->get_pct;
+    }
+    else
+    {
+        return -1;      /* Wait for the prefill to complete */
+    }
+
+    id = b->free_ids[--b->nfree];
+
+    hdr->op = set ? KV_OP_SET : KV_OP_GET;
+    hdr->status = 0;
+    hdr->klen = KEY_LEN;
+    hdr->vlen = set ? VALUE_LEN : 0;
+    hdr->opaque = id;
+    memcpy(body, &key, KEY_LEN);
+    if (set)
+    {
+        value = value_of(key);
+        memcpy(body + KEY_LEN, &value, VALUE_LEN);
+    }
+
+    b->send_ns[id] = now_ns();
+    return len;
+}
+
+static void client_tx(void* ctx, const uint8_t* frame, uint32_t len)
+{
+    struct bench* b = ctx;
+    const struct kv_hdr* hdr = (const struct kv_hdr*) (frame + KV_PAYLOAD_OFFSET);
+    const uint8_t* body = (const uint8_t*) (hdr + 1);
+    uint64_t lat, key, value;
+
+    if (hdr->opaque >= b->window)
+        return;
+
+    lat = now_ns() - b->send_ns[hdr->opaque];
+    b->free_ids[b->nfree++] = hdr->opaque;
+
+    if (!b->measuring)
+    {
+        b->prefilled++;
+        return;
+    }
+
+    b->ops++;
+    if (hdr->status == KV_STATUS_ERROR)
+        b->errors++;
+    else if (hdr->op == KV_OP_GET && hdr->status == KV_STATUS_MISS)
+        b->misses++;
+    else if (hdr->op == KV_OP_GET)
+    {
+        b->hits++;
+        memcpy(&key, body, KEY_LEN);
+        memcpy(&value, body + hdr->klen, VALUE_LEN);
+        if (hdr->vlen != VALUE_LEN || value != value_of(key))
+            b->bad_values++;
+    }
+
+    if (b->nsamples < MAX_SAMPLES)
+        b->samples[b->nsamples++] = lat;
+}
+
+static int cmp_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(const uint64_t* sorted, uint64_t n, double p)
+{
+    uint64_t idx;
+
+    if (n == 0)
+        return 0;
+    idx = (uint64_t) (p / 100.0 * (n - 1));
+    return sorted[idx] / 1000.0;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [-d SECONDS] [-k KEYS] [-g GET%%] [-w WINDOW] [-m MB]\n"
+        "  -d SECONDS  Measured duration (default 5)\n"
+        "  -k KEYS     Key space (default 100000)\n"
+        "  -g GET%%     Share of GETs (default 90)\n"
+        "  -w WINDOW   Outstanding requests (default 4, max %d)\n"
+        "  -m MB       Cache memory (default 64)\n",
+        prog, MAX_WINDOW);
+}
+
+int main(int argc, char* argv[])
+{
+    struct nic_emu_client client = {
+        .rx = client_rx,
+        .tx = client_tx,
+        .ctx = &bench,
+    };
+    const struct memzone *buffer_rx, *buffer_tx;
+    struct nfp_rtsym_table* rtbl;
+    struct nfp_cpp_area* area;
+    struct device_meta_t* meta;
+    struct rte_pci_device* dev;
+    struct nfp_cpp* cpp;
+    struct datapath dp;
+    unsigned int duration = 5, i;
+    const char* mem_mb = "64";
+    uint64_t start, elapsed, n;
+    int opt;
+
+    bench.keys = 100000;
+    bench.get_pct = 90;
+    bench.window = 4;
+
+    while ((opt = getopt(argc, argv, "d:k:g:w:m:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                duration = strtoul(optarg, NULL, 0);
+                break;
+            case 'k':
+                bench.keys = strtoull(optarg, NULL, 0);
+                break;
+            case 'g':
+                bench.get_pct = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                bench.window = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                mem_mb = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (bench.window == 0 || bench.window > MAX_WINDOW || bench.keys == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    bench.samples = malloc(MAX_SAMPLES * sizeof(uint64_t));
+    if (bench.samples == NULL)
+        return 1;
+    for (i = 0; i < bench.window; i++)
+        bench.free_ids[bench.nfree++] = i;
+    bench.rand = 0x853c49e6748fea9bull;
+
+    /* Always run against the emulated device, unthrottled by default */
+    setenv(NFP_CPP_EMU_ENV, "1", 1);
+    setenv(NIC_EMU_RATE_ENV, "0", 0);
+
+    memzone_init_iova_va();
+    nic_emu_set_client(&client);
+    if (nic_emu_init())
+        return 1;
+
+    dev = pci_scan();
+    if (dev == NULL || pci_probe(dev, &cpp))
+    {
+        fprintf(stderr, "Cannot probe the emulated device\n");
+        return 1;
+    }
+
+    rtbl = nfp_rtsym_table_read(cpp);
+    meta = (struct device_meta_t*) nfp_rtsym_map(rtbl, SYMBOL_DEVICE_META,
+                sizeof(struct device_meta_t), &area);
+    buffer_rx = memzone_reserve(RING_BUFFER_SIZE);
+    buffer_tx = memzone_reserve(RING_BUFFER_SIZE);
+    if (meta == NULL || buffer_rx == NULL || buffer_tx == NULL)
+        return 1;
+
+    if (datapath_init(&dp, meta, (void*) buffer_rx->addr,
+            (void*) buffer_tx->addr, RING_BUFFER_SIZE, UDP_PACKET_SIZE,
+            pkt_handler_find("kv"), mem_mb))
+        return 1;
+    datapath_start(&dp, buffer_rx->iova, buffer_tx->iova);
+
+    /* Prefill */
+    start = now_ns();
+    while (bench.prefilled < bench.keys)
+        datapath_poll(&dp);
+    fprintf(stderr, "Prefilled %lu keys in %.1f ms\n", bench.keys,
+        (now_ns() - start) / 1e6);
+
+    /* Measure */
+    start = now_ns();
+    bench.measuring = 1;
+    while (now_ns() - start < duration * 1000000000ull)
+        datapath_poll(&dp);
+    bench.stop = 1;
+    elapsed = now_ns() - start;
+
+    /* Let outstanding requests complete */
+    while (bench.nfree < bench.window && now_ns() - start - elapsed < 100000000ull)
+        datapath_poll(&dp);
+
+    n = bench.nsamples;
+    qsort(bench.samples, n, sizeof(uint64_t), cmp_u64);
+
+    printf("ops        %lu in %.2f s: %.0f ops/s\n",
+        bench.ops, elapsed / 1e9, bench.ops / (elapsed / 1e9));
+    printf("gets       %lu hits, %lu misses\n", bench.hits, bench.misses);
+    printf("errors     %lu, bad values %lu\n", bench.errors, bench.bad_values);
+    printf("latency us p50 %.2f p99 %.2f p99.9 %.2f max %.2f\n",
+        percentile_us(bench.samples, n, 50),
+        percentile_us(bench.samples, n, 99),
+        percentile_us(bench.samples, n, 99.9),
+        n ? bench.samples[n - 1] / 1000.0 : 0.0);
+
+    dp.handler->report(dp.handler_ctx, stdout);
+    datapath_fini(&dp);
+
+    return 0;
+}
@@ -0,0 +1,433 @@
+/**
+ * Benchmark of burst lookups in a chained hash table much larger than
+ * the LLC, comparing the ways a handler can hide the misses
+ * (pipeline.h):
+ *
+ *   naive      One lookup after the other.
+ *   group      Pass over the burst per dependent load, as the kv
+ *              handler does: hash and prefetch every bucket, then every
+ *              first node, then walk.
+ *   pipeline   pipeline_run(): the bucket of lookup i + 2 * ahead and
+ *              the first node of lookup i + ahead are prefetched while
+ *              lookup i walks its chain.
+ *   amac       amac_run(): a window of lookups stepped round robin,
+ *              one dependent load per step.
+ *
+ * Bursts are as large as the datapath hands a handler: 8 packets with
+ * the current 512 byte rings, DATAPATH_MAX_BATCH otherwise. A larger
+ * burst shows what longer rings would allow. -c sets the mean chain
+ * length; the longer and less even the chains, the more amac gains
+ * over the fixed-stage methods.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "datapath.h"
+#include "pipeline.h"
+
+#define NODE_EMPTY      UINT32_MAX
+#define MAX_BURST       256
+
+static const unsigned int bursts[] = { 8, DATAPATH_MAX_BATCH, MAX_BURST };
+
+#define NUM_BURSTS      (sizeof(bursts) / sizeof(bursts[0]))
+
+/* One cache line per node, so every hop of a chain is a miss */
+struct node
+{
+    uint64_t key;
+    uint64_t value;
+    uint32_t next;
+    uint8_t pad[44];
+};
+
+struct table
+{
+    uint32_t* heads;
+    struct node* nodes;
+    uint64_t mask;
+};
+
+/* Per-lookup state, shared by all the methods */
+struct lookup
+{
+    uint64_t key;
+    uint64_t hash;
+    uint32_t node;
+    unsigned int stage;
+    uint64_t value;
+};
+
+struct burst
+{
+    const struct table* t;
+    struct lookup* l;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* splitmix64, for keys and hashes alike */
+static inline uint64_t mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static inline uint64_t key_of(uint64_t i)
+{
+    return mix(i);
+}
+
+static inline uint64_t value_of(uint64_t key)
+{
+    return key * 3 + 1;
+}
+
+/**
+ * Anonymous memory, on transparent hugepages where the kernel allows:
+ * the datapath's own tables live in hugepage memzones, and with 4 KB
+ * pages every lookup would add a page walk to its misses.
+ */
+static void* table_alloc(size_t len)
+{
+    void* p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED)
+        return NULL;
+    madvise(p, len, MADV_HUGEPAGE);
+    return p;
+}
+
+/**
+ * Build a table of nkeys keys, nodes scattered at random over the
+ * node array, with about `chain` keys per bucket.
+ */
+static int table_build(struct table* t, uint64_t nkeys, unsigned int chain)
+{
+    uint64_t nbuckets = 1, i, j;
+    uint32_t* order;
+
+    while (nbuckets * 2 * chain <= nkeys)
+        nbuckets *= 2;
+
+    t->mask = nbuckets - 1;
+    t->heads = table_alloc(nbuckets * sizeof(*t->heads));
+    t->nodes = table_alloc(nkeys * sizeof(*t->nodes));
+    order = malloc(nkeys * sizeof(*order));
+    if (t->heads == NULL || t->nodes == NULL || order == NULL)
+    {
+        free(order);
+        return -1;
+    }
+
+    for (i = 0; i < nkeys; i++)
+        order[i] = i;
+    for (i = nkeys - 1; i > 0; i--)
+    {
+        uint32_t tmp;
+
+        j = mix(i ^ 0x5eed) % (i + 1);
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    memset(t->heads, 0xff, nbuckets * sizeof(*t->heads));
+    for (i = 0; i < nkeys; i++)
+    {
+        struct node* n = &t->nodes[order[i]];
+        uint64_t b = mix(key_of(i)) & t->mask;
+
+        memset(n, 0, sizeof(*n));
+        n->key = key_of(i);
+        n->value = value_of(n->key);
+        n->next = t->heads[b];
+        t->heads[b] = order[i];
+    }
+
+    free(order);
+    return 0;
+}
+
+/* Walk a chain from node, all misses taken as they come */
+static inline uint64_t chain_find(const struct table* t, uint32_t node,
+        uint64_t key)
+{
+    while (node != NODE_EMPTY)
+    {
+        const struct node* n = &t->nodes[node];
+
+        if (n->key == key)
+            return n->value;
+        node = n->next;
+    }
+
+    return 0;
+}
+
+static void run_naive(const struct table* t, struct lookup* l, unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+    {
+        uint64_t b = mix(l[i].key) & t->mask;
+
+        l[i].value = chain_find(t, t->heads[b], l[i].key);
+    }
+}
+
+static void run_group(const struct table* t, struct lookup* l, unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+    {
+        l[i].hash = mix(l[i].key);
+        __builtin_prefetch(&t->heads[l[i].hash & t->mask]);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        l[i].node = t->heads[l[i].hash & t->mask];
+        if (l[i].node != NODE_EMPTY)
+            __builtin_prefetch(&t->nodes[l[i].node]);
+    }
+
+    for (i = 0; i < count; i++)
+        l[i].value = chain_find(t, l[i].node, l[i].key);
+}
+
+static void pipeline_bucket(void* ctx, unsigned int i)
+{
+    struct burst* b = ctx;
+
+    b->l[i].hash = mix(b->l[i].key);
+    __builtin_prefetch(&b->t->heads[b->l[i].hash & b->t->mask]);
+}
+
+static void pipeline_node(void* ctx, unsigned int i)
+{
+    struct burst* b = ctx;
+
+    b->l[i].node = b->t->heads[b->l[i].hash & b->t->mask];
+    if (b->l[i].node != NODE_EMPTY)
+        __builtin_prefetch(&b->t->nodes[b->l[i].node]);
+}
+
+static void pipeline_walk(void* ctx, unsigned int i)
+{
+    struct burst* b = ctx;
+
+    b->l[i].value = chain_find(b->t, b->l[i].node, b->l[i].key);
+}
+
+static void run_pipeline(const struct table* t, struct lookup* l, unsigned int count)
+{
+    struct burst b = { t, l };
+
+    pipeline_run(&b, count, PIPELINE_AHEAD, pipeline_bucket, pipeline_node,
+        pipeline_walk);
+}
+
+/* Stages: 0 hash, 1 read the bucket, 2 and on compare one node each */
+static int amac_step(void* ctx, unsigned int i)
+{
+    struct burst* b = ctx;
+    struct lookup* l = &b->l[i];
+    const struct node* n;
+
+    switch (l->stage)
+    {
+        case 0:
+            l->hash = mix(l->key);
+            __builtin_prefetch(&b->t->heads[l->hash & b->t->mask]);
+            l->stage = 1;
+            return AMAC_PENDING;
+
+        case 1:
+            l->node = b->t->heads[l->hash & b->t->mask];
+            break;
+
+        default:
+            n = &b->t->nodes[l->node];
+            if (n->key == l->key)
+            {
+                l->value = n->value;
+                return AMAC_DONE;
+            }
+            l->node = n->next;
+            break;
+    }
+
+    if (l->node == NODE_EMPTY)
+    {
+        l->value = 0;
+        return AMAC_DONE;
+    }
+
+    __builtin_prefetch(&b->t->nodes[l->node]);
+    l->stage = 2;
+    return AMAC_PENDING;
+}
+
+static void run_amac(const struct table* t, struct lookup* l, unsigned int count,
+        unsigned int width)
+{
+    struct burst b = { t, l };
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+        l[i].stage = 0;
+
+    amac_run(&b, count, width, amac_step);
+}
+
+enum method { NAIVE, GROUP, PIPELINE, AMAC, NUM_METHODS };
+
+/**
+ * Look up every key of `keys` in bursts of `burst`.
+ *
+ * @return
+ *   ns per lookup, or a negative value if a lookup went wrong.
+ */
+static double run(const struct table* t, const uint64_t* keys, uint64_t count,
+        unsigned int burst, enum method m, unsigned int width)
+{
+    struct lookup l[MAX_BURST];
+    uint64_t done, start, elapsed;
+    unsigned int i;
+    int bad = 0;
+
+    start = now_ns();
+    for (done = 0; done + burst <= count; done += burst)
+    {
+        for (i = 0; i < burst; i++)
+            l[i].key = keys[done + i];
+
+        switch (m)
+        {
+            case NAIVE:
+                run_naive(t, l, burst);
+                break;
+            case GROUP:
+                run_group(t, l, burst);
+                break;
+            case PIPELINE:
+                run_pipeline(t, l, burst);
+                break;
+            default:
+                run_amac(t, l, burst, width < burst ? width : burst);
+                break;
+        }
+
+        for (i = 0; i < burst; i++)
+            bad |= l[i].value != value_of(l[i].key);
+    }
+    elapsed = now_ns() - start;
+
+    return bad ? -1.0 : (double) elapsed / done;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-m TABLE_MB] [-c KEYS_PER_BUCKET] [-n LOOKUPS] "
+        "[-w AMAC_WIDTH]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+    static const char* const method_names[NUM_METHODS] = {
+        "naive", "group", "pipeline", "amac",
+    };
+    uint64_t mb = 1024, lookups = 4000000, nkeys, i;
+    unsigned int width = 16, chain = 1, s;
+    struct table t;
+    uint64_t* keys;
+    double ns;
+    int opt, m;
+
+    while ((opt = getopt(argc, argv, "m:c:n:w:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                mb = strtoull(optarg, NULL, 0);
+                break;
+            case 'c':
+                chain = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                lookups = strtoull(optarg, NULL, 0);
+                break;
+            case 'w':
+                width = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    nkeys = (mb << 20) / sizeof(struct node);
+    if (nkeys < 2 || nkeys > UINT32_MAX - 1 || lookups == 0 || chain == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (table_build(&t, nkeys, chain))
+    {
+        fprintf(stderr, "Cannot allocate a %lu MB table\n", mb);
+        return 1;
+    }
+
+    keys = malloc(lookups * sizeof(*keys));
+    if (keys == NULL)
+    {
+        fprintf(stderr, "Cannot allocate %lu keys\n", lookups);
+        return 1;
+    }
+    for (i = 0; i < lookups; i++)
+        keys[i] = key_of(mix(i ^ 0xbe7c4) % nkeys);
+
+    printf("%lu keys, %lu MB of nodes, %lu buckets, amac width %u\n",
+        nkeys, mb, t.mask + 1, width);
+    printf("%-6s", "burst");
+    for (m = 0; m < NUM_METHODS; m++)
+        printf(" %12s", method_names[m]);
+    printf("   (ns per lookup)\n");
+
+    for (s = 0; s < NUM_BURSTS; s++)
+    {
+        printf("%-6u", bursts[s]);
+        for (m = 0; m < NUM_METHODS; m++)
+        {
+            ns = run(&t, keys, lookups, bursts[s], m, width);
+            if (ns < 0)
+            {
+                printf("\n%s returned wrong values\n", method_names[m]);
+                return 1;
+            }
+            printf(" %12.1f", ns);
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * Live view of the statistics nfp-user.out publishes to shared memory
+ * (stats_shm.h). Attaches read-only; never touches the device.
+ *
+ * Shows per-NIC totals and rates for the host worker, ring occupancy,
+ * doorbell traffic, the last interval's latency percentiles and the
+ * firmware counters per ME context.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "stats_shm.h"
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+        "Usage: %s [-i MS] [-n COUNT] [-b]\n"
+        "  -i MS     Refresh interval (default 1000)\n"
+        "  -n COUNT  Exit after COUNT refreshes\n"
+        "  -b        Batch mode: append instead of redrawing\n",
+        prog);
+}
+
+static double rate(uint64_t now, uint64_t prev, double seconds)
+{
+    return seconds > 0 ? (now - prev) / seconds : 0;
+}
+
+static const char* scaled(double v, char* buf, size_t len)
+{
+    if (v >= 1e9)
+        snprintf(buf, len, "%.2fG", v / 1e9);
+    else if (v >= 1e6)
+        snprintf(buf, len, "%.2fM", v / 1e6);
+    else if (v >= 1e3)
+        snprintf(buf, len, "%.2fk", v / 1e3);
+    else
+        snprintf(buf, len, "%.0f", v);
+    return buf;
+}
+
+static void show_nic(const struct stats_nic* cur, const struct stats_nic* prev)
+{
+    double dt = (cur->timestamp_ns - prev->timestamp_ns) / 1e9;
+    char a[16], b[16], c[16], d[16];
+    uint64_t batches = cur->batches - prev->batches;
+    unsigned int i;
+
+    printf("NIC %u  %s\n", cur->index, cur->name);
+
+    printf("  host     rx %s pps  tx %s pps  drop %s pps  (total rx %lu tx %lu drop %lu)\n",
+        scaled(rate(cur->rx_packets, prev->rx_packets, dt), a, sizeof(a)),
+        scaled(rate(cur->tx_packets, prev->tx_packets, dt), b, sizeof(b)),
+        scaled(rate(cur->dropped, prev->dropped, dt), c, sizeof(c)),
+        cur->rx_packets, cur->tx_packets, cur->dropped);
+
+    printf("  batches  %s/s  avg %.1f pkts\n",
+        scaled(rate(cur->batches, prev->batches, dt), a, sizeof(a)),
+        batches ? (double) (cur->rx_packets - prev->rx_packets) / batches : 0.0);
+
+    printf("  rings    rx %u/%u  tx %u/%u slots\n",
+        cur->rx_ring_used, cur->ring_slots, cur->tx_ring_used, cur->ring_slots);
+
+    printf("  mmio     rd %s/s  wr %s/s\n",
+        scaled(rate(cur->mmio_reads, prev->mmio_reads, dt), a, sizeof(a)),
+        scaled(rate(cur->mmio_writes, prev->mmio_writes, dt), b, sizeof(b)));
+
+    if (cur->lat_count > 0)
+        printf("  latency  p50 %.2f  p99 %.2f  p99.9 %.2f  max %.2f us  (n %lu)\n",
+            cur->lat_p50 / 1e3, cur->lat_p99 / 1e3, cur->lat_p999 / 1e3,
+            cur->lat_max / 1e3, cur->lat_count);
+
+    for (i = 0; cur->classes > 1 && i < cur->classes && i < STATS_MAX_CLASSES; i++)
+        printf("  class %u  rx %s pps  p50 %.2f  p99 %.2f us  (n %lu)\n", i,
+            scaled(rate(cur->class_rx[i], prev->class_rx[i], dt), a, sizeof(a)),
+            cur->class_lat_p50[i] / 1e3, cur->class_lat_p99[i] / 1e3,
+            cur->class_lat_count[i]);
+
+    if (cur->overload > 0 || cur->fw_drops[1] > 0 || cur->fw_drops[0] > 0)
+        printf("  overload nic ring full %s pps  host %s pps  (total %lu, %lu; filtered %lu)\n",
+            scaled(rate(cur->fw_drops[1], prev->fw_drops[1], dt), a, sizeof(a)),
+            scaled(rate(cur->overload, prev->overload, dt), b, sizeof(b)),
+            cur->fw_drops[1], cur->overload, cur->fw_drops[0]);
+
+    if (cur->policed > 0)
+        printf("  policer  %s pps dropped  (total %lu)\n",
+            scaled(rate(cur->policed, prev->policed, dt), a, sizeof(a)),
+            cur->policed);
+
+    if (cur->gen_packets > 0)
+        printf("  gen      %s pps  ring full %.1f%%  (total %lu)\n",
+            scaled(rate(cur->gen_packets, prev->gen_packets, dt), a, sizeof(a)),
+            dt > 0 ? (cur->gen_full_ns - prev->gen_full_ns) / (dt * 1e7) : 0.0,
+            cur->gen_packets);
+
+    if (cur->cap_written > 0 || cur->cap_dropped > 0)
+        printf("  capture  %s/s written  %s/s dropped  (total %lu, dropped %lu)\n",
+            scaled(rate(cur->cap_written, prev->cap_written, dt), a, sizeof(a)),
+            scaled(rate(cur->cap_dropped, prev->cap_dropped, dt), b, sizeof(b)),
+            cur->cap_written, cur->cap_dropped);
+
+    printf("  ctx  %14s %10s %14s %10s\n", "fw rx", "rx/s", "fw tx", "tx/s");
+    for (i = 0; i < STATS_FW_CONTEXTS; i++)
+    {
+        printf("  %3u  %14lu %10s %14lu %10s\n", i,
+            cur->fw_rx[i],
+            scaled(rate(cur->fw_rx[i], prev->fw_rx[i], dt), c, sizeof(c)),
+            cur->fw_tx[i],
+            scaled(rate(cur->fw_tx[i], prev->fw_tx[i], dt), d, sizeof(d)));
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    struct stats_nic prev[STATS_SHM_MAX_NICS], cur;
+    const struct stats_shm* shm;
+    unsigned int interval_ms = 1000, i;
+    long count = -1;
+    int batch = 0, opt;
+
+    while ((opt = getopt(argc, argv, "i:n:bh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'i':
+                interval_ms = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                count = strtol(optarg, NULL, 0);
+                break;
+            case 'b':
+                batch = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    shm = stats_shm_attach();
+    if (shm == NULL)
+    {
+        fprintf(stderr, "Cannot attach to %s; is nfp-user.out running?\n",
+            STATS_SHM_NAME);
+        return 1;
+    }
+
+    for (i = 0; i < shm->nic_count; i++)
+        stats_shm_read(shm, i, &prev[i]);
+
+    while (count < 0 || count-- > 0)
+    {
+        usleep(interval_ms * 1000);
+
+        if (!batch)
+            printf("\033[H\033[2J");
+        printf("pid %lu, %u NIC(s)\n\n", shm->pid, shm->nic_count);
+
+        for (i = 0; i < shm->nic_count; i++)
+        {
+            if (stats_shm_read(shm, i, &cur))
+                continue;
+
+            /* Rates need a newer sample than the last one shown */
+            if (cur.timestamp_ns != prev[i].timestamp_ns)
+            {
+                show_nic(&cur, &prev[i]);
+                prev[i] = cur;
+            }
+            else
+            {
+                show_nic(&cur, &cur);
+            }
+            printf("\n");
+        }
+
+        fflush(stdout);
+    }
+
+    return 0;
+}